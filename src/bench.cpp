@@ -1,21 +1,66 @@
 /**
  * @file bench.cpp
- * 
+ *
  * @author Gavin Dan (xfdan10@gmail.com)
  * @brief Benchmarking various sortedBucket implementations
- * @version 1.1
- * @date 2023-09-19
- * 
- * 
- * Benchmarking performance using Google Benchmark
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Benchmarking performance using Google Benchmark.
+ *
+ * Every benchmark is a template over the container, so each workload runs
+ * against RBT, LL, VV and BT with the same keys, and the uint64_t workloads
+ * over key distributions against Runs as well. Keys, queries and operation
+ * sequences are generated before timing starts, from a fixed seed, so runs are
+ * repeatable and the RNG never shows up in the numbers.
+ *
+ * Workloads:
+ *      find, distance, insert, erase:  single op loops
+ *      distanceMany:                   every distance query in one batched call
+ *      insertBatch:                    insert in batches of 10^4
+ *      mixed<95>, mixed<50>:           reads/writes at 95/5 and 50/50
+ *      window:                         sliding window with a median query per step
+ *      sortedWindow:                   the same through SortedWindow, evicting by replace()
+ *      parallelBuild, parallelSum:     VV built and summed on 1 thread and on every core
+ *      snapshotScan:                   a frozen view scanned in full while writes go on,
+ *                                      COW snapshots against deep copies of VV
+ *
+ * find and insert also run with SortedBucketRegion as the allocator, against
+ * the same containers on std::allocator.
+ *
+ * Key distributions (second argument): uniform, sorted, reverse sorted,
+ * Zipf-skewed (s = 1), and heavy duplicates (n/100 distinct values).
+ * Payloads: uint64_t, std::string (24 chars) and a 64 byte struct.
+ *
+ * Every benchmark also reports bytesPerElem, the heap bytes held by the
+ * container divided by its size, measured by counting global operator new
+ * (or taken from stats() for the SortedBucketRegion variants).
+ * Built with -DSORTED_BUCKET_STATS, they also report the container's stats()
+ * per operation of the timed part (comparisons, rotations, fix-ups, splits,
+ * merges, elements shifted and moved) and footprint, the bytes stats()
+ * accounts for once the timed part is done.
  */
 
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
 #include <random>
 #include <string>
+#include <vector>
 #include "sortedBucketRBT.h"
 #include "sortedBucketLL.h"
 #include "sortedBucketVV.h"
+#include "sortedBucketBT.h"
+#include "sortedBucketRuns.h"
+#include "sortedBucketWindow.h"
+#include "sortedBucketCOW.h"
+#include "sortedBucketRegion.h"
 
 
 /* Benchmark iteration factors */
@@ -23,242 +68,633 @@ constexpr size_t benchMultiplier	= 10;
 constexpr size_t benchIterLow		= 1000;
 constexpr size_t benchIterHigh		= 1000000;
 
-/* Mersenne Twister random number gen */
-static std::mt19937_64 random{uint64_t(rand())};
+/* Fixed seed so every container sees the same keys */
+constexpr uint64_t benchSeed		= 20231103;
 
+/* Batch size for BM_insertBatch */
+constexpr size_t benchBatch			= 10000;
 
-/* Benchmark wrappers for RBT */
+
+/* Heap accounting. Every allocation in the process goes through here */
+static std::atomic<size_t> heapBytes {0};
+
+void* operator new(size_t bytes) {
+	/* Stash the size in front of the block so operator delete can subtract it */
+	void* block = std::malloc(bytes + alignof(std::max_align_t));
+	if (!block) {
+		throw std::bad_alloc();
+	}
+	*static_cast<size_t*>(block) = bytes;
+	heapBytes += bytes;
+	return static_cast<char*>(block) + alignof(std::max_align_t);
+}
+
+void operator delete(void* ptr) noexcept {
+	if (ptr) {
+		/* Step back through an integer, since GCC cannot see where ptr came from */
+		void* block = reinterpret_cast<void*>(
+			reinterpret_cast<std::uintptr_t>(ptr) - alignof(std::max_align_t));
+		heapBytes -= *static_cast<size_t*>(block);
+		std::free(block);
+	}
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+
+/* Payload types */
+struct Payload {
+	uint64_t key {0};
+	uint64_t data[7] {};
+
+	Payload() = default;
+	Payload(uint64_t key) : key(key) {}
+
+	bool operator <(const Payload& other) const {
+		return key < other.key;
+	}
+	bool operator ==(const Payload& other) const {
+		return key == other.key;
+	}
+};
+
+/*	makeKey() turns a raw key into the payload type. Strings are zero padded
+	so that they sort in the same order as the raw keys */
 template <typename T>
-static void BM_RBT_find(benchmark::State& state) {
-	for (auto _ : state) {
-		state.PauseTiming();
-		SortedBucketRBT<T> rbt;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			rbt.insert(random());
+static T makeKey(uint64_t raw) {
+	if constexpr (std::is_same_v<T, std::string>) {
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "key-%020llu", static_cast<unsigned long long>(raw));
+		return std::string(buf);
+	}
+	else {
+		return T(raw);
+	}
+}
+
+
+/* Key distributions */
+enum Keys : int64_t {
+	Uniform,
+	Sorted,
+	Reverse,
+	Zipf,
+	Duplicate,
+};
+
+/* splitmix64, to scatter Zipf ranks and duplicate ids over the key space */
+static inline uint64_t scramble(uint64_t x) {
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+/*	rawKeys() generates n raw keys from distribution keys. Sorted and reverse
+	sorted keys are still random, just ordered */
+static std::vector<uint64_t> rawKeys(size_t n, Keys keys, uint64_t seed) {
+	std::mt19937_64 rng{seed};
+	std::vector<uint64_t> out(n);
+	switch (keys) {
+	case Zipf: {
+		/* Rank r is drawn with weight 1/(r+1) by inverting the CDF */
+		std::vector<double> cdf(n);
+		double total = 0;
+		for (size_t r = 0; r < n; ++r) {
+			total += 1.0 / (r + 1);
+			cdf[r] = total;
 		}
-		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(rbt.find(random()));
+		std::uniform_real_distribution<double> unit(0, total);
+		for (uint64_t& key : out) {
+			size_t rank = std::lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin();
+			key = scramble(rank);
+		}
+		break;
+	}
+	case Duplicate: {
+		std::uniform_int_distribution<uint64_t> id(0, std::max<size_t>(n / 100, 1) - 1);
+		for (uint64_t& key : out) {
+			key = scramble(id(rng));
+		}
+		break;
+	}
+	default:
+		for (uint64_t& key : out) {
+			key = rng();
 		}
+		break;
+	}
+	if (keys == Sorted) {
+		std::sort(out.begin(), out.end());
+	}
+	else if (keys == Reverse) {
+		std::sort(out.rbegin(), out.rend());
 	}
+	return out;
 }
+
 template <typename T>
-static void BM_RBT_insert(benchmark::State& state) {
-	for (auto _ : state) {
-		state.PauseTiming();
-		SortedBucketRBT<T> rbt;
-		const size_t ops = state.range(0);
-		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(rbt.insert(random()));
-		}
+static std::vector<T> makeKeys(size_t n, Keys keys, uint64_t seed) {
+	std::vector<T> out;
+	out.reserve(n);
+	for (uint64_t raw : rawKeys(n, keys, seed)) {
+		out.emplace_back(makeKey<T>(raw));
 	}
+	return out;
 }
+
+/*	Hits are drawn from the inserted keys, in random order */
 template <typename T>
-static void BM_RBT_distance(benchmark::State& state) {
+static std::vector<T> makeQueries(const std::vector<T>& keys, uint64_t seed) {
+	std::vector<T> out(keys);
+	std::shuffle(out.begin(), out.end(), std::mt19937_64{seed});
+	return out;
+}
+
+/*	Whether Bucket allocates from SortedBucketRegion, whose blocks never pass
+	through operator new */
+template <typename Bucket>
+constexpr bool regionBacked = false;
+
+template <template <typename, typename, typename> class Engine, typename T, typename Comp,
+		  typename U, bool HugePages, int NumaNode>
+constexpr bool regionBacked<Engine<T, Comp, SortedBucketRegion<U, HugePages, NumaNode>>> = true;
+
+/*	bytesPerElem() returns the heap bytes bucket took since heapBytes read
+	before, per element. before is read ahead of constructing bucket, so what
+	its constructor allocates (sentinels, roots, first buckets) is counted. A
+	container made with new reads heapBytes + sizeof(Bucket), so the object
+	itself is left out like it is for one on the stack. Region backed containers report the bytes of their
+	stats() instead, since the arena is shared and recycles freed blocks, so
+	neither operator new nor mapped() sees what they hold */
+template <typename Bucket>
+static double bytesPerElem(const Bucket& bucket, size_t before) {
+	size_t held = heapBytes - before;
+	if constexpr (regionBacked<Bucket>) {
+		held = bucket.stats().bytes;
+	}
+	return static_cast<double>(held) / std::max<size_t>(bucket.size(), 1);
+}
+
+/*	fill() inserts keys into a fresh container and reports the heap bytes it
+	holds per element, counted from before (see bytesPerElem()) */
+template <typename Bucket, typename T>
+static void fill(Bucket& bucket, const std::vector<T>& keys, benchmark::State& state,
+				 size_t before) {
+	for (const T& key : keys) {
+		bucket.insert(key);
+	}
+	state.counters["bytesPerElem"] = bytesPerElem(bucket, before);
+	bucket.resetStats();
+}
+
+/*	reportStats() adds the stats() counters of bucket since its last
+	resetStats(), and the comparisons made since startComparisons, as counters
+	per op. It does nothing unless SORTED_BUCKET_STATS is defined */
+template <typename Bucket>
+static void reportStats(const Bucket& bucket, benchmark::State& state, size_t ops,
+						size_t startComparisons) {
+#ifdef SORTED_BUCKET_STATS
+	const SortedBucketStats stats = bucket.stats();
+	const double per = static_cast<double>(std::max<size_t>(ops, 1));
+	state.counters["comparisons"] = (sortedBucketComparisons() - startComparisons) / per;
+	state.counters["rotations"] = stats.rotations / per;
+	state.counters["fixups"] = (stats.redFixups + stats.blackFixups) / per;
+	state.counters["splits"] = stats.splits / per;
+	state.counters["merges"] = stats.merges / per;
+	state.counters["shifted"] = stats.shifted / per;
+	state.counters["moved"] = stats.moved / per;
+	state.counters["footprint"] = benchmark::Counter(static_cast<double>(stats.bytes),
+		benchmark::Counter::kDefaults, benchmark::Counter::OneK::kIs1024);
+#else
+	(void)bucket, (void)state, (void)ops, (void)startComparisons;
+#endif
+}
+
+
+/* Single op loops */
+template <typename Bucket>
+static void BM_find(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	const std::vector<T> queries = makeQueries(keys, benchSeed + 1);
+	const size_t before = heapBytes;
+	Bucket bucket;
+	fill(bucket, keys, state, before);
+	const size_t startComparisons = sortedBucketComparisons();
 	for (auto _ : state) {
-		state.PauseTiming();
-		SortedBucketRBT<T> rbt;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			rbt.insert(random());
-		}
-		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(rbt.distance(random()));
+		for (const T& query : queries) {
+			benchmark::DoNotOptimize(bucket.find(query));
 		}
 	}
+	reportStats(bucket, state, state.iterations() * ops, startComparisons);
+	state.SetItemsProcessed(state.iterations() * ops);
 }
-template <typename T>
-static void BM_RBT_erase(benchmark::State& state) {
+
+template <typename Bucket>
+static void BM_distance(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	const std::vector<T> queries = makeQueries(keys, benchSeed + 1);
+	const size_t before = heapBytes;
+	Bucket bucket;
+	fill(bucket, keys, state, before);
+	const size_t startComparisons = sortedBucketComparisons();
 	for (auto _ : state) {
-		state.PauseTiming();
-		SortedBucketRBT<T> rbt;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			rbt.insert(random());
-		}
-		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(rbt.erase(random()));
+		for (const T& query : queries) {
+			benchmark::DoNotOptimize(bucket.distance(query));
 		}
 	}
+	reportStats(bucket, state, state.iterations() * ops, startComparisons);
+	state.SetItemsProcessed(state.iterations() * ops);
 }
 
-
-/* Benchmark wrappers for LL */
-template <typename T>
-static void BM_LL_find(benchmark::State& state) {
+template <typename Bucket>
+static void BM_distanceMany(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	const std::vector<T> queries = makeQueries(keys, benchSeed + 1);
+	const size_t before = heapBytes;
+	Bucket bucket;
+	fill(bucket, keys, state, before);
+	std::vector<decltype(bucket.distance(queries[0]))> dists(queries.size());
+	const size_t startComparisons = sortedBucketComparisons();
 	for (auto _ : state) {
-		state.PauseTiming();
-		SortedBucketLL<T> ll;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			ll.insert(random());
-		}
-		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(ll.find(random()));
-		}
+		bucket.distanceMany(queries, dists);
+		benchmark::DoNotOptimize(dists.data());
 	}
+	reportStats(bucket, state, state.iterations() * ops, startComparisons);
+	state.SetItemsProcessed(state.iterations() * ops);
 }
-template <typename T>
-static void BM_LL_insert(benchmark::State& state) {
+
+template <typename Bucket>
+static void BM_insert(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
 	for (auto _ : state) {
 		state.PauseTiming();
-		SortedBucketLL<T> ll;
-		const size_t ops = state.range(0);
+		const size_t before = heapBytes + sizeof(Bucket);
+		Bucket* bucket = new Bucket();
+		const size_t startComparisons = sortedBucketComparisons();
 		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(ll.insert(random()));
+		for (const T& key : keys) {
+			benchmark::DoNotOptimize(bucket->insert(key));
 		}
+		state.PauseTiming();
+		state.counters["bytesPerElem"] = bytesPerElem(*bucket, before);
+		reportStats(*bucket, state, ops, startComparisons);
+		delete bucket;
+		state.ResumeTiming();
 	}
+	state.SetItemsProcessed(state.iterations() * ops);
 }
-template <typename T>
-static void BM_LL_distance(benchmark::State& state) {
+
+template <typename Bucket>
+static void BM_insertBatch(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
 	for (auto _ : state) {
 		state.PauseTiming();
-		SortedBucketLL<T> ll;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			ll.insert(random());
-		}
+		const size_t before = heapBytes + sizeof(Bucket);
+		Bucket* bucket = new Bucket();
+		const size_t startComparisons = sortedBucketComparisons();
 		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(ll.distance(random()));
+		for (size_t i = 0; i < ops; i += benchBatch) {
+			bucket->insertBatch(keys.begin() + i, keys.begin() + std::min(i + benchBatch, ops));
 		}
+		state.PauseTiming();
+		state.counters["bytesPerElem"] = bytesPerElem(*bucket, before);
+		reportStats(*bucket, state, ops, startComparisons);
+		delete bucket;
+		state.ResumeTiming();
 	}
+	state.SetItemsProcessed(state.iterations() * ops);
 }
-template <typename T>
-static void BM_LL_erase(benchmark::State& state) {
+
+template <typename Bucket>
+static void BM_erase(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	const std::vector<T> queries = makeQueries(keys, benchSeed + 1);
 	for (auto _ : state) {
 		state.PauseTiming();
-		SortedBucketLL<T> ll;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			ll.insert(random());
-		}
+		const size_t before = heapBytes + sizeof(Bucket);
+		Bucket* bucket = new Bucket();
+		fill(*bucket, keys, state, before);
+		const size_t startComparisons = sortedBucketComparisons();
 		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(ll.erase(random()));
+		for (const T& query : queries) {
+			benchmark::DoNotOptimize(bucket->erase(query));
 		}
+		state.PauseTiming();
+		reportStats(*bucket, state, ops, startComparisons);
+		delete bucket;
+		state.ResumeTiming();
 	}
+	state.SetItemsProcessed(state.iterations() * ops);
 }
 
 
-/* Benchmark wrappers for VV */
-template <typename T>
-static void BM_VV_find(benchmark::State& state) {
+/*	Mixed reads and writes on a container holding range(0) keys. Reads
+	alternate find() and distance() on present keys, writes alternate inserting
+	a fresh key and erasing one, so the size stays about the same */
+template <typename Bucket, int ReadPercent>
+static void BM_mixed(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	const std::vector<T> fresh = makeKeys<T>(ops, Keys(state.range(1)), benchSeed + 2);
+	const std::vector<T> queries = makeQueries(keys, benchSeed + 1);
+	std::vector<unsigned char> isRead(ops);
+	std::mt19937_64 rng{benchSeed + 3};
+	for (unsigned char& read : isRead) {
+		read = rng() % 100 < ReadPercent;
+	}
 	for (auto _ : state) {
 		state.PauseTiming();
-		SortedBucketVV<T> vv;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			vv.insert(random());
-		}
+		const size_t before = heapBytes + sizeof(Bucket);
+		Bucket* bucket = new Bucket();
+		fill(*bucket, keys, state, before);
+		const size_t startComparisons = sortedBucketComparisons();
 		state.ResumeTiming();
 		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(vv.find(random()));
+			if (isRead[i]) {
+				if (i & 1) {
+					benchmark::DoNotOptimize(bucket->find(queries[i]));
+				}
+				else {
+					benchmark::DoNotOptimize(bucket->distance(queries[i]));
+				}
+			}
+			else if (i & 1) {
+				benchmark::DoNotOptimize(bucket->insert(fresh[i]));
+			}
+			else {
+				benchmark::DoNotOptimize(bucket->erase(queries[i]));
+			}
 		}
+		state.PauseTiming();
+		reportStats(*bucket, state, ops, startComparisons);
+		delete bucket;
+		state.ResumeTiming();
 	}
+	state.SetItemsProcessed(state.iterations() * ops);
 }
-template <typename T>
-static void BM_VV_insert(benchmark::State& state) {
+
+/*	Sliding window of range(0) keys over a stream 4 times as long. Every
+	step inserts the newest key, erases the oldest and reads the median */
+template <typename Bucket>
+static void BM_window(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t window = state.range(0);
+	const std::vector<T> stream = makeKeys<T>(5 * window, Keys(state.range(1)), benchSeed);
+	const std::vector<T> first(stream.begin(), stream.begin() + window);
 	for (auto _ : state) {
 		state.PauseTiming();
-		SortedBucketVV<T> vv;
-		const size_t ops = state.range(0);
+		const size_t before = heapBytes + sizeof(Bucket);
+		Bucket* bucket = new Bucket();
+		fill(*bucket, first, state, before);
+		const size_t startComparisons = sortedBucketComparisons();
 		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(vv.insert(random()));
+		for (size_t i = window; i < stream.size(); ++i) {
+			bucket->insert(stream[i]);
+			bucket->erase(stream[i - window]);
+			benchmark::DoNotOptimize(*bucket->nth(window / 2));
 		}
+		state.PauseTiming();
+		reportStats(*bucket, state, stream.size() - window, startComparisons);
+		delete bucket;
+		state.ResumeTiming();
 	}
+	state.SetItemsProcessed(state.iterations() * (stream.size() - window));
 }
-template <typename T>
-static void BM_VV_distance(benchmark::State& state) {
+
+/*	BM_window through SortedWindow, where each step is one push() */
+template <typename Bucket>
+static void BM_sortedWindow(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t window = state.range(0);
+	const std::vector<T> stream = makeKeys<T>(5 * window, Keys(state.range(1)), benchSeed);
 	for (auto _ : state) {
 		state.PauseTiming();
-		SortedBucketVV<T> vv;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			vv.insert(random());
+		SortedWindow<T, Bucket>* sorted = new SortedWindow<T, Bucket>(window);
+		for (size_t i = 0; i < window; ++i) {
+			sorted->push(stream[i]);
 		}
+		sorted->engine().resetStats();
+		const size_t startComparisons = sortedBucketComparisons();
 		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(vv.distance(random()));
+		for (size_t i = window; i < stream.size(); ++i) {
+			sorted->push(stream[i]);
+			benchmark::DoNotOptimize(sorted->median());
 		}
+		state.PauseTiming();
+		reportStats(sorted->engine(), state, stream.size() - window, startComparisons);
+		delete sorted;
+		state.ResumeTiming();
 	}
+	state.SetItemsProcessed(state.iterations() * (stream.size() - window));
 }
-template <typename T>
-static void BM_VV_erase(benchmark::State& state) {
+
+
+/*	Parallel bulk work on VV, on Threads threads (0 for every core) */
+template <typename Bucket, int Threads>
+static void BM_parallelBuild(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
 	for (auto _ : state) {
-		state.PauseTiming();
-		SortedBucketVV<T> vv;
-		const size_t ops = state.range(0);
-		for (size_t i = 0; i < ops; ++i) {
-			vv.insert(random());
+		Bucket bucket(Parallel{Threads}, keys.begin(), keys.end(), ops);
+		benchmark::DoNotOptimize(bucket.size());
+	}
+	state.SetItemsProcessed(state.iterations() * ops);
+}
+
+template <typename Bucket, int Threads>
+static void BM_parallelSum(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	Bucket bucket(Parallel{Threads}, keys.begin(), keys.end(), ops);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(bucket.transformReduce(Parallel{Threads}, 0, ops, T(0),
+			std::plus<T>(), [](const T& key) { return key; }));
+	}
+	state.SetItemsProcessed(state.iterations() * ops);
+}
+
+
+/*	A reader's view of range(0) keys, scanned in full, while 100 writes go on
+	in the live container. COW takes an O(1) snapshot, anything else a copy */
+template <typename Bucket>
+static void BM_snapshotScan(benchmark::State& state) {
+	using T = typename Bucket::Iterator::value_type;
+	const size_t ops = state.range(0);
+	const std::vector<T> keys = makeKeys<T>(ops, Keys(state.range(1)), benchSeed);
+	const std::vector<T> fresh = makeKeys<T>(ops, Keys(state.range(1)), benchSeed + 2);
+	const size_t before = heapBytes;
+	Bucket bucket;
+	fill(bucket, keys, state, before);
+	auto scanWhileWriting = [&](auto&& view, size_t round) {
+		/* insert 50 fresh keys and erase the 50 of the round before */
+		for (size_t i = 0; i < 50; ++i) {
+			bucket.insert(fresh[(round * 50 + i) % ops]);
+			if (round > 0) {
+				bucket.erase(fresh[(round * 50 + i - 50) % ops]);
+			}
 		}
-		state.ResumeTiming();
-		for (size_t i = 0; i < ops; ++i) {
-			benchmark::DoNotOptimize(vv.erase(random()));
+		T sum {0};
+		for (const T& key : view) {
+			sum += key;
+		}
+		benchmark::DoNotOptimize(sum);
+	};
+	size_t round = 0;
+	for (auto _ : state) {
+		if constexpr (requires { bucket.snapshot(); }) {
+			scanWhileWriting(bucket.snapshot(), round++);
 		}
+		else {
+			Bucket copy(bucket);
+			scanWhileWriting(copy, round++);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * ops);
+}
+
+
+/* Argument sets */
+static void sizes(benchmark::internal::Benchmark* bench) {
+	bench->ArgNames({"n", "keys"});
+	for (size_t n = benchIterLow; n <= benchIterHigh; n *= benchMultiplier) {
+		bench->Args({int64_t(n), Uniform});
+	}
+}
+
+static void distributions(benchmark::internal::Benchmark* bench) {
+	bench->ArgNames({"n", "keys"});
+	for (int64_t keys : {Uniform, Sorted, Reverse, Zipf, Duplicate}) {
+		bench->Args({int64_t(benchIterHigh / 10), keys});
 	}
 }
 
 
 /* Register wrappers for benchmark */
-BENCHMARK_TEMPLATE(BM_RBT_find, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_LL_find, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_VV_find, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-
-BENCHMARK_TEMPLATE(BM_RBT_distance, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_LL_distance, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_VV_distance, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-
-BENCHMARK_TEMPLATE(BM_RBT_insert, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_LL_insert, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_VV_insert, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-
-BENCHMARK_TEMPLATE(BM_RBT_erase, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_LL_erase, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-BENCHMARK_TEMPLATE(BM_VV_erase, uint64_t)
-	->RangeMultiplier(benchMultiplier)
-	->Range(benchIterLow, benchIterHigh)
-	->Unit(benchmark::kMillisecond);
-
-
-BENCHMARK_MAIN();
\ No newline at end of file
+#define BENCH_SIZES(bm, ...) \
+	BENCHMARK_TEMPLATE(bm, __VA_ARGS__)->Apply(sizes)->Unit(benchmark::kMillisecond)
+#define BENCH_DISTRIBUTIONS(bm, ...) \
+	BENCHMARK_TEMPLATE(bm, __VA_ARGS__)->Apply(distributions)->Unit(benchmark::kMillisecond)
+
+/* Single ops on uint64_t over sizes, as before */
+BENCH_SIZES(BM_find, SortedBucketRBT<uint64_t>);
+BENCH_SIZES(BM_find, SortedBucketLL<uint64_t>);
+BENCH_SIZES(BM_find, SortedBucketVV<uint64_t>);
+BENCH_SIZES(BM_find, SortedBucketBT<uint64_t>);
+BENCH_SIZES(BM_find, SortedBucketCOW<uint64_t>);
+
+BENCH_SIZES(BM_distance, SortedBucketRBT<uint64_t>);
+BENCH_SIZES(BM_distance, SortedBucketLL<uint64_t>);
+BENCH_SIZES(BM_distance, SortedBucketVV<uint64_t>);
+BENCH_SIZES(BM_distance, SortedBucketBT<uint64_t>);
+
+BENCH_SIZES(BM_distanceMany, SortedBucketRBT<uint64_t>);
+BENCH_SIZES(BM_distanceMany, SortedBucketLL<uint64_t>);
+BENCH_SIZES(BM_distanceMany, SortedBucketVV<uint64_t>);
+BENCH_SIZES(BM_distanceMany, SortedBucketBT<uint64_t>);
+
+BENCH_SIZES(BM_insert, SortedBucketRBT<uint64_t>);
+BENCH_SIZES(BM_insert, SortedBucketLL<uint64_t>);
+BENCH_SIZES(BM_insert, SortedBucketVV<uint64_t>);
+BENCH_SIZES(BM_insert, SortedBucketBT<uint64_t>);
+
+BENCH_SIZES(BM_erase, SortedBucketRBT<uint64_t>);
+BENCH_SIZES(BM_erase, SortedBucketLL<uint64_t>);
+BENCH_SIZES(BM_erase, SortedBucketVV<uint64_t>);
+BENCH_SIZES(BM_erase, SortedBucketBT<uint64_t>);
+
+/* Parallel work on uint64_t over sizes, timed by the wall clock */
+BENCH_SIZES(BM_parallelBuild, SortedBucketVV<uint64_t>, 1)->UseRealTime();
+BENCH_SIZES(BM_parallelBuild, SortedBucketVV<uint64_t>, 0)->UseRealTime();
+
+BENCH_SIZES(BM_parallelSum, SortedBucketVV<uint64_t>, 1)->UseRealTime();
+BENCH_SIZES(BM_parallelSum, SortedBucketVV<uint64_t>, 0)->UseRealTime();
+
+/* Storage from huge page backed regions, on uint64_t over sizes */
+BENCH_SIZES(BM_find, SortedBucketRBT<uint64_t, std::less<uint64_t>, SortedBucketRegion<uint64_t>>);
+BENCH_SIZES(BM_find, SortedBucketVV<uint64_t, std::less<uint64_t>, SortedBucketRegion<uint64_t>>);
+BENCH_SIZES(BM_find, SortedBucketBT<uint64_t, std::less<uint64_t>, SortedBucketRegion<uint64_t>>);
+BENCH_SIZES(BM_insert, SortedBucketRBT<uint64_t, std::less<uint64_t>, SortedBucketRegion<uint64_t>>);
+BENCH_SIZES(BM_insert, SortedBucketVV<uint64_t, std::less<uint64_t>, SortedBucketRegion<uint64_t>>);
+
+/* Scans of a frozen view during writes, on uint64_t over sizes */
+BENCH_SIZES(BM_snapshotScan, SortedBucketVV<uint64_t>);
+BENCH_SIZES(BM_snapshotScan, SortedBucketCOW<uint64_t>);
+
+/* Every key distribution */
+BENCH_DISTRIBUTIONS(BM_insert, SortedBucketRBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insert, SortedBucketLL<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insert, SortedBucketVV<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insert, SortedBucketBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insert, SortedBucketRuns<uint64_t>);
+
+BENCH_DISTRIBUTIONS(BM_insertBatch, SortedBucketRBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insertBatch, SortedBucketLL<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insertBatch, SortedBucketVV<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insertBatch, SortedBucketBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_insertBatch, SortedBucketRuns<uint64_t>);
+
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketRBT<uint64_t>, 95);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketLL<uint64_t>, 95);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketVV<uint64_t>, 95);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketBT<uint64_t>, 95);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketRuns<uint64_t>, 95);
+
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketRBT<uint64_t>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketLL<uint64_t>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketVV<uint64_t>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketBT<uint64_t>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketRuns<uint64_t>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketCOW<uint64_t>, 50);
+
+BENCH_DISTRIBUTIONS(BM_window, SortedBucketRBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_window, SortedBucketLL<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_window, SortedBucketVV<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_window, SortedBucketBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_window, SortedBucketRuns<uint64_t>);
+
+BENCH_DISTRIBUTIONS(BM_sortedWindow, SortedBucketRBT<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_sortedWindow, SortedBucketLL<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_sortedWindow, SortedBucketVV<uint64_t>);
+BENCH_DISTRIBUTIONS(BM_sortedWindow, SortedBucketBT<uint64_t>);
+
+/* Larger payloads */
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketRBT<std::string>);
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketLL<std::string>);
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketVV<std::string>);
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketBT<std::string>);
+
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketRBT<std::string>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketLL<std::string>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketVV<std::string>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketBT<std::string>, 50);
+
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketRBT<Payload>);
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketLL<Payload>);
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketVV<Payload>);
+BENCH_DISTRIBUTIONS(BM_find, SortedBucketBT<Payload>);
+
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketRBT<Payload>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketLL<Payload>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketVV<Payload>, 50);
+BENCH_DISTRIBUTIONS(BM_mixed, SortedBucketBT<Payload>, 50);
+
+
+BENCHMARK_MAIN();
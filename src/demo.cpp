@@ -73,7 +73,7 @@ int main() {
 #endif // DEMO_RBT
 
 
-#ifdef DEMO_LL // List of lists implementation
+#ifdef DEMO_LL // List of chunks implementation
     cout << "After range constructing SortedBucketLL: " << endl;
     SortedBucketLL<int> ll(v3.begin(), v3.end());
     ll.print();
@@ -0,0 +1,420 @@
+/**
+ * @file sortedBucket.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief One interface over every Sorted Bucket engine, picked at compile time
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * The engines share most of their interface, but not all of it: RBT inserts
+ * several copies at once and returns a null Iterator from a failed find(), VV
+ * and LL return int distances where RBT and BT return std::ptrdiff_t, and so
+ * on. This header gives them a common shape in two layers.
+ *
+ * SortedBucketLike is the concept every engine satisfies, for code templated
+ * directly on an engine. SortedBucket<T, Comp, Engine> is a thin facade over
+ * one engine with the differences ironed out, so a call site can switch
+ * engines by changing one template argument. The engine itself is still
+ * reachable through engine() for what only it offers (spans(), NodeHandle,
+ * the parallel scans...), and the facade's own batch lookups use the engine's
+ * interleaved kernels where it has them.
+ *
+ * Iteration is one of the differences: RBT and Runs store each distinct value
+ * once with a count of its copies, and their own Iterators step from value to
+ * value. The facade's Iterator steps through every copy on every engine, so a
+ * walk from begin() to end() always visits size() elements.
+ *
+ * By default the engine is AutoEngine<T, Comp>, picked from T and an optional
+ * expected size (see EngineFor).
+ *
+ * Usage:
+ *      SortedBucket<int> ints;                                 // VV
+ *      SortedBucket<std::string> names;                        // BT
+ *      SortedBucket<int, std::less<int>, SortedBucketRBT<int>> tree;
+ *      SortedBucket<int, std::less<int>, AutoEngine<int, std::less<int>, 200>> few;
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_H
+#define UTIL_SORTED_BUCKET_H
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include "sortedBucketRBT.h"
+#include "sortedBucketVV.h"
+#include "sortedBucketLL.h"
+#include "sortedBucketBT.h"
+#include "sortedBucketRuns.h"
+#include "sortedBucketCOW.h"
+
+/*
+    SortedBucketLike is met by a sorted multiset container of the Sorted Bucket
+    family: lookups by value and by sorted index, single and batch inserts and
+    erases, and iteration in sorted order.
+*/
+template <typename C>
+concept SortedBucketLike = requires(C c, const C cc, const typename C::Iterator::value_type& n,
+                                    const typename C::Iterator::value_type* batch, size_t idx) {
+    typename C::Iterator;
+    { cc.size() } -> std::convertible_to<size_t>;
+    { c.begin() } -> std::same_as<typename C::Iterator>;
+    { c.end() } -> std::same_as<typename C::Iterator>;
+    { c.find(n) } -> std::same_as<typename C::Iterator>;
+    { c.lowerBound(n) } -> std::same_as<typename C::Iterator>;
+    { c.upperBound(n) } -> std::same_as<typename C::Iterator>;
+    { c.nth(idx) } -> std::same_as<typename C::Iterator>;
+    { c.distance(n) } -> std::convertible_to<std::ptrdiff_t>;
+    { c.rank(n) } -> std::convertible_to<size_t>;
+    { c.countRange(n, n) } -> std::convertible_to<size_t>;
+    { c.insert(n) } -> std::same_as<typename C::Iterator>;
+    { c.erase(n) } -> std::convertible_to<size_t>;
+    { c.eraseAll(n) } -> std::convertible_to<size_t>;
+    c.insertBatch(batch, batch);
+    { c.eraseBatch(batch, batch) } -> std::convertible_to<size_t>;
+    c.clear();
+};
+
+/*
+    EngineFor picks the engine behind AutoEngine, from the mixed 50/50 and find
+    benchmarks in bench.cpp:
+        - An expected size of at most DefaultSmallDensity fits one VV bucket,
+          which is then just a sorted vector: VV.
+        - Small trivially copyable T (up to 16 bytes) shifts cheaply inside a
+          bucket, and VV searches its fences and buckets without a branch for
+          arithmetic T. It was ahead at every size from 10^3 to 10^6: VV.
+        - Anything else is expensive to shift, which BT keeps to a leaf of a
+          few hundred bytes: BT, about twice the speed of VV for std::string
+          or a 64 byte struct, and ahead of RBT too.
+    An ExpectedSize of 0 means unknown. Specialize EngineFor to override the
+    pick for a type.
+*/
+template <typename T, typename Comp, size_t ExpectedSize>
+struct EngineFor {
+    static constexpr bool fewElements = ExpectedSize > 0 && ExpectedSize <= DefaultSmallDensity;
+    static constexpr bool cheapShift = std::is_trivially_copyable_v<T> && sizeof(T) <= 16;
+    using type = std::conditional_t<fewElements || cheapShift,
+                                    SortedBucketVV<T, Comp>,
+                                    SortedBucketBT<T, Comp>>;
+};
+
+template <typename T, typename Comp = std::less<T>, size_t ExpectedSize = 0>
+using AutoEngine = typename EngineFor<T, Comp, ExpectedSize>::type;
+
+static_assert(SortedBucketLike<SortedBucketRBT<int>>);
+static_assert(SortedBucketLike<SortedBucketVV<int>>);
+static_assert(SortedBucketLike<SortedBucketLL<int>>);
+static_assert(SortedBucketLike<SortedBucketBT<int>>);
+static_assert(SortedBucketLike<SortedBucketRuns<int>>);
+static_assert(SortedBucketLike<SortedBucketCOW<int>>);
+
+template <typename T,
+          typename Comp     = std::less<T>,
+          typename Engine   = AutoEngine<T, Comp>>
+class SortedBucket {
+    using EngineIterator = typename Engine::Iterator;
+
+    /* Whether the engine keeps one entry per distinct value, with its copies */
+    static constexpr bool countsCopies = requires(const EngineIterator it) { it.copies(); };
+
+public:
+    static_assert(SortedBucketLike<Engine>, "Engine must be a Sorted Bucket container");
+    static_assert(std::is_same_v<typename EngineIterator::value_type, T>,
+                  "Engine must hold T");
+
+    /*
+        CopyIterator walks an engine which counts copies as if every copy were
+        stored on its own, repeating each value copies() times. base() is the
+        engine's Iterator to the value, and copy() which of its copies this is.
+    */
+    struct CopyIterator {
+        friend class SortedBucket;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = typename EngineIterator::pointer;
+        using reference         = typename EngineIterator::reference;
+
+        CopyIterator() noexcept {}
+
+        CopyIterator(EngineIterator it, size_t copy = 0) noexcept
+            : it(it)
+            , offset(copy) {}
+
+        inline reference operator *() const noexcept {
+            return *it;
+        }
+
+        inline pointer operator ->() const noexcept {
+            return std::addressof(**this);
+        }
+
+        inline bool operator ==(const CopyIterator& other) const noexcept {
+            return it == other.it && offset == other.offset;
+        }
+
+        inline bool operator !=(const CopyIterator& other) const noexcept {
+            return !(*this == other);
+        }
+
+        inline EngineIterator base() const noexcept {
+            return it;
+        }
+
+        inline size_t copy() const noexcept {
+            return offset;
+        }
+
+        /*  Pre-increment, to the next copy of the value or else the first copy
+            of the next one. Calling this on end() is UB, like in the engine */
+        CopyIterator& operator ++() {
+            if (++offset == it.copies()) {
+                ++it;
+                offset = 0;
+            }
+            return *this;
+        }
+
+        CopyIterator operator ++(int) {
+            CopyIterator temp = *this;
+            operator++();
+            return temp;
+        }
+
+        /*  Pre-decrement, to the previous copy of the value or else the last
+            copy of the previous one. Calling this on begin() is UB */
+        CopyIterator& operator --() {
+            if (offset == 0) {
+                --it;
+                offset = it.copies();
+            }
+            --offset;
+            return *this;
+        }
+
+        CopyIterator operator --(int) {
+            CopyIterator temp = *this;
+            operator--();
+            return temp;
+        }
+
+    private:
+        /* mutable, since RBT only hands out a reference from a non-const Iterator */
+        mutable EngineIterator  it;
+        size_t                  offset  {0};
+    };
+
+    using Iterator = std::conditional_t<countsCopies, CopyIterator, EngineIterator>;
+    using value_type = T;
+
+    /* Default constructor */
+    SortedBucket() {}
+
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucket(const Comp& comp)
+        : bucket(comp) {}
+
+    /* Range constructor */
+    template <class InputIterator>
+    SortedBucket(InputIterator beginIt, InputIterator endIt) {
+        insertBatch(beginIt, endIt);
+    }
+
+    /* Size getter */
+    size_t size() const noexcept {
+        return bucket.size();
+    }
+
+    bool empty() const noexcept {
+        return bucket.size() == 0;
+    }
+
+    Iterator begin() noexcept {
+        return Iterator(bucket.begin());
+    }
+
+    Iterator end() noexcept {
+        return Iterator(bucket.end());
+    }
+
+    /*  The engine, for whatever it offers beyond this interface. Its own
+        find() may miss differently, see find() */
+    Engine& engine() noexcept {
+        return bucket;
+    }
+
+    /* find() returns an Iterator to the first instance of n, or end() */
+    Iterator find(const T& n) {
+        return Iterator(normalize(bucket.find(n)));
+    }
+
+    bool contains(const T& n) {
+        return find(n) != end();
+    }
+
+    /* Number of instances of n */
+    size_t count(const T& n) {
+        return bucket.rank(n, true) - bucket.rank(n);
+    }
+
+    Iterator lowerBound(const T& n) {
+        return Iterator(bucket.lowerBound(n));
+    }
+
+    Iterator upperBound(const T& n) {
+        return Iterator(bucket.upperBound(n));
+    }
+
+    /* Index of the first instance of n, or -1 if it is not present */
+    std::ptrdiff_t distance(const T& n) {
+        return static_cast<std::ptrdiff_t>(bucket.distance(n));
+    }
+
+    /*  Element at sorted index idx, or end() if idx is out of range. On an
+        engine which counts copies, finding which copy takes one more rank() */
+    Iterator nth(size_t idx) {
+        EngineIterator it = bucket.nth(idx);
+        if constexpr (countsCopies) {
+            return (it == bucket.end()) ? end() : Iterator(it, idx - bucket.rank(*it));
+        }
+        else {
+            return it;
+        }
+    }
+
+    /* Number of elements below n, or with inclusive set, not above n */
+    size_t rank(const T& n, bool inclusive = false) {
+        return bucket.rank(n, inclusive);
+    }
+
+    /* Number of elements in [lo, hi) */
+    size_t countRange(const T& lo, const T& hi) {
+        return bucket.countRange(lo, hi);
+    }
+
+    /*
+        findMany() sets out[i] to find(keys[i]) for each key, through the
+        engine's interleaved lookups if it has them. out must hold at least
+        as many Iterators as there are keys.
+    */
+    void findMany(std::span<const T> keys, std::span<Iterator> out) {
+        if constexpr (countsCopies && requires(std::span<EngineIterator> found) {
+                          bucket.findMany(keys, found);
+                      }) {
+            /* the engine fills its own Iterators, a block of keys at a time */
+            constexpr size_t block = 64;
+            EngineIterator found[block];
+            for (size_t first = 0; first < keys.size(); first += block) {
+                size_t count = std::min(block, keys.size() - first);
+                bucket.findMany(keys.subspan(first, count), std::span<EngineIterator>(found, count));
+                for (size_t i = 0; i < count; ++i) {
+                    out[first + i] = Iterator(normalize(found[i]));
+                }
+            }
+        }
+        else if constexpr (requires { bucket.findMany(keys, out); }) {
+            bucket.findMany(keys, out);
+            for (size_t i = 0; i < keys.size(); ++i) {
+                out[i] = normalize(out[i]);
+            }
+        }
+        else {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                out[i] = find(keys[i]);
+            }
+        }
+    }
+
+    /*  insert() returns an Iterator to the new element, which goes after
+        any equal ones, so on an engine which counts copies, to the last copy */
+    Iterator insert(const T& n) {
+        return lastCopy(bucket.insert(n));
+    }
+
+    Iterator insert(T&& n) {
+        return lastCopy(bucket.insert(std::move(n)));
+    }
+
+    /*  insert() with copies inserts n that many times, in one go on engines
+        which count copies (RBT, Runs). It returns an Iterator to the last copy
+        of n, or end() if copies is 0 and n is not present */
+    Iterator insert(const T& n, size_t copies) {
+        if constexpr (requires { bucket.insert(n, copies); }) {
+            if (copies == 0) {
+                return find(n);
+            }
+            return lastCopy(bucket.insert(n, copies));
+        }
+        else {
+            if (copies == 0) {
+                return find(n);
+            }
+            Iterator it = bucket.insert(n);
+            while (--copies > 0) {
+                it = bucket.insert(n);
+            }
+            return it;
+        }
+    }
+
+    /* erase() erases one instance of n, and returns how many were erased */
+    size_t erase(const T& n) {
+        return static_cast<size_t>(bucket.erase(n));
+    }
+
+    /* eraseAll() erases every instance of n, and returns how many there were */
+    size_t eraseAll(const T& n) {
+        return static_cast<size_t>(bucket.eraseAll(n));
+    }
+
+    template <class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        bucket.insertBatch(beginIt, endIt);
+    }
+
+    template <class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        return static_cast<size_t>(bucket.eraseBatch(beginIt, endIt));
+    }
+
+    void clear() {
+        bucket.clear();
+    }
+
+    SortedBucketStats stats() const {
+        return bucket.stats();
+    }
+
+private:
+    /*  RBT (the engine with node handles) reports a miss with a null 
+        Iterator, which is not its end() */
+    EngineIterator normalize(EngineIterator it) noexcept {
+        if constexpr (requires { typename Engine::NodeHandle; }) {
+            return it == EngineIterator(nullptr) ? bucket.end() : it;
+        }
+        else {
+            return it;
+        }
+    }
+
+    /* The last copy of the value at it, which must not be end() */
+    Iterator lastCopy(EngineIterator it) noexcept {
+        if constexpr (countsCopies) {
+            return Iterator(it, it.copies() - 1);
+        }
+        else {
+            return it;
+        }
+    }
+
+    Engine  bucket;
+};
+
+static_assert(SortedBucketLike<SortedBucket<int>>);
+
+#endif // UTIL_SORTED_BUCKET_H
@@ -0,0 +1,1450 @@
+/**
+ * @file sortedBucketBT.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Implementation of Sorted Bucket container using a counted B+-tree
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Container provides sub-linear time lookup, distance, insertion, deletion.
+ * Elements live in wide leaves which are linked for iteration, and each inner
+ * node keeps, for every child, the largest element and the number of elements
+ * under it. A search reads one contiguous array of maxes per level, and the
+ * counts give the index on the way down, so the tree is only log_B(n) deep
+ * for a fan-out B of a few cache lines.
+ *
+ * Time complexities:
+ *      find:               O(log(n))
+ *      distance:           O(log(n))
+ *      nth:                O(log(n))
+ *      rank:               O(log(n))
+ *      countRange:         O(log(n))
+ *      insert:             O(log(n))
+ *      erase:              O(log(n))
+ *      batch of k:         O(k*log(k) + k*log(n))
+ *      findMany of k:      O(k*log(n))
+ *      split, join:        O(n/B) for leaves of B elements
+ *      merge:              O(n + m)
+ *      build from sorted:  O(n)
+ *
+ * Comp is stored, so it may carry state. If it is transparent, lookups and
+ * erases also take keys of any other type it compares against T.
+ *
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_BT_H
+#define UTIL_SORTED_BUCKET_BT_H
+
+/*
+    Node footprints in bytes. Leaves are scanned by binary search, so they can
+    be wider than inner nodes, whose maxes are read at every level.
+*/
+#define BTreeLeafBytes (size_t(512))
+#define BTreeInnerBytes (size_t(256))
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <vector>
+#include "sortedBucketCommon.h"
+#include "sortedBucketSnapshot.h"
+
+//#define NDEBUG
+#ifndef NDEBUG
+#include <iostream>
+#include <string>
+#endif // ifndef NDEBUG
+
+template <typename T,
+          typename Comp     = std::less<T>,
+          typename Alloc    = std::allocator<T>>
+class SortedBucketBT {
+    /*  Slots per node. A node is split as soon as it fills up, so a node always
+        has room for one more element or child when an operation starts. Nodes
+        other than the root hold at least a quarter of their slots */
+    static constexpr size_t LeafSlots  = std::max<size_t>(8, BTreeLeafBytes / sizeof(T));
+    static constexpr size_t InnerSlots = std::max<size_t>(8, BTreeInnerBytes / sizeof(T));
+    static constexpr size_t MaxHeight  = 64;
+
+    /* count is the number of elements in a leaf, or of children in an inner node */
+    struct Node {
+        size_t  count {0};
+    };
+
+    struct Leaf : Node {
+        Leaf*   prev {nullptr};
+        Leaf*   next {nullptr};
+        T       keys[LeafSlots];
+    };
+
+    struct Inner : Node {
+        T       maxes[InnerSlots];      // largest element under each child
+        size_t  sizes[InnerSlots];      // number of elements under each child
+        Node*   children[InnerSlots];
+    };
+
+    /*  steal Alloc's traits and rebind to allocate for nodes, like in
+        SortedBucketRBT */
+    using AllocLeaf  = typename std::allocator_traits<Alloc>::template rebind_alloc<Leaf>;
+    using AllocInner = typename std::allocator_traits<Alloc>::template rebind_alloc<Inner>;
+
+    /* Path of a descent: the inner nodes passed and the child taken in each */
+    struct Path {
+        Inner*  nodes[MaxHeight];
+        size_t  slots[MaxHeight];
+        size_t  depth {0};
+    };
+
+public:
+    friend struct Iterator;
+    struct Iterator {
+        friend class SortedBucketBT;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        /*  difference_type is included here for compliance with iterator_traits,
+            but distance should be calculated from SortedBucketBT::distance()
+            for runtime in O(log(n)) rather than O(n)   */
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = value_type*;
+        using const_pointer     = value_type const*;
+        using reference         = value_type&;
+        using const_reference   = value_type const&;
+
+        Iterator() noexcept {}
+
+        Iterator(Leaf* leaf, size_t targ) noexcept
+            : leaf(leaf)
+            , targ(targ) {}
+
+        Iterator(const Iterator& other) noexcept
+            : leaf(other.leaf)
+            , targ(other.targ) {}
+
+        inline reference operator *() noexcept {
+            return leaf->keys[targ];
+        }
+
+        inline const_reference operator *() const noexcept {
+            return leaf->keys[targ];
+        }
+
+        inline pointer operator ->() {
+            return std::addressof(leaf->keys[targ]);
+        }
+
+        inline const_pointer operator ->() const {
+            return std::addressof(leaf->keys[targ]);
+        }
+
+        inline bool operator ==(const Iterator other) const noexcept {
+            return (leaf    == other.leaf &&
+                    targ    == other.targ);
+        }
+
+        inline bool operator !=(const Iterator other) const noexcept {
+            return !(*this == other);
+        }
+
+        inline void operator =(const Iterator other) noexcept {
+            leaf = other.leaf;
+            targ = other.targ;
+        }
+
+        /*  Pre-increment. Calling this on SortedBucketBT::end() may segfault,
+            so requires checks like in STL containers. The end() Iterator is
+            one past the last element of the last leaf */
+        Iterator& operator ++() {
+            ++targ;
+            if (targ == leaf->count && leaf->next) {
+                leaf = leaf->next;
+                targ = 0;
+            }
+            return *this;
+        }
+
+        /*  Post-increment. Calling this on SortedBucketBT::end() may segfault,
+            so requires checks like in STL containers */
+        Iterator operator ++(int) {
+            Iterator temp = *this;
+            operator++();
+            return temp;
+        }
+
+        /*  Pre-decrement. Calling this on SortedBucketBT::begin() may segfault,
+            so requires checks like in STL containers */
+        Iterator& operator --() {
+            if (targ == 0) {
+                leaf = leaf->prev;
+                targ = leaf->count;
+            }
+            --targ;
+            return *this;
+        }
+
+        /*  Post-decrement. Calling this on SortedBucketBT::begin() may segfault,
+            so requires checks like in STL containers */
+        Iterator operator --(int) {
+            Iterator temp = *this;
+            operator--();
+            return temp;
+        }
+
+    private:
+        Leaf*   leaf {nullptr};
+        size_t  targ {0};
+    };
+
+    /* Default constructor */
+    SortedBucketBT() {
+        init();
+    }
+
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucketBT(const Comp& comp) 
+        : comp(comp) {
+        init();
+    }
+
+    /* Copy constructor. Rebuilds old's elements bottom-up in O(n) */
+    explicit SortedBucketBT(const SortedBucketBT& old) 
+        : comp(old.comp) {
+        init();
+        for (Leaf* leaf = old.head; leaf; leaf = leaf->next) {
+            for (size_t i = 0; i < leaf->count; ++i) {
+                appendSorted(leaf->keys[i]);
+            }
+        }
+        finishSorted();
+    }
+
+    /* Move constructor. Takes over old's nodes (and allocators), leaving old empty */
+    SortedBucketBT(SortedBucketBT&& old) noexcept
+        : allocLeaf(std::move(old.allocLeaf))
+        , allocInner(std::move(old.allocInner))
+        , sz(old.sz)
+        , height(old.height)
+        , root(old.root)
+        , head(old.head)
+        , tail(old.tail)
+        , comp(old.comp) {
+        old.sz = 0;
+        old.height = 0;
+        old.init();
+    }
+
+    /*  Nodes are owned through raw pointers, so a shallow copy would free them
+        twice. Assignment is not supported, use the constructors instead */
+    SortedBucketBT& operator =(const SortedBucketBT&) = delete;
+    SortedBucketBT& operator =(SortedBucketBT&&) = delete;
+
+    /* Range constructor */
+    template <class InputIterator>
+    SortedBucketBT(InputIterator beginIt, InputIterator endIt, const Comp& comp = Comp()) 
+        : comp(comp) {
+        init();
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            insert(*it);
+        }
+    }
+
+    /*
+        Sorted range constructor. Input must already be sorted by Comp, so it is
+        packed straight into leaves and the levels above are built in O(n).
+    */
+    template <class InputIterator>
+    SortedBucketBT(SortedInputTag, InputIterator beginIt, InputIterator endIt,
+                   const Comp& comp = Comp()) 
+        : comp(comp) {
+        init();
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            appendSorted(*it);
+        }
+        finishSorted();
+    }
+
+    /* Default destructor */
+    ~SortedBucketBT() noexcept {
+        release();
+    }
+
+    /* Size getter */
+    inline size_t size() const noexcept {
+        return sz;
+    }
+
+    /* Comparator getter */
+    Comp getComp() const noexcept {
+        return comp;
+    }
+
+    /* Begin getter */
+    inline Iterator begin() noexcept {
+        return Iterator(head, 0);
+    }
+
+    /* End getter */
+    inline Iterator end() noexcept {
+        return Iterator(tail, tail->count);
+    }
+
+    /*  Front element access. Calling front() on an empty SortedBucketBT will
+        cause segfault, just like with other STL containers */
+    inline T& front() noexcept {
+        return head->keys[0];
+    }
+
+    /*  Back element access. Calling back() on an empty SortedBucketBT will
+        cause segfault, just like with other STL containers */
+    inline T& back() noexcept {
+        return tail->keys[tail->count - 1];
+    }
+
+    /*
+        lowerBound() runs in O(log(n)) time and returns the first iterator
+        which satisfies: (element < n) or comp(element, n) is false).
+    */
+    Iterator lowerBound(const T& n) noexcept {
+        return lowerBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator lowerBound(const K& n) noexcept {
+        return boundWithDistance<false>(n).first;
+    }
+
+    /*
+        upperBound() runs in O(log(n)) time and returns the first iterator which
+        satisfies: (n < element) or comp(n, element) is true).
+    */
+    Iterator upperBound(const T& n) noexcept {
+        return upperBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator upperBound(const K& n) noexcept {
+        return boundWithDistance<true>(n).first;
+    }
+
+    /*
+        find() runs in O(log(n)) and returns an Iterator to the first instance
+        of n.
+    */
+    Iterator find(const T& n) noexcept {
+        return find<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator find(const K& n) noexcept {
+        return findWithDistance(n).first;
+    }
+
+    /*
+        distance() runs in O(log(n)) time and returns the index of the first
+        occurrence of the element, 0-indexed. (Returns -1 if element not found)
+    */
+    std::ptrdiff_t distance(const T& n) noexcept {
+        return distance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::ptrdiff_t distance(const K& n) noexcept {
+        return findWithDistance(n).second;
+    }
+
+    /*
+        findMany() runs in O(k*log(n)) time and sets out[i] to find(keys[i]) for
+        each of the k keys. Up to BatchLookupLanes keys go down the tree level
+        by level together, and each prefetches the node it steps to, so their 
+        cache misses overlap instead of being paid one after another. out must
+        hold at least k Iterators.
+    */
+    void findMany(std::span<const T> keys, std::span<Iterator> out) noexcept {
+        assert(out.size() >= keys.size());
+        lowerBoundMany(keys, [&](size_t i, const Iterator& it, size_t dist) {
+            out[i] = (dist == sz || comp(keys[i], *it)) ? end() : it;
+        });
+    }
+
+    /*
+        distanceMany() runs in O(k*log(n)) time and sets out[i] to 
+        distance(keys[i]) for each of the k keys, interleaved like findMany().
+        out must hold at least k distances.
+    */
+    void distanceMany(std::span<const T> keys, std::span<std::ptrdiff_t> out) noexcept {
+        assert(out.size() >= keys.size());
+        lowerBoundMany(keys, [&](size_t i, const Iterator& it, size_t dist) {
+            out[i] = (dist == sz || comp(keys[i], *it)) ? -1 : static_cast<std::ptrdiff_t>(dist);
+        });
+    }
+
+    /*
+        findWithDistance() runs in O(log(n)) time and returns a pair of: an
+        Iterator to the element, along with the index of its first occurrence.
+        If the element was not found, the pair consists of the end() Iterator
+        and a distance of -1.
+    */
+    std::pair<Iterator, std::ptrdiff_t> findWithDistance(const T& n) noexcept {
+        return findWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, std::ptrdiff_t> findWithDistance(const K& n) noexcept {
+        auto [it, dist] = boundWithDistance<false>(n);
+        if (dist == sz || comp(n, *it)) {
+            return std::make_pair(end(), std::ptrdiff_t(-1));
+        }
+        return std::make_pair(it, static_cast<std::ptrdiff_t>(dist));
+    }
+
+    /*
+        lowerBoundWithDistance() runs in O(log(n)) time and returns a pair of:
+        lowerBound(n), along with its index. Unlike findWithDistance(), n does
+        not have to be present, in which case the index is the number of
+        elements below n (and size() if there are none above).
+    */
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const T& n) noexcept {
+        return lowerBoundWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const K& n) noexcept {
+        return boundWithDistance<false>(n);
+    }
+
+    /*
+        rank() runs in O(log(n)) time and returns the number of elements below
+        n, or with inclusive set, the number not above n. n does not have to
+        be present.
+    */
+    size_t rank(const T& n, bool inclusive = false) noexcept {
+        return rank<T>(n, inclusive);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t rank(const K& n, bool inclusive = false) noexcept {
+        return inclusive ? boundWithDistance<true>(n).second
+                         : boundWithDistance<false>(n).second;
+    }
+
+    /*
+        countRange() runs in O(log(n)) time and returns how many elements lie
+        in [lo, hi). Neither lo nor hi has to be present.
+    */
+    size_t countRange(const T& lo, const T& hi) noexcept {
+        return countRange<T>(lo, hi);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t countRange(const K& lo, const K& hi) noexcept {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /*
+        nth() runs in O(log(n)) time and returns an Iterator to the element at
+        sorted index idx (0-indexed), making it the inverse of distance(). The
+        leaf is found by descending the child sizes. If idx is out of range,
+        returns the end() Iterator.
+    */
+    Iterator nth(size_t idx) noexcept {
+        if (idx >= sz) {
+            return end();
+        }
+        Node* node = root;
+        for (size_t h = height; h > 0; --h) {
+            Inner* inner = static_cast<Inner*>(node);
+            size_t slot = 0;
+            while (idx >= inner->sizes[slot]) {
+                idx -= inner->sizes[slot];
+                ++slot;
+            }
+            node = inner->children[slot];
+        }
+        return Iterator(static_cast<Leaf*>(node), idx);
+    }
+
+    /*
+        at() runs in O(log(n)) time and returns the element at sorted index idx.
+        Calling at() with an out of range idx is UB, so requires checks like
+        in STL containers.
+    */
+    inline T& at(size_t idx) noexcept {
+        assert(idx < sz);
+        return *nth(idx);
+    }
+
+    /*
+        insert() runs in O(log(n)) time. It preserves stable sorting order (by
+        inserting at upperBound()) and returns an iterator to the inserted
+        element. An element not below back() takes the last child all the way
+        down instead of searching, so ascending streams skip the comparisons.
+    */
+    Iterator insert(const T& n) {
+        return place(n);
+    }
+
+    Iterator insert(T&& n) {
+        return place(std::move(n));
+    }
+
+    /*
+        insert() with a hint is insert(n). The counts on the path down have to
+        be updated whatever the hint, and nodes have no parent links, so the 
+        descent from the root cannot be skipped. It is kept so that code 
+        written against std::multiset or the other containers compiles.
+    */
+    Iterator insert(Iterator hint, const T& n) {
+        (void)hint;
+        return place(n);
+    }
+
+    Iterator insert(Iterator hint, T&& n) {
+        (void)hint;
+        return place(std::move(n));
+    }
+
+    /*
+        emplace() runs in O(log(n)) time and inserts T(args...). The position 
+        depends on the element, so it is built first and then moved into its
+        leaf, never copied.
+    */
+    template <typename... Args>
+    Iterator emplace(Args&&... args) {
+        return insert(T(std::forward<Args>(args)...));
+    }
+
+    /*
+        emplace_hint() is emplace() for code written against std::multiset.
+        The hint is ignored, see insert(hint, n).
+    */
+    template <typename... Args>
+    Iterator emplace_hint(Iterator hint, Args&&... args) {
+        (void)hint;
+        return emplace(std::forward<Args>(args)...);
+    }
+
+    /*
+        erase() runs in O(log(n)) and erases a single instance of the element.
+        It returns how many instances of the element were erased (1 or 0)
+    */
+    int erase(const T& n) {
+        return erase<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int erase(const K& n) {
+        Path path;
+        size_t below = 0;
+        Leaf* leaf = descend<false>(n, path, below);
+        size_t targ = searchSorted<false>(leaf->keys, leaf->keys + leaf->count, n, comp) -
+                      leaf->keys;
+        /*  The descent only ends left of every larger element if there is one
+            not below n, so targ is never at the end of a non-last leaf here */
+        if (targ == leaf->count || comp(n, leaf->keys[targ])) {
+            return 0;
+        }
+        removeAt(path, leaf, targ);
+        return 1;
+    }
+
+    /*
+        eraseAll() runs in O(k*log(n)) for k erased elements, and erases all
+        instances of the element. It returns how many instances of the element
+        were erased.
+    */
+    int eraseAll(const T& n) {
+        return eraseAll<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int eraseAll(const K& n) {
+        int ct = 0;
+        while (erase(n)) {
+            ++ct;
+        }
+        return ct;
+    }
+
+    /*
+        insertBatch() runs in O(k*log(k) + k*log(n)) time for a batch of k
+        elements. The batch is sorted first, so consecutive inserts walk the
+        same nodes, and an empty container is built bottom-up in O(k) instead.
+        Equal elements end up in the same order as from repeated insert()
+        calls. This invalidates all iterators.
+    */
+    template <class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        std::stable_sort(batch.begin(), batch.end(), comp);
+        if (sz == 0) {
+            clear();
+            for (T& n : batch) {
+                appendSorted(std::move(n));
+            }
+            finishSorted();
+            return;
+        }
+        for (T& n : batch) {
+            place(std::move(n));
+        }
+    }
+
+    /*
+        eraseBatch() runs in O(k*log(k) + k*log(n)) time for a batch of k
+        elements. It erases a single instance for each element of the batch
+        (so a value given twice erases two instances), and returns how many
+        elements were erased.
+    */
+    template <class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        std::sort(batch.begin(), batch.end(), comp);
+        size_t ct = 0;
+        for (const T& n : batch) {
+            ct += erase(n);
+        }
+        return ct;
+    }
+
+    /*
+        clear() runs in O(n/B) time for leaves of B elements, and erases every
+        element. With SortedBucketPool as Alloc its memory is released all at
+        once instead, which skips visiting the nodes when T is trivially 
+        destructible. This invalidates all iterators.
+    */
+    void clear() {
+        release();
+        height = 0;
+        sz = 0;
+        init();
+    }
+
+    /*
+        split() runs in O(n/B) time for leaves of B elements, and moves every
+        element not below key into the returned container, keeping the ones
+        below it. The leaves are handed over as they are, so only the leaf
+        holding the cut has elements moved, but the inner levels of both sides
+        are built again over their leaves. With an allocator whose copies
+        cannot free each other's memory (SortedBucketPool), the moved elements
+        are packed into new leaves in O(n) instead. This invalidates all 
+        iterators.
+    */
+    SortedBucketBT split(const T& key) {
+        SortedBucketBT out(comp);
+        auto [cut, pos] = lowerBoundWithDistance(key);
+        Leaf* leaf = cut.leaf;
+        if (out.allocLeaf != allocLeaf || out.allocInner != allocInner) {
+            for (Leaf* from = leaf; from; from = from->next) {
+                for (size_t i = (from == leaf) ? cut.targ : 0; i < from->count; ++i) {
+                    out.appendSorted(std::move(from->keys[i]));
+                }
+            }
+            leaf->count = cut.targ;
+            while (tail != leaf) {
+                unlinkLeaf(tail);
+            }
+            if (leaf->count == 0 && leaf->prev) {
+                unlinkLeaf(leaf);
+            }
+        }
+        else if (cut.targ > 0) {
+            /*  out starts with its own empty leaf, which takes the tail of the
+                cut leaf and is followed by the leaves after it */
+            Leaf* first = out.head;
+            std::move(leaf->keys + cut.targ, leaf->keys + leaf->count, first->keys);
+            first->count = leaf->count - cut.targ;
+            leaf->count = cut.targ;
+            first->next = leaf->next;
+            if (leaf->next) {
+                leaf->next->prev = first;
+                out.tail = tail;
+            }
+            leaf->next = nullptr;
+            tail = leaf;
+        }
+        else {
+            out.freeLeaf(out.head);
+            out.head = leaf;
+            out.tail = tail;
+            tail = leaf->prev;
+            leaf->prev = nullptr;
+            if (tail) {
+                tail->next = nullptr;
+            }
+            else {
+                head = tail = newLeaf();
+            }
+        }
+        out.sz = sz - pos;
+        sz = pos;
+        relink(tail->prev);
+        out.relink(out.head);
+        return out;
+    }
+
+    /*
+        join() runs in O((n + m)/B) time for leaves of B elements, and moves
+        all of other onto the end of this container, leaving other empty.
+        Every element of other must be at least back(), otherwise nothing is
+        moved and false is returned. The leaf lists are spliced together and
+        at most the two leaves at the seam have elements moved, then the inner
+        levels are built again over the leaves. With an allocator whose copies
+        cannot free each other's memory (SortedBucketPool), this falls back to
+        merge(). This invalidates all iterators of both containers.
+    */
+    bool join(SortedBucketBT& other) {
+        if (&other == this || other.sz == 0) {
+            return true;
+        }
+        if (sz > 0 && comp(other.front(), back())) {
+            return false;
+        }
+        if (other.allocLeaf != allocLeaf || other.allocInner != allocInner) {
+            merge(other);
+            return true;
+        }
+        Leaf* seam = nullptr;
+        if (sz == 0) {
+            freeLeaf(head);
+            head = other.head;
+        }
+        else {
+            seam = tail;
+            tail->next = other.head;
+            other.head->prev = tail;
+        }
+        tail = other.tail;
+        sz += other.sz;
+        other.freeInners(other.root, other.height);
+        other.height = 0;
+        other.sz = 0;
+        other.init();
+        relink(seam);
+        return true;
+    }
+
+    /*
+        merge() runs in O(n + m) time and moves all of other into this
+        container, leaving other empty. Both are merged into one sorted run
+        which is then packed into leaves like the SortedInput constructor.
+        This invalidates all iterators of both containers.
+    */
+    void merge(SortedBucketBT& other) {
+        if (&other == this || other.sz == 0) {
+            return;
+        }
+        std::vector<T> merged;
+        merged.reserve(sz + other.sz);
+        Iterator mine = begin(), theirs = other.begin();
+        Iterator mineEnd = end(), theirsEnd = other.end();
+        while (mine != mineEnd || theirs != theirsEnd) {
+            /* equal elements keep ours first */
+            bool ours = theirs == theirsEnd || (mine != mineEnd && !comp(*theirs, *mine));
+            merged.emplace_back(std::move(ours ? *mine++ : *theirs++));
+        }
+        clear();
+        for (T& n : merged) {
+            appendSorted(std::move(n));
+        }
+        finishSorted();
+        other.clear();
+    }
+
+    /*
+        save() runs in O(n) time and writes a flat snapshot of the container
+        to path (see sortedBucketSnapshot.h), one leaf at a time. Leaves are
+        rebuilt on load(), so no runs are written. Returns whether it
+        succeeded.
+    */
+    bool save(const char* path) const requires std::is_trivially_copyable_v<T> {
+        SnapshotFile file(path, "wb");
+        SnapshotHeader header(sizeof(T), SnapshotFlat, sz, 0, 0);
+        file.write(&header, sizeof header);
+        file.pad(header.elemOffset());
+        for (const Leaf* leaf = head; leaf; leaf = leaf->next) {
+            file.write(leaf->keys, leaf->count * sizeof(T));
+        }
+        return file.close();
+    }
+
+    /*
+        load() runs in O(n) time and replaces the contents with the flat
+        snapshot at path, built bottom-up like the SortedInput constructor.
+        Any run lengths in the snapshot are skipped. Returns whether it
+        succeeded, leaving the container empty if not. This invalidates all
+        iterators.
+    */
+    bool load(const char* path) requires std::is_trivially_copyable_v<T> {
+        clear();
+        SnapshotFile file(path, "rb");
+        SnapshotHeader header;
+        file.read(&header, sizeof header);
+        bool good = file && header.valid<T>() && header.fits<T>(file.length()) &&
+                    header.layout == SnapshotFlat;
+        file.skip(header.elemOffset());
+        T chunk[LeafSlots];
+        for (size_t placed = 0; good && placed < header.count; placed += LeafSlots) {
+            size_t take = std::min<size_t>(LeafSlots, header.count - placed);
+            file.read(chunk, take * sizeof(T));
+            good = bool(file);
+            for (size_t i = 0; good && i < take; ++i) {
+                appendSorted(chunk[i]);
+            }
+        }
+        /* link up whatever was read, so that it can be freed as a tree */
+        finishSorted();
+        if (!good) {
+            clear();
+        }
+        return good;
+    }
+
+    /*
+        stats() runs in O(n/B) time for leaves of B elements and returns the
+        counters kept since construction or resetStats() (see
+        SortedBucketStats), where splits, merges and moves cover leaves and 
+        inner nodes alike. Also the bytes held by the nodes, and a histogram
+        of the leaf sizes.
+    */
+    SortedBucketStats stats() const {
+        SortedBucketStats out;
+#ifdef SORTED_BUCKET_STATS
+        out = counters;
+#endif
+        out.bytes = countInners(root, height) * sizeof(Inner);
+        for (const Leaf* leaf = head; leaf; leaf = leaf->next) {
+            out.bytes += sizeof(Leaf);
+            out.countBucket(leaf->count);
+        }
+        return out;
+    }
+
+    /* resetStats() zeroes the counters, a no-op without SORTED_BUCKET_STATS */
+    void resetStats() noexcept {
+#ifdef SORTED_BUCKET_STATS
+        counters = SortedBucketStats();
+#endif
+    }
+
+#ifndef NDEBUG
+    /*
+        Prints entire contents, one leaf per line. For debugging
+    */
+    void print(const std::string& name = "SortedBucketBT") const {
+        std::cout << "Printing " << name << std::endl;
+        std::cout << "    with size = " << sz <<
+            " and height = " << height << std::endl;
+        std::cout << "===========================================" << std::endl;
+        int l = 0;
+        for (Leaf* leaf = head; leaf; leaf = leaf->next) {
+            std::cout << "leaf " << l++ << " contains: " << std::endl;
+            for (size_t i = 0; i < leaf->count; ++i) {
+                std::cout << "  " << leaf->keys[i];
+            }
+            std::cout << std::endl;
+        }
+        std::cout << std::endl;
+    }
+#endif
+
+private:
+    /* init() gives an empty container its single, empty leaf */
+    inline void init() {
+        root = head = tail = newLeaf();
+    }
+
+    /*
+        childFor() returns the child of inner to descend into: the first whose
+        max is not below n (above n if Upper), or the last child if there is
+        none.
+    */
+    template <bool Upper, typename K>
+    inline size_t childFor(const Inner* inner, const K& n) const noexcept {
+        const T* slot = searchSorted<Upper>(inner->maxes, inner->maxes + inner->count, n, comp);
+        return std::min<size_t>(slot - inner->maxes, inner->count - 1);
+    }
+
+    /*
+        descend() walks from the root to the leaf where n would be bounded,
+        recording the path, and adds up the elements in the leaves before it.
+    */
+    template <bool Upper, typename K>
+    Leaf* descend(const K& n, Path& path, size_t& below) noexcept {
+        Node* node = root;
+        path.depth = 0;
+        for (size_t h = height; h > 0; --h) {
+            Inner* inner = static_cast<Inner*>(node);
+            size_t slot = childFor<Upper>(inner, n);
+            for (size_t c = 0; c < slot; ++c) {
+                below += inner->sizes[c];
+            }
+            path.nodes[path.depth] = inner;
+            path.slots[path.depth++] = slot;
+            node = inner->children[slot];
+        }
+        return static_cast<Leaf*>(node);
+    }
+
+    /*  descendLast() walks from the root to the last leaf, recording the 
+        path like descend() without comparing anything */
+    Leaf* descendLast(Path& path) noexcept {
+        Node* node = root;
+        path.depth = 0;
+        for (size_t h = height; h > 0; --h) {
+            Inner* inner = static_cast<Inner*>(node);
+            path.nodes[path.depth] = inner;
+            path.slots[path.depth++] = inner->count - 1;
+            node = inner->children[inner->count - 1];
+        }
+        return static_cast<Leaf*>(node);
+    }
+
+    /*
+        boundWithDistance() returns lowerBound(n) (upperBound(n) if Upper)
+        together with its index. An Iterator left at the end of a leaf is moved
+        to the start of the next one, so that it compares equal to the
+        Iterators from increments.
+    */
+    template <bool Upper, typename K>
+    std::pair<Iterator, size_t> boundWithDistance(const K& n) noexcept {
+        Path path;
+        size_t below = 0;
+        Leaf* leaf = descend<Upper>(n, path, below);
+        size_t idx = searchSorted<Upper>(leaf->keys, leaf->keys + leaf->count, n, comp) -
+                     leaf->keys;
+        below += idx;
+        if (idx == leaf->count && leaf->next) {
+            return std::make_pair(Iterator(leaf->next, 0), below);
+        }
+        return std::make_pair(Iterator(leaf, idx), below);
+    }
+
+    /*
+        lowerBoundMany() runs boundWithDistance<false>() for every key,
+        BatchLookupLanes at a time, and calls visit(i, it, dist) with the result
+        for keys[i]. Every key of a group is at the same height, so each round
+        steps all of them one level down before any of them reads its next 
+        node. Below BatchLookupMinBytes of leaves (counted half full), every
+        key is searched on its own.
+    */
+    template <typename Visit>
+    void lowerBoundMany(std::span<const T> keys, Visit&& visit) noexcept {
+        if (2 * sz / LeafSlots * sizeof(Leaf) < BatchLookupMinBytes) {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                auto [it, dist] = boundWithDistance<false>(keys[i]);
+                visit(i, it, dist);
+            }
+            return;
+        }
+        Node* nodes[BatchLookupLanes];
+        size_t below[BatchLookupLanes];
+        for (size_t first = 0; first < keys.size(); first += BatchLookupLanes) {
+            size_t lanes = std::min(BatchLookupLanes, keys.size() - first);
+            for (size_t l = 0; l < lanes; ++l) {
+                nodes[l] = root;
+                below[l] = 0;
+            }
+            for (size_t h = height; h > 0; --h) {
+                for (size_t l = 0; l < lanes; ++l) {
+                    Inner* inner = static_cast<Inner*>(nodes[l]);
+                    size_t slot = childFor<false>(inner, keys[first + l]);
+                    for (size_t c = 0; c < slot; ++c) {
+                        below[l] += inner->sizes[c];
+                    }
+                    nodes[l] = inner->children[slot];
+                    prefetchRead(nodes[l], (h > 1) ? sizeof(Inner) : sizeof(Leaf));
+                }
+            }
+            for (size_t l = 0; l < lanes; ++l) {
+                Leaf* leaf = static_cast<Leaf*>(nodes[l]);
+                size_t idx = searchSorted<false>(leaf->keys, leaf->keys + leaf->count, 
+                                                 keys[first + l], comp) - leaf->keys;
+                size_t dist = below[l] + idx;
+                if (idx == leaf->count && leaf->next) {
+                    visit(first + l, Iterator(leaf->next, 0), dist);
+                }
+                else {
+                    visit(first + l, Iterator(leaf, idx), dist);
+                }
+            }
+        }
+    }
+
+    /*
+        place() inserts n after any equal elements, updates the counts and
+        maxes on the path, and splits the leaf if it filled up.
+    */
+    template <typename U>
+    Iterator place(U&& n) {
+        Path path;
+        size_t below = 0;
+        Leaf* leaf;
+        size_t targ;
+        if (sz > 0 && !comp(n, back())) {
+            leaf = descendLast(path);
+            targ = leaf->count;
+        }
+        else {
+            leaf = descend<true>(n, path, below);
+            targ = searchSorted<true>(leaf->keys, leaf->keys + leaf->count, n, comp) -
+                   leaf->keys;
+        }
+        std::move_backward(leaf->keys + targ, leaf->keys + leaf->count,
+                           leaf->keys + leaf->count + 1);
+        leaf->keys[targ] = std::forward<U>(n);
+        ++leaf->count;
+        ++sz;
+        for (size_t d = 0; d < path.depth; ++d) {
+            ++path.nodes[d]->sizes[path.slots[d]];
+        }
+        settle(path, leaf, false);
+        if (leaf->count == LeafSlots) {
+            Leaf* right = splitLeaf(leaf);
+            splitUp(path, leaf, right, true);
+            if (targ >= leaf->count) {
+                targ -= leaf->count;
+                leaf = right;
+            }
+        }
+        return Iterator(leaf, targ);
+    }
+
+    /*
+        removeAt() erases the element at targ of leaf, then updates the counts
+        on the path and merges or refills any node which got too small.
+    */
+    void removeAt(Path& path, Leaf* leaf, size_t targ) {
+        std::move(leaf->keys + targ + 1, leaf->keys + leaf->count, leaf->keys + targ);
+        --leaf->count;
+        --sz;
+        for (size_t d = 0; d < path.depth; ++d) {
+            --path.nodes[d]->sizes[path.slots[d]];
+        }
+        settle(path, leaf, true);
+        /* Drop roots with a single child */
+        while (height > 0 && root->count == 1) {
+            Inner* top = static_cast<Inner*>(root);
+            root = top->children[0];
+            freeInner(top);
+            --height;
+        }
+    }
+
+    /*
+        settle() walks the path bottom-up from node, refreshing the max each
+        parent keeps of its child. With merge set, a child below a quarter full
+        is merged with or refilled from a sibling first. Neither changes the
+        contents under the parent, so the levels above only need their maxes,
+        and once a max is unchanged without merging, the walk stops. Maxes are
+        only copied when they change, which keeps heavy elements from being 
+        copied up the path on every insert.
+    */
+    void settle(Path& path, Node* node, bool merge) {
+        bool leaves = true;
+        for (size_t d = path.depth; d > 0; --d) {
+            Inner* parent = path.nodes[d - 1];
+            size_t slot = path.slots[d - 1];
+            size_t minimum = (leaves ? LeafSlots : InnerSlots) / 4;
+            if (merge && node->count < minimum) {
+                /* Pair the child with its right sibling, or its left if last */
+                size_t left = (slot + 1 < parent->count) ? slot : slot - 1;
+                merge = join(parent, left, leaves);
+            }
+            else {
+                const T& max = maxOf(node, leaves);
+                if (comp(max, parent->maxes[slot]) || comp(parent->maxes[slot], max)) {
+                    parent->maxes[slot] = max;
+                }
+                else if (!merge) {
+                    /* the maxes above are taken from this one, so they hold too */
+                    break;
+                }
+            }
+            node = parent;
+            leaves = false;
+        }
+    }
+
+    /*
+        join() evens out the children at left and left + 1 of parent, merging
+        them into the left one if they fit in a node together. It returns
+        whether parent lost a child.
+    */
+    bool join(Inner* parent, size_t left, bool leaves) {
+        Node* a = parent->children[left];
+        Node* b = parent->children[left + 1];
+        size_t total = a->count + b->count;
+        bool merged = total < (leaves ? LeafSlots : InnerSlots);
+        size_t target = merged ? total : total / 2;
+        SORTED_BUCKET_COUNT(merges, merged);
+        SORTED_BUCKET_COUNT(moved, a->count < target ? target - a->count
+                                                     : a->count - target);
+        if (leaves) {
+            shiftLeaves(static_cast<Leaf*>(a), static_cast<Leaf*>(b), target);
+        }
+        else {
+            shiftInners(static_cast<Inner*>(a), static_cast<Inner*>(b), target);
+        }
+        if (merged) {
+            if (leaves) {
+                unlinkLeaf(static_cast<Leaf*>(b));
+            }
+            else {
+                freeInner(static_cast<Inner*>(b));
+            }
+            std::move(parent->maxes + left + 2, parent->maxes + parent->count,
+                      parent->maxes + left + 1);
+            std::move(parent->sizes + left + 2, parent->sizes + parent->count,
+                      parent->sizes + left + 1);
+            std::move(parent->children + left + 2, parent->children + parent->count,
+                      parent->children + left + 1);
+            --parent->count;
+        }
+        else {
+            parent->maxes[left + 1] = maxOf(b, leaves);
+            parent->sizes[left + 1] = sizeOf(b, leaves);
+        }
+        parent->maxes[left] = maxOf(a, leaves);
+        parent->sizes[left] = sizeOf(a, leaves);
+        return merged;
+    }
+
+    /* shiftLeaves() moves elements between neighbours until a holds target */
+    static void shiftLeaves(Leaf* a, Leaf* b, size_t target) noexcept {
+        if (a->count < target) {
+            size_t moved = target - a->count;
+            std::move(b->keys, b->keys + moved, a->keys + a->count);
+            std::move(b->keys + moved, b->keys + b->count, b->keys);
+            a->count += moved;
+            b->count -= moved;
+        }
+        else if (a->count > target) {
+            size_t moved = a->count - target;
+            std::move_backward(b->keys, b->keys + b->count, b->keys + b->count + moved);
+            std::move(a->keys + target, a->keys + a->count, b->keys);
+            a->count -= moved;
+            b->count += moved;
+        }
+    }
+
+    /* shiftInners() moves children between neighbours until a holds target */
+    static void shiftInners(Inner* a, Inner* b, size_t target) noexcept {
+        if (a->count < target) {
+            size_t moved = target - a->count;
+            std::move(b->maxes, b->maxes + moved, a->maxes + a->count);
+            std::move(b->maxes + moved, b->maxes + b->count, b->maxes);
+            std::copy(b->sizes, b->sizes + moved, a->sizes + a->count);
+            std::copy(b->sizes + moved, b->sizes + b->count, b->sizes);
+            std::copy(b->children, b->children + moved, a->children + a->count);
+            std::copy(b->children + moved, b->children + b->count, b->children);
+            a->count += moved;
+            b->count -= moved;
+        }
+        else if (a->count > target) {
+            size_t moved = a->count - target;
+            std::move_backward(b->maxes, b->maxes + b->count, b->maxes + b->count + moved);
+            std::move(a->maxes + target, a->maxes + a->count, b->maxes);
+            std::copy_backward(b->sizes, b->sizes + b->count, b->sizes + b->count + moved);
+            std::copy(a->sizes + target, a->sizes + a->count, b->sizes);
+            std::copy_backward(b->children, b->children + b->count,
+                               b->children + b->count + moved);
+            std::copy(a->children + target, a->children + a->count, b->children);
+            a->count -= moved;
+            b->count += moved;
+        }
+    }
+
+    /* splitLeaf() moves the upper half of a full leaf into a new leaf after it */
+    Leaf* splitLeaf(Leaf* leaf) {
+        Leaf* right = newLeaf();
+        SORTED_BUCKET_COUNT(splits, 1);
+        SORTED_BUCKET_COUNT(moved, leaf->count - leaf->count / 2);
+        shiftLeaves(leaf, right, leaf->count / 2);
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) {
+            leaf->next->prev = right;
+        }
+        else {
+            tail = right;
+        }
+        leaf->next = right;
+        return right;
+    }
+
+    /*
+        splitUp() hangs right after left, which was just split, in the parent
+        at the end of the path, splitting full parents on the way up. A new
+        root is made if the root itself was split.
+    */
+    void splitUp(Path& path, Node* left, Node* right, bool leaves) {
+        for (size_t d = path.depth; ; --d) {
+            if (d == 0) {
+                Inner* top = newInner();
+                top->count = 2;
+                top->children[0] = left;
+                top->children[1] = right;
+                top->maxes[0] = maxOf(left, leaves);
+                top->maxes[1] = maxOf(right, leaves);
+                top->sizes[0] = sizeOf(left, leaves);
+                top->sizes[1] = sizeOf(right, leaves);
+                root = top;
+                ++height;
+                return;
+            }
+            Inner* parent = path.nodes[d - 1];
+            size_t slot = path.slots[d - 1];
+            std::move_backward(parent->maxes + slot + 1, parent->maxes + parent->count,
+                               parent->maxes + parent->count + 1);
+            std::copy_backward(parent->sizes + slot + 1, parent->sizes + parent->count,
+                               parent->sizes + parent->count + 1);
+            std::copy_backward(parent->children + slot + 1, parent->children + parent->count,
+                               parent->children + parent->count + 1);
+            ++parent->count;
+            parent->children[slot + 1] = right;
+            parent->maxes[slot] = maxOf(left, leaves);
+            parent->maxes[slot + 1] = maxOf(right, leaves);
+            parent->sizes[slot] = sizeOf(left, leaves);
+            parent->sizes[slot + 1] = sizeOf(right, leaves);
+            if (parent->count < InnerSlots) {
+                return;
+            }
+            Inner* sibling = newInner();
+            SORTED_BUCKET_COUNT(splits, 1);
+            SORTED_BUCKET_COUNT(moved, parent->count - parent->count / 2);
+            shiftInners(parent, sibling, parent->count / 2);
+            left = parent;
+            right = sibling;
+            leaves = false;
+        }
+    }
+
+    /*
+        appendSorted() and finishSorted() build the tree from sorted input in
+        O(n): leaves are packed three quarters full, left to right, and then
+        each level of inner nodes is built over the one below.
+    */
+    template <typename U>
+    void appendSorted(U&& n) {
+        static constexpr size_t fill = LeafSlots * 3 / 4;
+        if (tail->count == fill) {
+            Leaf* leaf = newLeaf();
+            leaf->prev = tail;
+            tail->next = leaf;
+            tail = leaf;
+        }
+        tail->keys[tail->count++] = std::forward<U>(n);
+        ++sz;
+    }
+
+    void finishSorted() {
+        /* Even out the last two leaves so the last one is not underfull */
+        if (tail->prev && tail->count < LeafSlots / 4) {
+            shiftLeaves(tail->prev, tail, (tail->prev->count + tail->count) / 2);
+        }
+        std::vector<Node*> level;
+        for (Leaf* leaf = head; leaf; leaf = leaf->next) {
+            level.emplace_back(leaf);
+        }
+        bool leaves = true;
+        while (level.size() > 1) {
+            /* Spread the children evenly, about three quarters full */
+            size_t groups = (level.size() + InnerSlots * 3 / 4 - 1) / (InnerSlots * 3 / 4);
+            std::vector<Node*> above;
+            above.reserve(groups);
+            size_t next = 0;
+            for (size_t g = 0; g < groups; ++g) {
+                size_t take = level.size() / groups + (g < level.size() % groups);
+                Inner* inner = newInner();
+                for (size_t c = 0; c < take; ++c, ++next) {
+                    inner->children[c] = level[next];
+                    inner->maxes[c] = maxOf(level[next], leaves);
+                    inner->sizes[c] = sizeOf(level[next], leaves);
+                }
+                inner->count = take;
+                above.emplace_back(inner);
+            }
+            level.swap(above);
+            leaves = false;
+            ++height;
+        }
+        root = level.front();
+    }
+
+    /*
+        relink() runs in O(n/B) time and builds the inner levels again after
+        split() or join() cut or spliced the leaf list. The leaf at seam and
+        the one after it are evened out or merged first, if either of them is
+        below a quarter full.
+    */
+    void relink(Leaf* seam) {
+        freeInners(root, height);
+        height = 0;
+        if (seam && seam->next &&
+            (seam->count < LeafSlots / 4 || seam->next->count < LeafSlots / 4)) {
+            Leaf* after = seam->next;
+            size_t total = seam->count + after->count;
+            if (total < LeafSlots) {
+                shiftLeaves(seam, after, total);
+                unlinkLeaf(after);
+            }
+            else {
+                shiftLeaves(seam, after, total / 2);
+            }
+        }
+        finishSorted();
+    }
+
+    /* maxOf() returns the largest element under a non-empty node */
+    static inline const T& maxOf(const Node* node, bool leaf) noexcept {
+        return leaf ? static_cast<const Leaf*>(node)->keys[node->count - 1]
+                    : static_cast<const Inner*>(node)->maxes[node->count - 1];
+    }
+
+    /* sizeOf() returns the number of elements under a node */
+    static inline size_t sizeOf(const Node* node, bool leaf) noexcept {
+        if (leaf) {
+            return node->count;
+        }
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t total = 0;
+        for (size_t c = 0; c < inner->count; ++c) {
+            total += inner->sizes[c];
+        }
+        return total;
+    }
+
+    inline Leaf* newLeaf() {
+        Leaf* leaf = std::allocator_traits<AllocLeaf>::allocate(allocLeaf, 1);
+        std::allocator_traits<AllocLeaf>::construct(allocLeaf, leaf);
+        return leaf;
+    }
+
+    inline Inner* newInner() {
+        Inner* inner = std::allocator_traits<AllocInner>::allocate(allocInner, 1);
+        std::allocator_traits<AllocInner>::construct(allocInner, inner);
+        return inner;
+    }
+
+    /* unlinkLeaf() takes an emptied leaf out of the leaf list and frees it */
+    inline void unlinkLeaf(Leaf* leaf) noexcept {
+        if (leaf->prev) {
+            leaf->prev->next = leaf->next;
+        }
+        else {
+            head = leaf->next;
+        }
+        if (leaf->next) {
+            leaf->next->prev = leaf->prev;
+        }
+        else {
+            tail = leaf->prev;
+        }
+        freeLeaf(leaf);
+    }
+
+    inline void freeLeaf(Leaf* leaf) noexcept {
+        std::allocator_traits<AllocLeaf>::destroy(allocLeaf, leaf);
+        std::allocator_traits<AllocLeaf>::deallocate(allocLeaf, leaf, 1);
+    }
+
+    inline void freeInner(Inner* inner) noexcept {
+        std::allocator_traits<AllocInner>::destroy(allocInner, inner);
+        std::allocator_traits<AllocInner>::deallocate(allocInner, inner, 1);
+    }
+
+    /*
+        release() frees every node. Allocators which can hand all of their 
+        memory back at once (SortedBucketPool) do so instead of taking the 
+        nodes back one by one, and then the nodes are only visited if T has
+        a destructor to run.
+    */
+    void release() noexcept {
+        if constexpr (requires (AllocLeaf& leaves, AllocInner& inners) {
+                          leaves.release();
+                          inners.release();
+                      }) {
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                destroy(root, height, false);
+            }
+            allocLeaf.release();
+            allocInner.release();
+        }
+        else {
+            destroy(root, height);
+        }
+        root = head = tail = nullptr;
+    }
+
+    /*  destroy() frees a subtree, levels above the leaves first. Unless 
+        dealloc is set, the nodes are only destroyed and the memory is left 
+        to the allocators to release in bulk */
+    void destroy(Node* node, size_t levels, bool dealloc = true) noexcept {
+        if (levels == 0) {
+            if (dealloc) {
+                freeLeaf(static_cast<Leaf*>(node));
+            }
+            else {
+                std::allocator_traits<AllocLeaf>::destroy(allocLeaf, static_cast<Leaf*>(node));
+            }
+            return;
+        }
+        Inner* inner = static_cast<Inner*>(node);
+        for (size_t c = 0; c < inner->count; ++c) {
+            destroy(inner->children[c], levels - 1, dealloc);
+        }
+        if (dealloc) {
+            freeInner(inner);
+        }
+        else {
+            std::allocator_traits<AllocInner>::destroy(allocInner, inner);
+        }
+    }
+
+    /* freeInners() frees the inner nodes of a subtree, but not its leaves */
+    void freeInners(Node* node, size_t levels) noexcept {
+        if (levels == 0) {
+            return;
+        }
+        Inner* inner = static_cast<Inner*>(node);
+        for (size_t c = 0; c < inner->count; ++c) {
+            freeInners(inner->children[c], levels - 1);
+        }
+        freeInner(inner);
+    }
+
+    /* countInners() returns the number of inner nodes of a subtree */
+    static size_t countInners(const Node* node, size_t levels) noexcept {
+        if (levels == 0) {
+            return 0;
+        }
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t ct = 1;
+        for (size_t c = 0; c < inner->count; ++c) {
+            ct += countInners(inner->children[c], levels - 1);
+        }
+        return ct;
+    }
+
+    // Private members
+    AllocLeaf                   allocLeaf;
+    AllocInner                  allocInner;
+    size_t                      sz              {0};
+    size_t                      height          {0};    // inner levels above the leaves
+    Node*                       root            {nullptr};
+    Leaf*                       head            {nullptr};
+    Leaf*                       tail            {nullptr};
+    [[no_unique_address]] StatsComp<Comp> comp;
+#ifdef SORTED_BUCKET_STATS
+    SortedBucketStats           counters;
+#endif
+};
+
+#endif // UTIL_SORTED_BUCKET_BT_H
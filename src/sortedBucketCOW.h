@@ -0,0 +1,775 @@
+/**
+ * @file sortedBucketCOW.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Copy-on-write Sorted Bucket container with O(1) frozen snapshots
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Laid out like SortedBucketVV, as sorted buckets with fences and a Fenwick
+ * tree over the bucket sizes, except that every bucket is reference counted
+ * and so is the directory holding the bucket pointers, fences and index. A
+ * Snapshot shares the directory, so taking one is O(1) however large the
+ * container is. Writes never change anything a Snapshot can see: the first
+ * write after a snapshot copies the directory (O(n/B) pointers), and a write
+ * to a bucket still shared copies that bucket (O(B)) before changing it.
+ * Splits and merges only ever build or change buckets the container owns.
+ *
+ * Copying the container is O(1) as well, since the copy shares everything
+ * until one of the two is written to.
+ *
+ * Time complexities, for buckets of B elements. B is DefaultCowDensity (512)
+ * and stays fixed as n grows, since COW has no auto density like VV and LL:
+ *      snapshot, copy:     O(1)
+ *      find:               O(log(n))
+ *      distance, rank:     O(log(n))
+ *      nth:                O(log(n/B))
+ *      countRange:         O(log(n))
+ *      insert, erase:      O(log(n) + B), plus the first write after a
+ *                          snapshot copying n/512 bucket pointers, fences and
+ *                          index entries, which is O(n)
+ *
+ * Threads: snapshot() has to be called on the writer's side, like any other
+ * member. The Snapshot it returns may then be read from any thread, for as
+ * long as needed, while the container keeps being written to. A bucket is
+ * changed in place only when the container holds its sole reference, and
+ * releasing a reference synchronizes with that check.
+ *
+ * Usage:
+ *      SortedBucketCOW<int> cow;
+ *      auto frozen = cow.snapshot();                           // O(1)
+ *      std::thread scan([frozen]() {
+ *          for (int v : frozen) { ... }                        // never changes
+ *      });
+ *      cow.insert(5);                                          // not seen by scan
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_COW_H
+#define UTIL_SORTED_BUCKET_COW_H
+
+/* The default bucket size */
+#define DefaultCowDensity (size_t(512))
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "sortedBucketCommon.h"
+
+//#define NDEBUG
+#ifndef NDEBUG
+#include <iostream>
+#include <string>
+#endif // ifndef NDEBUG
+
+template <typename T,
+          typename Comp     = std::less<T>,
+          typename Alloc    = std::allocator<T>>
+class SortedBucketCOW {
+    using Bucket = std::vector<T, Alloc>;
+
+    /*
+        The directory of a container: its buckets, which are never empty (bar
+        a single one in an empty container), the max of every bucket but the
+        last, and the Fenwick tree (1-indexed) over the bucket sizes. Shared
+        with every Snapshot taken since the last write.
+    */
+    struct Directory {
+        std::vector<std::shared_ptr<Bucket>>    buckets;
+        std::vector<size_t>                     bucketIndex;
+        std::vector<T>                          fences;
+        size_t                                  sz      {0};
+
+        void rebuildIndex() {
+            fences.clear();
+            for (size_t i = 0; i + 1 < buckets.size(); ++i) {
+                fences.emplace_back(buckets[i]->back());
+            }
+            bucketIndex.assign(buckets.size() + 1, 0);
+            for (size_t i = 1; i <= buckets.size(); ++i) {
+                bucketIndex[i] += buckets[i - 1]->size();
+                size_t par = i + (i & (0 - i));
+                if (par <= buckets.size()) {
+                    bucketIndex[par] += bucketIndex[i];
+                }
+            }
+        }
+
+        /* indexAdd() adds delta to the size recorded for bucket bucketDist */
+        inline void indexAdd(size_t bucketDist, int delta) noexcept {
+            for (size_t i = bucketDist + 1; i < bucketIndex.size(); i += i & (0 - i)) {
+                bucketIndex[i] += delta;
+            }
+        }
+
+        /* indexPrefix() returns the number of elements before bucket bucketDist */
+        inline size_t indexPrefix(size_t bucketDist) const noexcept {
+            size_t sum = 0;
+            for (size_t i = bucketDist; i > 0; i -= i & (0 - i)) {
+                sum += bucketIndex[i];
+            }
+            return sum;
+        }
+
+        /*  indexFind() returns the bucket holding sorted index idx, and reduces
+            idx to the offset inside that bucket. Requires idx < sz. */
+        inline size_t indexFind(size_t& idx) const noexcept {
+            size_t pos = 0;
+            for (size_t step = std::bit_floor(bucketIndex.size() - 1); step > 0; step >>= 1) {
+                if (pos + step < bucketIndex.size() && bucketIndex[pos + step] <= idx) {
+                    pos += step;
+                    idx -= bucketIndex[pos];
+                }
+            }
+            return pos;
+        }
+
+        /*  bound() returns the bucket and offset of the first element not below
+            n, or above n if Upper. The offset is the bucket size if there is
+            no such element in the last bucket */
+        template <bool Upper, typename Compare>
+        std::pair<size_t, size_t> bound(const T& n, const Compare& comp) const noexcept {
+            size_t b = 0;
+            if (buckets.size() > 1) {
+                b = searchSorted<Upper>(fences.data(), fences.data() + fences.size(), n, comp) -
+                    fences.data();
+            }
+            const T* first = buckets[b]->data();
+            const T* last = first + buckets[b]->size();
+            return std::make_pair(b, size_t(searchSorted<Upper>(first, last, n, comp) - first));
+        }
+    };
+
+public:
+    /*
+        Iterator walks the elements of one directory in sorted order, read
+        only, since changing an element in place would also change it for
+        every Snapshot sharing its bucket.
+    */
+    struct Iterator {
+        friend class SortedBucketCOW;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        /*  difference_type is included here for compliance with iterator_traits,
+            but distance should be calculated from SortedBucketCOW::distance() */
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = value_type const*;
+        using reference         = value_type const&;
+
+        Iterator() noexcept {}
+
+        inline reference operator *() const noexcept {
+            return elems[offset];
+        }
+
+        inline pointer operator ->() const noexcept {
+            return std::addressof(**this);
+        }
+
+        inline bool operator ==(const Iterator& other) const noexcept {
+            return bucket == other.bucket && offset == other.offset;
+        }
+
+        inline bool operator !=(const Iterator& other) const noexcept {
+            return !(*this == other);
+        }
+
+        /*  Pre-increment. Calling this on end() is UB, so requires checks like
+            in STL containers */
+        Iterator& operator ++() {
+            if (++offset == len) {
+                load(bucket + 1);
+                offset = 0;
+            }
+            return *this;
+        }
+
+        Iterator operator ++(int) {
+            Iterator temp = *this;
+            operator++();
+            return temp;
+        }
+
+        /*  Pre-decrement. Calling this on begin() is UB, so requires checks
+            like in STL containers */
+        Iterator& operator --() {
+            if (offset == 0) {
+                load(bucket - 1);
+                offset = len;
+            }
+            --offset;
+            return *this;
+        }
+
+        Iterator operator --(int) {
+            Iterator temp = *this;
+            operator--();
+            return temp;
+        }
+
+    private:
+        /*  An offset at the end of a bucket steps to the next bucket, so that
+            end() is one past the last bucket */
+        Iterator(const Directory* dir, size_t bucket, size_t offset) noexcept
+            : dir(dir)
+            , offset(offset) {
+            load(bucket);
+            if (offset == len && bucket < dir->buckets.size()) {
+                load(bucket + 1);
+                this->offset = 0;
+            }
+        }
+
+        /* load() moves to bucket b, keeping its elements at hand for stepping */
+        inline void load(size_t b) noexcept {
+            bucket = b;
+            if (b < dir->buckets.size()) {
+                elems = dir->buckets[b]->data();
+                len = dir->buckets[b]->size();
+            }
+            else {
+                elems = nullptr;
+                len = 0;
+            }
+        }
+
+        const Directory*    dir     {nullptr};
+        const T*            elems   {nullptr};
+        size_t              len     {0};
+        size_t              bucket  {0};
+        size_t              offset  {0};
+    };
+
+    /*
+        Snapshot is a frozen, read-only view of the container as it was when
+        snapshot() was called. It keeps what it sees alive by itself, so it
+        may outlive the container, and it can be copied freely in O(1).
+    */
+    class Snapshot {
+    public:
+        size_t size() const noexcept {
+            return dir->sz;
+        }
+
+        Iterator begin() const noexcept {
+            return Iterator(dir.get(), 0, 0);
+        }
+
+        Iterator end() const noexcept {
+            return Iterator(dir.get(), dir->buckets.size(), 0);
+        }
+
+        Iterator lowerBound(const T& n) const noexcept {
+            return boundIn<false>(*dir, n, comp);
+        }
+
+        Iterator upperBound(const T& n) const noexcept {
+            return boundIn<true>(*dir, n, comp);
+        }
+
+        Iterator find(const T& n) const noexcept {
+            return findIn(*dir, n, comp);
+        }
+
+        std::ptrdiff_t distance(const T& n) const noexcept {
+            return distanceIn(*dir, n, comp);
+        }
+
+        size_t rank(const T& n, bool inclusive = false) const noexcept {
+            return rankIn(*dir, n, inclusive, comp);
+        }
+
+        size_t countRange(const T& lo, const T& hi) const noexcept {
+            return comp(lo, hi) ? rank(hi) - rank(lo) : 0;
+        }
+
+        Iterator nth(size_t idx) const noexcept {
+            return nthIn(*dir, idx);
+        }
+
+    private:
+        friend class SortedBucketCOW;
+
+        Snapshot(std::shared_ptr<const Directory> dir, const StatsComp<Comp>& comp) noexcept
+            : dir(std::move(dir))
+            , comp(comp) {}
+
+        std::shared_ptr<const Directory>        dir;
+        [[no_unique_address]] StatsComp<Comp>   comp;
+    };
+
+    /* Default constructor */
+    SortedBucketCOW() {
+        init();
+    }
+
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucketCOW(const Comp& comp)
+        : comp(comp) {
+        init();
+    }
+
+    /*  Copy constructor. Runs in O(1) time: the copy shares the buckets until
+        either container is written to */
+    SortedBucketCOW(const SortedBucketCOW& old) = default;
+
+    /* Move constructor. Leaves old as a valid empty container */
+    SortedBucketCOW(SortedBucketCOW&& old) noexcept
+        : dir(std::move(old.dir))
+        , bucketDensity(old.bucketDensity)
+        , comp(old.comp) {
+        old.init();
+    }
+
+    SortedBucketCOW& operator =(const SortedBucketCOW& old) = default;
+
+    SortedBucketCOW& operator =(SortedBucketCOW&& old) noexcept {
+        if (this != &old) {
+            dir = std::move(old.dir);
+            bucketDensity = old.bucketDensity;
+            comp = old.comp;
+            old.init();
+        }
+        return *this;
+    }
+
+    /* Range constructor */
+    template <class InputIterator>
+    SortedBucketCOW(InputIterator beginIt, InputIterator endIt, const Comp& comp = Comp())
+        : comp(comp) {
+        init();
+        insertBatch(beginIt, endIt);
+    }
+
+    /*
+        Sorted range constructor. Input must already be sorted by Comp, so it
+        is sliced straight into full buckets in O(n) instead of being inserted.
+    */
+    template <class InputIterator>
+    SortedBucketCOW(SortedInputTag, InputIterator beginIt, InputIterator endIt,
+                    const Comp& comp = Comp())
+        : comp(comp) {
+        buildSorted(beginIt, endIt);
+    }
+
+    /* Size getter */
+    size_t size() const noexcept {
+        return dir->sz;
+    }
+
+    /* Density getter */
+    size_t getDensity() const noexcept {
+        return bucketDensity;
+    }
+
+    /* Comparator getter */
+    Comp getComp() const noexcept {
+        return comp;
+    }
+
+    /*
+        snapshot() runs in O(1) time and returns a frozen view of the current
+        contents, which later writes to the container do not change.
+    */
+    Snapshot snapshot() const noexcept {
+        return Snapshot(dir, comp);
+    }
+
+    /*  Begin and end getters. Like every Iterator of the container (but not
+        of a Snapshot), they are invalidated by any write */
+    Iterator begin() const noexcept {
+        return Iterator(dir.get(), 0, 0);
+    }
+
+    Iterator end() const noexcept {
+        return Iterator(dir.get(), dir->buckets.size(), 0);
+    }
+
+    /*
+        lowerBound() runs in O(log(n)) time and returns the first element not
+        below n.
+    */
+    Iterator lowerBound(const T& n) const noexcept {
+        return boundIn<false>(*dir, n, comp);
+    }
+
+    /*
+        upperBound() runs in O(log(n)) time and returns the first element above n.
+    */
+    Iterator upperBound(const T& n) const noexcept {
+        return boundIn<true>(*dir, n, comp);
+    }
+
+    /*
+        find() runs in O(log(n)) time and returns an Iterator to the first
+        instance of n, or end() if it is not present.
+    */
+    Iterator find(const T& n) const noexcept {
+        return findIn(*dir, n, comp);
+    }
+
+    /*
+        distance() runs in O(log(n)) time and returns the index of the first
+        instance of n, or -1 if it is not present.
+    */
+    std::ptrdiff_t distance(const T& n) const noexcept {
+        return distanceIn(*dir, n, comp);
+    }
+
+    /*
+        rank() runs in O(log(n)) time and returns the number of elements below
+        n, or with inclusive set, the number not above n.
+    */
+    size_t rank(const T& n, bool inclusive = false) const noexcept {
+        return rankIn(*dir, n, inclusive, comp);
+    }
+
+    /*
+        countRange() runs in O(log(n)) time and returns how many elements lie
+        in [lo, hi).
+    */
+    size_t countRange(const T& lo, const T& hi) const noexcept {
+        return comp(lo, hi) ? rank(hi) - rank(lo) : 0;
+    }
+
+    /*
+        nth() runs in O(log(n/B)) time and returns an Iterator to the element
+        at sorted index idx, or end() if idx is out of range.
+    */
+    Iterator nth(size_t idx) const noexcept {
+        return nthIn(*dir, idx);
+    }
+
+    /*
+        insert() runs in O(log(n) + B) time and returns an Iterator to the
+        inserted element, which goes after any equal ones. If the bucket it
+        lands in is shared with a Snapshot, the bucket is copied first.
+    */
+    Iterator insert(const T& n) {
+        return place(T(n));
+    }
+
+    Iterator insert(T&& n) {
+        return place(std::move(n));
+    }
+
+    /*
+        erase() runs in O(log(n) + B) time and erases a single instance of n.
+        It returns how many instances were erased (1 or 0).
+    */
+    int erase(const T& n) {
+        auto [b, offset] = dir->template bound<false>(n, comp);
+        const Bucket& found = *dir->buckets[b];
+        if (offset == found.size() || comp(n, found[offset])) {
+            return 0;
+        }
+        Directory& own = ownDirectory();
+        Bucket& bucket = ownBucket(b);
+        bool erasedMax = offset + 1 == bucket.size();
+        SORTED_BUCKET_COUNT(shifted, bucket.size() - offset - 1);
+        bucket.erase(std::next(bucket.begin(), offset));
+        own.indexAdd(b, -1);
+        --own.sz;
+        if (erasedMax && !bucket.empty() && b + 1 < own.buckets.size()) {
+            own.fences[b] = bucket.back();
+        }
+        if (bucket.size() < bucketDensity / 2) {
+            balance(b);
+        }
+        return 1;
+    }
+
+    /*
+        eraseAll() runs in O(k*(log(n) + B)) time for k instances of n, erases
+        all of them, and returns k.
+    */
+    size_t eraseAll(const T& n) {
+        size_t ct = 0;
+        while (erase(n)) {
+            ++ct;
+        }
+        return ct;
+    }
+
+    /* insertBatch() inserts every element of the range, one at a time */
+    template <class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            insert(*it);
+        }
+    }
+
+    /* eraseBatch() erases one instance per element of the range, and returns how many were */
+    template <class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        size_t ct = 0;
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            ct += erase(*it);
+        }
+        return ct;
+    }
+
+    /*
+        clear() runs in O(1) time for the container, which starts over on a
+        fresh directory. Buckets still held by a Snapshot stay alive with it.
+    */
+    void clear() {
+        init();
+    }
+
+    /*
+        stats() runs in O(n/B) time and returns the counters kept since
+        construction or resetStats() (see SortedBucketStats), where copied
+        counts the elements copied out of buckets shared with a Snapshot.
+        Also the bytes held by the directory and buckets, shared ones
+        included, and a histogram of the bucket sizes.
+    */
+    SortedBucketStats stats() const {
+        SortedBucketStats out;
+#ifdef SORTED_BUCKET_STATS
+        out = counters;
+#endif
+        out.bytes = sizeof(Directory) +
+            dir->buckets.capacity() * (sizeof(std::shared_ptr<Bucket>) + sizeof(Bucket)) +
+            dir->bucketIndex.capacity() * sizeof(size_t) + dir->fences.capacity() * sizeof(T);
+        for (const std::shared_ptr<Bucket>& bucket : dir->buckets) {
+            out.bytes += bucket->capacity() * sizeof(T);
+            out.countBucket(bucket->size());
+        }
+        return out;
+    }
+
+    /* resetStats() zeroes the counters, a no-op without SORTED_BUCKET_STATS */
+    void resetStats() noexcept {
+#ifdef SORTED_BUCKET_STATS
+        counters = SortedBucketStats();
+#endif
+    }
+
+#ifndef NDEBUG
+    /*
+        forceDensity() changes the bucket size and cuts the buckets again.
+        This is used to force balancing with few elements.
+    */
+    void forceDensity(size_t density) {
+        std::vector<T> all(begin(), end());
+        bucketDensity = std::max<size_t>(2, density);
+        buildSorted(all.begin(), all.end());
+    }
+
+    /*
+        Prints entire contents. For debugging
+    */
+    void print(const std::string& name = "SortedBucketCOW") const {
+        std::cout << "Printing " << name << std::endl;
+        std::cout << "    with size = " << dir->sz << " and density = " <<
+            bucketDensity << std::endl;
+        std::cout << "===========================================" << std::endl;
+        std::cout << "Total buckets " << dir->buckets.size() << std::endl;
+        for (size_t b = 0; b < dir->buckets.size(); ++b) {
+            std::cout << "bucket " << b << " shared by " << dir->buckets[b].use_count() <<
+                ": " << std::endl;
+            for (const T& n : *dir->buckets[b]) {
+                std::cout << "  " << n;
+            }
+            std::cout << std::endl;
+        }
+        std::cout << std::endl;
+    }
+#endif
+
+private:
+    /* init() starts the container over on a directory with one empty bucket */
+    void init() {
+        dir = std::make_shared<Directory>();
+        dir->buckets.emplace_back(newBucket());
+        dir->rebuildIndex();
+    }
+
+    inline std::shared_ptr<Bucket> newBucket() const {
+        std::shared_ptr<Bucket> bucket = std::make_shared<Bucket>();
+        bucket->reserve(2*bucketDensity + 4);
+        return bucket;
+    }
+
+    /*
+        buildSorted() runs in O(n) time and fills fresh buckets from sorted
+        input, bucketDensity elements at a time.
+    */
+    template <class InputIterator>
+    void buildSorted(InputIterator beginIt, InputIterator endIt) {
+        dir = std::make_shared<Directory>();
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            if (dir->buckets.empty() || dir->buckets.back()->size() == bucketDensity) {
+                dir->buckets.emplace_back(newBucket());
+            }
+            dir->buckets.back()->emplace_back(*it);
+            ++dir->sz;
+        }
+        if (dir->buckets.empty()) {
+            dir->buckets.emplace_back(newBucket());
+        }
+        dir->rebuildIndex();
+    }
+
+    /*
+        ownDirectory() returns the directory for writing, copying it first if
+        a Snapshot or a copy of the container shares it. The copy shares every
+        bucket with the old directory.
+    */
+    Directory& ownDirectory() {
+        if (dir.use_count() > 1) {
+            dir = std::make_shared<Directory>(*dir);
+        }
+        else {
+            /* pairs with the release of the last other reference */
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *dir;
+    }
+
+    /*
+        ownBucket() returns bucket b of an owned directory for writing, copying
+        it first if another directory shares it.
+    */
+    Bucket& ownBucket(size_t b) {
+        std::shared_ptr<Bucket>& bucket = dir->buckets[b];
+        if (bucket.use_count() > 1) {
+            SORTED_BUCKET_COUNT(copied, bucket->size());
+            std::shared_ptr<Bucket> copy = newBucket();
+            copy->assign(bucket->begin(), bucket->end());
+            bucket = std::move(copy);
+        }
+        else {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *bucket;
+    }
+
+    /* place() inserts n at upperBound(n) and splits its bucket if oversized */
+    Iterator place(T&& n) {
+        auto [b, offset] = dir->template bound<true>(n, comp);
+        Directory& own = ownDirectory();
+        Bucket& bucket = ownBucket(b);
+        SORTED_BUCKET_COUNT(shifted, bucket.size() - offset);
+        bucket.emplace(std::next(bucket.begin(), offset), std::move(n));
+        own.indexAdd(b, 1);
+        ++own.sz;
+        if (bucket.size() > 2*bucketDensity) {
+            balance(b);
+            if (offset >= bucketDensity) {
+                ++b;
+                offset -= bucketDensity;
+            }
+        }
+        return Iterator(&own, b, offset);
+    }
+
+    /*
+        balance() runs in O(B + n/B) time, on an owned directory and bucket b,
+        and splits the bucket in two if it holds over 2*B elements. If it holds
+        under B/2, it drops the bucket once empty, or else merges it with the
+        bucket after it or takes elements from it until both are even. The
+        last bucket is permitted to be undersized. Any change rebuilds the
+        index.
+    */
+    void balance(size_t b) {
+        std::vector<std::shared_ptr<Bucket>>& buckets = dir->buckets;
+        Bucket& bucket = *buckets[b];
+        if (bucket.size() > 2*bucketDensity) {
+            SORTED_BUCKET_COUNT(splits, 1);
+            SORTED_BUCKET_COUNT(moved, bucket.size() - bucketDensity);
+            std::shared_ptr<Bucket> piece = newBucket();
+            piece->insert(piece->end(),
+                          std::make_move_iterator(std::next(bucket.begin(), bucketDensity)),
+                          std::make_move_iterator(bucket.end()));
+            bucket.erase(std::next(bucket.begin(), bucketDensity), bucket.end());
+            buckets.emplace(std::next(buckets.begin(), b + 1), std::move(piece));
+        }
+        else if (bucket.empty() && buckets.size() > 1) {
+            SORTED_BUCKET_COUNT(merges, 1);
+            buckets.erase(std::next(buckets.begin(), b));
+        }
+        else if (bucket.size() < bucketDensity / 2 && b + 1 < buckets.size()) {
+            if (bucket.size() + buckets[b + 1]->size() > 2*bucketDensity) {
+                Bucket& next = ownBucket(b + 1);
+                size_t desired = (next.size() - bucket.size()) / 2;
+                SORTED_BUCKET_COUNT(moved, desired);
+                bucket.insert(bucket.end(), std::make_move_iterator(next.begin()),
+                              std::make_move_iterator(std::next(next.begin(), desired)));
+                next.erase(next.begin(), std::next(next.begin(), desired));
+            }
+            else {
+                /* The next bucket is only read, so a shared one is copied from */
+                const Bucket& next = *buckets[b + 1];
+                SORTED_BUCKET_COUNT(merges, 1);
+                SORTED_BUCKET_COUNT(moved, next.size());
+                bucket.insert(bucket.end(), next.begin(), next.end());
+                buckets.erase(std::next(buckets.begin(), b + 1));
+            }
+        }
+        else {
+            return;
+        }
+        dir->rebuildIndex();
+    }
+
+    /* Lookups shared by the container and its Snapshots */
+    template <bool Upper>
+    static Iterator boundIn(const Directory& d, const T& n, const StatsComp<Comp>& comp) noexcept {
+        auto [b, offset] = d.template bound<Upper>(n, comp);
+        return Iterator(&d, b, offset);
+    }
+
+    static Iterator findIn(const Directory& d, const T& n, const StatsComp<Comp>& comp) noexcept {
+        auto [b, offset] = d.template bound<false>(n, comp);
+        const Bucket& bucket = *d.buckets[b];
+        if (offset == bucket.size() || comp(n, bucket[offset])) {
+            return Iterator(&d, d.buckets.size(), 0);
+        }
+        return Iterator(&d, b, offset);
+    }
+
+    static std::ptrdiff_t distanceIn(const Directory& d, const T& n,
+                                     const StatsComp<Comp>& comp) noexcept {
+        auto [b, offset] = d.template bound<false>(n, comp);
+        const Bucket& bucket = *d.buckets[b];
+        if (offset == bucket.size() || comp(n, bucket[offset])) {
+            return -1;
+        }
+        return static_cast<std::ptrdiff_t>(d.indexPrefix(b) + offset);
+    }
+
+    static size_t rankIn(const Directory& d, const T& n, bool inclusive,
+                         const StatsComp<Comp>& comp) noexcept {
+        auto [b, offset] = inclusive ? d.template bound<true>(n, comp)
+                                     : d.template bound<false>(n, comp);
+        return d.indexPrefix(b) + offset;
+    }
+
+    static Iterator nthIn(const Directory& d, size_t idx) noexcept {
+        if (idx >= d.sz) {
+            return Iterator(&d, d.buckets.size(), 0);
+        }
+        size_t b = d.indexFind(idx);
+        return Iterator(&d, b, idx);
+    }
+
+    // Private members
+    std::shared_ptr<Directory>              dir;
+    size_t                                  bucketDensity   {DefaultCowDensity};
+    [[no_unique_address]] StatsComp<Comp>   comp;
+#ifdef SORTED_BUCKET_STATS
+    SortedBucketStats                       counters;
+#endif
+};
+
+#endif // UTIL_SORTED_BUCKET_COW_H
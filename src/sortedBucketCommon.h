@@ -0,0 +1,328 @@
+/**
+ * @file sortedBucketCommon.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Small pieces shared by every Sorted Bucket implementation
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Included by each of the container headers, so it never needs to be
+ * included directly.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_COMMON_H
+#define UTIL_SORTED_BUCKET_COMMON_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+    Tag for the constructors which take input that is already sorted by Comp.
+    They skip the search and rebalancing of insert() and build the container
+    in O(n) time. Passing unsorted input to them is UB.
+
+        SortedBucketVV<int> vv(SortedInput, sorted.begin(), sorted.end());
+*/
+struct SortedInputTag {
+    explicit SortedInputTag() = default;
+};
+inline constexpr SortedInputTag SortedInput {};
+
+/*
+    Parallel asks the bulk operations which take it to split their work over
+    up to threads threads, where 0 means std::thread::hardware_concurrency().
+    Work too small to be worth a thread runs on fewer, down to the calling
+    thread alone, so Parallel{1} is the serial version.
+
+        SortedBucketVV<int> vv(Parallel{}, keys.begin(), keys.end());
+*/
+struct Parallel {
+    size_t threads {0};
+};
+
+/* Fewest elements handed to a thread of a Parallel operation */
+#define ParallelGrain (size_t(1) << 15)
+
+/* parallelShards() returns how many threads to split work elements over */
+inline size_t parallelShards(const Parallel& par, size_t work) noexcept {
+    size_t threads = par.threads ? par.threads : std::thread::hardware_concurrency();
+    return std::clamp<size_t>(work / ParallelGrain, 1, std::max<size_t>(threads, 1));
+}
+
+/*
+    runShards() calls f(shard) for every shard in [0, shards), on shards - 1
+    new threads and the calling thread, and returns once all are done. Calls
+    for different shards must not touch the same data.
+*/
+template <typename F>
+void runShards(size_t shards, F&& f) {
+    std::vector<std::thread> workers;
+    workers.reserve(shards ? shards - 1 : 0);
+    for (size_t shard = 1; shard < shards; ++shard) {
+        workers.emplace_back([&f, shard]() { f(shard); });
+    }
+    if (shards > 0) {
+        f(size_t(0));
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+/*
+    Bucket footprint bounds for auto density, in bytes. The lower bound keeps
+    buckets of large T from shrinking to a handful of elements, where the per
+    bucket overhead dominates. The upper bound keeps a bucket within a typical
+    L2 cache, so that the shifting in insert() and erase() stays cheap.
+*/
+#define AutoDensityMinBytes (size_t(4096))
+#define AutoDensityMaxBytes (size_t(256 * 1024))
+
+/*
+    autoDensityFor() returns the bucket density used in auto density mode for
+    a container of n elements: sqrt(n), clamped so that a bucket spans between
+    AutoDensityMinBytes and AutoDensityMaxBytes.
+*/
+template <typename T>
+inline size_t autoDensityFor(size_t n) noexcept {
+    constexpr size_t lo = std::max<size_t>(16, AutoDensityMinBytes / sizeof(T));
+    constexpr size_t hi = std::max<size_t>(lo, AutoDensityMaxBytes / sizeof(T));
+    return std::clamp<size_t>(static_cast<size_t>(std::sqrt(n)), lo, hi);
+}
+
+/*
+    Building with SORTED_BUCKET_STATS defined (before the first container 
+    header) keeps counters of the structural work each container does, so
+    that latency drifting in production can be put down to rotations, bucket
+    splits, shifting and the like. Without it the counting compiles away, and
+    stats() only reports what it can work out on request: the heap bytes 
+    held and the bucket sizes. Each container fills in the fields which
+    apply to it and leaves the others at 0.
+*/
+struct SortedBucketStats {
+    size_t  bytes       {0};    // heap held by the container, bar what the elements own
+    size_t  rotations   {0};    // RBT rotations, a double rotation counting as two
+    size_t  redFixups   {0};    // RBT steps of fixing a double red after an insert
+    size_t  blackFixups {0};    // RBT steps of fixing a double black after an erase
+    size_t  splits      {0};    // buckets (or BT nodes) split for being oversized
+    size_t  merges      {0};    // buckets (or BT nodes) merged into a neighbour
+    size_t  shifted     {0};    // elements shifted inside a bucket by single inserts and erases
+    size_t  moved       {0};    // elements moved between buckets by balancing
+    size_t  copied      {0};    // elements copied out of buckets shared with a snapshot (COW)
+    /*  Bucket (or BT leaf) sizes, slot i counting those holding [2^i, 2^(i+1))
+        elements, and slot 0 the empty ones as well */
+    std::array<size_t, 32>  bucketSizes {};
+
+    /* countBucket() adds a bucket of size elements to the histogram */
+    inline void countBucket(size_t size) noexcept {
+        size_t slot = (size > 0) ? std::bit_width(size) - 1 : 0;
+        ++bucketSizes[std::min<size_t>(slot, bucketSizes.size() - 1)];
+    }
+};
+
+#ifdef SORTED_BUCKET_STATS
+/*  SORTED_BUCKET_COUNT() adds n to a field of the counters member, which only
+    exists in stats builds. Elsewhere n is not even evaluated */
+#define SORTED_BUCKET_COUNT(field, n) (counters.field += (n))
+
+/*  Comparisons made by the calling thread through any container. They are 
+    kept per thread rather than per container, since std::sort() and friends
+    work on copies of the comparator */
+inline thread_local size_t statsComparisons = 0;
+
+/*
+    CountedComp wraps the comparator of every container in stats builds, 
+    counting each call into statsComparisons and otherwise passing it on.
+*/
+template <typename Comp>
+struct CountedComp {
+    CountedComp() = default;
+
+    CountedComp(const Comp& base) 
+        : base(base) {}
+
+    operator const Comp&() const noexcept {
+        return base;
+    }
+
+    template <typename A, typename B>
+    inline bool operator ()(const A& a, const B& b) const {
+        ++statsComparisons;
+        return base(a, b);
+    }
+
+    [[no_unique_address]] Comp base {};
+};
+
+template <typename Comp>
+using StatsComp = CountedComp<Comp>;
+
+template <typename Comp>
+struct UnwrapComp {
+    using type = Comp;
+};
+
+template <typename Comp>
+struct UnwrapComp<CountedComp<Comp>> {
+    using type = Comp;
+};
+#else
+#define SORTED_BUCKET_COUNT(field, n) ((void)0)
+
+template <typename Comp>
+using StatsComp = Comp;
+
+template <typename Comp>
+struct UnwrapComp {
+    using type = Comp;
+};
+#endif // ifdef SORTED_BUCKET_STATS
+
+/*  sortedBucketComparisons() returns how many comparisons the calling thread 
+    has made through any container, always 0 without SORTED_BUCKET_STATS */
+inline size_t sortedBucketComparisons() noexcept {
+#ifdef SORTED_BUCKET_STATS
+    return statsComparisons;
+#else
+    return 0;
+#endif
+}
+
+/* noteComparisons() counts ct comparisons made without calling the comparator */
+inline void noteComparisons(size_t ct) noexcept {
+#ifdef SORTED_BUCKET_STATS
+    statsComparisons += ct;
+#else
+    (void)ct;
+#endif
+}
+
+/*
+    Lookups take keys of another type K than T when Comp is transparent (it
+    has is_transparent, like std::less<>), so that a std::string_view, say,
+    can be looked up among std::string without building a temporary T.
+*/
+template <typename K, typename T, typename Comp>
+concept LookupKey = std::is_same_v<K, T> || requires { typename Comp::is_transparent; };
+
+/*  Arithmetic keys ordered by std::less take the branchless path in 
+    searchSorted(), which counts searchWindow<T> elements (128 bytes) at the end.
+    A comparator wrapped for counting still takes it */
+template <typename T, typename Comp>
+inline constexpr bool branchlessSearch = 
+    std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+    (std::is_same_v<typename UnwrapComp<Comp>::type, std::less<T>> || 
+     std::is_same_v<typename UnwrapComp<Comp>::type, std::less<>>);
+
+template <typename T>
+inline constexpr size_t searchWindow = std::max<size_t>(8, 128 / sizeof(T));
+
+/*
+    searchSorted() runs in O(log(n)) time and returns the first element in the
+    sorted array [first, last) not below n, or the first element above n if 
+    Upper, as ordered by comp.
+    For arithmetic keys it bisects with conditional moves until a window of
+    searchWindow<T> elements is left, then counts the elements below n across 
+    the whole window. The count has a fixed trip count and no branches on 
+    the data, so the compiler turns it into SIMD compares for whatever the 
+    target supports (SSE2, AVX2, AVX-512, NEON). Other keys or comparators 
+    use std::lower_bound() and std::upper_bound().
+*/
+template <bool Upper, typename T, typename K, typename Comp>
+inline const T* searchSorted(const T* first, const T* last, const K& n, 
+                             const Comp& comp) noexcept {
+    if constexpr (branchlessSearch<T, Comp> && std::is_same_v<K, T>) {
+        constexpr size_t window = searchWindow<T>;
+        const T* base = first;
+        size_t len = last - first;
+        auto below = [&](const T& elem) { return Upper ? !(n < elem) : elem < n; };
+        size_t ct = 0;
+        if (len < window) {
+            for (size_t i = 0; i < len; ++i) {
+                ct += below(base[i]);
+            }
+            noteComparisons(len);
+            return first + ct;
+        }
+        while (len > window) {
+            size_t half = len / 2;
+            base = below(base[half]) ? base + half : base;
+            len -= half;
+            noteComparisons(1);
+        }
+        /*  Everything before base is below n, so the window can be slid 
+            left to keep its length fixed without changing the count */
+        base = std::min(base, last - window);
+        for (size_t i = 0; i < window; ++i) {
+            ct += below(base[i]);
+        }
+        noteComparisons(window);
+        return base + ct;
+    }
+    else if constexpr (Upper) {
+        return std::upper_bound(first, last, n,
+            [&comp](const K& n, const T& elem) { return comp(n, elem); });
+    }
+    else {
+        return std::lower_bound(first, last, n,
+            [&comp](const T& elem, const K& n) { return comp(elem, n); });
+    }
+}
+
+/*
+    Number of keys findMany() and distanceMany() search side by side. Each
+    round steps every key in the group one level down and prefetches where it
+    lands, so up to this many cache misses are in flight at once.
+*/
+#define BatchLookupLanes (size_t(16))
+
+/*
+    Footprint under which findMany() and distanceMany() search each key on its
+    own instead. A tree this small sits in a typical L2 cache, so there are no
+    misses to overlap and the interleaving only adds bookkeeping.
+*/
+#define BatchLookupMinBytes (size_t(2) << 20)
+
+/* prefetchRead() hints that the cache lines over [p, p + bytes) are read soon */
+inline void prefetchRead(const void* p, size_t bytes = 1) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    const char* line = static_cast<const char*>(p);
+    for (size_t offset = 0; offset < bytes; offset += 64) {
+        __builtin_prefetch(line + offset, 0, 3);
+    }
+#else
+    (void)p;
+    (void)bytes;
+#endif
+}
+
+#ifndef NDEBUG
+/* magic value for sentinel, otherwise uses T{} */
+#define SENTINEL_FLAG 0xBEEF
+#endif // ifndef NDEBUG
+
+/*
+    sentinelValue() returns the value stored in the end sentinel. Debug builds
+    use SENTINEL_FLAG so the sentinel stands out in print(), as long as T can
+    be built from it (std::string for one cannot), and T{} otherwise.
+*/
+template <typename T>
+inline T sentinelValue() {
+#ifndef NDEBUG
+    if constexpr (requires { T{SENTINEL_FLAG}; }) {
+        return T{SENTINEL_FLAG};
+    }
+#endif
+    return T{};
+}
+
+#endif // UTIL_SORTED_BUCKET_COMMON_H
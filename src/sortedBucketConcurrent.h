@@ -0,0 +1,187 @@
+/**
+ * @file sortedBucketConcurrent.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Left-right wrapper letting any Sorted Bucket container be read concurrently
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Keeps two replicas of the wrapped container. Readers always use the replica
+ * that no writer is touching, so reads never block, never retry, and scale
+ * with the number of cores while a writer is active. A write is applied to the
+ * idle replica, readers are switched over to it, and once every reader of the
+ * old replica has left, the same write is applied there too. Writers are
+ * serialized by a mutex.
+ *
+ * The cost is double the memory, and every write is done twice. Write
+ * callbacks must therefore do the same thing on both replicas (no moving from
+ * captured state, no randomness).
+ *
+ * An optimistic seqlock is not an option here: a reader racing a writer would
+ * walk buckets or nodes that are being reallocated, which can crash before any
+ * version check gets to reject the read. Per-bucket locks do not cover the
+ * bucket splits and merges in balance(), or the rotations in the RBT.
+ *
+ * Usage:
+ *      SortedBucketConcurrent<SortedBucketVV<int>> shared;
+ *      shared.insert(5);                                       // writer thread
+ *      auto dist = shared.read([](auto& vv) { return vv.distance(5); });
+ *
+ * Read callbacks get the container by reference since its lookups are not
+ * const, but they must only call lookups (find, distance, nth, iteration...).
+ * Iterators must not escape the callback.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_CONCURRENT_H
+#define UTIL_SORTED_BUCKET_CONCURRENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+/* Default number of reader counters per replica version, to spread contention */
+#define DefaultReadStripes (size_t(64))
+
+template <typename Container, size_t Stripes = DefaultReadStripes>
+class SortedBucketConcurrent {
+public:
+    static_assert(Stripes > 0, "need at least one reader stripe");
+
+    using value_type = typename Container::Iterator::value_type;
+
+    /* Default constructor */
+    SortedBucketConcurrent() {}
+
+    /* Construct both replicas from the same arguments */
+    template <typename... Args>
+    explicit SortedBucketConcurrent(std::in_place_t, const Args&... args)
+        : replicas{Container(args...), Container(args...)} {}
+
+    SortedBucketConcurrent(const SortedBucketConcurrent&) = delete;
+    SortedBucketConcurrent& operator =(const SortedBucketConcurrent&) = delete;
+
+    /*
+        read() runs the callback against the replica readers are currently on
+        and returns its result. It never waits on a writer: it only bumps a
+        reader counter before and after.
+    */
+    template <typename F>
+    decltype(auto) read(F&& f) const {
+        size_t version = versionIndex.load();
+        std::atomic<size_t>& arrived = readers[version][stripe()].count;
+        arrived.fetch_add(1);
+        /* Departs even if the callback throws */
+        struct Depart {
+            std::atomic<size_t>& arrived;
+            ~Depart() { arrived.fetch_sub(1); }
+        } depart{arrived};
+        return std::invoke(std::forward<F>(f), replicas[readIndex.load()]);
+    }
+
+    /*
+        write() applies the callback to both replicas, one at a time, and
+        returns the result of the second application. It waits for the
+        readers still on the old replica, so expect it to take as long as the
+        slowest read in flight.
+    */
+    template <typename F>
+    decltype(auto) write(F&& f) {
+        std::lock_guard<std::mutex> lock(writer);
+        size_t active = readIndex.load();
+        std::invoke(f, replicas[1 - active]);
+        readIndex.store(1 - active);
+        drain();
+        return std::invoke(f, replicas[active]);
+    }
+
+    /* Forwarding helpers for the common operations */
+    void insert(const value_type& n) {
+        write([&](Container& c) { c.insert(n); });
+    }
+
+    int erase(const value_type& n) {
+        return write([&](Container& c) { return c.erase(n); });
+    }
+
+    auto eraseAll(const value_type& n) {
+        return write([&](Container& c) { return c.eraseAll(n); });
+    }
+
+    template <class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        write([&](Container& c) { c.insertBatch(beginIt, endIt); });
+    }
+
+    template <class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        return write([&](Container& c) { return c.eraseBatch(beginIt, endIt); });
+    }
+
+    auto distance(const value_type& n) const {
+        return read([&](Container& c) { return c.distance(n); });
+    }
+
+    bool contains(const value_type& n) const {
+        return read([&](Container& c) { return c.find(n) != c.end(); });
+    }
+
+    size_t size() const {
+        return read([](Container& c) { return c.size(); });
+    }
+
+private:
+    /*  One counter per cache line so that readers on different stripes do
+        not contend */
+    struct alignas(64) Stripe {
+        std::atomic<size_t> count {0};
+    };
+
+    /* stripe() spreads threads over the reader counters */
+    static inline size_t stripe() noexcept {
+        static thread_local const size_t mine =
+            std::hash<std::thread::id>{}(std::this_thread::get_id()) % Stripes;
+        return mine;
+    }
+
+    /* empty() checks whether no reader is counted on a version */
+    inline bool empty(size_t version) const noexcept {
+        for (size_t i = 0; i < Stripes; ++i) {
+            if (readers[version][i].count.load() != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+        drain() waits until no reader can still be on the replica readers were
+        just moved off. Readers counted on either version might have read the
+        old readIndex, so this waits out both. The version is flipped in
+        between so new readers never keep a version from draining.
+    */
+    void drain() {
+        size_t prev = versionIndex.load();
+        size_t next = 1 - prev;
+        while (!empty(next)) {
+            std::this_thread::yield();
+        }
+        versionIndex.store(next);
+        while (!empty(prev)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Private members
+    mutable Container                   replicas[2];
+    mutable Stripe                      readers[2][Stripes];
+    std::atomic<size_t>                 readIndex       {0};
+    std::atomic<size_t>                 versionIndex    {0};
+    std::mutex                          writer;
+};
+
+#endif // UTIL_SORTED_BUCKET_CONCURRENT_H
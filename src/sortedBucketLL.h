@@ -2,20 +2,36 @@
  * @file sortedBucketLL.h
  * 
  * @author Gavin Dan (xfdan10@gmail.com)
- * @brief Implementation of Sorted Bucket container using std::list of lists
+ * @brief Implementation of Sorted Bucket container using std::list of vectors
  * @version 1.2
  * @date 2023-11-03
  * 
  * 
  * Container provides sub-linear time lookup, distance, insertion, deletion.
- * Expect worse performance than the vector of vectors implementation because
- * of garbage collection and worse cache performance.
+ * It is an unrolled linked list: each bucket is a contiguous chunk reserved
+ * up front for 2*density elements, so it never reallocates, and buckets are
+ * linked in a list. Compared to the vector of vectors implementation, 
+ * splitting or merging a bucket never shifts the other buckets, and bucket
+ * iterators stay valid, but finding a bucket walks the list.
  * 
  * Time complexities:
- *      find:       O(sqrt(n))
- *      distance:   O(sqrt(n))
- *      insert:     O(sqrt(n))
- *      erase:      O(sqrt(n))
+ *      find:               O(sqrt(n))
+ *      distance:           O(sqrt(n))
+ *      nth:                O(sqrt(n))
+ *      rank:               O(sqrt(n))
+ *      countRange:         O(sqrt(n))
+ *      insert:             O(sqrt(n))
+ *      erase:              O(sqrt(n))
+ *      batch of k:         O(k*log(k) + sqrt(n) + touched buckets)
+ *      split, join:        O(sqrt(n))
+ *      merge:              O(n + m)
+ *      build from sorted:  O(n)
+ *
+ * Bucket density is fixed unless auto density is turned on with 
+ * setAutoDensity(), in which case it follows the size of the container.
+ *
+ * Comp is stored, so it may carry state. If it is transparent, lookups and
+ * erases also take keys of any other type it compares against T.
  *
  * 
  */
@@ -30,15 +46,20 @@
 */
 #define DefaultSmallDensity (size_t(500))
 
+#include <algorithm>
 #include <cassert>
 #include <functional>
 #include <list>
+#include <iterator>
 #include <math.h>
+#include <memory>
+#include <span>
+#include <vector>
+#include "sortedBucketCommon.h"
+#include "sortedBucketSnapshot.h"
 
 //#define NDEBUG
 #ifndef NDEBUG
-/* magic value for sentinel, otherwise uses T{} */
-#define SENTINEL_FLAG 0xBEEF
 #include <iostream>
 #include <string>
 #endif // ifndef NDEBUG
@@ -47,6 +68,11 @@ template <typename T,
           typename Comp     = std::less<T>,
           typename Alloc    = std::allocator<T>>
 class SortedBucketLL {
+    /* A bucket, and iterators over the buckets and over one bucket */
+    using Bucket            = std::vector<T, Alloc>;
+    using BucketIterator    = typename std::list<Bucket>::iterator;
+    using ElementIterator   = typename Bucket::iterator;
+
 public:
     friend struct Iterator;
     struct Iterator {
@@ -64,8 +90,8 @@ public:
 
         Iterator() noexcept {}
 
-        Iterator(typename std::list<std::list<T>>::iterator targetBucket,
-                 typename std::list<T>::iterator targ) noexcept
+        Iterator(BucketIterator targetBucket,
+                 ElementIterator targ) noexcept
             : targetBucket(targetBucket)
             , targ(targ) {}
 
@@ -144,10 +170,8 @@ public:
         }
 
     private:
-        typename std::list<std::list<value_type>>::iterator     targetBucket
-            {typename std::list<std::list<value_type>>::iterator(nullptr)};
-        typename std::list<value_type>::iterator                targ
-            {typename std::list<value_type>::iterator           (nullptr)};
+        BucketIterator      targetBucket    {BucketIterator(nullptr)};
+        ElementIterator     targ;
     };
 
     /* Default constructor */
@@ -155,22 +179,43 @@ public:
         init();
     }
 
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucketLL(const Comp& comp) noexcept 
+        : comp(comp) {
+        init();
+    }
+
     /* Copy constructor */
-    explicit SortedBucketLL(const SortedBucketLL<T, Comp>& old) noexcept {
+    explicit SortedBucketLL(const SortedBucketLL& old) noexcept 
+        : comp(old.comp) {
         buckets = old.buckets;
         sz = old.sz;
         capacity = old.capacity;
         bucketDensity = old.bucketDensity;
+        autoDensity = old.autoDensity;
+        growAt = old.growAt;
+        shrinkAt = old.shrinkAt;
+        rebalanceCursor = old.rebalanceCursor;
         /* populate sentinel */
         init();
     }
 
     /* Move constructor */
-    explicit SortedBucketLL(SortedBucketLL<T, Comp>&& old) noexcept {
+    explicit SortedBucketLL(SortedBucketLL&& old) noexcept 
+        : comp(old.comp) {
         buckets.swap(old.buckets);
         sz = old.sz;
         capacity = old.capacity;
         bucketDensity = old.bucketDensity;
+        autoDensity = old.autoDensity;
+        growAt = old.growAt;
+        shrinkAt = old.shrinkAt;
+        rebalanceCursor = old.rebalanceCursor;
+        /* list swap keeps the bucket chunks, so old sentinel is still ours */
+        endSentinel = old.endSentinel;
+        /* leave old as a valid empty container */
+        old.sz = 0;
+        old.init();
     }
 
     /* Capacity constructor */
@@ -183,16 +228,32 @@ public:
 
     /* Range constructor */
     template<class InputIterator>
-    SortedBucketLL(InputIterator beginIt, InputIterator endIt, size_t cap = 25000) noexcept 
+    SortedBucketLL(InputIterator beginIt, InputIterator endIt, size_t cap = 25000,
+                   const Comp& comp = Comp()) noexcept 
         : capacity(cap)
         , bucketDensity(std::max(DefaultSmallDensity, 
-                                 static_cast<size_t>(std::sqrt(cap)))) {
+                                 static_cast<size_t>(std::sqrt(cap))))
+        , comp(comp) {
         init();
         for (InputIterator it = beginIt; it != endIt; ++it) {
             insert(*it);
         }
     }
     
+    /* 
+        Sorted range constructor. Input must already be sorted by Comp, so it is
+        sliced straight into full buckets in O(n) instead of being inserted.
+    */
+    template<class InputIterator>
+    SortedBucketLL(SortedInputTag, InputIterator beginIt, InputIterator endIt, 
+                   size_t cap = 25000, const Comp& comp = Comp()) noexcept 
+        : capacity(cap)
+        , bucketDensity(std::max(DefaultSmallDensity, 
+                                 static_cast<size_t>(std::sqrt(cap))))
+        , comp(comp) {
+        buildSorted(beginIt, endIt);
+    }
+    
     /* Default destructor */
     ~SortedBucketLL() noexcept {}
 
@@ -206,9 +267,38 @@ public:
         return bucketDensity;
     }
 
+    /* Comparator getter */
+    Comp getComp() const noexcept {
+        return comp;
+    }
+
+    /*
+        setAutoDensity() turns auto density on or off. In auto density mode the
+        density follows autoDensityFor<T>(size()), and is tuned again whenever
+        that would double or halve it. Instead of rebalancing everything at 
+        once, buckets are then re-split one per insert or erase, left to right,
+        on top of the bucket the operation touches anyway. Batch operations 
+        still rebalance everything in their single pass. changeCapacity() and
+        forceDensity() turn auto density off.
+    */
+    void setAutoDensity(bool enable) {
+        autoDensity = enable;
+        growAt = NoThreshold;
+        shrinkAt = 0;
+        rebalanceCursor = NoCursor;
+        if (enable) {
+            retune();
+        }
+    }
+
+    /* Auto density getter */
+    bool getAutoDensity() const noexcept {
+        return autoDensity;
+    }
+
     /* Begin getter */
     inline Iterator begin() noexcept {
-        typename std::list<std::list<T>>::iterator targetBucket = buckets.begin();
+        BucketIterator targetBucket = buckets.begin();
         return Iterator(targetBucket, targetBucket->begin());
     }
 
@@ -226,56 +316,54 @@ public:
     /*  Back element access. Calling back() on an empty SortedBucketLL will cause
         segfault, just like with other STL containers */
     inline T& back() noexcept {
-        return *std::prev(buckets.back().end());
+        return *std::prev(end());
     }
 
     /*
         changeCapacity() makes the container aware of the intended capacity 
-        and rebalances all buckets. Because this implementation uses list nodes,
-        it does not invalidate element iterators, but may invalidate target
-        iterators.
+        and rebalances all buckets. This potentially invalidates all element
+        iterators, but bucket iterators of buckets which are kept stay valid.
     */
     void changeCapacity(size_t cap) {
+        setAutoDensity(false);
         bucketDensity = std::max(DefaultSmallDensity,
                                 static_cast<size_t>(std::sqrt(cap)));
         if (sz > 0) {
-            typename std::list<std::list<T, Alloc>>::iterator b = buckets.begin();
-            while (b != buckets.end()) {
-                /*  Guaranteed no empty buckets if sz > 0, so track the first elem
-                    of each bucket. For list implementation, iterators remain 
-                    valid after balancing */
-                assert(!b->empty());
-                balance(b);
-                ++b;
-            }
+            balanceAll();
         }
     }
 
     /* 
         lowerBound() runs in O(sqrt(n)) time and returns the first iterator 
-        which satisfies: (element < n) or Comp{}(element, n) is false).
+        which satisfies: (element < n) or comp(element, n) is false).
     */
     Iterator lowerBound(const T& n) {
+        return lowerBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator lowerBound(const K& n) {
         /*  Sentinel is last item of last bucket, so need to exclude from search */
-        typename std::list<std::list<T>>::iterator targetBucket = buckets.begin();
-        typename std::list<std::list<T>>::iterator sentinelBucket = 
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
             std::prev(buckets.end());
         if (buckets.size() > 1) {
-            while (targetBucket != sentinelBucket && Comp{} (targetBucket->back(), n)) {
+            while (targetBucket != sentinelBucket && comp(targetBucket->back(), n)) {
                 ++targetBucket;
             }
-            if (Comp{} (targetBucket->back(), n)) {
+            if (comp(targetBucket->back(), n)) {
                 targetBucket = sentinelBucket;
             }
         }
         assert(targetBucket != buckets.end());
         // Find insertion point within targetBucket
-        typename std::list<T>::iterator targ = targetBucket->begin();
-        while (targ != targetBucket->end() &&
-               (targetBucket != sentinelBucket || targ != endSentinel) && 
-               Comp{} (*targ, n)) {
-            ++targ;
+        ElementIterator end = targetBucket->end();
+        if (targetBucket == sentinelBucket) {
+            /* Exclude sentinel from search */
+            --end;
         }
+        ElementIterator targ = 
+            std::lower_bound(targetBucket->begin(), end, n, comp);
         if (targ == targetBucket->end()) {
             /*  Point to beginning of next bucket rather than end of this bucket.
                 If targ was already the sentinel, we cannot arrive here. */
@@ -287,30 +375,36 @@ public:
 
     /* 
         upperBound() runs in O(sqrt(n)) time and returns the first iterator which
-        satisfies: (n < element) or Comp{}(n, element) is true).
+        satisfies: (n < element) or comp(n, element) is true).
     */
     Iterator upperBound(const T& n) {
+        return upperBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator upperBound(const K& n) {
         /*  Sentinel is last item of last bucket, so need to exclude from search */
-        typename std::list<std::list<T>>::iterator targetBucket = buckets.begin();
-        typename std::list<std::list<T>>::iterator sentinelBucket = 
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
             std::prev(buckets.end());
         if (buckets.size() > 1) {
             while (targetBucket != sentinelBucket && 
-                !Comp{} (n, targetBucket->back())) {
+                !comp(n, targetBucket->back())) {
                 ++targetBucket;
             }
-            if (!Comp{} (n, targetBucket->back())) {
+            if (!comp(n, targetBucket->back())) {
                 targetBucket = sentinelBucket;
             }
         }
         assert(targetBucket != buckets.end());
         // Find insertion point within targetBucket
-        typename std::list<T>::iterator targ = targetBucket->begin();
-        while (targ != targetBucket->end() && 
-               (targetBucket != sentinelBucket || targ != endSentinel) &&
-               !Comp{} (n, *targ)) {
-            ++targ;
+        ElementIterator end = targetBucket->end();
+        if (targetBucket == sentinelBucket) {
+            /* Exclude sentinel from search */
+            --end;
         }
+        ElementIterator targ = 
+            std::upper_bound(targetBucket->begin(), end, n, comp);
         if (targ == targetBucket->end()) {
             /*  Point to beginning of next bucket rather than end of this bucket.
                 If targ was already the sentinel, we cannot arrive here. */
@@ -325,6 +419,11 @@ public:
         instance of n.
     */
     Iterator find(const T& n) {
+        return find<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator find(const K& n) {
         return findWithDistance(n).first;
     }
     
@@ -334,9 +433,84 @@ public:
         If n is not present then it returns -1.
     */
     int distance(const T& n) {
+        return distance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int distance(const K& n) {
         return findWithDistance(n).second;
     }
 
+    /*
+        findMany() runs in O(k*sqrt(n)) time and sets out[i] to find(keys[i])
+        for each of the k keys. The other containers interleave the searches of
+        a batch, but here each search is a walk down the bucket list, so the
+        keys are simply searched one by one. out must hold at least k Iterators.
+    */
+    void findMany(std::span<const T> keys, std::span<Iterator> out) noexcept {
+        assert(out.size() >= keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            out[i] = findWithDistance(keys[i]).first;
+        }
+    }
+
+    /*
+        distanceMany() runs in O(k*sqrt(n)) time and sets out[i] to 
+        distance(keys[i]) for each of the k keys. out must hold at least k 
+        distances.
+    */
+    void distanceMany(std::span<const T> keys, std::span<int> out) noexcept {
+        assert(out.size() >= keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            out[i] = findWithDistance(keys[i]).second;
+        }
+    }
+
+    /*
+        countRange() runs in O(sqrt(n)) time and returns how many elements lie 
+        in [lo, hi). Neither lo nor hi has to be present.
+    */
+    size_t countRange(const T& lo, const T& hi) noexcept {
+        return countRange<T>(lo, hi);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t countRange(const K& lo, const K& hi) noexcept {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /*
+        nth() runs in O(sqrt(n)) time and returns an Iterator to the element at 
+        sorted index idx (0-indexed), making it the inverse of distance(). Whole
+        buckets are skipped by their size. If idx is out of range, returns the
+        end() Iterator.
+    */
+    Iterator nth(size_t idx) noexcept {
+        if (idx >= sz) {
+            return end();
+        }
+        /*  idx < sz guarantees we stop before reaching the sentinel */
+        BucketIterator targetBucket = buckets.begin();
+        while (idx >= targetBucket->size()) {
+            idx -= targetBucket->size();
+            ++targetBucket;
+        }
+        return Iterator(targetBucket, std::next(targetBucket->begin(), idx));
+    }
+
+    /*
+        at() runs in O(sqrt(n)) time and returns the element at sorted index idx.
+        Calling at() with an out of range idx is UB, so requires checks like
+        in STL containers.
+    */
+    inline T& at(size_t idx) noexcept {
+        assert(idx < sz);
+        return *nth(idx);
+    }
+
     /*
         findWithDistance() runs in O(sqrt(n)) time and returns a pair of: an 
         Iterator to the element, along with the index of its first occurrence. 
@@ -344,63 +518,93 @@ public:
         and a distance of -1.
     */
     std::pair<Iterator, int> findWithDistance(const T& n) noexcept {
-        /*  Sentinel is last item of last bucket, so need to exclude from search */
-        int dist = 0;
-        typename std::list<std::list<T>>::iterator targetBucket = buckets.begin();
-        typename std::list<std::list<T>>::iterator sentinelBucket = 
-            std::prev(buckets.end());
-        if (buckets.size() > 1) {
-            while (targetBucket != sentinelBucket && Comp{} (targetBucket->back(), n)) {
-                dist += targetBucket->size();
-                ++targetBucket;
-            }
-            if (Comp{} (targetBucket->back(), n)) {
-                targetBucket = sentinelBucket;
-            }
-        }
-        assert(targetBucket != buckets.end());
-        // Find insertion point within targetBucket
-        typename std::list<T>::iterator targ = targetBucket->begin();
-        while (targ != targetBucket->end() &&
-               (targetBucket != sentinelBucket || targ != endSentinel) && 
-               Comp{} (*targ, n)) {
-            ++dist;
-            ++targ;
-        }
-        if (targ == targetBucket->end()) {
-            /*  Point to beginning of next bucket rather than end of this bucket.
-                If targ was already the sentinel, we cannot arrive here. */
-            ++targetBucket;
-            targ = targetBucket->begin();
-        }
-        return ((targetBucket == sentinelBucket && targ == endSentinel) || 
-            *targ != n)
+        return findWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, int> findWithDistance(const K& n) noexcept {
+        auto [it, dist] = boundWithDistance<false>(n);
+        return (dist == sz || comp(n, *it))
             ? std::make_pair(this->end(), -1)
-            : std::make_pair(Iterator(targetBucket, targ), dist);
+            : std::make_pair(it, static_cast<int>(dist));
+    }
+
+    /*
+        lowerBoundWithDistance() runs in O(sqrt(n)) time and returns a pair of:
+        lowerBound(n), along with its index. Unlike findWithDistance(), n does 
+        not have to be present, in which case the index is the number of 
+        elements below n (and size() if there are none above).
+    */
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const T& n) noexcept {
+        return lowerBoundWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const K& n) noexcept {
+        return boundWithDistance<false>(n);
+    }
+
+    /*
+        rank() runs in O(sqrt(n)) time and returns the number of elements below
+        n, or with inclusive set, the number not above n. n does not have to 
+        be present.
+    */
+    size_t rank(const T& n, bool inclusive = false) noexcept {
+        return rank<T>(n, inclusive);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t rank(const K& n, bool inclusive = false) noexcept {
+        return inclusive ? boundWithDistance<true>(n).second 
+                         : boundWithDistance<false>(n).second;
     }
 
     /* 
         insert() runs in O(sqrt(n)). It preserves stable sorting order (by
         calling upperBound()) and returns an iterator to the inserted element.
+        An element not below back() goes straight in front of the sentinel 
+        without walking the buckets, so ascending streams append in amortized
+        O(1) time.
     */
     Iterator insert(const T& n) {
-        auto [targetBucket, targ] = upperBound(n);
-        targetBucket->emplace(targ, n);
-        --targ; // so we point to newly inserted element. Only for LL, not VV
-        typename std::list<std::list<T>>::iterator outBucket = 
-            balance(targetBucket, targ, true) ? std::next(targetBucket) : targetBucket;
-        ++sz;
-        return Iterator(outBucket, targ);
+        return emplaceNear(end(), n);
     }
 
     Iterator insert(T&& n) {
-        auto [targetBucket, targ] = upperBound(n);
-        targetBucket->emplace(targ, std::forward<T>(n));
-        --targ; // so we point to newly inserted element. Only for LL, not VV
-        typename std::list<std::list<T>>::iterator outBucket = 
-            balance(targetBucket, targ, true) ? std::next(targetBucket) : targetBucket;
-        ++sz;
-        return Iterator(outBucket, targ);
+        return emplaceNear(end(), std::move(n));
+    }
+
+    /*
+        insert() with a hint runs in amortized O(1) time plus the shift inside
+        the bucket if n belongs right before hint, in which case it goes there
+        without walking the buckets, like in std::multiset. Otherwise the hint
+        is ignored and this is insert(n). The hint must be a valid Iterator.
+    */
+    Iterator insert(Iterator hint, const T& n) {
+        return emplaceNear(hint, n);
+    }
+
+    Iterator insert(Iterator hint, T&& n) {
+        return emplaceNear(hint, std::move(n));
+    }
+
+    /*
+        emplace() runs in O(sqrt(n)) time and inserts T(args...). The position 
+        depends on the element, so it is built first and then moved into its
+        bucket, never copied.
+    */
+    template <typename... Args>
+    Iterator emplace(Args&&... args) {
+        return insert(T(std::forward<Args>(args)...));
+    }
+
+    /*
+        emplace_hint() is insert(hint, n) with T(args...) as n, for code 
+        written against std::multiset.
+    */
+    template <typename... Args>
+    Iterator emplace_hint(Iterator hint, Args&&... args) {
+        return insert(hint, T(std::forward<Args>(args)...));
     }
 
     /*
@@ -408,10 +612,17 @@ public:
         It returns how many instances of the element were erased (1 or 0)
     */
     int erase(const T& n) {
+        return erase<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int erase(const K& n) {
+        adapt();
         auto [targetBucket, targ] = find(n);
         if (targetBucket == std::prev(buckets.end()) && targ == endSentinel) {
             return 0;
         }
+        SORTED_BUCKET_COUNT(shifted, std::distance(targ, targetBucket->end()) - 1);
         targetBucket->erase(targ);
         balance(targetBucket);
         --sz;
@@ -423,6 +634,12 @@ public:
         of the element. It returns how many instances of the element were erased.
     */
     int eraseAll(const T& n) {
+        return eraseAll<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int eraseAll(const K& n) {
+        adapt();
         auto [targetBucket, targ] = find(n);
         if (targetBucket == std::prev(buckets.end()) && targ == endSentinel) {
             return 0;
@@ -430,22 +647,392 @@ public:
         // targ guaranteed to not point to end of targetBucket if valid targetBucket.
         assert(targ != targetBucket->end());
         int ct = 0;
-        typename std::list<std::list<T>>::iterator thisBucket = targetBucket;
-        typename std::list<std::list<T>>::iterator sentinelBucket = 
+        BucketIterator thisBucket = targetBucket;
+        BucketIterator sentinelBucket = 
             std::prev(buckets.end());
-        while ((thisBucket != sentinelBucket || targ != endSentinel) && *targ == n) {
-            ++ct;
-            targ = thisBucket->erase(targ);
-            // now targ points right after erased element
-            if (targ == thisBucket->end()) {
-                targ = (++thisBucket)->begin();
+        while (true) {
+            /*  Erase the run of n in each bucket at once, so that the rest of
+                the chunk only shifts down once */
+            ElementIterator stop = 
+                (thisBucket == sentinelBucket) ? endSentinel : thisBucket->end();
+            ElementIterator last = 
+                std::find_if(targ, stop, [this, &n](const T& element) { return comp(n, element); });
+            ct += std::distance(targ, last);
+            SORTED_BUCKET_COUNT(shifted, std::distance(last, thisBucket->end()));
+            targ = thisBucket->erase(targ, last);
+            endSentinel = std::prev(buckets.back().end());
+            // now targ points right after erased elements
+            if (targ != thisBucket->end()) {
+                break;
             }
+            targ = (++thisBucket)->begin();
+        }
+        sz -= ct;
+        /*  Balance the rightmost touched bucket first. Balancing may erase 
+            the bucket it is given, and balancing targetBucket first could
+            merge it away. Any emptied buckets between the two are removed 
+            when targetBucket is balanced. */
+        if (thisBucket != targetBucket) {
+            balance(thisBucket);
         }
         balance(targetBucket);
-        balance(thisBucket);
+        return ct;
+    }
+
+    /*
+        insertBatch() runs in O(k*log(k) + sqrt(n) + m) time for a batch of k 
+        elements, where m is the total size of the buckets the batch lands in.
+        The batch is sorted and merged into each of those buckets in one pass, 
+        and then every bucket is balanced once. Equal elements end up in the 
+        same order as from repeated insert() calls. This invalidates all 
+        element iterators.
+    */
+    template<class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        if (batch.empty()) {
+            return;
+        }
+        std::stable_sort(batch.begin(), batch.end(), comp);
+        typename std::vector<T>::iterator next = batch.begin();
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
+            std::prev(buckets.end());
+        while (next != batch.end()) {
+            /*  Same bucket search as upperBound(), resumed from the last bucket
+                touched since the batch is sorted */
+            while (targetBucket != sentinelBucket && 
+                   !comp(*next, targetBucket->back())) {
+                ++targetBucket;
+            }
+            /*  Everything below the bucket max goes here. The sentinel bucket
+                takes the rest, merged in front of the sentinel */
+            typename std::vector<T>::iterator last = batch.end();
+            size_t mid = targetBucket->size();
+            if (targetBucket != sentinelBucket) {
+                last = std::lower_bound(next, batch.end(), targetBucket->back(), comp);
+            }
+            else {
+                --mid;
+            }
+            size_t ct = std::distance(next, last);
+            targetBucket->insert(std::next(targetBucket->begin(), mid), 
+                                 std::make_move_iterator(next), 
+                                 std::make_move_iterator(last));
+            /*  inplace_merge() is stable and keeps the bucket's own elements 
+                ahead of equal ones from the batch, just like upperBound() */
+            std::inplace_merge(targetBucket->begin(), 
+                               std::next(targetBucket->begin(), mid),
+                               std::next(targetBucket->begin(), mid + ct), comp);
+            sz += ct;
+            next = last;
+            if (targetBucket != sentinelBucket) {
+                ++targetBucket;
+            }
+        }
+        endSentinel = std::prev(buckets.back().end());
+        if (autoDensity) {
+            retune();
+        }
+        balanceAll();
+        rebalanceCursor = NoCursor;
+    }
+
+    /*
+        eraseBatch() runs in O(k*log(k) + sqrt(n) + m) time for a batch of k 
+        elements, where m is the total size of the buckets the batch lands in.
+        It erases a single instance for each element of the batch (so a value 
+        given twice erases two instances), walking each touched bucket once 
+        and balancing every bucket after. It returns how many elements were 
+        erased.
+    */
+    template<class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        if (batch.empty()) {
+            return 0;
+        }
+        std::sort(batch.begin(), batch.end(), comp);
+        size_t ct = 0;
+        typename std::vector<T>::iterator next = batch.begin();
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
+            std::prev(buckets.end());
+        while (next != batch.end()) {
+            /*  Same bucket search as lowerBound(), resumed from the last bucket
+                touched since the batch is sorted */
+            while (targetBucket != sentinelBucket && 
+                   comp(targetBucket->back(), *next)) {
+                ++targetBucket;
+            }
+            ElementIterator stop = 
+                (targetBucket == sentinelBucket) ? endSentinel : targetBucket->end();
+            ElementIterator targ = 
+                std::lower_bound(targetBucket->begin(), stop, *next, comp);
+            /*  Walk the bucket and the batch together. Matched elements are 
+                dropped and the survivors are moved down over them */
+            ElementIterator kept = targ;
+            while (targ != stop && next != batch.end()) {
+                if (comp(*next, *targ)) {
+                    ++next;
+                }
+                else if (comp(*targ, *next)) {
+                    if (kept != targ) {
+                        *kept = std::move(*targ);
+                    }
+                    ++kept;
+                    ++targ;
+                }
+                else {
+                    ++targ;
+                    ++next;
+                }
+            }
+            kept = (kept != targ) ? std::move(targ, stop, kept) : stop;
+            ct += std::distance(kept, stop);
+            targetBucket->erase(kept, stop);
+            if (targetBucket == sentinelBucket) {
+                break;
+            }
+            ++targetBucket;
+        }
         sz -= ct;
+        endSentinel = std::prev(buckets.back().end());
+        if (autoDensity) {
+            retune();
+        }
+        balanceAll();
+        rebalanceCursor = NoCursor;
         return ct;
     }
+
+    /*
+        clear() runs in O(sqrt(n)) time and erases every element. The first
+        bucket keeps its chunk for the next inserts, and the other buckets 
+        hand theirs back, so that a reset never costs more than one free per
+        bucket (and no destructor calls if T is trivially destructible). This
+        invalidates all iterators.
+    */
+    void clear() {
+        buckets.resize(1);
+        buckets.front().clear();
+        appendSentinel();
+        sz = 0;
+        rebalanceCursor = NoCursor;
+        if (autoDensity) {
+            retune();
+        }
+        init();
+    }
+
+    /*
+        split() runs in O(sqrt(n)) time and moves every element not below key
+        into the returned container, keeping the ones below it. Whole buckets
+        are spliced over as they are, so only the bucket holding the cut has
+        elements moved. The new container takes the density settings of this
+        one. This invalidates end(), and Iterators to moved elements now 
+        belong to the returned container.
+    */
+    SortedBucketLL split(const T& key) {
+        SortedBucketLL out(comp);
+        out.capacity = capacity;
+        out.bucketDensity = bucketDensity;
+        out.autoDensity = autoDensity;
+        auto [cut, pos] = lowerBoundWithDistance(key);
+        BucketIterator from = cut.targetBucket;
+        out.buckets.clear();
+        if (cut.targ != from->begin()) {
+            out.buckets.emplace_back(std::vector<T, Alloc>());
+            out.buckets.back().reserve(2*bucketDensity + 4);
+            out.buckets.back().insert(out.buckets.back().end(),
+                                      std::make_move_iterator(cut.targ),
+                                      std::make_move_iterator(from->end()));
+            from->erase(cut.targ, from->end());
+            ++from;
+        }
+        /* the sentinel goes along with the last bucket */
+        out.buckets.splice(out.buckets.end(), buckets, from, buckets.end());
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        out.sz = sz - pos;
+        sz = pos;
+        settle();
+        out.settle();
+        return SortedBucketLL(std::move(out));
+    }
+
+    /*
+        join() runs in O(sqrt(n + m)) time and moves all of other onto the end
+        of this container, leaving other empty. Every element of other must
+        be at least back(), otherwise nothing is moved and false is returned.
+        The bucket list of other is spliced on whole, so no element is moved
+        unless the bucket at the seam is undersized, or other has another 
+        density. This invalidates end() of both containers.
+    */
+    bool join(SortedBucketLL& other) {
+        if (&other == this || other.sz == 0) {
+            return true;
+        }
+        if (sz > 0 && comp(other.front(), back())) {
+            return false;
+        }
+        buckets.back().pop_back();
+        if (buckets.back().empty()) {
+            buckets.pop_back();
+        }
+        buckets.splice(buckets.end(), other.buckets);
+        sz += other.sz;
+        other.sz = 0;
+        other.settle();
+        settle();
+        return true;
+    }
+
+    /*
+        merge() runs in O(n + m) time and moves all of other into this
+        container, leaving other empty. Both are merged into one sorted run
+        which is then cut into full buckets like the SortedInput constructor.
+        This invalidates all iterators of both containers.
+    */
+    void merge(SortedBucketLL& other) {
+        if (&other == this || other.sz == 0) {
+            return;
+        }
+        std::vector<T> merged;
+        merged.reserve(sz + other.sz);
+        Iterator mine = begin(), theirs = other.begin();
+        Iterator mineEnd = end(), theirsEnd = other.end();
+        while (mine != mineEnd || theirs != theirsEnd) {
+            /* equal elements keep ours first */
+            bool ours = theirs == theirsEnd || (mine != mineEnd && !comp(*theirs, *mine));
+            merged.emplace_back(std::move(ours ? *mine++ : *theirs++));
+        }
+        if (autoDensity) {
+            /* tune for the merged size first so the buckets are cut only once */
+            sz = merged.size();
+            retune();
+        }
+        sz = 0;
+        buildSorted(std::make_move_iterator(merged.begin()),
+                    std::make_move_iterator(merged.end()));
+        rebalanceCursor = NoCursor;
+        other.clear();
+    }
+
+    /*
+        save() runs in O(n) time and writes a flat snapshot of the container
+        to path (see sortedBucketSnapshot.h), with the bucket sizes as runs
+        and each bucket written out whole. Returns whether it succeeded.
+    */
+    bool save(const char* path) const requires std::is_trivially_copyable_v<T> {
+        SnapshotFile file(path, "wb");
+        /* the sentinel is left out of the last bucket, and so are emptied buckets */
+        auto runOf = [this](auto b) {
+            return b->size() - (std::next(b) == buckets.end());
+        };
+        size_t runs = 0;
+        for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+            runs += (runOf(b) > 0);
+        }
+        SnapshotHeader header(sizeof(T), SnapshotFlat, sz, runs, bucketDensity);
+        file.write(&header, sizeof header);
+        for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+            uint64_t run = runOf(b);
+            if (run > 0) {
+                file.write(&run, sizeof run);
+            }
+        }
+        file.pad(header.elemOffset());
+        for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+            file.write(b->data(), runOf(b) * sizeof(T));
+        }
+        return file.close();
+    }
+
+    /*
+        load() runs in O(n) time and replaces the contents with the flat
+        snapshot at path, reading each bucket straight into place. If the
+        snapshot has bucket sizes they are kept along with its density, and
+        otherwise the elements are cut into buckets of the current density.
+        Returns whether it succeeded, leaving the container empty if not.
+        This invalidates all iterators.
+    */
+    bool load(const char* path) requires std::is_trivially_copyable_v<T> {
+        buckets.clear();
+        sz = 0;
+        SnapshotFile file(path, "rb");
+        SnapshotHeader header;
+        file.read(&header, sizeof header);
+        bool good = file && header.valid<T>() && header.fits<T>(file.length()) &&
+                    header.layout == SnapshotFlat;
+        std::vector<uint64_t> runs(good ? header.runs : 0);
+        file.read(runs.data(), runs.size() * sizeof(uint64_t));
+        size_t total = 0;
+        for (uint64_t run : runs) {
+            /* every bucket holds at least one element, and no more than are left */
+            good = good && run > 0 && run <= header.count - total;
+            total += good ? run : 0;
+        }
+        good = good && file && (runs.empty() || total == header.count);
+        if (good && !runs.empty()) {
+            bucketDensity = std::max<size_t>(1, header.density);
+        }
+        file.skip(header.elemOffset());
+        for (size_t b = 0, placed = 0; good && placed < header.count; ++b) {
+            size_t run = runs.empty() ? std::min<size_t>(bucketDensity, header.count - placed)
+                                      : runs[b];
+            buckets.emplace_back(std::vector<T, Alloc>());
+            buckets.back().reserve(std::max<size_t>(2*bucketDensity + 4, run + 1));
+            buckets.back().resize(run);
+            file.read(buckets.back().data(), run * sizeof(T));
+            good = bool(file);
+            placed += run;
+        }
+        if (good) {
+            sz = header.count;
+        }
+        else {
+            buckets.clear();
+        }
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        init();
+        rebalanceCursor = NoCursor;
+        if (autoDensity) {
+            retune();
+        }
+        return good;
+    }
+
+    /*
+        stats() runs in O(sqrt(n)) time and returns the counters kept since
+        construction or resetStats() (see SortedBucketStats), along with the
+        bytes held by the chunks and their list nodes (taken as two pointers
+        on top of each chunk's vector), and a histogram of the chunk sizes.
+    */
+    SortedBucketStats stats() const {
+        SortedBucketStats out;
+#ifdef SORTED_BUCKET_STATS
+        out = counters;
+#endif
+        typename std::list<std::vector<T, Alloc>>::const_iterator last = std::prev(buckets.end());
+        for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+            out.bytes += sizeof(std::vector<T, Alloc>) + 2 * sizeof(void*) + 
+                         b->capacity() * sizeof(T);
+            /* the sentinel is left out of the last bucket */
+            out.countBucket(b->size() - (b == last));
+        }
+        return out;
+    }
+
+    /* resetStats() zeroes the counters, a no-op without SORTED_BUCKET_STATS */
+    void resetStats() noexcept {
+#ifdef SORTED_BUCKET_STATS
+        counters = SortedBucketStats();
+#endif
+    }
     
 #ifndef NDEBUG
     /*
@@ -454,17 +1041,10 @@ public:
         to force balancing for small number of elements.
     */
     void forceDensity(size_t density) {
+        setAutoDensity(false);
         bucketDensity = density;
         if (sz > 0) {
-            typename std::list<std::list<T>>::iterator b = buckets.begin();
-            while (b != buckets.end()) {
-                /*  Guaranteed no empty buckets if sz > 0, so track the first elem
-                    of each bucket. For list implementation, iterators remain 
-                    valid after balancing */
-                assert(!b->empty());
-                balance(b);
-                ++b;
-            }
+            balanceAll();
         }
     }
 
@@ -495,35 +1075,191 @@ public:
 #endif
 
 private:
+    /*
+        emplaceNear() inserts n right before hint if it belongs there, and at
+        upperBound(n) otherwise. As adapt() may move elements between buckets,
+        the hint is only trusted when adapt() has nothing to do.
+    */
+    template <typename U>
+    Iterator emplaceNear(Iterator hint, U&& n) {
+        bool adapting = sz >= growAt || sz < shrinkAt || rebalanceCursor != NoCursor;
+        if (adapting || !fitsBefore(hint, n)) {
+            adapt();
+            auto [targetBucket, targ] = upperBound(n);
+            return emplaceAt(targetBucket, targ, std::forward<U>(n));
+        }
+        return emplaceAt(hint.targetBucket, hint.targ, std::forward<U>(n));
+    }
+
+    /*  fitsBefore() checks that n is not below the element before hint, nor 
+        above hint, treating end() as above everything */
+    inline bool fitsBefore(const Iterator& hint, const T& n) noexcept {
+        bool atEnd = hint.targetBucket == std::prev(buckets.end()) && hint.targ == endSentinel;
+        if (!atEnd && comp(*hint, n)) {
+            return false;
+        }
+        if (hint.targetBucket == buckets.begin() && hint.targ == buckets.front().begin()) {
+            return true;
+        }
+        return !comp(n, *std::prev(hint));
+    }
+
+    /*
+        emplaceAt() inserts n in front of targ, which must keep the order, and
+        balances the bucket. It returns an Iterator to the new element.
+    */
+    template <typename U>
+    Iterator emplaceAt(BucketIterator targetBucket,
+                       ElementIterator targ, U&& n) {
+        /*  Balancing moves elements between chunks, so keep the index of the 
+            new element and regenerate its iterator after */
+        size_t targDist = std::distance(targetBucket->begin(), targ);
+        targ = targetBucket->emplace(targ, std::forward<U>(n));
+        SORTED_BUCKET_COUNT(shifted, targetBucket->size() - targDist - 1);
+        endSentinel = std::prev(buckets.back().end());
+        /*  If shifted right, targetBucket was either split, or merged into 
+            the bucket after it and erased */
+        BucketIterator after = std::next(targetBucket);
+        bool split = targetBucket->size() > bucketDensity * 2;
+        BucketIterator outBucket = targetBucket;
+        if (balance(targetBucket, targ, true)) {
+            outBucket = split ? std::next(targetBucket) : after;
+            targDist -= split ? bucketDensity : 0;
+        }
+        ++sz;
+        return Iterator(outBucket, std::next(outBucket->begin(), targDist));
+    }
+
+    /*
+        boundWithDistance() walks like lowerBound() (upperBound() if Upper) 
+        while counting the elements it passes, and returns the bound together 
+        with its index.
+    */
+    template <bool Upper, typename K>
+    std::pair<Iterator, size_t> boundWithDistance(const K& n) noexcept {
+        /*  Sentinel is last item of last bucket, so need to exclude from search */
+        size_t dist = 0;
+        auto before = [this, &n](const T& element) {
+            return Upper ? !comp(n, element) : comp(element, n);
+        };
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
+            std::prev(buckets.end());
+        while (targetBucket != sentinelBucket && before(targetBucket->back())) {
+            dist += targetBucket->size();
+            ++targetBucket;
+        }
+        // Find insertion point within targetBucket
+        ElementIterator end = targetBucket->end();
+        if (targetBucket == sentinelBucket) {
+            /* Exclude sentinel from search */
+            --end;
+        }
+        ElementIterator targ = 
+            std::partition_point(targetBucket->begin(), end, before);
+        dist += std::distance(targetBucket->begin(), targ);
+        if (targ == targetBucket->end()) {
+            /*  Point to beginning of next bucket rather than end of this bucket.
+                If targ was already the sentinel, we cannot arrive here. */
+            ++targetBucket;
+            targ = targetBucket->begin();
+        }
+        return std::make_pair(Iterator(targetBucket, targ), dist);
+    }
+
     inline void init() {
         if (buckets.empty()) {
-            buckets.emplace_back(std::list<T>());
-            buckets.front().emplace_back(T{
-            # ifndef NDEBUG
-                SENTINEL_FLAG // if no flag, we use T{} constructor.
-            #endif
-            });
+            buckets.emplace_back(std::vector<T, Alloc>());
+            buckets.front().reserve(2*bucketDensity + 4);
+            appendSentinel();
         }
         endSentinel = std::prev(buckets.back().end());
     }
 
+    /*
+        settle() runs in O(sqrt(n)) time, plus the size of any buckets out of
+        bounds, and tidies up after split() or join() spliced whole buckets in
+        or out. A container left without buckets gets a fresh sentinel bucket,
+        and otherwise balanceAll() restores the bounds around the seam.
+    */
+    void settle() {
+        if (autoDensity) {
+            retune();
+        }
+        init();
+        balanceAll();
+        rebalanceCursor = NoCursor;
+    }
+
+    /* appendSentinel() places the sentinel as the last item of the last bucket */
+    inline void appendSentinel() {
+        buckets.back().emplace_back(sentinelValue<T>());
+    }
+
+    /*
+        buildSorted() runs in O(n) time and fills the buckets from sorted input,
+        bucketDensity elements at a time. Only the last bucket (which also holds
+        the sentinel) may end up undersized, which balance() permits anyway.
+    */
+    template<class InputIterator>
+    void buildSorted(InputIterator beginIt, InputIterator endIt) {
+        assert(sz == 0);
+        buckets.clear();
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            if (buckets.empty() || buckets.back().size() == bucketDensity) {
+                buckets.emplace_back(std::vector<T, Alloc>());
+                buckets.back().reserve(2*bucketDensity + 4);
+            }
+            buckets.back().emplace_back(*it);
+            ++sz;
+        }
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        init();
+    }
+
+    /*
+        balanceAll() runs in O(sqrt(n) + m) time, where m is the number of 
+        elements moved, and balances every bucket from left to right. Since
+        balance() may erase the bucket it is given, each bucket is found again
+        from its left neighbour, and the same bucket is balanced until it is 
+        within the density bounds.
+    */
+    void balanceAll() {
+        BucketIterator before = buckets.end();
+        BucketIterator b = buckets.begin();
+        while (b != buckets.end()) {
+            balance(b);
+            b = (before == buckets.end()) ? buckets.begin() : std::next(before);
+            if (b->size() > bucketDensity * 2 ||
+                (b->size() < bucketDensity / 2 && std::next(b) != buckets.end())) {
+                continue;
+            }
+            before = b;
+            ++b;
+        }
+    }
+
     /* 
-        balance() runs in O(1) time and balances the bucket sizes, then
+        balance() runs in O(sqrt(n)) time and balances the bucket sizes, then
         returns whether or not the target element was shifted to the bucket 
-        to its right after the balancing.
+        to its right after the balancing. Only the chunks involved are 
+        touched, since the bucket list itself never shifts.
         This first removes any empty buckets to its right.
         Then it checks if targetBucket is too large or too small. 
         If so, we redistribute the contents among other buckets to maintain
-        approximately sqrt(n) operations for this container.
+        approximately sqrt(n) operations for this container. Elements are
+        moved between buckets rather than copied.
     */
-    bool balance(typename std::list<std::list<T>>::iterator targetBucket,
-                 typename std::list<T>::iterator targ = typename std::list<T>::iterator(),
+    bool balance(BucketIterator targetBucket,
+                 ElementIterator targ = ElementIterator(),
                  bool targSupplied = false) {
         if (targetBucket == buckets.end()) {
             return false;
         }
         bool shiftRight = false;
-        typename std::list<std::list<T>>::iterator right = std::next(targetBucket);
+        BucketIterator right = std::next(targetBucket);
         while (right != buckets.end() && right->empty()) {
             right = buckets.erase(right); 
         }
@@ -531,34 +1267,43 @@ private:
         if (targetBucket->size() > bucketDensity * 2) {
             /* Create a bucket right of targetBucket and dump half of the 
                 oversized targetBucket there */
-            shiftRight = true;
-            typename std::list<T>::iterator mid = targetBucket->begin();
-            for (int i = 0; i < bucketDensity; ++i) {
-                // if we encounter targ in first half, it remains in same bucket
-                shiftRight &= !(targSupplied && mid == targ);
-                ++mid;
-            }
-            typename std::list<std::list<T>>::iterator next = 
-                buckets.emplace(std::next(targetBucket), std::list<T, Alloc>());
-            next->splice(next->begin(), *targetBucket, mid, targetBucket->end());
+            shiftRight = targSupplied && 
+                         (std::distance(targetBucket->begin(), targ) >= bucketDensity);
+            SORTED_BUCKET_COUNT(splits, 1);
+            SORTED_BUCKET_COUNT(moved, targetBucket->size() - bucketDensity);
+            BucketIterator next = 
+                buckets.emplace(std::next(targetBucket), std::vector<T, Alloc>());
+            next->reserve(2*bucketDensity + 4);
+            next->insert(next->begin(), 
+                         std::make_move_iterator(std::next(targetBucket->begin(), bucketDensity)), 
+                         std::make_move_iterator(targetBucket->end()));
+            targetBucket->erase(std::next(targetBucket->begin(), bucketDensity),
+                                targetBucket->end());
         }
         else if (targetBucket->size() < bucketDensity / 2) {
             // last bucket is permitted to be undersized
             if (std::next(targetBucket) == buckets.end()) {
+                endSentinel = std::prev(buckets.back().end());
                 return false;
             }
-            typename std::list<std::list<T>>::iterator next = std::next(targetBucket);
+            BucketIterator next = std::next(targetBucket);
             /* If dumping to the right would cause overflow, append some of right
                 into targetBucket */
             if (targetBucket->size() + next->size() > bucketDensity * 2) {
                 int desired = (next->size() - targetBucket->size()) / 2;
-                targetBucket->splice(targetBucket->end(), *next,
-                    next->begin(), std::next(next->begin(), desired));
+                SORTED_BUCKET_COUNT(moved, desired);
+                targetBucket->insert(targetBucket->end(), 
+                                     std::make_move_iterator(next->begin()), 
+                                     std::make_move_iterator(std::next(next->begin(), desired)));
+                next->erase(next->begin(), std::next(next->begin(), desired));
             }
             // Otherwise prepend all to the right
             else {
                 shiftRight = true;
-                next->splice(next->begin(), *targetBucket);
+                SORTED_BUCKET_COUNT(merges, 1);
+                SORTED_BUCKET_COUNT(moved, targetBucket->size());
+                next->insert(next->begin(), std::make_move_iterator(targetBucket->begin()), 
+                             std::make_move_iterator(targetBucket->end()));
                 buckets.erase(targetBucket);
             }
         }
@@ -566,12 +1311,73 @@ private:
         return shiftRight;
     }
 
+    /*
+        adapt() runs at the start of every insert and erase. In auto density 
+        mode it tunes the density once size() crosses a threshold, then 
+        balances the bucket under the rebalance cursor until every bucket has 
+        been visited. Otherwise it only compares size() against thresholds 
+        which can never be crossed.
+    */
+    inline void adapt() {
+        if (sz >= growAt || sz < shrinkAt) {
+            retune();
+        }
+        if (rebalanceCursor != NoCursor) {
+            stepCursor();
+        }
+    }
+
+    /*
+        retune() sets the density for the current size, restarting the 
+        rebalance cursor if it changed, and sets the sizes at which the density
+        would double or halve. When the density is already at one of the 
+        bounds of autoDensityFor(), that side never triggers.
+    */
+    void retune() {
+        size_t density = autoDensityFor<T>(sz);
+        if (density != bucketDensity) {
+            bucketDensity = density;
+            rebalanceCursor = 0;
+        }
+        size_t grow = 4 * density * density;
+        size_t shrink = density * density / 4;
+        growAt = (autoDensityFor<T>(grow) > density) ? grow : NoThreshold;
+        shrinkAt = (autoDensityFor<T>(shrink) < density) ? shrink : 0;
+    }
+
+    /* stepCursor() balances the bucket under the rebalance cursor */
+    void stepCursor() {
+        if (rebalanceCursor >= buckets.size()) {
+            rebalanceCursor = NoCursor;
+            return;
+        }
+        /*  An index rather than an iterator, since balance() may erase the
+            bucket under the cursor. Walking to it costs about as much as the
+            search of the operation itself */
+        BucketIterator b = 
+            std::next(buckets.begin(), rebalanceCursor);
+        if (!balance(b)) {
+            ++rebalanceCursor;
+        }
+    }
+
+    static constexpr size_t NoThreshold = size_t(-1);
+    static constexpr size_t NoCursor = size_t(-1);
+
     // Private members
     size_t                              sz              {0};
     size_t                              capacity        {0};
     size_t                              bucketDensity   {DefaultSmallDensity};
-    std::list<std::list<T, Alloc>>      buckets;
-    typename std::list<T>::iterator     endSentinel;
+    bool                                autoDensity     {false};
+    size_t                              growAt          {NoThreshold};  // auto density thresholds on sz
+    size_t                              shrinkAt        {0};
+    size_t                              rebalanceCursor {NoCursor};     // next bucket to re-split
+    std::list<Bucket>                   buckets;
+    ElementIterator                     endSentinel;
+    [[no_unique_address]] StatsComp<Comp> comp;
+#ifdef SORTED_BUCKET_STATS
+    SortedBucketStats                     counters;
+#endif
 };
 
 #endif // UTIL_SORTED_BUCKET_LL_H
\ No newline at end of file
@@ -0,0 +1,179 @@
+/**
+ * @file sortedBucketPool.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Slab allocator for the node based Sorted Bucket containers
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Hands out single objects from large chunks and recycles them through an
+ * intrusive free list, so insert/erase churn never reaches the global
+ * allocator and nodes allocated near each other in time end up in nearby
+ * pages. All chunks are released in bulk when the pool is destroyed.
+ *
+ * Usage with the red-black tree (the allocator is rebound to the node type):
+ *      SortedBucketRBT<int, std::less<int>, SortedBucketPool<int>> rbt;
+ *
+ * Every allocator instance owns its own pool. Copies (including rebound
+ * copies) start with an empty pool and compare unequal, so memory must be
+ * returned to the same instance that handed it out. The containers only
+ * ever allocate and free through their own member allocator, so this holds.
+ * Requests for more than one object are forwarded to std::allocator.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_POOL_H
+#define UTIL_SORTED_BUCKET_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+/* Default number of objects carved out of each chunk */
+#define DefaultPoolChunk (size_t(1024))
+
+template <typename T, size_t ChunkObjects = DefaultPoolChunk>
+class SortedBucketPool {
+public:
+    static_assert(ChunkObjects > 0, "pool chunks must hold at least one object");
+
+    using value_type                             = T;
+    using size_type                              = size_t;
+    using difference_type                        = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+    using is_always_equal                        = std::false_type;
+
+    /*  allocator_traits cannot rebind through the non-type ChunkObjects
+        parameter on its own, so spell it out */
+    template <typename U>
+    struct rebind {
+        using other = SortedBucketPool<U, ChunkObjects>;
+    };
+
+    /* Default constructor */
+    SortedBucketPool() noexcept {}
+
+    /* Copy constructor. The copy gets its own empty pool */
+    SortedBucketPool(const SortedBucketPool&) noexcept {}
+
+    /* Rebind constructor. The copy gets its own empty pool */
+    template <typename U>
+    SortedBucketPool(const SortedBucketPool<U, ChunkObjects>&) noexcept {}
+
+    /* Move constructor. Takes over all chunks, leaving old empty */
+    SortedBucketPool(SortedBucketPool&& old) noexcept
+        : chunks(old.chunks)
+        , freeList(old.freeList)
+        , used(old.used) {
+        old.chunks = nullptr;
+        old.freeList = nullptr;
+        old.used = ChunkObjects;
+    }
+
+    /* Copy assignment keeps our own pool, nothing is shared */
+    SortedBucketPool& operator =(const SortedBucketPool&) noexcept {
+        return *this;
+    }
+
+    /* Move assignment releases our chunks and takes over old's */
+    SortedBucketPool& operator =(SortedBucketPool&& old) noexcept {
+        if (this != &old) {
+            release();
+            chunks = old.chunks;
+            freeList = old.freeList;
+            used = old.used;
+            old.chunks = nullptr;
+            old.freeList = nullptr;
+            old.used = ChunkObjects;
+        }
+        return *this;
+    }
+
+    /* Destructor releases every chunk at once */
+    ~SortedBucketPool() noexcept {
+        release();
+    }
+
+    /*
+        allocate() runs in amortized O(1) time. Single objects are popped from
+        the free list, or else bumped out of the newest chunk.
+    */
+    T* allocate(size_t n) {
+        if (n != 1) {
+            return std::allocator<T>().allocate(n);
+        }
+        if (freeList) {
+            Slot* slot = freeList;
+            freeList = slot->next;
+            return reinterpret_cast<T*>(slot);
+        }
+        if (used == ChunkObjects) {
+            Chunk* chunk = std::allocator<Chunk>().allocate(1);
+            chunk->prev = chunks;
+            chunks = chunk;
+            used = 0;
+        }
+        return reinterpret_cast<T*>(&chunks->slots[used++]);
+    }
+
+    /*
+        deallocate() runs in O(1) time and pushes a single object onto the free
+        list. The memory itself is only returned when the pool is released.
+    */
+    void deallocate(T* ptr, size_t n) noexcept {
+        if (n != 1) {
+            std::allocator<T>().deallocate(ptr, n);
+            return;
+        }
+        Slot* slot = reinterpret_cast<Slot*>(ptr);
+        slot->next = freeList;
+        freeList = slot;
+    }
+
+    /*
+        release() runs in O(chunks) time and hands every chunk back at once.
+        Objects still living in the pool are not destroyed, so this is only
+        valid once the owner is done with all of them.
+    */
+    void release() noexcept {
+        while (chunks) {
+            Chunk* prev = chunks->prev;
+            std::allocator<Chunk>().deallocate(chunks, 1);
+            chunks = prev;
+        }
+        freeList = nullptr;
+        used = ChunkObjects;
+    }
+
+    /* Pools are only interchangeable with themselves */
+    inline bool operator ==(const SortedBucketPool& other) const noexcept {
+        return this == &other;
+    }
+
+    inline bool operator !=(const SortedBucketPool& other) const noexcept {
+        return !(*this == other);
+    }
+
+private:
+    /*  A free slot stores the link to the next free slot in its own storage,
+        so the free list costs no extra memory */
+    union Slot {
+        Slot*                               next;
+        alignas(T) unsigned char            storage[sizeof(T)];
+    };
+
+    struct Chunk {
+        Chunk*                              prev;
+        Slot                                slots[ChunkObjects];
+    };
+
+    // Private members
+    Chunk*      chunks      {nullptr};          // newest chunk, linked to older ones
+    Slot*       freeList    {nullptr};
+    size_t      used        {ChunkObjects};     // slots bumped from newest chunk
+};
+
+#endif // UTIL_SORTED_BUCKET_POOL_H
@@ -11,13 +11,26 @@
  * Note that although this container has theoretically decent time complexity,
  * the constant factors are high because each node stores more info than usual 
  * (weight, copies). Furthermore, expect poor cache performance because of 
- * underlying tree structure. Also possibly frequent garbage collection
+ * underlying tree structure. Also possibly frequent garbage collection, which
+ * can be avoided by passing SortedBucketPool (sortedBucketPool.h) as Alloc so
+ * nodes come from chunked slabs with a free list.
  * 
  * Time complexities:
  *      find:               O(log(n))
  *      distance:           O(log(n))
+ *      nth:                O(log(n))
+ *      rank:               O(log(n))
+ *      countRange:         O(log(n))
  *      insert:             O(log(n))
  *      erase:              O(log(n))
+ *      batch of k:         O(k*log(k) + distinct*log(n))
+ *      findMany of k:      O(k*log(n))
+ *      split, join:        O(log(n))
+ *      merge:              O(n + m)
+ *      build from sorted:  O(n)
+ *
+ * Comp is stored, so it may carry state. If it is transparent, lookups and
+ * erases also take keys of any other type it compares against T.
  * 
  * 
  */
@@ -25,13 +38,19 @@
 #ifndef UTIL_SORTED_BUCKET_RBT_H
 #define UTIL_SORTED_BUCKET_RBT_H
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <functional>
+#include <iterator>
+#include <span>
+#include <utility>
+#include <vector>
+#include "sortedBucketCommon.h"
+#include "sortedBucketSnapshot.h"
 
 //#define NDEBUG
 #ifndef NDEBUG
-/* magic value for sentinel, otherwise uses T{} */
-#define SENTINEL_FLAG 0xBEEF
 #include <iostream>
 #include <queue>
 #include <string>
@@ -44,25 +63,36 @@ class SortedBucketRBT {
 public:
     struct Node {
         Node(const T& val, Node* par, unsigned char color, size_t copies = 1) noexcept
-            : val(val)
-            , par(par)
+            : par(par)
             , mass(copies)
             , copies(copies) 
-            , color(color){}
+            , color(color)
+            , val(val) {}
             
         Node(T&& val, Node* par, unsigned char color, size_t copies = 1) noexcept
-            : val(std::move(val))
-            , par(par)
+            : par(par)
             , mass(copies)
             , copies(copies)
-            , color(color){}
+            , color(color)
+            , val(std::move(val)) {}
+
+        template <typename... Args>
+        Node(std::in_place_t, Node* par, size_t copies, Args&&... args)
+            : par(par)
+            , mass(copies)
+            , copies(copies)
+            , val(std::forward<Args>(args)...) {}
         
-        Node*           par     {nullptr};
-        Node*           left    {nullptr};
-        Node*           right   {nullptr};
-        int             mass    {1}; // mass of itself and all lower nodes
-        int             copies  {1}; // allow multiset functionality while keeping BST rules
-        unsigned char   color   {Red};
+        /*  mass and copies are 64-bit so that insert(n, copies) can go past 2^31
+            total copies. The color only needs 2 bits, so it is packed into the 
+            spare top bits of copies, which keeps the node the same size as 
+            with 32-bit counts (48 bytes for uint64_t on 64-bit targets). */
+        Node*           par         {nullptr};
+        Node*           left        {nullptr};
+        Node*           right       {nullptr};
+        size_t          mass        {1};        // mass of itself and all lower nodes
+        size_t          copies : 62 {1};        // allow multiset functionality while keeping BST rules
+        size_t          color  : 2  {Red};
         T               val;
     };
     /*  steal Alloc's traits and rebind to allocate for node, which contains extra
@@ -120,7 +150,7 @@ public:
             nodePtr = other.nodePtr;
         }
 
-        inline int copies() const noexcept {
+        inline size_t copies() const noexcept {
             return nodePtr->copies;
         }
 
@@ -188,6 +218,72 @@ public:
         Node* nodePtr {nullptr};
     };
 
+    /*
+        NodeHandle owns a node taken out by extract(), together with all of its
+        copies, and frees it on destruction unless it is inserted again. The 
+        node's memory belongs to the tree's allocator, so a handle must be 
+        inserted or dropped before its tree is moved, cleared or destroyed.
+    */
+    class NodeHandle {
+    public:
+        NodeHandle() noexcept {}
+
+        NodeHandle(NodeHandle&& old) noexcept
+            : node(std::exchange(old.node, nullptr))
+            , alloc(old.alloc) {}
+
+        NodeHandle& operator =(NodeHandle&& old) noexcept {
+            if (this != &old) {
+                reset();
+                node = std::exchange(old.node, nullptr);
+                alloc = old.alloc;
+            }
+            return *this;
+        }
+
+        ~NodeHandle() noexcept {
+            reset();
+        }
+
+        /* Whether the handle holds no node */
+        bool empty() const noexcept {
+            return node == nullptr;
+        }
+
+        explicit operator bool() const noexcept {
+            return node != nullptr;
+        }
+
+        /*  The element, which may be changed before inserting it again. Calling
+            value() on an empty handle is UB */
+        T& value() const noexcept {
+            return node->val;
+        }
+
+        /* Number of copies the node carries */
+        size_t copies() const noexcept {
+            return node ? size_t(node->copies) : 0;
+        }
+
+    private:
+        friend class SortedBucketRBT;
+
+        NodeHandle(Node* node, AllocNode* alloc) noexcept
+            : node(node)
+            , alloc(alloc) {}
+
+        void reset() noexcept {
+            if (node) {
+                std::allocator_traits<AllocNode>::destroy(*alloc, node);
+                std::allocator_traits<AllocNode>::deallocate(*alloc, node, 1);
+                node = nullptr;
+            }
+        }
+
+        Node*       node    {nullptr};
+        AllocNode*  alloc   {nullptr};
+    };
+
     enum Color {
         Red             = 0,
         Black           = 1,
@@ -197,9 +293,57 @@ public:
     /* Default constructor */
     SortedBucketRBT() noexcept {init();}
 
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucketRBT(const Comp& comp) noexcept 
+        : comp(comp) {
+        init();
+    }
+
+    /* 
+        Sorted range constructor. Input must already be sorted by Comp, which
+        lets us link a perfectly balanced tree in O(n) instead of inserting.
+    */
+    template <class InputIterator>
+    SortedBucketRBT(SortedInputTag, InputIterator beginIt, InputIterator endIt,
+                    const Comp& comp = Comp()) 
+        : comp(comp) {
+        init();
+        buildSorted(beginIt, endIt);
+    }
+
+    /* Copy constructor. Clones the tree shape in O(n) without rebalancing */
+    explicit SortedBucketRBT(const SortedBucketRBT& old) 
+        : comp(old.comp) {
+        root = clone(old.root, nullptr, old.endSentinel);
+        sz = old.sz;
+        leftmost = root;
+        while (leftmost->left) {
+            leftmost = leftmost->left;
+        }
+    }
+
+    /* Move constructor. Takes over old's nodes (and allocator), leaving old empty */
+    SortedBucketRBT(SortedBucketRBT&& old) noexcept
+        : allocNode(std::move(old.allocNode))
+        , sz(old.sz)
+        , root(old.root)
+        , leftmost(old.leftmost)
+        , endSentinel(old.endSentinel)
+        , comp(old.comp) {
+        old.sz = 0;
+        old.init();
+    }
+
+    /*  Nodes are owned through raw pointers, so a shallow copy would free them 
+        twice. Assignment is not supported, use the constructors instead */
+    SortedBucketRBT& operator =(const SortedBucketRBT&) = delete;
+    SortedBucketRBT& operator =(SortedBucketRBT&&) = delete;
+
     /* Range constructor */
     template <class InputIterator>
-    SortedBucketRBT(InputIterator beginIt, InputIterator endIt) noexcept {
+    SortedBucketRBT(InputIterator beginIt, InputIterator endIt, 
+                    const Comp& comp = Comp()) noexcept 
+        : comp(comp) {
         init();
         for (InputIterator it = beginIt; it != endIt; ++it) {
             insert(*it);
@@ -208,7 +352,7 @@ public:
     
     /* Default destructor */
     ~SortedBucketRBT() noexcept {
-        destroy(root);
+        release();
     }
 
     /* Size getter */
@@ -216,6 +360,11 @@ public:
         return sz;
     }
 
+    /* Comparator getter */
+    Comp getComp() const noexcept {
+        return comp;
+    }
+
     /* Begin getter */
     inline Iterator begin() noexcept {
         return Iterator(leftmost);
@@ -235,13 +384,44 @@ public:
     /*  Back element access. Calling back() on an empty RBTree will cause
         segfault, just like with other STL containers */
     inline T& back() noexcept {
-        return (--Iterator(endSentinel))->val;
+        return *--Iterator(endSentinel);
+    }
+
+    /*
+        lowerBound() runs in O(log(n)) time and returns an Iterator to the first 
+        element not below n, or end() if there is none.
+    */
+    Iterator lowerBound(const T& n) noexcept {
+        return lowerBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator lowerBound(const K& n) noexcept {
+        return Iterator(descend<false>(n).first);
+    }
+
+    /*
+        upperBound() runs in O(log(n)) time and returns an Iterator to the first 
+        element above n, or end() if there is none.
+    */
+    Iterator upperBound(const T& n) noexcept {
+        return upperBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator upperBound(const K& n) noexcept {
+        return Iterator(descend<true>(n).first);
     }
 
     /*
         find() runs in O(log(n)) and returns an Iterator to the first instance of n.
     */
     Iterator find(const T& n) noexcept {
+        return find<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator find(const K& n) noexcept {
         return findWithDistance(n).first;
     }
 
@@ -251,132 +431,228 @@ public:
         the smallest element in the tree (0-indexed). If the element was not 
         found, the first of the pair is the end() Iterator. 
     */
-    std::pair<Iterator, int> findWithDistance(const T& n) noexcept {
-        Node* node = root;
-        int dist = 0;
-        while (node) {
-            if (node == endSentinel) {
-                assert(endSentinel->right == nullptr);
-                node = node->left;
-            }
-            else if (!Comp{} (n, node->val) && !Comp{} (node->val, n)) { /* Equality */
-                dist += (node->left) ? node->left->mass : 0;
-                return std::make_pair(Iterator(node), dist);
-            }
-            else if (Comp{} (n, node->val)) {
-                node = node->left;
-            }
-            else {
-                dist += (node->left) ? node->left->mass : 0;
-                dist += node->copies;
-                node = node->right;
-            }
+    std::pair<Iterator, std::ptrdiff_t> findWithDistance(const T& n) noexcept {
+        return findWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, std::ptrdiff_t> findWithDistance(const K& n) noexcept {
+        auto [node, dist] = descend<false>(n);
+        if (node == endSentinel || comp(n, node->val)) {
+            return std::make_pair(Iterator(static_cast<Node*>(nullptr)), std::ptrdiff_t(-1));
         }
-        return std::make_pair(Iterator(static_cast<Node*>(nullptr)), -1);
+        return std::make_pair(Iterator(node), static_cast<std::ptrdiff_t>(dist));
+    }
+
+    /*
+        lowerBoundWithDistance() runs in O(log(n)) time and returns a pair of: 
+        an Iterator to the first element not below n, along with its index. 
+        Unlike findWithDistance(), n does not have to be present, in which case 
+        the index is the number of elements below n (and the Iterator is end()
+        if there are none above).
+    */
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const T& n) noexcept {
+        return lowerBoundWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const K& n) noexcept {
+        auto [node, dist] = descend<false>(n);
+        return std::make_pair(Iterator(node), dist);
+    }
+
+    /*
+        rank() runs in O(log(n)) time and returns the number of elements below
+        n, or with inclusive set, the number not above n. n does not have to 
+        be present.
+    */
+    size_t rank(const T& n, bool inclusive = false) noexcept {
+        return rank<T>(n, inclusive);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t rank(const K& n, bool inclusive = false) noexcept {
+        return inclusive ? descend<true>(n).second : descend<false>(n).second;
     }
 
     /*
         distance() runs in O(logn) time and returns the index of the first 
         occurrence of the element, 0-indexed. (Returns -1 if element not found)
     */
-    int distance (const T& n) noexcept {
+    std::ptrdiff_t distance(const T& n) noexcept {
+        return distance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::ptrdiff_t distance(const K& n) noexcept {
         return findWithDistance(n).second;
     }
 
     /*
-        insert() runs in O(log(n)) time and returns an Iterator to the inserted
-        element.
+        countRange() runs in O(log(n)) time and returns how many elements lie 
+        in [lo, hi). Neither lo nor hi has to be present.
     */
-    Iterator insert(const T& n, size_t copies = 1) {
-        sz += copies;
+    size_t countRange(const T& lo, const T& hi) noexcept {
+        return countRange<T>(lo, hi);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t countRange(const K& lo, const K& hi) noexcept {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /*
+        findMany() runs in O(k*log(n)) time and sets out[i] to find(keys[i]) for
+        each of the k keys. The descents of up to BatchLookupLanes keys are 
+        interleaved and each prefetches the node it steps to, so their cache 
+        misses overlap instead of being paid one after another. out must hold 
+        at least k Iterators.
+    */
+    void findMany(std::span<const T> keys, std::span<Iterator> out) noexcept {
+        assert(out.size() >= keys.size());
+        descendMany(keys, [&](size_t i, Node* node, size_t) {
+            bool found = node != endSentinel && !comp(keys[i], node->val);
+            out[i] = Iterator(found ? node : nullptr);
+        });
+    }
+
+    /*
+        distanceMany() runs in O(k*log(n)) time and sets out[i] to 
+        distance(keys[i]) for each of the k keys, interleaved like findMany().
+        out must hold at least k distances.
+    */
+    void distanceMany(std::span<const T> keys, std::span<std::ptrdiff_t> out) noexcept {
+        assert(out.size() >= keys.size());
+        descendMany(keys, [&](size_t i, Node* node, size_t below) {
+            bool found = node != endSentinel && !comp(keys[i], node->val);
+            out[i] = found ? static_cast<std::ptrdiff_t>(below) : -1;
+        });
+    }
+
+    /*
+        nth() runs in O(log(n)) time and returns an Iterator to the element at 
+        sorted index idx (0-indexed), making it the inverse of distance(). Since
+        duplicates share a node, the Iterator points to the node whose copies 
+        cover idx. If idx is out of range, returns the end() Iterator.
+    */
+    Iterator nth(size_t idx) noexcept {
+        if (idx >= sz) {
+            return end();
+        }
         Node* node = root;
         while (node) {
-            node->mass += copies;
             if (node == endSentinel) {
-                if (!endSentinel->left) {
-                    endSentinel->left = std::allocator_traits<AllocNode>::allocate(
-                        allocNode, 1);
-                    std::allocator_traits<AllocNode>::construct(allocNode, endSentinel->left,
-                        n, endSentinel, Red, copies);
-                    balanceDoubleRed(endSentinel->left);
-                    return insertHelper(n, endSentinel->left);
-                }
-                node = endSentinel->left;
-            }
-            else if (!Comp{} (n, node->val) && !Comp{} (node->val, n)) { /* Equality */
-                node->copies += copies;
-                return insertHelper(n, node);
+                node = node->left;
+                continue;
             }
-            else if (Comp{} (n, node->val)) {
-                if (!node->left) {
-                    node->left = std::allocator_traits<AllocNode>::allocate(
-                        allocNode, 1, /* hint location */ node);
-                    std::allocator_traits<AllocNode>::construct(allocNode, node->left, 
-                        n, node, Red, copies);
-                    balanceDoubleRed(node->left);
-                    return insertHelper(n, node->left);
-                }
+            size_t leftMass = (node->left) ? node->left->mass : 0;
+            if (idx < leftMass) {
                 node = node->left;
             }
+            else if (idx < leftMass + node->copies) {
+                return Iterator(node);
+            }
             else {
-                if (!node->right) {
-                    node->right = std::allocator_traits<AllocNode>::allocate(
-                        allocNode, 1, /* hint location */ node);
-                    std::allocator_traits<AllocNode>::construct(allocNode, node->right, 
-                        n, node, Red, copies);
-                    balanceDoubleRed(node->right);
-                    return insertHelper(n, node->right);
-                }
+                idx -= leftMass + node->copies;
                 node = node->right;
             }
         }
-        return insertHelper(n, static_cast<Node*>(nullptr));
+        return end();
+    }
+
+    /*
+        at() runs in O(log(n)) time and returns the element at sorted index idx.
+        Calling at() with an out of range idx is UB, so requires checks like
+        in STL containers.
+    */
+    inline T& at(size_t idx) noexcept {
+        assert(idx < sz);
+        return *nth(idx);
+    }
+
+    /*
+        insert() runs in O(log(n)) time and returns an Iterator to the inserted
+        element. An element not below back() is linked next to the sentinel
+        without a search, so ascending streams skip the comparisons, though 
+        the masses above still take O(log(n)) to update.
+    */
+    Iterator insert(const T& n, size_t copies = 1) {
+        return placeAt(endSentinel, n, copies, [&](Node* par) {
+            return newNode(par, copies, n);
+        });
     }
 
     Iterator insert(T&& n, size_t copies = 1) {
-        sz += copies;
-        Node* node = root;
-        while (node) {
-            node->mass += copies;
-            if (node == endSentinel) {
-                if (!endSentinel->left) {
-                    endSentinel->left = std::allocator_traits<AllocNode>::allocate(
-                        allocNode, 1);
-                    std::allocator_traits<AllocNode>::construct(allocNode, endSentinel->left,
-                        std::forward<T>(n), endSentinel, Red, copies);
-                    balanceDoubleRed(endSentinel->left);
-                    return insertHelper(n, endSentinel->left);
-                }
-                node = endSentinel->left;
-            }
-            else if (!Comp{} (n, node->val) && !Comp{} (node->val, n)) { /* Equality */
-                node->copies += copies;
-                return insertHelper(n, node);
-            }
-            else if (Comp{} (n, node->val)) {
-                if (!node->left) {
-                    node->left = std::allocator_traits<AllocNode>::allocate(
-                        allocNode, 1, /* hint location */ node);
-                    std::allocator_traits<AllocNode>::construct(allocNode, node->left, 
-                        std::forward<T>(n), node, Red, copies);
-                    balanceDoubleRed(node->left);
-                    return insertHelper(n, node->left);
-                }
-                node = node->left;
-            }
-            else {
-                if (!node->right) {
-                    node->right = std::allocator_traits<AllocNode>::allocate(
-                        allocNode, 1, /* hint location */ node);
-                    std::allocator_traits<AllocNode>::construct(allocNode, node->right, 
-                        std::forward<T>(n), node, Red, copies);
-                    balanceDoubleRed(node->right);
-                    return insertHelper(n, node->right);
-                }
-                node = node->right;
-            }
+        /* n is only moved from once the search is over */
+        return placeAt(endSentinel, n, copies, [&](Node* par) {
+            return newNode(par, copies, std::move(n));
+        });
+    }
+
+    /*
+        insert() with a hint links n in right before hint without a search if
+        it belongs there, like in std::multiset, and is insert(n) otherwise.
+        Either way the masses above take O(log(n)) to update, but a correct
+        hint saves every comparison. The hint must be a valid Iterator.
+    */
+    Iterator insert(Iterator hint, const T& n) {
+        return placeAt(hintNode(hint), n, 1, [&](Node* par) {
+            return newNode(par, 1, n);
+        });
+    }
+
+    Iterator insert(Iterator hint, T&& n) {
+        return placeAt(hintNode(hint), n, 1, [&](Node* par) {
+            return newNode(par, 1, std::move(n));
+        });
+    }
+
+    /*
+        insert() with a NodeHandle runs in O(log(n)) time and links the node 
+        from extract() back in, with all of its copies, without allocating. If
+        an equal element is already present, it takes the copies and the node 
+        is freed. An empty handle inserts nothing and returns end().
+    */
+    Iterator insert(NodeHandle&& handle) {
+        Node* node = std::exchange(handle.node, nullptr);
+        if (!node) {
+            return end();
+        }
+        if (*handle.alloc != allocNode) {
+            /* the memory has to go back to the allocator it came from */
+            Iterator it = insert(std::move(node->val), node->copies);
+            std::allocator_traits<AllocNode>::destroy(*handle.alloc, node);
+            std::allocator_traits<AllocNode>::deallocate(*handle.alloc, node, 1);
+            return it;
         }
-        return insertHelper(n, static_cast<Node*>(nullptr));
+        node->left = nullptr;
+        node->right = nullptr;
+        node->mass = node->copies;
+        node->color = Red;
+        return attach(node, endSentinel);
+    }
+
+    /*
+        emplace() runs in O(log(n)) time and inserts an element constructed 
+        from args straight into a new node, so it is never copied or moved. 
+        If an equal element is already present, the new one only adds a copy
+        to it and is destroyed.
+    */
+    template <typename... Args>
+    Iterator emplace(Args&&... args) {
+        return attach(newNode(nullptr, 1, std::forward<Args>(args)...), endSentinel);
+    }
+
+    /*
+        emplace_hint() is emplace() which first tries to link the new element
+        right before hint, like insert(hint, n).
+    */
+    template <typename... Args>
+    Iterator emplace_hint(Iterator hint, Args&&... args) {
+        return attach(newNode(nullptr, 1, std::forward<Args>(args)...), hintNode(hint));
     }
 
     template <class InputIterator>
@@ -389,18 +665,78 @@ public:
         }
     }
 
+    /*
+        insertBatch() runs in O(k*log(k) + d*log(n)) time for a batch of k 
+        elements with d distinct values. The batch is sorted so that every run
+        of equal elements descends the tree only once, as a single insert with
+        that many copies.
+    */
+    template <class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        std::sort(batch.begin(), batch.end(), comp);
+        typename std::vector<T>::iterator next = batch.begin();
+        while (next != batch.end()) {
+            typename std::vector<T>::iterator last = std::upper_bound(next, 
+                batch.end(), *next, comp);
+            insert(std::move(*next), static_cast<size_t>(std::distance(next, last)));
+            next = last;
+        }
+    }
+
+    /*
+        eraseBatch() runs in O(k*log(k) + d*log(n)) time for a batch of k 
+        elements with d distinct values. It erases a single instance for each 
+        element of the batch (so a value given twice erases two copies), with 
+        every run of equal elements handled by one search and one mass update.
+        It returns how many elements were erased.
+    */
+    template <class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        std::sort(batch.begin(), batch.end(), comp);
+        size_t ct = 0;
+        typename std::vector<T>::iterator next = batch.begin();
+        while (next != batch.end()) {
+            typename std::vector<T>::iterator last = std::upper_bound(next, 
+                batch.end(), *next, comp);
+            size_t copies = std::distance(next, last);
+            Node* node = find(*next).nodePtr;
+            next = last;
+            if (!node) {
+                continue;
+            }
+            if (node->copies > copies) {
+                node->copies -= copies;
+                updateMass(node, -static_cast<std::ptrdiff_t>(copies));
+                sz -= copies;
+                ct += copies;
+            }
+            else {
+                ct += eraseAll(node);
+            }
+        }
+        return ct;
+    }
+
     /*
         erase runs in O(logn) erases a single instance of the element and 
         returns how many instances of the element were erased (1 if successful,
         0 if not found).
     */
     int erase(const T& n) noexcept {
+        return erase<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int erase(const K& n) noexcept {
         auto [it, pos] = findWithDistance(n);
         Node* node = it.nodePtr;
         if (!node) {
             return 0;
         }
         if (node->copies > 1) {
+            --node->copies;
             updateMass(node, -1);
             --sz;
             return 1;
@@ -414,7 +750,12 @@ public:
         eraseAll runs in O(logn) and erases all instances of the element. 
         It returns how many instances of the element were erased.
     */
-    int eraseAll(const T& n) noexcept {
+    size_t eraseAll(const T& n) noexcept {
+        return eraseAll<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t eraseAll(const K& n) noexcept {
         auto [it, pos] = findWithDistance(n);
         Node* node = it.nodePtr;
         if (!node) {
@@ -423,173 +764,296 @@ public:
         return eraseAll(node);
     }
 
-    int eraseAll(Node* node) noexcept {
+    size_t eraseAll(Node* node) noexcept {
         if (!node) {
             return 0;
         }
-        Node* par = node->par;
-        int ct = node->copies;
+        size_t ct = unlink(node);
+        deleteNode(node);
+        return ct;
+    }
 
-        if (leftmost != endSentinel && node->val == leftmost->val) {
-            leftmost = (++Iterator(leftmost)).nodePtr;
+    /*
+        extract() runs in O(log(n)) time and takes the node at it out of the 
+        tree, all copies included, and hands it over in a NodeHandle instead
+        of freeing it. The element can then be changed and inserted again 
+        without allocating. Extracting end() returns an empty handle.
+    */
+    NodeHandle extract(Iterator it) noexcept {
+        Node* node = it.nodePtr;
+        if (!node || node == endSentinel) {
+            return NodeHandle();
         }
+        unlink(node);
+        return NodeHandle(node, &allocNode);
+    }
 
-        //  node is a leaf. 
-        if (!node->left && !node->right) {
-            if (node == root) {
-                root = nullptr;
-            }
-            else {
-                updateMass(par, 0 - ct);
-                bool nodeOnLeft = (par->left == node);
-                if (nodeOnLeft) {
-                    par->left = nullptr;
-                }
-                else {
-                    par->right = nullptr;
-                }
-                if (node->color == Black) {
-                    bool nodeRemoved = false;
-                    while (!nodeRemoved) {
-                        /* If node is a black leaf, then a sibling must exist due
-                            to length property for sibling's branch. This might
-                            produce a "DoubleBlack null node" which is not an 
-                            actual node, so we cannot use balanceDoubleBlack(node).
-                            Instead, handle the scenario right here.
-                        */
-                        Node* sibling = (nodeOnLeft) ? par->right : par->left;
+    NodeHandle extract(const T& n) noexcept {
+        return extract(find(n));
+    }
 
-                        if (sibling->color == Red) {
-                            /* sibling must have exactly two black children to
-                                satisfy initial length property */
-                            sibling->color = Black;
-                            par->color = Red;
-                            if (nodeOnLeft) {
-                                leftRotate(par);
-                            }
-                            else {
-                                rightRotate(par);
-                            }
-                            // Repeat loop brings us to black sibling case
-                        }
-                        else {
-                            // black sibling has no children.
-                            if (!sibling->left && !sibling->right) {
-                                par->color += sibling->color;
-                                sibling->color = Red;
-                                balanceDoubleBlack(par);
-                                nodeRemoved = true;
-                            }
-                            /* black sibling has an in-line child along rotation
-                                (lhs), which must be red, other child irrelevant */
-                            else if (!nodeOnLeft && sibling->left) {
-                                sibling->color = par->color;
-                                sibling->left->color = Black;
-                                par->color = Black;
-                                rightRotate(par);
-                                nodeRemoved = true;
-                            }
-                            /* black sibling has an in-line child along rotation
-                                (rhs), which must be red, other child irrelevant */
-                            else if (nodeOnLeft && sibling->right) {
-                                sibling->color = par->color;
-                                sibling->right->color = Black;
-                                par->color = Black;
-                                leftRotate(par);
-                                nodeRemoved = true;
-                            }
-                            /* black sibling has out-of-line child (lhs), which
-                                must be red, create an in-line red child from it */
-                            else if (nodeOnLeft && sibling->left) {
-                                sibling->left->color = Black;
-                                sibling->color = Red;
-                                rightRotate(sibling);
-                                // continue loop, now sibling has in-line child
-                            }
-                            /* black sibling has out-of-line child (rhs), which 
-                                must be red, create an in-line red child from it */
-                            else {
-                                sibling->right->color = Black;
-                                sibling->color = Red;
-                                leftRotate(sibling);
-                                // continue loop, now sibling has in-line child
-                            }
-                        }
-                    }
-                }
-            }
-            sz -= ct;
-            std::allocator_traits<AllocNode>::destroy(allocNode, node);
+    /*
+        replace() runs in O(log(n)) time and swaps one instance of old for n, 
+        like erase(old) and insert(n) would, but reusing the node of old. If 
+        old has a single copy and n falls strictly between its neighbours, n 
+        takes the node's place and nothing is rebalanced. Otherwise the node 
+        is extracted and linked in again at n, without allocating. It returns
+        an Iterator to n, or end() if old is not present and nothing changed.
+    */
+    Iterator replace(const T& old, T n) {
+        Node* node = find(old).nodePtr;
+        if (!node) {
+            return end();
+        }
+        if (node->copies > 1) {
+            --node->copies;
+            updateMass(node, -1);
+            --sz;
+            return insert(std::move(n));
         }
+        Iterator before(node);
+        Iterator after(node);
+        ++after;
+        if ((node == leftmost || comp(*--before, n)) && 
+            (after == end() || comp(n, *after))) {
+            node->val = std::move(n);
+            return Iterator(node);
+        }
+        NodeHandle handle = extract(Iterator(node));
+        handle.value() = std::move(n);
+        return insert(std::move(handle));
+    }
 
-        // node has only a left child
-        else if (node->left && !node->right) {
-            node->left->par = node->par;
-            if (node == root) {
-                root = node->left;
-                root->color = Black;
-            }
-            else {
-                node->left->color += node->color;
-                if (par->left == node) {
-                    par->left = node->left;
+    /*
+        clear() runs in O(n) time and erases every element, handing the nodes
+        back without recursing. With SortedBucketPool as Alloc its memory is
+        released all at once instead, which takes O(n / chunk size) time when
+        T is trivially destructible, since no node has to be visited then.
+        This invalidates all iterators, and any NodeHandle from extract().
+    */
+    void clear() {
+        release();
+        sz = 0;
+        init();
+    }
+
+    /*
+        split() runs in O(log(n)) time and moves every element not below key
+        into the returned tree, keeping the ones below it. The tree is cut
+        along the search path for key and both halves are joined back up on
+        the way out, so no node is copied or reallocated. With an allocator
+        whose copies cannot free each other's memory (SortedBucketPool), the
+        moved elements are rebuilt in the new tree in O(n) instead. This
+        invalidates end(), and Iterators to moved elements now belong to the
+        returned tree.
+    */
+    SortedBucketRBT split(const T& key) {
+        SortedBucketRBT out(comp);
+        if (out.allocNode != allocNode) {
+            std::vector<Node*> nodes;
+            collect(root, nodes);
+            std::vector<Node*> keep, moved;
+            sz = 0;
+            for (Node* node : nodes) {
+                if (comp(node->val, key)) {
+                    sz += node->copies;
+                    keep.push_back(node);
                 }
                 else {
-                    par->right = node->left;
+                    out.appendSorted(moved, std::move(node->val), node->copies);
+                    deleteNode(node);
                 }
             }
-            updateMass(par, 0 - ct);
-            balanceDoubleBlack(node->left);
-            sz -= ct;
-            std::allocator_traits<AllocNode>::destroy(allocNode, node);
+            linkAll(keep);
+            out.linkAll(moved);
+            return out;
         }
+        auto [lower, upper] = splitNodes(detachSentinel(), key);
+        out.sz = (upper) ? upper->mass : 0;
+        sz -= out.sz;
+        attachSentinel(lower);
+        out.attachSentinel(upper);
+        return out;
+    }
 
-        // node has only a right child
-        else if (!node->left && node->right) {
-            node->right->par = node->par;
-            if (node == root) {
-                root = node->right;
-                root->color = Black;
+    /*
+        join() runs in O(log(n)) time and moves all of other onto the end of
+        this tree, leaving other empty. Every element of other must be at
+        least back(), otherwise nothing is moved and false is returned. The
+        trees are glued under the front node of other, then rebalanced along
+        the spine of the taller one. With an allocator whose copies cannot
+        free each other's memory (SortedBucketPool), this falls back to
+        merge(). This invalidates end() of both trees.
+    */
+    bool join(SortedBucketRBT& other) {
+        if (&other == this || other.sz == 0) {
+            return true;
+        }
+        if (sz > 0 && comp(other.front(), back())) {
+            return false;
+        }
+        if (other.allocNode != allocNode) {
+            merge(other);
+            return true;
+        }
+        Node* lower = detachSentinel();
+        other.detachSentinel();
+        Node* middle = nullptr;
+        while (!middle && other.root) {
+            middle = other.leftmost;
+            other.unlink(middle);
+            if (lower && !comp(rightmost(lower)->val, middle->val)) {
+                /* equal to our last element, so it only adds copies there */
+                Node* last = rightmost(lower);
+                last->copies += middle->copies;
+                updateMass(last, middle->copies);
+                sz += middle->copies;
+                deleteNode(middle);
+                middle = nullptr;
+            }
+        }
+        if (middle) {
+            sz += other.sz + middle->copies;
+            lower = joinNodes(lower, middle, other.root);
+        }
+        attachSentinel(lower);
+        other.sz = 0;
+        other.attachSentinel(nullptr);
+        return true;
+    }
+
+    /*
+        merge() runs in O(n + m) time and moves all of other into this tree,
+        leaving other empty. The nodes of both trees are walked in order
+        and relinked like the SortedInput constructor, with equal elements
+        folded into one node, so a node is only allocated when other's
+        allocator cannot hand its memory over (SortedBucketPool). This
+        invalidates all iterators of both trees.
+    */
+    void merge(SortedBucketRBT& other) {
+        if (&other == this || other.sz == 0) {
+            return;
+        }
+        std::vector<Node*> mine, theirs;
+        collect(root, mine);
+        other.collect(other.root, theirs);
+        bool shared = (other.allocNode == allocNode);
+        std::vector<Node*> nodes;
+        nodes.reserve(mine.size() + theirs.size() + 1);
+        sz = 0;
+        size_t i = 0, j = 0;
+        while (i < mine.size() || j < theirs.size()) {
+            bool ours = j == theirs.size() ||
+                        (i < mine.size() && !comp(theirs[j]->val, mine[i]->val));
+            Node* node = ours ? mine[i++] : theirs[j++];
+            if (!ours && !shared) {
+                appendSorted(nodes, std::move(node->val), node->copies);
+                other.deleteNode(node);
+            }
+            else if (!nodes.empty() && !comp(nodes.back()->val, node->val)) {
+                /* sorted, so not less means equal */
+                nodes.back()->copies += node->copies;
+                sz += node->copies;
+                deleteNode(node);
             }
             else {
-                node->right->color += node->color;
-                if (par->left == node) {
-                    par->left = node->right;
-                }
-                else {
-                    par->right = node->right;
-                }
+                sz += node->copies;
+                nodes.push_back(node);
             }
-            updateMass(par, 0 - ct);
-            balanceDoubleBlack(node->right);
-            sz -= ct;
-            std::allocator_traits<AllocNode>::destroy(allocNode, node);
         }
+        linkAll(nodes);
+        theirs.clear();
+        other.sz = 0;
+        other.linkAll(theirs);
+    }
 
-        // node has two children
-        else {
-            /*  Normal BST deletion, find next in-order successor.
-                Succ now takes the place of node.
-                We must physically rearrange (not simply swap contents of) successor
-                node, so that Iterators and pointers become invalid after we erase
-                that node, rather than cause confusion when contents of an
-                apparently valid Iterator suddenly change.
-            */
-            Node* succ = node->right;
-            while (succ->left) {
-                succ = succ->left;
-            }
-            Node* succPar = succ->par;
+    /*
+        save() runs in O(n) time and writes a weighted snapshot of the tree to
+        path (see sortedBucketSnapshot.h): every node in sorted order, with 
+        its copies as the runs. Returns whether it succeeded.
+    */
+    bool save(const char* path) const requires std::is_trivially_copyable_v<T> {
+        SnapshotFile file(path, "wb");
+        size_t distinct = 0;
+        inOrder(root, [&distinct](const Node*) { ++distinct; });
+        SnapshotHeader header(sizeof(T), SnapshotWeighted, distinct, distinct, 0);
+        file.write(&header, sizeof header);
+        inOrder(root, [&file](const Node* node) {
+            uint64_t copies = node->copies;
+            file.write(&copies, sizeof copies);
+        });
+        file.pad(header.elemOffset());
+        inOrder(root, [&file](const Node* node) {
+            file.write(&node->val, sizeof(T));
+        });
+        return file.close();
+    }
 
-            if (node->right != succ) {
-                this->swap(succ, node, false);
+    /*
+        load() runs in O(n) time and replaces the contents with the snapshot at
+        path, linked like the SortedInput constructor. Both weighted and flat
+        snapshots load, since runs of equal elements collapse into one node 
+        either way. Returns whether it succeeded, leaving the tree empty if
+        not. This invalidates all iterators.
+    */
+    bool load(const char* path) requires std::is_trivially_copyable_v<T> {
+        clear();
+        SnapshotFile file(path, "rb");
+        SnapshotHeader header;
+        file.read(&header, sizeof header);
+        bool good = file && header.valid<T>() && header.fits<T>(file.length());
+        bool weighted = good && header.layout == SnapshotWeighted;
+        std::vector<uint64_t> copies(weighted ? header.runs : 0);
+        file.read(copies.data(), copies.size() * sizeof(uint64_t));
+        file.skip(header.elemOffset());
+        std::vector<Node*> nodes;
+        static constexpr size_t chunkSize = std::max<size_t>(1, 4096 / sizeof(T));
+        T chunk[chunkSize];
+        for (size_t placed = 0; good && placed < header.count; placed += chunkSize) {
+            size_t take = std::min<size_t>(chunkSize, header.count - placed);
+            file.read(chunk, take * sizeof(T));
+            good = bool(file);
+            for (size_t i = 0; good && i < take; ++i) {
+                size_t ct = weighted ? copies[placed + i] : 1;
+                good = ct > 0;
+                if (good) {
+                    appendSorted(nodes, chunk[i], ct);
+                }
             }
-            else {
-                this->swap(succ, node, true);
+        }
+        if (!good) {
+            for (Node* node : nodes) {
+                deleteNode(node);
             }
-            eraseAll(node);
+            sz = 0;
+            return false;
         }
-        return ct;
+        linkAll(nodes);
+        return true;
+    }
+
+    /*
+        stats() runs in O(n) time, since it walks the tree to count the nodes,
+        and returns the counters kept since construction or resetStats() (see
+        SortedBucketStats) along with the bytes held by the nodes. The tree
+        has no buckets, so bucketSizes stays empty.
+    */
+    SortedBucketStats stats() const {
+        SortedBucketStats out;
+#ifdef SORTED_BUCKET_STATS
+        out = counters;
+#endif
+        size_t nodes = (endSentinel) ? 1 : 0;
+        inOrder(root, [&nodes](const Node*) { ++nodes; });
+        out.bytes = nodes * sizeof(Node);
+        return out;
+    }
+
+    /* resetStats() zeroes the counters, a no-op without SORTED_BUCKET_STATS */
+    void resetStats() noexcept {
+#ifdef SORTED_BUCKET_STATS
+        counters = SortedBucketStats();
+#endif
     }
 
 #ifndef NDEBUG
@@ -642,36 +1106,391 @@ public:
             //cout << " pushed " << ((node->right) ? " val " : "null") << 
             //(node->right ? node->right->val : 0) << endl;
         }
-        std::cout << std::endl;
+        std::cout << std::endl;
+    }
+#endif
+
+private:
+    inline void init() {
+        endSentinel = std::allocator_traits<AllocNode>::allocate(
+            allocNode, 1);
+        std::allocator_traits<AllocNode>::construct(allocNode, endSentinel,
+            sentinelValue<T>(), nullptr, Black, 0);
+        /*  Must explicitly set internal data when using traits::allocate and construct
+            combo, since class initializers not called this way. */
+        endSentinel->left = nullptr;
+        endSentinel->right = nullptr;
+        endSentinel->mass = 0;
+        root = endSentinel;
+        leftmost = endSentinel;
+    }
+
+    /*
+        buildSorted() runs in O(n) time and fills an empty tree from sorted input.
+        Runs of equal elements collapse into one node with copies, then the
+        nodes (plus endSentinel as the largest) are linked by recursive 
+        midpoint, which gives a tree whose null links differ in depth by at 
+        most one. Colouring the deepest level Red (when it is not full) and 
+        everything else Black then satisfies the red-black rules.
+    */
+    template <class InputIterator>
+    void buildSorted(InputIterator beginIt, InputIterator endIt) {
+        assert(sz == 0 && root == endSentinel);
+        std::vector<Node*> nodes;
+        if constexpr (std::forward_iterator<InputIterator>) {
+            nodes.reserve(std::distance(beginIt, endIt) + 1);
+        }
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            appendSorted(nodes, *it, 1);
+        }
+        linkAll(nodes);
+    }
+
+    /*  appendSorted() adds copies of n after the nodes built so far, joining
+        the last node if it holds the same element */
+    template <typename U>
+    void appendSorted(std::vector<Node*>& nodes, U&& n, size_t copies) {
+        sz += copies;
+        if (!nodes.empty() && !comp(nodes.back()->val, n)) {
+            /* sorted, so not less means equal */
+            nodes.back()->copies += copies;
+            return;
+        }
+        Node* node = std::allocator_traits<AllocNode>::allocate(allocNode, 1);
+        std::allocator_traits<AllocNode>::construct(allocNode, node, 
+            std::forward<U>(n), nullptr, Black, copies);
+        node->left = nullptr;
+        node->right = nullptr;
+        nodes.push_back(node);
+    }
+
+    /*  linkAll() finishes buildSorted(), linking the nodes from appendSorted()
+        into the tree. With no nodes, the tree is left holding only endSentinel */
+    void linkAll(std::vector<Node*>& nodes) noexcept {
+        if (nodes.empty()) {
+            attachSentinel(nullptr);
+            return;
+        }
+        leftmost = nodes.front();
+        nodes.push_back(endSentinel);
+        size_t redDepth = std::has_single_bit(nodes.size() + 1)
+            ? nodes.size() /* full last level, no depth reaches this */
+            : std::bit_width(nodes.size()) - 1;
+        root = linkSorted(nodes, 0, nodes.size(), 0, redDepth, nullptr);
+    }
+
+    /* linkSorted() is the recursive helper of buildSorted() for nodes[lo, hi) */
+    Node* linkSorted(std::vector<Node*>& nodes, size_t lo, size_t hi, 
+                     size_t depth, size_t redDepth, Node* par) noexcept {
+        if (lo >= hi) {
+            return nullptr;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        Node* node = nodes[mid];
+        node->par = par;
+        node->color = (depth == redDepth) ? Red : Black;
+        node->left = linkSorted(nodes, lo, mid, depth + 1, redDepth, node);
+        node->right = linkSorted(nodes, mid + 1, hi, depth + 1, redDepth, node);
+        node->mass = node->copies;
+        node->mass += (node->left) ? node->left->mass : 0;
+        node->mass += (node->right) ? node->right->mass : 0;
+        return node;
+    }
+
+    /*  collect() appends every node under node to nodes in sorted order, bar
+        endSentinel */
+    void collect(Node* node, std::vector<Node*>& nodes) const {
+        if (!node) {
+            return;
+        }
+        collect(node->left, nodes);
+        if (node != endSentinel) {
+            nodes.push_back(node);
+        }
+        collect(node->right, nodes);
+    }
+
+    /* rightmost() returns the largest node under node */
+    static inline Node* rightmost(Node* node) noexcept {
+        while (node->right) {
+            node = node->right;
+        }
+        return node;
+    }
+
+    /*  blackHeight() returns the number of Black nodes on any path from node 
+        down to a null link, counting node itself */
+    static inline size_t blackHeight(const Node* node) noexcept {
+        size_t h = 0;
+        for (; node; node = node->left) {
+            h += (node->color == Black);
+        }
+        return h;
+    }
+
+    /*  
+        detachSentinel() runs in O(log(n)) time and unlinks endSentinel, so 
+        that split() and join() work on real elements only. It returns the
+        root of what is left, or nullptr if the tree is empty.
+    */
+    Node* detachSentinel() noexcept {
+        if (sz == 0) {
+            return nullptr;
+        }
+        unlink(endSentinel);
+        return root;
+    }
+
+    /*
+        attachSentinel() runs in O(log(n)) time and makes top, a valid red-black
+        tree detached from any other (or nullptr), the whole tree. endSentinel
+        is linked back in after its largest node, and leftmost is found again.
+    */
+    void attachSentinel(Node* top) noexcept {
+        endSentinel->left = nullptr;
+        endSentinel->right = nullptr;
+        endSentinel->mass = 0;
+        if (!top) {
+            endSentinel->par = nullptr;
+            endSentinel->color = Black;
+            root = endSentinel;
+            leftmost = endSentinel;
+            return;
+        }
+        top->par = nullptr;
+        top->color = Black;
+        root = top;
+        leftmost = top;
+        while (leftmost->left) {
+            leftmost = leftmost->left;
+        }
+        Node* last = rightmost(top);
+        last->right = endSentinel;
+        endSentinel->par = last;
+        endSentinel->color = Red;
+        balanceDoubleRed(endSentinel);
+    }
+
+    /*
+        joinNodes() runs in O(|blackHeight(lower) - blackHeight(upper)| + 1) 
+        time and links the detached trees lower and upper (either may be 
+        nullptr) into one, with middle in between. Every element of lower must
+        be below middle, and every element of upper above it. middle is hung 
+        red on the spine of the taller tree, at the first Black node as high 
+        as the shorter tree, and the double red this may leave is fixed on the
+        way back up. It returns the new root.
+    */
+    Node* joinNodes(Node* lower, Node* middle, Node* upper) noexcept {
+        if (lower) {
+            lower->par = nullptr;
+            lower->color = Black;
+        }
+        if (upper) {
+            upper->par = nullptr;
+            upper->color = Black;
+        }
+        size_t lowerHeight = blackHeight(lower);
+        size_t upperHeight = blackHeight(upper);
+        size_t lowerMass = (lower) ? lower->mass : 0;
+        size_t upperMass = (upper) ? upper->mass : 0;
+        if (lowerHeight == upperHeight) {
+            middle->par = nullptr;
+            middle->left = lower;
+            middle->right = upper;
+            middle->color = Black;
+            middle->mass = middle->copies + lowerMass + upperMass;
+            if (lower) {
+                lower->par = middle;
+            }
+            if (upper) {
+                upper->par = middle;
+            }
+            return middle;
+        }
+        bool lowerTaller = lowerHeight > upperHeight;
+        Node* tall = (lowerTaller) ? lower : upper;
+        size_t target = (lowerTaller) ? upperHeight : lowerHeight;
+        /*  walk the inner spine of the taller tree down to the first Black 
+            node as high as the shorter tree (or a null link if that is empty) */
+        Node* par = nullptr;
+        Node* node = tall;
+        size_t h = (lowerTaller) ? lowerHeight : upperHeight;
+        while (node && (node->color != Black || h != target)) {
+            h -= (node->color == Black);
+            par = node;
+            node = (lowerTaller) ? node->right : node->left;
+        }
+        Node* small = (lowerTaller) ? upper : lower;
+        middle->par = par;
+        middle->color = Red;
+        middle->left = (lowerTaller) ? node : small;
+        middle->right = (lowerTaller) ? small : node;
+        if (middle->left) {
+            middle->left->par = middle;
+        }
+        if (middle->right) {
+            middle->right->par = middle;
+        }
+        middle->mass = middle->copies + ((node) ? node->mass : 0) + 
+                       ((lowerTaller) ? upperMass : lowerMass);
+        if (lowerTaller) {
+            par->right = middle;
+        }
+        else {
+            par->left = middle;
+        }
+        updateMass(par, middle->mass - ((node) ? node->mass : 0));
+        root = tall;
+        balanceDoubleRed(middle);
+        return root;
+    }
+
+    /*
+        splitNodes() runs in O(log(n)) time and cuts the detached tree under
+        node into the elements below key and the rest, returned as two 
+        detached trees. Every node on the search path goes to one side or the
+        other, and joinNodes() attaches it there together with the subtree 
+        hanging off the path next to it. The black heights of the subtrees 
+        joined on either side only grow, which keeps the total cost in 
+        O(log(n)) rather than O(log(n)) per join.
+    */
+    std::pair<Node*, Node*> splitNodes(Node* node, const T& key) noexcept {
+        if (!node) {
+            return {nullptr, nullptr};
+        }
+        Node* left = node->left;
+        Node* right = node->right;
+        if (comp(node->val, key)) {
+            auto [lower, upper] = splitNodes(right, key);
+            return {joinNodes(left, node, lower), upper};
+        }
+        auto [lower, upper] = splitNodes(left, key);
+        return {lower, joinNodes(upper, node, right)};
+    }
+
+    /*
+        place() runs in O(log(n)) time and adds copies of n, counting them on
+        the way down. Only if no equal element is present is make(par) called 
+        for the new leaf under par, which it returns. n is not read after 
+        that, so make may move from it.
+    */
+    template <typename Make>
+    Iterator place(const T& n, size_t copies, Make&& make) {
+        sz += copies;
+        Node* node = root;
+        while (node) {
+            node->mass += copies;
+            if (node == endSentinel) {
+                if (!endSentinel->left) {
+                    Node* fresh = make(endSentinel);
+                    endSentinel->left = fresh;
+                    balanceDoubleRed(fresh);
+                    return insertHelper(fresh);
+                }
+                node = endSentinel->left;
+            }
+            else if (!comp(n, node->val) && !comp(node->val, n)) { /* Equality */
+                node->copies += copies;
+                return insertHelper(node);
+            }
+            else if (comp(n, node->val)) {
+                if (!node->left) {
+                    Node* fresh = make(node);
+                    node->left = fresh;
+                    balanceDoubleRed(fresh);
+                    return insertHelper(fresh);
+                }
+                node = node->left;
+            }
+            else {
+                if (!node->right) {
+                    Node* fresh = make(node);
+                    node->right = fresh;
+                    balanceDoubleRed(fresh);
+                    return insertHelper(fresh);
+                }
+                node = node->right;
+            }
+        }
+        return insertHelper(static_cast<Node*>(nullptr));
+    }
+
+    /*
+        placeAt() is place() which first tries to link n right before hint. 
+        That is only done if n is not below the element before hint and not 
+        above hint (the sentinel being above everything), and then no 
+        comparison is needed beyond those two. If n equals either neighbour, 
+        that node takes the copies. Otherwise it becomes the right child of 
+        the element before hint or the left child of hint, whichever is free,
+        as one of them always is.
+    */
+    template <typename Make>
+    Iterator placeAt(Node* hint, const T& n, size_t copies, Make&& make) {
+        Node* prev = (hint == leftmost) ? nullptr : (--Iterator(hint)).nodePtr;
+        if ((prev && comp(n, prev->val)) || (hint != endSentinel && comp(hint->val, n))) {
+            return place(n, copies, make);
+        }
+        sz += copies;
+        Node* equal = (prev && !comp(prev->val, n)) ? prev
+                    : (hint != endSentinel && !comp(n, hint->val)) ? hint 
+                    : nullptr;
+        if (equal) {
+            equal->copies += copies;
+            updateMass(equal, copies);
+            return Iterator(equal);
+        }
+        Node* fresh;
+        if (!hint->left) {
+            fresh = make(hint);
+            hint->left = fresh;
+        }
+        else {
+            fresh = make(prev);
+            prev->right = fresh;
+        }
+        updateMass(fresh->par, copies);
+        balanceDoubleRed(fresh);
+        return insertHelper(fresh);
     }
-#endif
 
-private:
-    inline void init() {
-        endSentinel = std::allocator_traits<AllocNode>::allocate(
-            allocNode, 1);
-        std::allocator_traits<AllocNode>::construct(allocNode, endSentinel,
-            T{
-            #ifndef NDEBUG 
-                SENTINEL_FLAG // if no flag, we use T{} constructor.
-            #endif
-            }, nullptr, Black, 0);
-        /*  Must explicitly set internal data when using traits::allocate and construct
-            combo, since class initializers not called this way. */
-        endSentinel->left = nullptr;
-        endSentinel->right = nullptr;
-        endSentinel->mass = 0;
-        root = endSentinel;
-        leftmost = endSentinel;
+    /*  hintNode() turns a hint into the node to insert before, taking the 
+        null Iterator from a failed find() as end() */
+    inline Node* hintNode(const Iterator& hint) const noexcept {
+        return hint.nodePtr ? hint.nodePtr : endSentinel;
+    }
+
+    /*  attach() places a node which is already built, trying right before 
+        hint first, and frees it instead if an equal element took its copies */
+    Iterator attach(Node* fresh, Node* hint) {
+        bool linked = false;
+        Iterator it = placeAt(hint, fresh->val, fresh->copies, [&](Node* par) {
+            fresh->par = par;
+            linked = true;
+            return fresh;
+        });
+        if (!linked) {
+            deleteNode(fresh);
+        }
+        return it;
+    }
+
+    /* newNode() allocates a red leaf under par holding T(args...) */
+    template <typename... Args>
+    inline Node* newNode(Node* par, size_t copies, Args&&... args) {
+        Node* node = std::allocator_traits<AllocNode>::allocate(allocNode, 1, 
+            /* hint location */ par);
+        std::allocator_traits<AllocNode>::construct(allocNode, node, std::in_place, 
+            par, copies, std::forward<Args>(args)...);
+        return node;
     }
 
     /*  insertHelper catches all return paths from insert(), and injects a check 
         where leftmost is replaced if we inserted a new smallest element. */
-    inline Iterator insertHelper(const T& n, Node* node) noexcept {
+    inline Iterator insertHelper(Node* node) noexcept {
         if (!node) {
             return Iterator(node);
         }
-        if (leftmost == endSentinel || Comp{} (n, leftmost->val)) {
+        if (leftmost == endSentinel || comp(node->val, leftmost->val)) {
             leftmost = node;
         }
         return Iterator(node);
@@ -713,7 +1532,10 @@ private:
             }
         }
         std::swap(a->left, b->left);
-        std::swap(a->color, b->color);
+        /* color is a bit-field, so it cannot go through std::swap */
+        size_t aColor = a->color;
+        a->color = b->color;
+        b->color = aColor;
         if (a->left) {
             a->left->par = a;
         }
@@ -737,10 +1559,16 @@ private:
         if (b->right) {
             b->right->par = b;
         }
-        // Swap only the part of mass that's from its children, not itself!
-        int aMassBelow = a->mass - a->copies, bMassBelow = b->mass - b->copies;
-        a->mass = bMassBelow + a->copies;
-        b->mass = aMassBelow + b->copies;
+        /*  a now roots b's old subtree, which holds the same elements as before,
+            so it takes b's whole mass. b only takes the part of a's mass that's
+            from its children. Any nodes strictly between them now hold b's
+            copies instead of a's. */
+        size_t aMass = a->mass, bMass = b->mass;
+        a->mass = bMass;
+        b->mass = aMass - a->copies + b->copies;
+        for (Node* between = b->par; between != a; between = between->par) {
+            between->mass += b->copies - a->copies;
+        }
     }
     
     /* 
@@ -756,6 +1584,7 @@ private:
         if (!child) {
             return;
         }
+        SORTED_BUCKET_COUNT(rotations, 1);
         if (root == upperPivot) {
             root = child;
         }
@@ -794,6 +1623,7 @@ private:
         if (!child) {
             return;
         }
+        SORTED_BUCKET_COUNT(rotations, 1);
         if (root == upperPivot) {
             root = child;
         }
@@ -819,11 +1649,116 @@ private:
         child->mass += (child->left) ? child->left->mass : 0;
     }
 
+    /*
+        descend() is the single search shared by the lookups. It returns the 
+        first node not below n (above n if Upper), or endSentinel if there is
+        none, together with the number of elements before that node.
+    */
+    template <bool Upper, typename K>
+    inline std::pair<Node*, size_t> descend(const K& n) noexcept {
+        Node* node = root;
+        Node* bound = endSentinel;
+        size_t below = 0;
+        while (node) {
+            if (node == endSentinel) {
+                assert(endSentinel->right == nullptr);
+                node = node->left;
+            }
+            else if (Upper ? !comp(n, node->val) : comp(node->val, n)) {
+                below += (node->left) ? node->left->mass : 0;
+                below += node->copies;
+                node = node->right;
+            }
+            else if (!Upper && !comp(n, node->val)) { /* Equality */
+                /*  Duplicates share a node, so nothing equal is further down */
+                below += (node->left) ? node->left->mass : 0;
+                return std::make_pair(node, below);
+            }
+            else {
+                bound = node;
+                node = node->left;
+            }
+        }
+        return std::make_pair(bound, below);
+    }
+
+    /*
+        descendMany() runs descend<false>() for every key, BatchLookupLanes at a
+        time, and calls visit(i, node, below) with the result for keys[i]. Each
+        round moves every unfinished key one level down and prefetches its 
+        next node. Stepping right adds the whole mass of the node left behind,
+        and the mass of the right child is taken off once that child is loaded
+        anyway, so no round reads a node it did not prefetch. Below 
+        BatchLookupMinBytes of nodes, every key is descended on its own.
+    */
+    template <typename Visit>
+    void descendMany(std::span<const T> keys, Visit&& visit) noexcept {
+        if (sz * sizeof(Node) < BatchLookupMinBytes) {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                auto [node, below] = descend<false>(keys[i]);
+                visit(i, node, below);
+            }
+            return;
+        }
+        Node* nodes[BatchLookupLanes];
+        Node* bounds[BatchLookupLanes];
+        size_t below[BatchLookupLanes];
+        bool wentRight[BatchLookupLanes];
+        for (size_t first = 0; first < keys.size(); first += BatchLookupLanes) {
+            size_t lanes = std::min(BatchLookupLanes, keys.size() - first);
+            for (size_t l = 0; l < lanes; ++l) {
+                nodes[l] = root;
+                bounds[l] = endSentinel;
+                below[l] = 0;
+                wentRight[l] = false;
+            }
+            for (size_t active = lanes; active > 0;) {
+                active = 0;
+                for (size_t l = 0; l < lanes; ++l) {
+                    Node* node = nodes[l];
+                    if (!node) {
+                        continue;
+                    }
+                    const T& n = keys[first + l];
+                    if (wentRight[l]) {
+                        below[l] -= node->mass;
+                        wentRight[l] = false;
+                    }
+                    if (node == endSentinel) {
+                        node = node->left;
+                    }
+                    else if (comp(node->val, n)) {
+                        below[l] += node->mass;
+                        wentRight[l] = true;
+                        node = node->right;
+                    }
+                    else if (!comp(n, node->val)) { /* Equality */
+                        below[l] += (node->left) ? node->left->mass : 0;
+                        bounds[l] = node;
+                        node = nullptr;
+                    }
+                    else {
+                        bounds[l] = node;
+                        node = node->left;
+                    }
+                    nodes[l] = node;
+                    if (node) {
+                        prefetchRead(node, sizeof(Node));
+                        ++active;
+                    }
+                }
+            }
+            for (size_t l = 0; l < lanes; ++l) {
+                visit(first + l, bounds[l], below[l]);
+            }
+        }
+    }
+
     /* 
         updateMass runs in O(logn) time and propogates a mass change of (ct) up
         the tree to the root, starting from node.
     */
-    inline void updateMass(Node* node, int ct) noexcept {
+    inline void updateMass(Node* node, std::ptrdiff_t ct) noexcept {
         while (node) {
             node->mass += ct;
             node = node->par;
@@ -851,6 +1786,7 @@ private:
                 return;
             }
             bool parOnLeft = (grandpar->left == par);
+            SORTED_BUCKET_COUNT(redFixups, 1);
 
             /* red problem child is along axis of rotation (lhs) */
             if (parOnLeft && child == par->left) {
@@ -868,6 +1804,8 @@ private:
             }
             /* red problem child is out-of-line (lhs) */
             else if (parOnLeft && child == par->right) {
+                /* a double rotation, done in one go */
+                SORTED_BUCKET_COUNT(rotations, 2);
                 if (grandpar == root) {
                     root = child;
                 }
@@ -904,6 +1842,7 @@ private:
             }
             /* red problem child is out-of-line (rhs) */
             else {
+                SORTED_BUCKET_COUNT(rotations, 2);
                 if (grandpar == root) {
                     root = child;
                 }
@@ -959,6 +1898,7 @@ private:
             Node* par = child->par;
             bool childOnLeft = (par->left == child);
             Node* sibling = (childOnLeft) ? par->right : par->left;
+            SORTED_BUCKET_COUNT(blackFixups, 1);
             // impossible to have null sibling if valid RB tree.
 
             // red sibling must have black children, then also par must be black.
@@ -1020,15 +1960,257 @@ private:
         }
     }
 
+    /*
+        release() frees every node, endSentinel included. An allocator which
+        can hand all of its memory back at once (SortedBucketPool) does so
+        instead of taking the nodes back one by one, and then the nodes are 
+        only visited if T has a destructor to run.
+    */
+    void release() noexcept {
+        if constexpr (requires (AllocNode& alloc) { alloc.release(); }) {
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                destroy(root, false);
+            }
+            allocNode.release();
+        }
+        else {
+            destroy(root);
+        }
+        root = leftmost = endSentinel = nullptr;
+    }
+
+    /* 
+        destroy() runs in O(n) time and destroys the whole subtree under node
+        without recursing. While the node has a left child, that child is 
+        rotated up in its place, and a node without one is destroyed before
+        moving on to its right child. This visits every node about twice and
+        needs no stack. Unless dealloc is set, the memory is left to the
+        allocator to release in bulk.
+    */
+    void destroy(Node* node, bool dealloc = true) noexcept {
+        while (node) {
+            if (Node* left = node->left) {
+                node->left = left->right;
+                left->right = node;
+                node = left;
+                continue;
+            }
+            Node* right = node->right;
+            if (dealloc) {
+                deleteNode(node);
+            }
+            else {
+                std::allocator_traits<AllocNode>::destroy(allocNode, node);
+            }
+            node = right;
+        }
+    }
+
+    /* inOrder() calls visit on every node under node in sorted order, bar endSentinel */
+    template <typename Visit>
+    void inOrder(const Node* node, Visit&& visit) const {
+        if (!node) {
+            return;
+        }
+        inOrder(node->left, visit);
+        if (node != endSentinel) {
+            visit(node);
+        }
+        inOrder(node->right, visit);
+    }
+
+    /*
+        unlink() runs in O(log(n)) time and takes node out of the tree with all
+        of its copies, rebalancing around the gap, and returns the copies. The
+        node itself is left to the caller.
+    */
+    size_t unlink(Node* node) noexcept {
+        Node* par = node->par;
+        size_t ct = node->copies;
+
+        if (node == leftmost) {
+            leftmost = (++Iterator(leftmost)).nodePtr;
+        }
+
+        //  node is a leaf. 
+        if (!node->left && !node->right) {
+            if (node == root) {
+                root = nullptr;
+            }
+            else {
+                updateMass(par, 0 - ct);
+                bool nodeOnLeft = (par->left == node);
+                if (nodeOnLeft) {
+                    par->left = nullptr;
+                }
+                else {
+                    par->right = nullptr;
+                }
+                if (node->color == Black) {
+                    bool nodeRemoved = false;
+                    while (!nodeRemoved) {
+                        /* If node is a black leaf, then a sibling must exist due
+                            to length property for sibling's branch. This might
+                            produce a "DoubleBlack null node" which is not an 
+                            actual node, so we cannot use balanceDoubleBlack(node).
+                            Instead, handle the scenario right here.
+                        */
+                        Node* sibling = (nodeOnLeft) ? par->right : par->left;
+                        SORTED_BUCKET_COUNT(blackFixups, 1);
+
+                        if (sibling->color == Red) {
+                            /* sibling must have exactly two black children to
+                                satisfy initial length property */
+                            sibling->color = Black;
+                            par->color = Red;
+                            if (nodeOnLeft) {
+                                leftRotate(par);
+                            }
+                            else {
+                                rightRotate(par);
+                            }
+                            // Repeat loop brings us to black sibling case
+                        }
+                        else {
+                            // black sibling has no children.
+                            if (!sibling->left && !sibling->right) {
+                                par->color += sibling->color;
+                                sibling->color = Red;
+                                balanceDoubleBlack(par);
+                                nodeRemoved = true;
+                            }
+                            /* black sibling has an in-line child along rotation
+                                (lhs), which must be red, other child irrelevant */
+                            else if (!nodeOnLeft && sibling->left) {
+                                sibling->color = par->color;
+                                sibling->left->color = Black;
+                                par->color = Black;
+                                rightRotate(par);
+                                nodeRemoved = true;
+                            }
+                            /* black sibling has an in-line child along rotation
+                                (rhs), which must be red, other child irrelevant */
+                            else if (nodeOnLeft && sibling->right) {
+                                sibling->color = par->color;
+                                sibling->right->color = Black;
+                                par->color = Black;
+                                leftRotate(par);
+                                nodeRemoved = true;
+                            }
+                            /* black sibling has out-of-line child (lhs), which
+                                must be red, create an in-line red child from it */
+                            else if (nodeOnLeft && sibling->left) {
+                                sibling->left->color = Black;
+                                sibling->color = Red;
+                                rightRotate(sibling);
+                                // continue loop, now sibling has in-line child
+                            }
+                            /* black sibling has out-of-line child (rhs), which 
+                                must be red, create an in-line red child from it */
+                            else {
+                                sibling->right->color = Black;
+                                sibling->color = Red;
+                                leftRotate(sibling);
+                                // continue loop, now sibling has in-line child
+                            }
+                        }
+                    }
+                }
+            }
+            sz -= ct;
+        }
+
+        // node has only a left child
+        else if (node->left && !node->right) {
+            node->left->par = node->par;
+            if (node == root) {
+                root = node->left;
+                root->color = Black;
+            }
+            else {
+                node->left->color += node->color;
+                if (par->left == node) {
+                    par->left = node->left;
+                }
+                else {
+                    par->right = node->left;
+                }
+            }
+            updateMass(par, 0 - ct);
+            balanceDoubleBlack(node->left);
+            sz -= ct;
+        }
+
+        // node has only a right child
+        else if (!node->left && node->right) {
+            node->right->par = node->par;
+            if (node == root) {
+                root = node->right;
+                root->color = Black;
+            }
+            else {
+                node->right->color += node->color;
+                if (par->left == node) {
+                    par->left = node->right;
+                }
+                else {
+                    par->right = node->right;
+                }
+            }
+            updateMass(par, 0 - ct);
+            balanceDoubleBlack(node->right);
+            sz -= ct;
+        }
+
+        // node has two children
+        else {
+            /*  Normal BST deletion, find next in-order successor.
+                Succ now takes the place of node.
+                We must physically rearrange (not simply swap contents of) successor
+                node, so that Iterators and pointers become invalid after we erase
+                that node, rather than cause confusion when contents of an
+                apparently valid Iterator suddenly change.
+            */
+            Node* succ = node->right;
+            while (succ->left) {
+                succ = succ->left;
+            }
+
+            if (node->right != succ) {
+                this->swap(succ, node, false);
+            }
+            else {
+                this->swap(succ, node, true);
+            }
+            unlink(node);
+        }
+        return ct;
+    }
+
+    /* deleteNode() destroys a single node and hands its memory back */
+    inline void deleteNode(Node* node) noexcept {
+        std::allocator_traits<AllocNode>::destroy(allocNode, node);
+        std::allocator_traits<AllocNode>::deallocate(allocNode, node, 1);
+    }
+
     /* 
-        Destructor recursive helper.
+        Copy constructor recursive helper. Clones the subtree under par and 
+        points endSentinel at the clone of the old sentinel.
     */
-    void destroy(Node* node) noexcept {
-        if (node) {
-            std::allocator_traits<AllocNode>::destroy(allocNode, node->left);
-            std::allocator_traits<AllocNode>::destroy(allocNode, node->right);
-            std::allocator_traits<AllocNode>::destroy(allocNode, node);
+    Node* clone(const Node* node, Node* par, const Node* oldSentinel) {
+        if (!node) {
+            return nullptr;
         }
+        Node* copy = std::allocator_traits<AllocNode>::allocate(allocNode, 1);
+        std::allocator_traits<AllocNode>::construct(allocNode, copy, 
+            node->val, par, node->color, node->copies);
+        copy->mass = node->mass;
+        copy->left = clone(node->left, copy, oldSentinel);
+        copy->right = clone(node->right, copy, oldSentinel);
+        if (node == oldSentinel) {
+            endSentinel = copy;
+        }
+        return copy;
     }
 
     // Private members
@@ -1037,6 +2219,10 @@ private:
     Node*       root            {nullptr};
     Node*       leftmost        {nullptr};
     Node*       endSentinel     {nullptr};
+    [[no_unique_address]] StatsComp<Comp> comp;
+#ifdef SORTED_BUCKET_STATS
+    SortedBucketStats counters;
+#endif
 };
 
 #endif // UTIL_SORTED_BUCKET_RBT_H
\ No newline at end of file
@@ -0,0 +1,301 @@
+/**
+ * @file sortedBucketRegion.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Huge page and NUMA aware region allocator for the Sorted Bucket containers
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * At hundreds of millions of elements, a lookup spends much of its time on
+ * TLB misses: every RBT node and every VV bucket sits on its own 4 KiB page.
+ * SortedBucketRegion serves all of a container's buckets or nodes out of a few
+ * large, 2 MiB aligned chunks instead, backed by huge pages, so one TLB entry
+ * covers hundreds of buckets. Chunks can also be bound to one NUMA node.
+ *
+ * Huge pages are taken from the reserved pool (MAP_HUGETLB) when one is set
+ * up, or else the chunk is mapped normally and madvise(MADV_HUGEPAGE) asks for
+ * transparent huge pages. A NUMA node is bound with mbind(MPOL_BIND), and
+ * silently left alone if the kernel has no NUMA support. Off Linux, chunks
+ * come from aligned operator new and neither option does anything.
+ *
+ * Blocks are sized in cache lines (64 bytes) and aligned to one. Freed blocks
+ * go onto a free list for their size and are reused by the next allocation
+ * of the same size, so the equally sized buckets of VV, or nodes of RBT and
+ * BT, recycle each other's memory and stay packed in their chunks. Blocks of
+ * at least half a chunk get a mapping of their own, which is unmapped when
+ * they are freed. Chunks themselves are kept until the process exits.
+ *
+ * Usage (the allocator is rebound to the node type where there is one):
+ *      SortedBucketVV<int, std::less<int>, SortedBucketRegion<int>> vv;
+ *      SortedBucketRBT<int, std::less<int>, SortedBucketRegion<int, true, 1>> rbt; // node 1
+ *      SortedBucketRegion<int>::reserve(buckets * (2*DefaultSmallDensity + 4));
+ *
+ * reserve() maps one chunk for that many elements up front, so that the
+ * buckets allocated next are laid out back to back in one contiguous region.
+ *
+ * Every allocator with the same HugePages and NumaNode shares one arena,
+ * which is what lets VV's buckets (each a std::vector constructed on its own)
+ * come from the same region. All copies compare equal. The arena takes a
+ * lock on every allocation and free, so it is safe across threads, but node
+ * churn is cheaper through SortedBucketPool when huge pages are not needed.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_REGION_H
+#define UTIL_SORTED_BUCKET_REGION_H
+
+/* Size of each chunk mapped for the arena, a multiple of the huge page size */
+#define DefaultRegionChunk (size_t(8) << 20)
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // ifdef __linux__
+
+/* Huge page size, and the alignment of every chunk */
+constexpr size_t RegionHugePage = size_t(2) << 20;
+
+/* Granularity and alignment of every block */
+constexpr size_t RegionLine = 64;
+
+/*
+    SortedBucketArena is the process wide region behind every
+    SortedBucketRegion with the same HugePages and NumaNode (-1 for no
+    binding). It is never destroyed, so containers with static storage can
+    still free into it at exit.
+*/
+template <bool HugePages, int NumaNode>
+class SortedBucketArena {
+public:
+    static SortedBucketArena& instance() {
+        static SortedBucketArena* arena = new SortedBucketArena();
+        return *arena;
+    }
+
+    /*
+        allocate() runs in amortized O(1) time and returns a block of at least
+        bytes, aligned to a cache line: a freed block of the same size if there
+        is one, or else the next one bumped out of the newest chunk.
+    */
+    void* allocate(size_t bytes) {
+        bytes = roundUp(std::max<size_t>(bytes, 1), RegionLine);
+        if (bytes >= DefaultRegionChunk / 2) {
+            size_t length = roundUp(bytes, RegionHugePage);
+            bool huge = false;
+            void* block = mapChunk(length, huge);
+            std::lock_guard<std::mutex> guard(lock);
+            mappedBytes += length;
+            fromHugeTlb |= huge;
+            return block;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = freeLists.find(bytes);
+        if (found != freeLists.end() && found->second) {
+            FreeBlock* block = found->second;
+            found->second = block->next;
+            return block;
+        }
+        if (size_t(limit - cursor) < bytes) {
+            cursor = static_cast<char*>(mapChunk(DefaultRegionChunk, fromHugeTlb));
+            limit = cursor + DefaultRegionChunk;
+            mappedBytes += DefaultRegionChunk;
+        }
+        void* block = cursor;
+        cursor += bytes;
+        return block;
+    }
+
+    /*
+        deallocate() runs in O(1) time and puts the block on the free list for
+        its size, or unmaps it if it had a mapping of its own.
+    */
+    void deallocate(void* ptr, size_t bytes) noexcept {
+        bytes = roundUp(std::max<size_t>(bytes, 1), RegionLine);
+        if (bytes >= DefaultRegionChunk / 2) {
+            size_t length = roundUp(bytes, RegionHugePage);
+            unmapChunk(ptr, length);
+            std::lock_guard<std::mutex> guard(lock);
+            mappedBytes -= length;
+            return;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        FreeBlock*& head = freeLists[bytes];
+        block->next = head;
+        head = block;
+    }
+
+    /*
+        reserve() maps a single chunk of at least bytes, unless what is left of
+        the newest chunk already holds them, so that the next bytes allocated
+        are contiguous. The rest of the previous chunk is left unused.
+    */
+    void reserve(size_t bytes) {
+        bytes = roundUp(bytes, RegionHugePage);
+        std::lock_guard<std::mutex> guard(lock);
+        if (size_t(limit - cursor) >= bytes) {
+            return;
+        }
+        size_t length = std::max(bytes, DefaultRegionChunk);
+        cursor = static_cast<char*>(mapChunk(length, fromHugeTlb));
+        limit = cursor + length;
+        mappedBytes += length;
+    }
+
+    /* Bytes mapped by the arena so far, in use or not */
+    size_t mapped() const noexcept {
+        std::lock_guard<std::mutex> guard(lock);
+        return mappedBytes;
+    }
+
+    /* Whether any chunk came from the reserved huge page pool */
+    bool hugeTlb() const noexcept {
+        std::lock_guard<std::mutex> guard(lock);
+        return fromHugeTlb;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock*  next;
+    };
+
+    SortedBucketArena() {}
+
+    static inline size_t roundUp(size_t n, size_t to) noexcept {
+        return (n + to - 1) / to * to;
+    }
+
+    /*  mapChunk() maps length bytes (a multiple of RegionHugePage) aligned to
+        RegionHugePage, and sets huge if they came from the huge page pool */
+    static void* mapChunk(size_t length, bool& huge) {
+#ifdef __linux__
+        void* chunk = MAP_FAILED;
+        if constexpr (HugePages) {
+            chunk = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (chunk != MAP_FAILED) {
+                huge = true;
+            }
+        }
+        if (chunk == MAP_FAILED) {
+            /* over-map by a huge page, then trim both ends down to an aligned chunk */
+            char* raw = static_cast<char*>(mmap(nullptr, length + RegionHugePage,
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (raw == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            char* aligned = reinterpret_cast<char*>(
+                roundUp(reinterpret_cast<std::uintptr_t>(raw), RegionHugePage));
+            if (aligned != raw) {
+                munmap(raw, aligned - raw);
+            }
+            munmap(aligned + length, raw + RegionHugePage - aligned);
+            chunk = aligned;
+#ifdef MADV_HUGEPAGE
+            if constexpr (HugePages) {
+                madvise(chunk, length, MADV_HUGEPAGE);
+            }
+#endif // ifdef MADV_HUGEPAGE
+        }
+#ifdef SYS_mbind
+        if constexpr (NumaNode >= 0) {
+            /* MPOL_BIND, from linux/mempolicy.h */
+            constexpr int bindPolicy = 2;
+            constexpr size_t maskBits = 8 * sizeof(unsigned long);
+            unsigned long mask[NumaNode / maskBits + 1] {};
+            mask[NumaNode / maskBits] = 1ul << (NumaNode % maskBits);
+            syscall(SYS_mbind, chunk, length, bindPolicy, mask, sizeof(mask) * 8 + 1, 0);
+        }
+#endif // ifdef SYS_mbind
+        return chunk;
+#else
+        (void)huge;
+        return ::operator new(length, std::align_val_t(RegionHugePage));
+#endif // ifdef __linux__
+    }
+
+    static void unmapChunk(void* chunk, size_t length) noexcept {
+#ifdef __linux__
+        munmap(chunk, length);
+#else
+        ::operator delete(chunk, std::align_val_t(RegionHugePage));
+#endif // ifdef __linux__
+    }
+
+    // Private members
+    mutable std::mutex                          lock;
+    std::unordered_map<size_t, FreeBlock*>      freeLists;      // by block size
+    char*                                       cursor      {nullptr};
+    char*                                       limit       {nullptr};
+    size_t                                      mappedBytes {0};
+    bool                                        fromHugeTlb {false};
+};
+
+template <typename T, bool HugePages = true, int NumaNode = -1>
+class SortedBucketRegion {
+public:
+    static_assert(alignof(T) <= RegionLine, "region blocks are aligned to a cache line");
+
+    using value_type        = T;
+    using size_type         = size_t;
+    using difference_type   = std::ptrdiff_t;
+    using is_always_equal   = std::true_type;
+    using Arena             = SortedBucketArena<HugePages, NumaNode>;
+
+    /*  allocator_traits cannot rebind through the non-type parameters on its
+        own, so spell it out */
+    template <typename U>
+    struct rebind {
+        using other = SortedBucketRegion<U, HugePages, NumaNode>;
+    };
+
+    /* Default constructor */
+    SortedBucketRegion() noexcept {}
+
+    /* Rebind constructor. Every instance uses the same arena */
+    template <typename U>
+    SortedBucketRegion(const SortedBucketRegion<U, HugePages, NumaNode>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(Arena::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        Arena::instance().deallocate(ptr, n * sizeof(T));
+    }
+
+    /*  reserve() makes room for n more elements (or nodes, through a rebound
+        allocator) in one contiguous chunk, see SortedBucketArena::reserve().
+        Each block is rounded up to a cache line, so allow for that in n */
+    static void reserve(size_t n) {
+        Arena::instance().reserve(n * sizeof(T));
+    }
+
+    /* Bytes mapped by the shared arena */
+    static size_t mapped() noexcept {
+        return Arena::instance().mapped();
+    }
+
+    template <typename U>
+    inline bool operator ==(const SortedBucketRegion<U, HugePages, NumaNode>&) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    inline bool operator !=(const SortedBucketRegion<U, HugePages, NumaNode>&) const noexcept {
+        return false;
+    }
+};
+
+#endif // UTIL_SORTED_BUCKET_REGION_H
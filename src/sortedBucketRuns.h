@@ -0,0 +1,946 @@
+/**
+ * @file sortedBucketRuns.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Run-length Sorted Bucket container for inputs with many duplicates
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Laid out like SortedBucketVV, as a vector of sorted buckets with fences and
+ * a Fenwick tree over the buckets, except that each bucket holds runs: a
+ * distinct value and how many copies of it are stored. A multiset of n
+ * elements with d distinct values then takes d runs instead of n elements,
+ * adding or dropping copies of a value already present never shifts a bucket,
+ * and iterating visits every value once. The Fenwick tree counts copies, so
+ * distance(), rank() and nth() still answer in elements, like the weighted
+ * RBT.
+ *
+ * Time complexities, for d distinct values in buckets of B runs:
+ *      find:               O(log(d))
+ *      distance:           O(log(d) + B)
+ *      nth:                O(log(d) + B)
+ *      rank:               O(log(d) + B)
+ *      countRange:         O(log(d) + B)
+ *      insert:             O(log(d)), or O(log(d) + B) for a new value
+ *      erase:              O(log(d)), or O(log(d) + B) for the last copy
+ *      eraseAll:           O(log(d) + B)
+ *      batch of k:         O(k*log(k) + distinct*(log(d) + B))
+ *      build from sorted:  O(n)
+ *
+ * Comp is stored, so it may carry state. If it is transparent, lookups and
+ * erases also take keys of any other type it compares against T.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_RUNS_H
+#define UTIL_SORTED_BUCKET_RUNS_H
+
+/*
+    The default number of runs per bucket. Runs are only shifted when a value
+    comes or goes, and distance() sums the copies of the runs in front of it
+    in its bucket, so buckets are kept smaller than in SortedBucketVV.
+*/
+#define DefaultRunDensity (size_t(128))
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "sortedBucketCommon.h"
+#include "sortedBucketSnapshot.h"
+
+//#define NDEBUG
+#ifndef NDEBUG
+#include <iostream>
+#include <string>
+#endif // ifndef NDEBUG
+
+template <typename T,
+          typename Comp     = std::less<T>,
+          typename Alloc    = std::allocator<T>>
+class SortedBucketRuns {
+public:
+    /* A distinct value along with the number of copies of it stored */
+    struct Run {
+        T               val;
+        size_t          copies;
+    };
+    using RunAlloc  = typename std::allocator_traits<Alloc>::template rebind_alloc<Run>;
+    using Bucket    = std::vector<Run, RunAlloc>;
+
+    friend struct Iterator;
+    struct Iterator {
+        friend class SortedBucketRuns;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        /*  difference_type is included here for compliance with iterator_traits,
+            but distance should be calculated from SortedBucketRuns::distance() */
+        using difference_type   = std::ptrdiff_t;
+        /*  Runs are ordered and merged by value, so it cannot be changed
+            through an Iterator */
+        using pointer           = value_type const*;
+        using reference         = value_type const&;
+
+        Iterator() noexcept {}
+
+        Iterator(typename std::vector<Bucket>::iterator targetBucket,
+                 typename Bucket::iterator targ) noexcept
+            : targetBucket(targetBucket)
+            , targ(targ) {}
+
+        inline reference operator *() const noexcept {
+            return targ->val;
+        }
+
+        inline pointer operator ->() const noexcept {
+            return std::addressof(targ->val);
+        }
+
+        inline bool operator ==(const Iterator& other) const noexcept {
+            return targetBucket == other.targetBucket && targ == other.targ;
+        }
+
+        inline bool operator !=(const Iterator& other) const noexcept {
+            return !(*this == other);
+        }
+
+        /* Number of copies of the value */
+        inline size_t copies() const noexcept {
+            return targ->copies;
+        }
+
+        /*  Pre-increment, to the next distinct value. Calling this on
+            SortedBucketRuns::end() may segfault, so requires checks like in
+            STL containers */
+        Iterator& operator ++() {
+            ++targ;
+            if (targ == targetBucket->end()) {
+                ++targetBucket;
+                targ = targetBucket->begin();
+            }
+            return *this;
+        }
+
+        Iterator operator ++(int) {
+            Iterator temp = *this;
+            operator++();
+            return temp;
+        }
+
+        /*  Pre-decrement, to the previous distinct value. Calling this on
+            SortedBucketRuns::begin() may segfault, so requires checks like in
+            STL containers */
+        Iterator& operator --() {
+            if (targ == targetBucket->begin()) {
+                --targetBucket;
+                targ = std::prev(targetBucket->end());
+            }
+            else {
+                --targ;
+            }
+            return *this;
+        }
+
+        Iterator operator --(int) {
+            Iterator temp = *this;
+            operator--();
+            return temp;
+        }
+
+    private:
+        typename std::vector<Bucket>::iterator  targetBucket {};
+        typename Bucket::iterator               targ {};
+    };
+
+    /* Default constructor */
+    SortedBucketRuns() {
+        init();
+    }
+
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucketRuns(const Comp& comp)
+        : comp(comp) {
+        init();
+    }
+
+    /* Copy constructor. Iterators are not stored, so members copy as they are */
+    SortedBucketRuns(const SortedBucketRuns& old) = default;
+
+    /* Move constructor. Leaves old as a valid empty container */
+    SortedBucketRuns(SortedBucketRuns&& old) noexcept
+        : sz(old.sz)
+        , distinctRuns(old.distinctRuns)
+        , bucketDensity(old.bucketDensity)
+        , buckets(std::move(old.buckets))
+        , bucketCopies(std::move(old.bucketCopies))
+        , bucketIndex(std::move(old.bucketIndex))
+        , fences(std::move(old.fences))
+        , comp(old.comp) {
+        old.clear();
+    }
+
+    /* Range constructor */
+    template <class InputIterator>
+    SortedBucketRuns(InputIterator beginIt, InputIterator endIt,
+                     const Comp& comp = Comp())
+        : comp(comp) {
+        init();
+        insertBatch(beginIt, endIt);
+    }
+
+    /*
+        Sorted range constructor. Input must already be sorted by Comp, so
+        equal elements are counted into runs as they come and the runs are
+        sliced straight into buckets in O(n).
+    */
+    template <class InputIterator>
+    SortedBucketRuns(SortedInputTag, InputIterator beginIt, InputIterator endIt,
+                     const Comp& comp = Comp())
+        : comp(comp) {
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            appendRun(*it, 1);
+        }
+        finishRuns();
+    }
+
+    /* Size getter, counting every copy */
+    size_t size() const noexcept {
+        return sz;
+    }
+
+    /* Number of distinct values, which is the number of runs */
+    size_t distinct() const noexcept {
+        return distinctRuns;
+    }
+
+    /* Density getter, in runs per bucket */
+    size_t getDensity() const noexcept {
+        return bucketDensity;
+    }
+
+    /* Comparator getter */
+    Comp getComp() const noexcept {
+        return comp;
+    }
+
+    /* Begin getter */
+    inline Iterator begin() noexcept {
+        return Iterator(buckets.begin(), buckets.front().begin());
+    }
+
+    /* End getter, the sentinel run which ends the last bucket */
+    inline Iterator end() noexcept {
+        return Iterator(std::prev(buckets.end()), std::prev(buckets.back().end()));
+    }
+
+    /*  Front element access. Calling front() on an empty SortedBucketRuns will
+        cause segfault, just like with other STL containers */
+    inline const T& front() noexcept {
+        return buckets.front().front().val;
+    }
+
+    /*  Back element access. Calling back() on an empty SortedBucketRuns will
+        cause segfault, just like with other STL containers */
+    inline const T& back() noexcept {
+        return *std::prev(end());
+    }
+
+    /*
+        lowerBound() runs in O(log(d)) time and returns the run of the first
+        value not below n.
+    */
+    Iterator lowerBound(const T& n) noexcept {
+        return lowerBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator lowerBound(const K& n) noexcept {
+        return bound<false>(n);
+    }
+
+    /*
+        upperBound() runs in O(log(d)) time and returns the run of the first
+        value above n.
+    */
+    Iterator upperBound(const T& n) noexcept {
+        return upperBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator upperBound(const K& n) noexcept {
+        return bound<true>(n);
+    }
+
+    /*
+        find() runs in O(log(d)) time and returns the run of n, or end() if n
+        is not present.
+    */
+    Iterator find(const T& n) noexcept {
+        return find<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator find(const K& n) noexcept {
+        Iterator it = lowerBound(n);
+        if (it == end() || comp(n, *it)) {
+            return end();
+        }
+        return it;
+    }
+
+    /* count() runs in O(log(d)) time and returns how many copies of n are stored */
+    size_t count(const T& n) noexcept {
+        return count<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t count(const K& n) noexcept {
+        Iterator it = find(n);
+        return (it == end()) ? 0 : it.copies();
+    }
+
+    /*
+        distance() runs in O(log(d) + B) time and returns the index (from 0)
+        of the first copy of n, counting every copy before it. If n is not
+        present then it returns -1.
+    */
+    std::ptrdiff_t distance(const T& n) noexcept {
+        return distance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::ptrdiff_t distance(const K& n) noexcept {
+        return findWithDistance(n).second;
+    }
+
+    /*
+        findWithDistance() runs in O(log(d) + B) time and returns a pair of:
+        the run of n, along with the index of its first copy. If n was not
+        found, the pair consists of the end() Iterator and a distance of -1.
+    */
+    std::pair<Iterator, std::ptrdiff_t> findWithDistance(const T& n) noexcept {
+        return findWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, std::ptrdiff_t> findWithDistance(const K& n) noexcept {
+        Iterator it = find(n);
+        if (it == end()) {
+            return std::make_pair(it, std::ptrdiff_t(-1));
+        }
+        return std::make_pair(it, static_cast<std::ptrdiff_t>(position(it)));
+    }
+
+    /*
+        rank() runs in O(log(d) + B) time and returns the number of elements
+        below n, or with inclusive set, the number not above n. n does not
+        have to be present.
+    */
+    size_t rank(const T& n, bool inclusive = false) noexcept {
+        return rank<T>(n, inclusive);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t rank(const K& n, bool inclusive = false) noexcept {
+        return position(inclusive ? upperBound(n) : lowerBound(n));
+    }
+
+    /*
+        countRange() runs in O(log(d) + B) time and returns how many elements
+        lie in [lo, hi). Neither lo nor hi has to be present.
+    */
+    size_t countRange(const T& lo, const T& hi) noexcept {
+        return countRange<T>(lo, hi);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t countRange(const K& lo, const K& hi) noexcept {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /*
+        nth() runs in O(log(d) + B) time and returns the run holding the
+        element at sorted index idx (0-indexed), making it the inverse of
+        distance(). The bucket is found by descending the Fenwick tree, and
+        then the copies of its runs are counted off. If idx is out of range,
+        returns the end() Iterator.
+    */
+    Iterator nth(size_t idx) noexcept {
+        if (idx >= sz) {
+            return end();
+        }
+        /*  idx < sz guarantees we stop before reaching the sentinel */
+        size_t bucketDist = indexFind(idx);
+        typename std::vector<Bucket>::iterator targetBucket =
+            std::next(buckets.begin(), bucketDist);
+        typename Bucket::iterator targ = targetBucket->begin();
+        while (idx >= targ->copies) {
+            idx -= targ->copies;
+            ++targ;
+        }
+        return Iterator(targetBucket, targ);
+    }
+
+    /*
+        at() runs in O(log(d) + B) time and returns the element at sorted
+        index idx. Calling at() with an out of range idx is UB, so requires
+        checks like in STL containers.
+    */
+    inline const T& at(size_t idx) noexcept {
+        assert(idx < sz);
+        return *nth(idx);
+    }
+
+    /*
+        insert() runs in O(log(d)) time if n is already present, in which case
+        it only adds copies to its run, and in O(log(d) + B) time otherwise,
+        shifting the bucket to make room for a new run. It returns the run of n.
+    */
+    Iterator insert(const T& n, size_t copies = 1) {
+        return placeRun(n, copies);
+    }
+
+    Iterator insert(T&& n, size_t copies = 1) {
+        return placeRun(std::move(n), copies);
+    }
+
+    /*
+        emplace() is insert(T(args...)), for code written against
+        std::multiset. The element is built first, since its run depends
+        on its value.
+    */
+    template <typename... Args>
+    Iterator emplace(Args&&... args) {
+        return insert(T(std::forward<Args>(args)...));
+    }
+
+    /*
+        insertBatch() runs in O(k*log(k) + m*(log(d) + B)) time for a batch
+        of k elements with m distinct values. The batch is sorted so that each
+        value is added once, with all of its copies.
+    */
+    template <class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        std::sort(batch.begin(), batch.end(), comp);
+        typename std::vector<T>::iterator next = batch.begin();
+        while (next != batch.end()) {
+            typename std::vector<T>::iterator last = std::upper_bound(next,
+                batch.end(), *next, comp);
+            insert(std::move(*next), static_cast<size_t>(std::distance(next, last)));
+            next = last;
+        }
+    }
+
+    /*
+        eraseBatch() runs in O(k*log(k) + m*(log(d) + B)) time for a batch
+        of k elements with m distinct values. It erases a single copy for each
+        element of the batch (so a value given twice erases two copies), with
+        each value looked up once. It returns how many elements were erased.
+    */
+    template <class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        std::sort(batch.begin(), batch.end(), comp);
+        size_t ct = 0;
+        typename std::vector<T>::iterator next = batch.begin();
+        while (next != batch.end()) {
+            typename std::vector<T>::iterator last = std::upper_bound(next,
+                batch.end(), *next, comp);
+            ct += takeCopies(find(*next), std::distance(next, last));
+            next = last;
+        }
+        return ct;
+    }
+
+    /*
+        erase() runs in O(log(d)) time, or O(log(d) + B) when it takes the
+        last copy and the run goes, and erases a single copy of n. It returns
+        how many copies were erased (1 or 0).
+    */
+    int erase(const T& n) {
+        return erase<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int erase(const K& n) {
+        return static_cast<int>(takeCopies(find(n), 1));
+    }
+
+    /*
+        eraseAll() runs in O(log(d) + B) time however many copies there are,
+        since it drops the one run of n. It returns how many copies were erased.
+    */
+    size_t eraseAll(const T& n) {
+        return eraseAll<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t eraseAll(const K& n) {
+        return takeCopies(find(n), size_t(-1));
+    }
+
+    /*
+        clear() runs in O(d) time and erases every element. The first bucket
+        and the bucket list keep their storage for the next inserts. This
+        invalidates all iterators.
+    */
+    void clear() {
+        buckets.resize(1);
+        buckets.front().clear();
+        bucketCopies.assign(1, 0);
+        sz = 0;
+        distinctRuns = 0;
+        finishRuns();
+    }
+
+    /*
+        save() runs in O(d) time and writes a weighted snapshot of the
+        container to path (see sortedBucketSnapshot.h), each run as a value
+        and its copies, which is the layout RBT saves as well. Returns whether
+        it succeeded.
+    */
+    bool save(const char* path) const requires std::is_trivially_copyable_v<T> {
+        SnapshotFile file(path, "wb");
+        SnapshotHeader header(sizeof(T), SnapshotWeighted, distinctRuns, distinctRuns,
+                              bucketDensity);
+        file.write(&header, sizeof header);
+        forEachRun([&file](const Run& run) {
+            uint64_t copies = run.copies;
+            file.write(&copies, sizeof copies);
+        });
+        file.pad(header.elemOffset());
+        forEachRun([&file](const Run& run) {
+            file.write(&run.val, sizeof(T));
+        });
+        return file.close();
+    }
+
+    /*
+        load() runs in O(n) time and replaces the contents with the snapshot at
+        path. Both weighted and flat snapshots load, since equal elements
+        collapse into one run either way. Returns whether it succeeded, leaving
+        the container empty if not. This invalidates all iterators.
+    */
+    bool load(const char* path) requires std::is_trivially_copyable_v<T> {
+        buckets.clear();
+        bucketCopies.clear();
+        sz = 0;
+        distinctRuns = 0;
+        SnapshotFile file(path, "rb");
+        SnapshotHeader header;
+        file.read(&header, sizeof header);
+        bool good = file && header.valid<T>() && header.fits<T>(file.length());
+        bool weighted = good && header.layout == SnapshotWeighted;
+        std::vector<uint64_t> copies(weighted ? header.runs : 0);
+        file.read(copies.data(), copies.size() * sizeof(uint64_t));
+        file.skip(header.elemOffset());
+        static constexpr size_t chunkSize = std::max<size_t>(1, 4096 / sizeof(T));
+        T chunk[chunkSize];
+        for (size_t placed = 0; good && placed < header.count; placed += chunkSize) {
+            size_t take = std::min<size_t>(chunkSize, header.count - placed);
+            file.read(chunk, take * sizeof(T));
+            good = bool(file);
+            for (size_t i = 0; good && i < take; ++i) {
+                size_t ct = weighted ? copies[placed + i] : 1;
+                good = ct > 0;
+                if (good) {
+                    appendRun(chunk[i], ct);
+                }
+            }
+        }
+        if (!good) {
+            buckets.clear();
+            bucketCopies.clear();
+            sz = 0;
+            distinctRuns = 0;
+        }
+        finishRuns();
+        return good;
+    }
+
+    /*
+        stats() runs in O(n/B) time for buckets of B runs and returns the
+        counters kept since construction or resetStats() (see
+        SortedBucketStats), where shifts and moves count runs rather than
+        copies. Also the bytes held by the buckets, and a histogram of the
+        runs per bucket.
+    */
+    SortedBucketStats stats() const {
+        SortedBucketStats out;
+#ifdef SORTED_BUCKET_STATS
+        out = counters;
+#endif
+        out.bytes = buckets.capacity() * sizeof(Bucket) +
+            (bucketCopies.capacity() + bucketIndex.capacity()) * sizeof(size_t) +
+            fences.capacity() * sizeof(T);
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            out.bytes += buckets[b].capacity() * sizeof(Run);
+            /* the sentinel is left out of the histogram */
+            out.countBucket(buckets[b].size() - (b + 1 == buckets.size()));
+        }
+        return out;
+    }
+
+    /* resetStats() zeroes the counters, a no-op without SORTED_BUCKET_STATS */
+    void resetStats() noexcept {
+#ifdef SORTED_BUCKET_STATS
+        counters = SortedBucketStats();
+#endif
+    }
+
+#ifndef NDEBUG
+    /*
+        forceDensity() changes the number of runs per bucket and cuts the
+        buckets again. This is used to force balancing with few values.
+    */
+    void forceDensity(size_t density) {
+        std::vector<Bucket> old;
+        old.swap(buckets);
+        bucketCopies.clear();
+        /* the sentinel is dropped from the last bucket and appended again */
+        old.back().pop_back();
+        bucketDensity = std::max<size_t>(2, density);
+        sz = 0;
+        distinctRuns = 0;
+        for (Bucket& bucket : old) {
+            for (Run& run : bucket) {
+                appendRun(std::move(run.val), run.copies);
+            }
+        }
+        finishRuns();
+    }
+
+    /*
+        Prints entire contents. For debugging
+    */
+    void print(const std::string& name = "SortedBucketRuns") const {
+        std::cout << "Printing " << name << std::endl;
+        std::cout << "    with size = " << sz << ", distinct = " << distinctRuns <<
+            " and density = " << bucketDensity << std::endl;
+        std::cout << "===========================================" << std::endl;
+        std::cout << "Total buckets " << buckets.size() << std::endl;
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            std::cout << "bucket " << b << " holds " << bucketCopies[b] <<
+                " copies in runs: " << std::endl;
+            for (const Run& run : buckets[b]) {
+                if (run.copies == 0) {
+                    std::cout << " sent ";
+                }
+                else {
+                    std::cout << "  " << run.val << "x" << run.copies;
+                }
+            }
+            std::cout << std::endl;
+        }
+        std::cout << std::endl;
+    }
+#endif
+
+private:
+    inline void init() {
+        if (buckets.empty()) {
+            finishRuns();
+        }
+    }
+
+    /*
+        appendRun() adds copies of n after every run so far, which must not be
+        above n, adding to the last run if it holds the same value. Buckets
+        are filled up to bucketDensity runs. finishRuns() seals the container.
+    */
+    template <typename U>
+    void appendRun(U&& n, size_t copies) {
+        sz += copies;
+        if (!buckets.empty() && !buckets.back().empty() &&
+            !comp(buckets.back().back().val, n)) {
+            buckets.back().back().copies += copies;
+            bucketCopies.back() += copies;
+            return;
+        }
+        if (buckets.empty() || buckets.back().size() == bucketDensity) {
+            buckets.emplace_back(Bucket());
+            buckets.back().reserve(2*bucketDensity + 2);
+            bucketCopies.emplace_back(0);
+        }
+        buckets.back().emplace_back(Run{T(std::forward<U>(n)), copies});
+        bucketCopies.back() += copies;
+        ++distinctRuns;
+    }
+
+    /*
+        finishRuns() runs in O(number of buckets) time after the buckets were
+        filled by appendRun() or emptied, giving a container without buckets
+        its first one and appending the sentinel run to the last bucket.
+    */
+    void finishRuns() {
+        if (buckets.empty()) {
+            buckets.emplace_back(Bucket());
+            buckets.front().reserve(2*bucketDensity + 2);
+        }
+        bucketCopies.resize(buckets.size(), 0);
+        buckets.back().emplace_back(Run{sentinelValue<T>(), 0});
+        rebuildIndex();
+    }
+
+    /* forEachRun() calls visit on every run in order, the sentinel left out */
+    template <typename Visit>
+    void forEachRun(Visit&& visit) const {
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            size_t stop = buckets[b].size() - (b + 1 == buckets.size());
+            for (size_t r = 0; r < stop; ++r) {
+                visit(buckets[b][r]);
+            }
+        }
+    }
+
+    /*
+        The Fenwick tree (1-indexed) sums bucketCopies, the number of copies
+        held by each bucket, so finding the elements before a bucket costs
+        O(log(d/B)). Adding or dropping copies updates one bucket's count and
+        the tree, and a change to the bucket layout rebuilds the tree from
+        bucketCopies without visiting the runs. The fences are a copy of the
+        max value of every bucket but the last, like in SortedBucketVV.
+    */
+    void rebuildIndex() {
+        fences.clear();
+        for (size_t i = 0; i + 1 < buckets.size(); ++i) {
+            fences.emplace_back(buckets[i].back().val);
+        }
+        bucketIndex.assign(buckets.size() + 1, 0);
+        for (size_t i = 1; i <= buckets.size(); ++i) {
+            bucketIndex[i] += bucketCopies[i - 1];
+            size_t par = i + (i & (0 - i));
+            if (par <= buckets.size()) {
+                bucketIndex[par] += bucketIndex[i];
+            }
+        }
+    }
+
+    /* indexAdd() adds delta copies to bucket bucketDist, wrapping for negatives */
+    inline void indexAdd(size_t bucketDist, size_t delta) noexcept {
+        bucketCopies[bucketDist] += delta;
+        for (size_t i = bucketDist + 1; i < bucketIndex.size(); i += i & (0 - i)) {
+            bucketIndex[i] += delta;
+        }
+    }
+
+    /* indexPrefix() returns the number of elements before bucket bucketDist */
+    inline size_t indexPrefix(size_t bucketDist) const noexcept {
+        size_t sum = 0;
+        for (size_t i = bucketDist; i > 0; i -= i & (0 - i)) {
+            sum += bucketIndex[i];
+        }
+        return sum;
+    }
+
+    /*  indexFind() returns the bucket holding sorted index idx, and reduces idx
+        to the offset inside that bucket. Requires idx < size(). */
+    inline size_t indexFind(size_t& idx) const noexcept {
+        size_t pos = 0;
+        for (size_t step = std::bit_floor(bucketIndex.size() - 1); step > 0; step >>= 1) {
+            if (pos + step < bucketIndex.size() && bucketIndex[pos + step] <= idx) {
+                pos += step;
+                idx -= bucketIndex[pos];
+            }
+        }
+        return pos;
+    }
+
+    /* position() returns the index of the first copy of a run, size() for end() */
+    inline size_t position(const Iterator& it) noexcept {
+        size_t pos = indexPrefix(std::distance(buckets.begin(), it.targetBucket));
+        for (typename Bucket::iterator run = it.targetBucket->begin(); run != it.targ; ++run) {
+            pos += run->copies;
+        }
+        return pos;
+    }
+
+    /*
+        bound() runs in O(log(d)) time and returns the first run not below n,
+        or the first run above n if Upper. The fences pick the bucket without
+        touching any other, and the sentinel run is left out of the search.
+    */
+    template <bool Upper, typename K>
+    Iterator bound(const K& n) noexcept {
+        size_t bucketDist = 0;
+        if (buckets.size() > 1) {
+            const T* base = fences.data();
+            bucketDist = searchSorted<Upper>(base, base + fences.size(), n, comp) - base;
+        }
+        typename std::vector<Bucket>::iterator targetBucket =
+            std::next(buckets.begin(), bucketDist);
+        typename Bucket::iterator last = targetBucket->end();
+        if (std::next(targetBucket) == buckets.end()) {
+            --last;
+        }
+        typename Bucket::iterator targ;
+        if constexpr (Upper) {
+            targ = std::upper_bound(targetBucket->begin(), last, n,
+                [this](const K& key, const Run& run) { return comp(key, run.val); });
+        }
+        else {
+            targ = std::lower_bound(targetBucket->begin(), last, n,
+                [this](const Run& run, const K& key) { return comp(run.val, key); });
+        }
+        /*  Every bucket but the last ends with its fence, which stops the
+            search, so targ never runs off the end of its bucket */
+        assert(targ != targetBucket->end());
+        return Iterator(targetBucket, targ);
+    }
+
+    /*
+        placeRun() adds copies of n to its run, or makes a new run for it at
+        lowerBound(n) if it is not present. A new run is placed in front of a
+        run above it, so no fence changes, and only an oversized bucket is
+        split. It returns the run of n.
+    */
+    template <typename U>
+    Iterator placeRun(U&& n, size_t copies) {
+        if (copies == 0) {
+            return find(n);
+        }
+        Iterator it = lowerBound(n);
+        size_t bucketDist = std::distance(buckets.begin(), it.targetBucket);
+        bool present = it != end() && !comp(n, *it);
+        indexAdd(bucketDist, copies);
+        sz += copies;
+        if (present) {
+            it.targ->copies += copies;
+            return it;
+        }
+        size_t runDist = std::distance(it.targetBucket->begin(), it.targ);
+        SORTED_BUCKET_COUNT(shifted, it.targetBucket->size() - runDist);
+        it.targetBucket->emplace(it.targ, Run{T(std::forward<U>(n)), copies});
+        ++distinctRuns;
+        if (buckets[bucketDist].size() > 2*bucketDensity) {
+            balance(bucketDist);
+            if (runDist >= bucketDensity) {
+                ++bucketDist;
+                runDist -= bucketDensity;
+            }
+        }
+        typename std::vector<Bucket>::iterator targetBucket =
+            std::next(buckets.begin(), bucketDist);
+        return Iterator(targetBucket, std::next(targetBucket->begin(), runDist));
+    }
+
+    /*
+        takeCopies() erases up to copies copies from the run at it, dropping
+        the run once none are left, and returns how many were erased. it may
+        be end(), in which case nothing is erased.
+    */
+    size_t takeCopies(Iterator it, size_t copies) {
+        if (it == end()) {
+            return 0;
+        }
+        size_t bucketDist = std::distance(buckets.begin(), it.targetBucket);
+        if (it.targ->copies > copies) {
+            it.targ->copies -= copies;
+            indexAdd(bucketDist, 0 - copies);
+            sz -= copies;
+            return copies;
+        }
+        size_t ct = it.targ->copies;
+        /* The sentinel is never erased, so this is never the last bucket's max */
+        bool erasedMax = std::next(it.targ) == it.targetBucket->end();
+        SORTED_BUCKET_COUNT(shifted, std::distance(it.targ, it.targetBucket->end()) - 1);
+        it.targetBucket->erase(it.targ);
+        indexAdd(bucketDist, 0 - ct);
+        sz -= ct;
+        --distinctRuns;
+        Bucket& bucket = buckets[bucketDist];
+        if (erasedMax && !bucket.empty()) {
+            fences[bucketDist] = bucket.back().val;
+        }
+        if (bucket.size() < bucketDensity / 2) {
+            balance(bucketDist);
+        }
+        return ct;
+    }
+
+    /*
+        balance() runs in O(B) time and splits bucket bucketDist in two if it
+        holds over 2*B runs, or if it holds under B/2, merges it with the
+        bucket after it or takes runs from it until both are even. The last
+        bucket is permitted to be undersized. Any change rebuilds the index.
+    */
+    void balance(size_t bucketDist) {
+        Bucket& bucket = buckets[bucketDist];
+        if (bucket.size() > 2*bucketDensity) {
+            SORTED_BUCKET_COUNT(splits, 1);
+            SORTED_BUCKET_COUNT(moved, bucket.size() - bucketDensity);
+            Bucket piece;
+            piece.reserve(2*bucketDensity + 2);
+            piece.insert(piece.end(),
+                         std::make_move_iterator(std::next(bucket.begin(), bucketDensity)),
+                         std::make_move_iterator(bucket.end()));
+            bucket.erase(std::next(bucket.begin(), bucketDensity), bucket.end());
+            size_t moved = copiesIn(piece);
+            bucketCopies[bucketDist] -= moved;
+            buckets.emplace(std::next(buckets.begin(), bucketDist + 1), std::move(piece));
+            bucketCopies.emplace(std::next(bucketCopies.begin(), bucketDist + 1), moved);
+        }
+        else if (bucket.size() < bucketDensity / 2 && bucketDist + 1 < buckets.size()) {
+            Bucket& next = buckets[bucketDist + 1];
+            if (bucket.size() + next.size() > 2*bucketDensity) {
+                size_t desired = (next.size() - bucket.size()) / 2;
+                SORTED_BUCKET_COUNT(moved, desired);
+                typename Bucket::iterator cut = std::next(next.begin(), desired);
+                size_t moved = copiesIn(std::span<const Run>(next.data(), desired));
+                bucket.insert(bucket.end(), std::make_move_iterator(next.begin()),
+                              std::make_move_iterator(cut));
+                next.erase(next.begin(), cut);
+                bucketCopies[bucketDist] += moved;
+                bucketCopies[bucketDist + 1] -= moved;
+            }
+            else {
+                SORTED_BUCKET_COUNT(merges, 1);
+                SORTED_BUCKET_COUNT(moved, next.size());
+                bucket.insert(bucket.end(), std::make_move_iterator(next.begin()),
+                              std::make_move_iterator(next.end()));
+                bucketCopies[bucketDist] += bucketCopies[bucketDist + 1];
+                buckets.erase(std::next(buckets.begin(), bucketDist + 1));
+                bucketCopies.erase(std::next(bucketCopies.begin(), bucketDist + 1));
+            }
+        }
+        else {
+            return;
+        }
+        rebuildIndex();
+    }
+
+    /* copiesIn() sums the copies of some runs */
+    static size_t copiesIn(std::span<const Run> runs) noexcept {
+        size_t ct = 0;
+        for (const Run& run : runs) {
+            ct += run.copies;
+        }
+        return ct;
+    }
+
+    // Private members
+    size_t                      sz              {0};    // copies of every value
+    size_t                      distinctRuns    {0};    // runs, the sentinel left out
+    size_t                      bucketDensity   {DefaultRunDensity};
+    std::vector<Bucket>         buckets;
+    std::vector<size_t>         bucketCopies;   // copies held by each bucket
+    std::vector<size_t>         bucketIndex;    // Fenwick tree of bucketCopies
+    std::vector<T>              fences;         // max of each bucket but the last
+    [[no_unique_address]] StatsComp<Comp> comp;
+#ifdef SORTED_BUCKET_STATS
+    SortedBucketStats           counters;
+#endif
+};
+
+#endif // UTIL_SORTED_BUCKET_RUNS_H
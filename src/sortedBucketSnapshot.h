@@ -0,0 +1,402 @@
+/**
+ * @file sortedBucketSnapshot.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief On-disk snapshot format of the Sorted Bucket containers
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Every container with a trivially copyable T can save() itself to a file
+ * and load() it back in O(n), with the elements read straight into place
+ * instead of being inserted one by one. SortedBucketMapped attaches to a
+ * snapshot with mmap() and answers queries on it read-only, so a warm
+ * restart only pages in what it touches.
+ *
+ * Layout (all offsets from the start of the file):
+ *      0:      SnapshotHeader (64 bytes)
+ *      64:     runs, one uint64_t each
+ *      next multiple of 64 after the runs:    elements, T each
+ *
+ * A flat snapshot (VV, LL and BT) holds every element in sorted order, and
+ * the runs are the bucket sizes of VV and LL (BT writes none). A weighted
+ * snapshot (RBT and SortedBucketRuns) holds each distinct element once, and
+ * the runs are the copies of each. Any container loads a flat snapshot, while
+ * a weighted one only loads into RBT, SortedBucketRuns or SortedBucketMapped.
+ *
+ * The file is a raw image of T in host byte order. It must be written and
+ * read by builds that agree on T and Comp, which is only checked as far as
+ * sizeof(T) goes. A file shorter than its header says fails to load or
+ * open, but the elements are not checked to be sorted, so loading a
+ * corrupted file is UB like passing unsorted input to SortedInput.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_SNAPSHOT_H
+#define UTIL_SORTED_BUCKET_SNAPSHOT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include "sortedBucketCommon.h"
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SORTED_BUCKET_HAS_MMAP 1
+#endif
+
+/* Snapshot layouts, see above */
+enum SnapshotLayout : uint32_t {
+    SnapshotFlat        = 0,
+    SnapshotWeighted    = 1
+};
+
+/* Alignment of the element array, enough for any T and for SIMD loads */
+inline constexpr size_t SnapshotAlign = 64;
+
+struct SnapshotHeader {
+    char        magic[8]    {'S', 'B', 'S', 'N', 'A', 'P', '1', '\0'};
+    uint32_t    elemSize    {0};
+    uint32_t    layout      {SnapshotFlat};
+    uint64_t    count       {0};    // elements stored
+    uint64_t    runs        {0};    // run lengths stored
+    uint64_t    density     {0};    // bucket density of the saved container, 0 if none
+    uint64_t    reserved[3] {0, 0, 0};
+
+    SnapshotHeader() noexcept {}
+
+    SnapshotHeader(size_t elemSize, SnapshotLayout layout, size_t count, size_t runs,
+                   size_t density) noexcept
+        : elemSize(static_cast<uint32_t>(elemSize))
+        , layout(layout)
+        , count(count)
+        , runs(runs)
+        , density(density) {}
+
+    /* valid() checks the header was written by this format for elements of T */
+    template <typename T>
+    bool valid() const noexcept {
+        return std::memcmp(magic, SnapshotHeader().magic, sizeof magic) == 0 &&
+               elemSize == sizeof(T) && layout <= SnapshotWeighted &&
+               (layout == SnapshotFlat || runs == count);
+    }
+
+    /* Offset of the element array. Only meaningful once fits() holds */
+    size_t elemOffset() const noexcept {
+        size_t end = sizeof(SnapshotHeader) + runs * sizeof(uint64_t);
+        return (end + SnapshotAlign - 1) / SnapshotAlign * SnapshotAlign;
+    }
+
+    /*
+        fits() checks that a file of bytes holds the runs and elements of T
+        the header claims. Each count is bounded by what is left of the file
+        before it is multiplied, so a corrupted count cannot wrap the sum.
+    */
+    template <typename T>
+    bool fits(size_t bytes) const noexcept {
+        if (bytes < sizeof(SnapshotHeader) ||
+            runs > (bytes - sizeof(SnapshotHeader)) / sizeof(uint64_t)) {
+            return false;
+        }
+        size_t offset = elemOffset();
+        return offset <= bytes && count <= (bytes - offset) / sizeof(T);
+    }
+};
+static_assert(sizeof(SnapshotHeader) == SnapshotAlign);
+
+/*
+    SnapshotFile wraps a FILE* for writing or reading a snapshot front to
+    back. Any failed call sets the file bad and turns the later calls into
+    no-ops, so callers only check once at the end.
+*/
+class SnapshotFile {
+public:
+    SnapshotFile(const char* path, const char* mode) noexcept
+        : file(std::fopen(path, mode))
+        , good(file != nullptr) {}
+
+    ~SnapshotFile() noexcept {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator =(const SnapshotFile&) = delete;
+
+    explicit operator bool() const noexcept {
+        return good;
+    }
+
+    void write(const void* data, size_t bytes) noexcept {
+        good = good && std::fwrite(data, 1, bytes, file) == bytes;
+        offset += bytes;
+    }
+
+    void read(void* data, size_t bytes) noexcept {
+        good = good && std::fread(data, 1, bytes, file) == bytes;
+        offset += bytes;
+    }
+
+    /* pad() writes zeros up to offset to */
+    void pad(size_t to) noexcept {
+        static constexpr char zeros[SnapshotAlign] {};
+        while (good && offset < to) {
+            write(zeros, std::min(to - offset, sizeof zeros));
+        }
+    }
+
+    /* skip() reads and drops bytes up to offset to */
+    void skip(size_t to) noexcept {
+        char scratch[SnapshotAlign];
+        while (good && offset < to) {
+            read(scratch, std::min(to - offset, sizeof scratch));
+        }
+    }
+
+    /*  length() returns the size of the file in bytes, leaving the read
+        position where it was, or 0 (and sets the file bad) if it cannot tell */
+    size_t length() noexcept {
+        long here = good ? std::ftell(file) : -1;
+        bool seeked = here >= 0 && std::fseek(file, 0, SEEK_END) == 0;
+        long end = seeked ? std::ftell(file) : -1;
+        good = seeked && end >= 0 && std::fseek(file, here, SEEK_SET) == 0;
+        return good ? static_cast<size_t>(end) : 0;
+    }
+
+    /* close() flushes and closes, returning whether every call succeeded */
+    bool close() noexcept {
+        good = (std::fclose(file) == 0) && good;
+        file = nullptr;
+        return good;
+    }
+
+private:
+    std::FILE*  file;
+    bool        good;
+    size_t      offset  {0};
+};
+
+#ifdef SORTED_BUCKET_HAS_MMAP
+/*
+    SortedBucketMapped is a read-only sorted container over a snapshot file,
+    mapped with mmap() rather than read. Attaching costs O(1) no matter the
+    size, and no element is touched until a query needs it. Flat snapshots
+    are searched in place. Weighted ones also keep the copies of each
+    element, and answer ranks through a prefix sum over them built on open()
+    in O(distinct elements).
+
+    Time complexities:
+        find:               O(log(n))
+        distance:           O(log(n))
+        nth:                O(log(n))
+        rank:               O(log(n))
+        countRange:         O(log(n))
+*/
+template <typename T,
+          typename Comp     = std::less<T>>
+class SortedBucketMapped {
+    static_assert(std::is_trivially_copyable_v<T>, "snapshots store T as raw bytes");
+
+public:
+    /* Default constructor, attached to nothing */
+    SortedBucketMapped() noexcept {}
+
+    /* Path constructor. Check attached() for whether open() succeeded */
+    explicit SortedBucketMapped(const char* path, const Comp& comp = Comp()) noexcept 
+        : comp(comp) {
+        open(path);
+    }
+
+    /* Move constructor. Takes over old's mapping */
+    SortedBucketMapped(SortedBucketMapped&& old) noexcept
+        : mapping(old.mapping)
+        , mapped(old.mapped)
+        , elems(old.elems)
+        , distinct(old.distinct)
+        , sz(old.sz)
+        , prefix(std::move(old.prefix))
+        , comp(old.comp) {
+        old.mapping = nullptr;
+        old.close();
+    }
+
+    SortedBucketMapped(const SortedBucketMapped&) = delete;
+    SortedBucketMapped& operator =(const SortedBucketMapped&) = delete;
+
+    /* Destructor unmaps the file */
+    ~SortedBucketMapped() noexcept {
+        close();
+    }
+
+    /*
+        open() maps the snapshot at path, replacing any earlier mapping, and
+        returns whether it succeeded. It fails if the file cannot be mapped,
+        was saved for another sizeof(T), or is shorter than its header says.
+    */
+    bool open(const char* path) noexcept {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SnapshotHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        /* the mapping holds its own reference to the file */
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        mapping = addr;
+        mapped = st.st_size;
+        const SnapshotHeader& header = *static_cast<const SnapshotHeader*>(addr);
+        if (!header.valid<T>() || !header.fits<T>(mapped)) {
+            close();
+            return false;
+        }
+        const unsigned char* base = static_cast<const unsigned char*>(addr);
+        elems = reinterpret_cast<const T*>(base + header.elemOffset());
+        distinct = header.count;
+        sz = header.count;
+        if (header.layout == SnapshotWeighted) {
+            const uint64_t* copies = reinterpret_cast<const uint64_t*>(base + sizeof header);
+            prefix.assign(distinct + 1, 0);
+            for (size_t i = 0; i < distinct; ++i) {
+                prefix[i + 1] = prefix[i] + copies[i];
+            }
+            sz = prefix.back();
+        }
+        return true;
+    }
+
+    /* close() unmaps the file, leaving an empty container */
+    void close() noexcept {
+        if (mapping) {
+            ::munmap(mapping, mapped);
+        }
+        mapping = nullptr;
+        mapped = 0;
+        elems = nullptr;
+        distinct = 0;
+        sz = 0;
+        prefix.clear();
+    }
+
+    /* Whether a snapshot is mapped */
+    bool attached() const noexcept {
+        return mapping != nullptr;
+    }
+
+    /* Size getter, counting every copy */
+    size_t size() const noexcept {
+        return sz;
+    }
+
+    /*  The distinct elements, or all elements of a flat snapshot, as one
+        contiguous sorted array */
+    std::span<const T> elements() const noexcept {
+        return std::span<const T>(elems, distinct);
+    }
+
+    /*
+        lowerBound() runs in O(log(n)) time and returns the first element in
+        elements() not below n.
+    */
+    const T* lowerBound(const T& n) const noexcept {
+        return searchSorted<false>(elems, elems + distinct, n, comp);
+    }
+
+    /*
+        upperBound() runs in O(log(n)) time and returns the first element in
+        elements() above n.
+    */
+    const T* upperBound(const T& n) const noexcept {
+        return searchSorted<true>(elems, elems + distinct, n, comp);
+    }
+
+    /*
+        find() runs in O(log(n)) time and returns the first instance of n in
+        elements(), or nullptr if n is not present.
+    */
+    const T* find(const T& n) const noexcept {
+        const T* targ = lowerBound(n);
+        if (targ == elems + distinct || comp(n, *targ)) {
+            return nullptr;
+        }
+        return targ;
+    }
+
+    /*
+        distance() runs in O(log(n)) time and returns the index (from 0) of
+        the first occurrence of n, or -1 if n is not present.
+    */
+    std::ptrdiff_t distance(const T& n) const noexcept {
+        const T* targ = find(n);
+        return targ ? std::ptrdiff_t(position(targ)) : -1;
+    }
+
+    /*
+        nth() runs in O(log(n)) time and returns the element at sorted index
+        idx. Calling nth() with an out of range idx is UB, so requires checks
+        like in STL containers.
+    */
+    const T& nth(size_t idx) const noexcept {
+        if (prefix.empty()) {
+            return elems[idx];
+        }
+        /* the last prefix not above idx starts the run holding idx */
+        size_t run = std::upper_bound(prefix.begin(), prefix.end(), uint64_t(idx)) -
+                     prefix.begin() - 1;
+        return elems[run];
+    }
+
+    /*
+        rank() runs in O(log(n)) time and returns the number of elements below
+        n, or with inclusive set, the number not above n.
+    */
+    size_t rank(const T& n, bool inclusive = false) const noexcept {
+        return position(inclusive ? upperBound(n) : lowerBound(n));
+    }
+
+    /*
+        countRange() runs in O(log(n)) time and returns how many elements lie
+        in [lo, hi).
+    */
+    size_t countRange(const T& lo, const T& hi) const noexcept {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+private:
+    /* position() turns a pointer into elements() into a sorted index */
+    inline size_t position(const T* targ) const noexcept {
+        size_t idx = targ - elems;
+        return prefix.empty() ? idx : prefix[idx];
+    }
+
+    void*                   mapping     {nullptr};
+    size_t                  mapped      {0};        // bytes mapped
+    const T*                elems       {nullptr};
+    size_t                  distinct    {0};        // length of elems
+    size_t                  sz          {0};
+    std::vector<uint64_t>   prefix;                 // copies before each element, weighted only
+    [[no_unique_address]] Comp comp;
+};
+#endif // ifdef SORTED_BUCKET_HAS_MMAP
+
+#endif // UTIL_SORTED_BUCKET_SNAPSHOT_H
@@ -13,10 +13,26 @@
  * used as inspiration.
  * 
  * Time complexities:
- *      find:       O(log(sqrt(n)))
- *      distance:   O(sqrt(n))
- *      insert:     O(log(sqrt(n)))
- *      erase:      O(log(sqrt(n)))
+ *      find:               O(log(sqrt(n)))
+ *      distance:           O(log(sqrt(n)))
+ *      nth:                O(log(sqrt(n)))
+ *      rank:               O(log(sqrt(n)))
+ *      countRange:         O(log(sqrt(n)))
+ *      insert:             O(log(sqrt(n)))
+ *      erase:              O(log(sqrt(n)))
+ *      batch of k:         O(k*log(k) + sqrt(n) + touched buckets)
+ *      findMany of k:      O(k*log(sqrt(n)))
+ *      split, join:        O(sqrt(n))
+ *      merge:              O(n + m)
+ *      build from sorted:  O(n)
+ *      parallel build:     O(n*log(n/t)/t + n) on t threads, O(n/t) if sorted
+ *      parallel scans:     O(log(sqrt(n)) + k/t) over k elements
+ *
+ * Bucket density is fixed unless auto density is turned on with 
+ * setAutoDensity(), in which case it follows the size of the container.
+ *
+ * Comp is stored, so it may carry state. If it is transparent, lookups and
+ * erases also take keys of any other type it compares against T.
  * 
  * 
  */
@@ -31,14 +47,22 @@
 */
 #define DefaultSmallDensity (size_t(500))
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <functional>
+#include <iterator>
 #include <math.h>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include "sortedBucketCommon.h"
+#include "sortedBucketSnapshot.h"
 
 //#define NDEBUG
 #ifndef NDEBUG
-/* magic value for sentinel, otherwise uses T{} */
-#define SENTINEL_FLAG 0xBEEF
 #include <iostream>
 #include <string>
 #endif // ifndef NDEBUG
@@ -47,6 +71,11 @@ template <typename T,
           typename Comp     = std::less<T>,
           typename Alloc    = std::allocator<T>>
 class SortedBucketVV {
+    /* A bucket, and iterators over the buckets and over one bucket */
+    using Bucket            = std::vector<T, Alloc>;
+    using BucketIterator    = typename std::vector<Bucket>::iterator;
+    using ElementIterator   = typename Bucket::iterator;
+
 public:
     friend struct Iterator;
     struct Iterator {
@@ -65,8 +94,8 @@ public:
 
         Iterator() noexcept {}
 
-        Iterator(typename std::vector<std::vector<T>>::iterator targetBucket,
-                 typename std::vector<T>::iterator targ) noexcept
+        Iterator(BucketIterator targetBucket,
+                 ElementIterator targ) noexcept
             : targetBucket(targetBucket)
             , targ(targ) {}
 
@@ -169,10 +198,86 @@ public:
         }
 
     private:
-        typename std::vector<std::vector<value_type>>::iterator     targetBucket
-            {typename std::vector<std::vector<value_type>>::iterator(nullptr)};
-        typename std::vector<value_type>::iterator                  targ
-            {typename std::vector<value_type>::iterator             (nullptr)};
+        BucketIterator      targetBucket    {BucketIterator(nullptr)};
+        ElementIterator     targ            {ElementIterator(nullptr)};
+    };
+
+    /*
+        SpanView is a std::ranges forward view over a run of elements which
+        yields one std::span per bucket, so that consumers can loop over 
+        contiguous memory without copying. Any insert or erase invalidates it,
+        just like Iterators.
+    */
+    class SpanView : public std::ranges::view_interface<SpanView> {
+    public:
+        struct SpanIterator {
+            using iterator_concept  = std::forward_iterator_tag;
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = std::span<T>;
+            using difference_type   = std::ptrdiff_t;
+
+            SpanIterator() noexcept {}
+
+            SpanIterator(const SpanView* view,
+                         BucketIterator targetBucket) noexcept
+                : view(view)
+                , targetBucket(targetBucket) {}
+
+            /* The first and last buckets are clipped to the range */
+            std::span<T> operator *() const noexcept {
+                ElementIterator from = 
+                    (targetBucket == view->first.targetBucket) 
+                    ? view->first.targ : targetBucket->begin();
+                ElementIterator to = 
+                    (targetBucket == view->last.targetBucket) 
+                    ? view->last.targ : targetBucket->end();
+                return std::span<T>(std::to_address(from), std::distance(from, to));
+            }
+
+            SpanIterator& operator ++() noexcept {
+                ++targetBucket;
+                return *this;
+            }
+
+            SpanIterator operator ++(int) noexcept {
+                SpanIterator temp = *this;
+                ++targetBucket;
+                return temp;
+            }
+
+            bool operator ==(const SpanIterator& other) const noexcept {
+                return targetBucket == other.targetBucket;
+            }
+
+        private:
+            const SpanView*                                 view {nullptr};
+            BucketIterator  targetBucket;
+        };
+
+        SpanView() noexcept {}
+
+        /* View over [first, last), both of which must be valid Iterators */
+        SpanView(Iterator first, Iterator last) noexcept
+            : first(first)
+            , last(last) {}
+
+        SpanIterator begin() const noexcept {
+            return SpanIterator(this, first.targetBucket);
+        }
+
+        /*  last points at the first element left out, so its bucket is only 
+            part of the view if something before it is included */
+        SpanIterator end() const noexcept {
+            if (first == last) {
+                return begin();
+            }
+            return SpanIterator(this, (last.targ == last.targetBucket->begin()) 
+                                      ? last.targetBucket : std::next(last.targetBucket));
+        }
+
+    private:
+        Iterator    first;
+        Iterator    last;
     };
 
     /* Default constructor */
@@ -180,23 +285,46 @@ public:
         init();
     }
 
+    /* Comparator constructor, for a Comp which carries state */
+    explicit SortedBucketVV(const Comp& comp) noexcept 
+        : comp(comp) {
+        init();
+    }
+
     /* Copy constructor */
-    explicit SortedBucketVV(const SortedBucketVV<T, Comp>& old) noexcept {
+    explicit SortedBucketVV(const SortedBucketVV& old) noexcept 
+        : comp(old.comp) {
         init();
         buckets = old.buckets;
         sz = old.sz;
         capacity = old.capacity;
         bucketDensity = old.bucketDensity;
+        autoDensity = old.autoDensity;
+        growAt = old.growAt;
+        shrinkAt = old.shrinkAt;
+        rebalanceCursor = old.rebalanceCursor;
         /* populate sentinel */
         init();
     }
 
     /* Move constructor */
-    explicit SortedBucketVV(SortedBucketVV<T, Comp>&& old) noexcept {
+    explicit SortedBucketVV(SortedBucketVV&& old) noexcept 
+        : comp(old.comp) {
         buckets.swap(old.buckets);
+        bucketIndex.swap(old.bucketIndex);
+        fences.swap(old.fences);
         sz = old.sz;
         capacity = old.capacity;
         bucketDensity = old.bucketDensity;
+        autoDensity = old.autoDensity;
+        growAt = old.growAt;
+        shrinkAt = old.shrinkAt;
+        rebalanceCursor = old.rebalanceCursor;
+        /* vector swap keeps element storage, so old sentinel is still ours */
+        endSentinel = old.endSentinel;
+        /* leave old as a valid empty container */
+        old.sz = 0;
+        old.init();
     }
 
     /* Capacity constructor */
@@ -209,16 +337,65 @@ public:
     
     /* Range constructor */
     template<class InputIterator>
-    SortedBucketVV(InputIterator beginIt, InputIterator endIt, size_t cap = 25000) noexcept 
+    SortedBucketVV(InputIterator beginIt, InputIterator endIt, size_t cap = 25000,
+                   const Comp& comp = Comp()) noexcept 
         : capacity(cap)
         , bucketDensity(std::max(DefaultSmallDensity, 
-                                 static_cast<size_t>(std::sqrt(cap)))) {
+                                 static_cast<size_t>(std::sqrt(cap))))
+        , comp(comp) {
         init();
         for (InputIterator it = beginIt; it != endIt; ++it) {
             insert(*it);
         }
     }
     
+    /* 
+        Sorted range constructor. Input must already be sorted by Comp, so it is
+        sliced straight into full buckets in O(n) instead of being inserted.
+    */
+    template<class InputIterator>
+    SortedBucketVV(SortedInputTag, InputIterator beginIt, InputIterator endIt, 
+                   size_t cap = 25000, const Comp& comp = Comp()) noexcept 
+        : capacity(cap)
+        , bucketDensity(std::max(DefaultSmallDensity, 
+                                 static_cast<size_t>(std::sqrt(cap))))
+        , comp(comp) {
+        buildSorted(beginIt, endIt);
+    }
+
+    /*
+        Parallel range constructor. The input is copied and sorted in chunks on
+        separate threads, the chunks are merged pairwise (each round on as many
+        threads as there are pairs), and the sorted elements are moved into the
+        buckets, every thread filling its own run of buckets. Equal elements
+        keep their input order, as with insert().
+    */
+    template<std::random_access_iterator RandomIt>
+    SortedBucketVV(const Parallel& par, RandomIt beginIt, RandomIt endIt, 
+                   size_t cap = 25000, const Comp& comp = Comp()) noexcept 
+        : capacity(cap)
+        , bucketDensity(std::max(DefaultSmallDensity, 
+                                 static_cast<size_t>(std::sqrt(cap))))
+        , comp(comp) {
+        std::vector<T> sorted(beginIt, endIt);
+        sortParallel(par, sorted);
+        buildParallel(par, std::make_move_iterator(sorted.begin()), sorted.size());
+    }
+
+    /*
+        Parallel sorted range constructor, which only fills the buckets on
+        several threads. Input must already be sorted by Comp.
+    */
+    template<std::random_access_iterator RandomIt>
+    SortedBucketVV(const Parallel& par, SortedInputTag, RandomIt beginIt, RandomIt endIt, 
+                   size_t cap = 25000, const Comp& comp = Comp()) noexcept 
+        : capacity(cap)
+        , bucketDensity(std::max(DefaultSmallDensity, 
+                                 static_cast<size_t>(std::sqrt(cap))))
+        , comp(comp) {
+        buildParallel(par, beginIt, static_cast<size_t>(std::distance(beginIt, endIt)));
+    }
+    
     /* Default destructor */
     ~SortedBucketVV() noexcept {}
 
@@ -232,9 +409,38 @@ public:
         return bucketDensity;
     }
 
+    /* Comparator getter */
+    Comp getComp() const noexcept {
+        return comp;
+    }
+
+    /*
+        setAutoDensity() turns auto density on or off. In auto density mode the
+        density follows autoDensityFor<T>(size()), and is tuned again whenever
+        that would double or halve it. Instead of rebalancing everything at 
+        once, buckets are then re-split one per insert or erase, left to right,
+        on top of the bucket the operation touches anyway. Batch operations 
+        still rebalance everything in their single pass. changeCapacity() and
+        forceDensity() turn auto density off.
+    */
+    void setAutoDensity(bool enable) {
+        autoDensity = enable;
+        growAt = NoThreshold;
+        shrinkAt = 0;
+        rebalanceCursor = NoCursor;
+        if (enable) {
+            retune();
+        }
+    }
+
+    /* Auto density getter */
+    bool getAutoDensity() const noexcept {
+        return autoDensity;
+    }
+
     /* Begin getter */
     inline Iterator begin() noexcept {
-        typename std::vector<std::vector<T>>::iterator targetBucket = buckets.begin();
+        BucketIterator targetBucket = buckets.begin();
         return Iterator(targetBucket, targetBucket->begin());
     }
 
@@ -252,7 +458,7 @@ public:
     /*  Back element access. Calling back() on an empty SortedBucketVV will cause
         segfault, just like with other STL containers */
     inline T& back() noexcept {
-        *std::prev(buckets.back().end());
+        return *std::prev(end());
     }
 
     /*
@@ -261,10 +467,11 @@ public:
         invalidates all iterators.
     */
     void changeCapacity(size_t cap) {
+        setAutoDensity(false);
         bucketDensity = std::max(DefaultSmallDensity, 
                                  static_cast<size_t>(std::sqrt(cap)));
         if (sz > 0) {
-            typename std::vector<std::vector<T>>::iterator b = buckets.begin();
+            BucketIterator b = buckets.begin();
             while (b < buckets.end()) {
                 /*  Guaranteed no empty buckets if sz > 0, so track the first elem
                     of each bucket. For vector implementation, if we shift the 
@@ -282,29 +489,31 @@ public:
 
     /* 
         lowerBound() runs in O(log(sqrt(n))) time and returns the first iterator 
-        which satisfies: (element < n) or Comp{}(element, n) is false).
+        which satisfies: (element < n) or comp(element, n) is false).
     */
     Iterator lowerBound(const T& n) {
-        /*  Sentinel is last item of last bucket, so need to exclude from search */
-        int dist = 0;
-        typename std::vector<std::vector<T>>::iterator targetBucket = buckets.begin();
-        typename std::vector<std::vector<T>>::iterator sentinelBucket = 
-            std::prev(buckets.end());
+        return lowerBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator lowerBound(const K& n) {
+        /*  Sentinel is last item of last bucket, so need to exclude from search.
+            The fences leave out the sentinel bucket, and it is picked if n is 
+            above every fence. No bucket is touched until then */
+        BucketIterator targetBucket = buckets.begin();
         if (buckets.size() > 1) {
-            targetBucket = std::lower_bound(buckets.begin(), sentinelBucket, n,
-                [&](const std::vector<T>& bucket, const T& n) 
-                { return bucket.empty() || Comp{} (bucket.back(), n); });
+            targetBucket = std::next(buckets.begin(), std::distance(fences.begin(), 
+                searchRange<false>(fences.begin(), fences.end(), n)));
         }
         assert(targetBucket != buckets.end());
         // Find insertion point within targetBucket
-        typename std::vector<T>::iterator end = targetBucket->end();
+        ElementIterator end = targetBucket->end();
         if (std::next(targetBucket) == buckets.end()) {
             /* If here, then we are in sentinel bucket. Exclude sentinel from search */
             --end;
         }
-        typename std::vector<T>::iterator targ = 
-            std::lower_bound(targetBucket->begin(), end, n,
-            [&](const T& elem, const T& n) { return Comp{} (elem, n); });
+        ElementIterator targ = 
+            searchRange<false>(targetBucket->begin(), end, n);
 
         if (targ == targetBucket->end()) { 
             // point to beginning of next bucket rather than end of this bucket.
@@ -316,29 +525,31 @@ public:
     
     /* 
         upperBound() runs in O(log(sqrt(n))) time and returns the first iterator which
-        satisfies: (n < element) or Comp{}(n, element) is true)
+        satisfies: (n < element) or comp(n, element) is true)
     */
     Iterator upperBound(const T& n) {
-        /*  Sentinel is last item of last bucket, so need to exclude from search */
-        int dist = 0;
-        typename std::vector<std::vector<T>>::iterator targetBucket = buckets.begin();
-        typename std::vector<std::vector<T>>::iterator sentinelBucket = 
-            std::prev(buckets.end());
+        return upperBound<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator upperBound(const K& n) {
+        /*  Sentinel is last item of last bucket, so need to exclude from search.
+            The fences leave out the sentinel bucket, and it is picked if n is 
+            above every fence. No bucket is touched until then */
+        BucketIterator targetBucket = buckets.begin();
         if (buckets.size() > 1) {
-            targetBucket = std::upper_bound(buckets.begin(), sentinelBucket, n,
-                [&](const T& n, const std::vector<T>& bucket) 
-                { return bucket.empty() || Comp{} (n, bucket.back()); });
+            targetBucket = std::next(buckets.begin(), std::distance(fences.begin(), 
+                searchRange<true>(fences.begin(), fences.end(), n)));
         }
         assert(targetBucket != buckets.end());
         // Find insertion point within targetBucket
-        typename std::vector<T>::iterator end = targetBucket->end();
+        ElementIterator end = targetBucket->end();
         if (std::next(targetBucket) == buckets.end()) {
             /* If here, then we are in sentinel bucket. Exclude sentinel from search */
             --end;
         }
-        typename std::vector<T>::iterator targ = 
-            std::upper_bound(targetBucket->begin(), end, n,
-            [&](const T& n, const T& elem) { return Comp{} (n, elem); });
+        ElementIterator targ = 
+            searchRange<true>(targetBucket->begin(), end, n);
 
         if (targ == targetBucket->end()) { 
             // point to beginning of next bucket rather than end of this bucket.
@@ -353,112 +564,264 @@ public:
         instance of n.
     */
     Iterator find(const T& n) {
+        return find<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    Iterator find(const K& n) {
         auto [targetBucket, targ] = lowerBound(n);
         if ((targetBucket == std::prev(buckets.end()) && targ == endSentinel) || 
-            *targ != n) {
+            comp(n, *targ)) {
             return this->end();
         }
         return Iterator(targetBucket, targ);
     }
 
     /*
-        distance() runs in O(sqrt(n)) time and returns the supposed index 
+        distance() runs in O(log(sqrt(n))) time and returns the supposed index 
         (from 0) of the first occurence of n inside the sortedBucket.
         If n is not present then it returns -1.
     */
     int distance(const T& n) {
+        return distance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int distance(const K& n) {
         return findWithDistance(n).second;
     }
 
     /*
-        findWithDistance() runs in O(sqrt(n)) time and returns a pair of: an 
-        Iterator to the element, along with the index of its first occurrence. 
+        findMany() runs in O(k*log(sqrt(n))) time and sets out[i] to 
+        find(keys[i]) for each of the k keys. Up to BatchLookupLanes keys pick
+        their buckets from the fences first and prefetch them, and only then 
+        are the buckets searched, so their cache misses overlap instead of 
+        being paid one after another. out must hold at least k Iterators.
+    */
+    void findMany(std::span<const T> keys, std::span<Iterator> out) noexcept {
+        assert(out.size() >= keys.size());
+        lowerBoundMany(keys, [&](size_t i, const Iterator& it, size_t dist) {
+            out[i] = (dist == sz || comp(keys[i], *it)) ? this->end() : it;
+        });
+    }
+
+    /*
+        distanceMany() runs in O(k*log(sqrt(n))) time and sets out[i] to 
+        distance(keys[i]) for each of the k keys, interleaved like findMany().
+        out must hold at least k distances.
+    */
+    void distanceMany(std::span<const T> keys, std::span<int> out) noexcept {
+        assert(out.size() >= keys.size());
+        lowerBoundMany(keys, [&](size_t i, const Iterator& it, size_t dist) {
+            out[i] = (dist == sz || comp(keys[i], *it)) ? -1 : static_cast<int>(dist);
+        });
+    }
+
+    /*
+        nth() runs in O(log(sqrt(n))) time and returns an Iterator to the element
+        at sorted index idx (0-indexed), making it the inverse of distance(). 
+        The bucket is found by descending the bucket size index. If idx is out 
+        of range, returns the end() Iterator.
+    */
+    Iterator nth(size_t idx) noexcept {
+        if (idx >= sz) {
+            return end();
+        }
+        /*  idx < sz guarantees we stop before reaching the sentinel */
+        size_t bucketDist = indexFind(idx);
+        BucketIterator targetBucket = 
+            std::next(buckets.begin(), bucketDist);
+        return Iterator(targetBucket, std::next(targetBucket->begin(), idx));
+    }
+
+    /*
+        at() runs in O(log(sqrt(n))) time and returns the element at sorted index idx.
+        Calling at() with an out of range idx is UB, so requires checks like
+        in STL containers.
+    */
+    inline T& at(size_t idx) noexcept {
+        assert(idx < sz);
+        return *nth(idx);
+    }
+
+    /*
+        findWithDistance() runs in O(log(sqrt(n))) time and returns a pair of: 
+        an Iterator to the element, along with the index of its first occurrence. 
         If the element was not found, the pair consists of the end() Iterator 
-        and a distance of -1.
+        and a distance of -1. The buckets before the target are summed by the
+        bucket size index rather than walked one by one.
     */
     std::pair<Iterator, int> findWithDistance(const T& n) noexcept {
-        /*  Sentinel is last item of last bucket, so need to exclude from search */
-        int dist = 0;
-        typename std::vector<std::vector<T>>::iterator targetBucket = buckets.begin();
-        typename std::vector<std::vector<T>>::iterator sentinelBucket = 
-                std::prev(buckets.end());
-        if (buckets.size() > 1) {
-            while (targetBucket != sentinelBucket && 
-                   Comp{} (targetBucket->back(), n)) {
-                dist += targetBucket->size();
-                ++targetBucket;
-            }
-            if (Comp{} (targetBucket->back(), n)) {
-                targetBucket = sentinelBucket;
+        return findWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, int> findWithDistance(const K& n) noexcept {
+        auto [it, dist] = lowerBoundWithDistance(n);
+        if (dist == sz || comp(n, *it)) {
+            return std::make_pair(this->end(), -1);
+        }
+        return std::make_pair(it, static_cast<int>(dist));
+    }
+
+    /*
+        lowerBoundWithDistance() runs in O(log(sqrt(n))) time and returns a pair
+        of: lowerBound(n), along with its index. Unlike findWithDistance(), n 
+        does not have to be present, in which case the index is the number of 
+        elements below n (and size() if there are none above).
+    */
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const T& n) noexcept {
+        return lowerBoundWithDistance<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    std::pair<Iterator, size_t> lowerBoundWithDistance(const K& n) noexcept {
+        Iterator it = lowerBound(n);
+        return std::make_pair(it, position(it));
+    }
+
+    /*
+        rank() runs in O(log(sqrt(n))) time and returns the number of elements
+        below n, or with inclusive set, the number not above n. n does not 
+        have to be present.
+    */
+    size_t rank(const T& n, bool inclusive = false) noexcept {
+        return rank<T>(n, inclusive);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t rank(const K& n, bool inclusive = false) noexcept {
+        return position(inclusive ? upperBound(n) : lowerBound(n));
+    }
+
+    /*
+        countRange() runs in O(log(sqrt(n))) time and returns how many elements
+        lie in [lo, hi). Neither lo nor hi has to be present.
+    */
+    size_t countRange(const T& lo, const T& hi) noexcept {
+        return countRange<T>(lo, hi);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    size_t countRange(const K& lo, const K& hi) noexcept {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /*
+        spans() runs in O(log(sqrt(n))) time and returns a SpanView over the
+        elements in [lo, hi), one std::span per bucket. Neither lo nor hi has
+        to be present.
+            for (std::span<int> run : vv.spans(10, 20)) {
+                sum = std::accumulate(run.begin(), run.end(), sum);
             }
+    */
+    SpanView spans(const T& lo, const T& hi) noexcept {
+        if (!comp(lo, hi)) {
+            return SpanView(end(), end());
         }
-        assert(targetBucket != buckets.end());
-        // Find insertion point within targetBucket
-        typename std::vector<T>::iterator targ = targetBucket->begin();
-        while (targ != targetBucket->end() &&
-               (targetBucket != sentinelBucket || targ != endSentinel) && 
-               Comp{} (*targ, n)) {
-            ++dist;
-            ++targ;
+        return SpanView(lowerBound(lo), lowerBound(hi));
+    }
+
+    /*
+        forEach() calls f(element) for every element at a sorted index in
+        [first, last), with the range split over threads as Parallel asks. 
+        Each thread visits its part in order, but the parts run concurrently, 
+        so f must be safe to call from several threads at once.
+            std::atomic<size_t> odd {0};
+            vv.forEach(Parallel{}, 0, vv.size(), [&](int v) { odd += v & 1; });
+    */
+    template <typename F>
+    void forEach(const Parallel& par, size_t first, size_t last, F&& f) {
+        last = std::min(last, sz);
+        if (first >= last) {
+            return;
         }
-        if (targ == targetBucket->end()) {
-            /*  Point to beginning of next bucket rather than end of this bucket.
-                If targ was already the sentinel, we cannot arrive here. */
-            ++targetBucket;
-            targ = targetBucket->begin();
+        scanShards(parallelShards(par, last - first), first, last,
+                   [&](size_t, std::span<const T> run) {
+            for (const T& n : run) {
+                f(n);
+            }
+        });
+    }
+
+    /*
+        transformReduce() returns init combined with transform(element) of
+        every element at a sorted index in [first, last) through reduce, like
+        std::transform_reduce. Every thread reduces its part of the range, and
+        the parts are then folded into init in index order, so reduce has to be
+        associative but not commutative.
+            long sum = vv.transformReduce(Parallel{}, lo, hi, 0L, std::plus<>(),
+                                          [](int v) { return long(v); });
+    */
+    template <typename R, typename Reduce, typename Transform>
+    R transformReduce(const Parallel& par, size_t first, size_t last, R init,
+                      Reduce reduce, Transform transform) {
+        last = std::min(last, sz);
+        if (first >= last) {
+            return init;
+        }
+        size_t shards = parallelShards(par, last - first);
+        std::vector<std::optional<R>> partials(shards);
+        scanShards(shards, first, last, [&](size_t shard, std::span<const T> run) {
+            std::optional<R>& partial = partials[shard];
+            for (const T& n : run) {
+                partial = partial ? reduce(std::move(*partial), transform(n)) : R(transform(n));
+            }
+        });
+        for (std::optional<R>& partial : partials) {
+            init = reduce(std::move(init), std::move(*partial));
         }
-        return ((targetBucket == sentinelBucket && targ == endSentinel) || 
-                *targ != n)
-            ? std::make_pair(this->end(), -1)
-            : std::make_pair(Iterator(targetBucket, targ), dist);
+        return init;
     }
 
     /* 
         insert() runs in O(sqrt(n)). It preserves stable sorting order (by
         calling upperBound()) and returns an iterator to the inserted element.
+        An element not below back() goes straight in front of the sentinel 
+        without a search, so ascending streams append in amortized O(1) time.
     */
     Iterator insert(const T& n) {
-        auto [targetBucket, targ] = upperBound(n);
-        /*  Only for insertion: the rebalance may invalidate all buckets::iterator
-            and bucket::iterator if allocation occurs due to buckets vector 
-            resizing. We store dists then regenerate iterators after balancing */
-        size_t bucketDist = std::distance(buckets.begin(), targetBucket);
-        size_t targDist = std::distance(targetBucket->begin(), targ);
-        targetBucket->emplace(targ, n);
-        endSentinel = std::prev(buckets.back().end());
-        
-        size_t origSize = targetBucket->size();
-        bool shiftRight = balance(targetBucket,
-                                  std::next(targetBucket->begin(), targDist),
-                                  true);
-        
-        targetBucket = std::next(buckets.begin(), bucketDist + shiftRight);
-        targDist -= (shiftRight && origSize > 2*bucketDensity) ? bucketDensity : 0;
-        targ = std::next(targetBucket->begin(), targDist);
-        ++sz;
-        return Iterator(targetBucket, targ);
+        return emplaceNear(end(), n);
     }
 
     Iterator insert(T&& n) {
-        auto [targetBucket, targ] = upperBound(n);
-        /*  Only for insertion: the rebalance may invalidate all buckets::iterator
-            and bucket::iterator if allocation occurs due to buckets vector 
-            resizing. We store dists then regenerate iterators after balancing */
-        size_t bucketDist = std::distance(buckets.begin(), targetBucket);
-        size_t targDist = std::distance(targetBucket->begin(), targ);
-        targetBucket->emplace(targ, std::forward<T>(n));
-        endSentinel = std::prev(buckets.back().end());
+        return emplaceNear(end(), std::move(n));
+    }
 
-        size_t origSize = targetBucket->size();
-        bool shiftRight = balance(targetBucket,
-                                  std::next(targetBucket->begin(), targDist),
-                                  true);
-        
-        targetBucket = std::next(buckets.begin(), bucketDist + shiftRight);
-        targDist -= (shiftRight && origSize > 2*bucketDensity) ? bucketDensity : 0;
-        targ = std::next(targetBucket->begin(), targDist);
-        ++sz;
-        return Iterator(targetBucket, targ);
+    /*
+        insert() with a hint runs in amortized O(1) time plus the shift inside
+        the bucket if n belongs right before hint, in which case it goes there
+        without a search, like in std::multiset. Otherwise the hint is ignored
+        and this is insert(n). The hint must be a valid Iterator.
+    */
+    Iterator insert(Iterator hint, const T& n) {
+        return emplaceNear(hint, n);
+    }
+
+    Iterator insert(Iterator hint, T&& n) {
+        return emplaceNear(hint, std::move(n));
+    }
+
+    /*
+        emplace() runs in O(sqrt(n)) time and inserts T(args...). The position 
+        depends on the element, so it is built first and then moved into its
+        bucket, never copied.
+    */
+    template <typename... Args>
+    Iterator emplace(Args&&... args) {
+        return insert(T(std::forward<Args>(args)...));
+    }
+
+    /*
+        emplace_hint() is insert(hint, n) with T(args...) as n, for code 
+        written against std::multiset.
+    */
+    template <typename... Args>
+    Iterator emplace_hint(Iterator hint, Args&&... args) {
+        return insert(hint, T(std::forward<Args>(args)...));
     }
 
     /*
@@ -466,13 +829,17 @@ public:
         It returns how many instances of the element were erased (1 or 0)
     */
     int erase(const T& n) {
+        return erase<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int erase(const K& n) {
+        adapt();
         auto [targetBucket, targ] = find(n);
         if (targetBucket == std::prev(buckets.end()) && targ == endSentinel) {
             return 0;
         }
-        targetBucket->erase(targ);
-        balance(targetBucket);
-        --sz;
+        eraseAt(targetBucket, targ);
         return 1;
     }
 
@@ -481,6 +848,12 @@ public:
         of the element. It returns how many instances of the element were erased.
     */
     int eraseAll(const T& n) {
+        return eraseAll<T>(n);
+    }
+
+    template <typename K> requires LookupKey<K, T, Comp>
+    int eraseAll(const K& n) {
+        adapt();
         auto [targetBucket, targ] = find(n);
         if (targetBucket == std::prev(buckets.end()) && targ == endSentinel) {
             return 0;
@@ -488,23 +861,451 @@ public:
         // targ guaranteed to not point to end of targetBucket if valid targetBucket.
         assert(targ != targetBucket->end());
         int ct = 0;
-        typename std::vector<std::vector<T>>::iterator thisBucket = targetBucket;
-        typename std::vector<std::vector<T>>::iterator sentinelBucket = 
+        BucketIterator thisBucket = targetBucket;
+        BucketIterator sentinelBucket = 
             std::prev(buckets.end());
-        while ((thisBucket != sentinelBucket || targ != endSentinel) && *targ == n) {
+        while ((thisBucket != sentinelBucket || targ != endSentinel) && !comp(n, *targ)) {
             ++ct;
+            SORTED_BUCKET_COUNT(shifted, std::distance(targ, thisBucket->end()) - 1);
             targ = thisBucket->erase(targ);
+            indexAdd(std::distance(buckets.begin(), thisBucket), -1);
+            /* erasing from the sentinel bucket shifts the sentinel down */
+            endSentinel = std::prev(buckets.back().end());
             // now targ points right after erased element
             if (targ == thisBucket->end()) {
                 targ = (++thisBucket)->begin();
             }
         }
+        sz -= ct;
+        /*  Only targetBucket can have lost its max without being emptied */
+        if (targetBucket != sentinelBucket && !targetBucket->empty()) {
+            fences[std::distance(buckets.begin(), targetBucket)] = targetBucket->back();
+        }
+        /*  Drop the buckets emptied on the way (possibly targetBucket too), so 
+            that balancing never sees an empty bucket other than the one given */
+        BucketIterator firstEmpty = 
+            targetBucket->empty() ? targetBucket : std::next(targetBucket);
+        if (thisBucket != targetBucket && firstEmpty != thisBucket) {
+            thisBucket = buckets.erase(firstEmpty, thisBucket);
+            targetBucket = (firstEmpty == targetBucket) ? thisBucket : targetBucket;
+            rebuildIndex();
+        }
+        /*  Balance the rightmost touched bucket first. Balancing may erase 
+            buckets, which shifts every bucket to its right but leaves 
+            targetBucket valid. */
+        if (thisBucket != targetBucket) {
+            balance(thisBucket);
+        }
         balance(targetBucket);
-        balance(thisBucket);
+        return ct;
+    }
+
+    /*
+        replace() swaps one instance of old for n, like erase(old) and then
+        insert(n) would. When n belongs in the bucket of old, it runs in 
+        O(log(sqrt(n))) time plus the shift between the two slots: n is moved
+        into place over old, and the bucket sizes, the index and balancing are
+        left alone. Otherwise it erases old where it was found and inserts n,
+        in the time of insert(). It returns an Iterator to n, or end() if old
+        is not present and nothing changed.
+    */
+    Iterator replace(const T& old, T n) {
+        auto [targetBucket, targ] = find(old);
+        BucketIterator sentinelBucket = 
+            std::prev(buckets.end());
+        if (targetBucket == sentinelBucket && targ == endSentinel) {
+            return end();
+        }
+        /*  n stays in the bucket if upperBound() would pick it, and ends up
+            below its max, so that the fence only moves if old was the max */
+        size_t bucketDist = std::distance(buckets.begin(), targetBucket);
+        bool stays = (bucketDist == 0 || !comp(n, fences[bucketDist - 1])) &&
+                     (targetBucket == sentinelBucket || comp(n, fences[bucketDist]));
+        if (!stays) {
+            eraseAt(targetBucket, targ);
+            return insert(std::move(n));
+        }
+        ElementIterator last = targetBucket->end();
+        if (targetBucket == sentinelBucket) {
+            --last;
+        }
+        ElementIterator dest = searchRange<true>(targetBucket->begin(), last, n);
+        if (dest > targ) {
+            SORTED_BUCKET_COUNT(shifted, std::distance(targ, dest) - 1);
+            std::move(std::next(targ), dest, targ);
+            --dest;
+        }
+        else {
+            SORTED_BUCKET_COUNT(shifted, std::distance(dest, targ));
+            std::move_backward(dest, targ, std::next(targ));
+        }
+        *dest = std::move(n);
+        if (targetBucket != sentinelBucket) {
+            fences[bucketDist] = targetBucket->back();
+        }
+        return Iterator(targetBucket, dest);
+    }
+
+    /*
+        insertBatch() runs in O(k*log(k) + sqrt(n) + m) time for a batch of k 
+        elements, where m is the total size of the buckets the batch lands in.
+        The batch is sorted, merged into each of those buckets in one pass, and
+        then the buckets are split or merged once by rebucket(). Equal elements 
+        end up in the same order as from repeated insert() calls. This 
+        invalidates all iterators.
+    */
+    template<class InputIterator>
+    void insertBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        if (batch.empty()) {
+            return;
+        }
+        std::stable_sort(batch.begin(), batch.end(), comp);
+        typename std::vector<T>::iterator next = batch.begin();
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
+            std::prev(buckets.end());
+        while (next != batch.end()) {
+            /*  Same bucket search as upperBound(), resumed from the last bucket
+                touched since the batch is sorted. Merging below the bucket max
+                leaves the fences as they were */
+            size_t bucketDist = std::distance(buckets.begin(), targetBucket);
+            targetBucket = std::next(buckets.begin(), std::distance(fences.begin(), 
+                searchRange<true>(std::next(fences.begin(), bucketDist), fences.end(), 
+                                  *next)));
+            /*  Everything below the bucket max goes here. The sentinel bucket
+                takes the rest, merged in front of the sentinel */
+            typename std::vector<T>::iterator last = batch.end();
+            size_t mid = targetBucket->size();
+            if (targetBucket != sentinelBucket) {
+                last = std::lower_bound(next, batch.end(), targetBucket->back(), comp);
+            }
+            else {
+                --mid;
+            }
+            size_t ct = std::distance(next, last);
+            targetBucket->insert(std::next(targetBucket->begin(), mid), 
+                                 std::make_move_iterator(next), 
+                                 std::make_move_iterator(last));
+            std::inplace_merge(targetBucket->begin(), 
+                               std::next(targetBucket->begin(), mid),
+                               std::next(targetBucket->begin(), mid + ct), comp);
+            sz += ct;
+            next = last;
+            if (targetBucket != sentinelBucket) {
+                ++targetBucket;
+            }
+        }
+        if (autoDensity) {
+            retune();
+        }
+        rebucket();
+        rebalanceCursor = NoCursor;
+    }
+
+    /*
+        eraseBatch() runs in O(k*log(k) + sqrt(n) + m) time for a batch of k 
+        elements, where m is the total size of the buckets the batch lands in.
+        It erases a single instance for each element of the batch (so a value 
+        given twice erases two instances), compacting each touched bucket in 
+        one pass before rebucket(). It returns how many elements were erased
+        and invalidates all iterators.
+    */
+    template<class InputIterator>
+    size_t eraseBatch(InputIterator beginIt, InputIterator endIt) {
+        std::vector<T> batch(beginIt, endIt);
+        if (batch.empty()) {
+            return 0;
+        }
+        std::sort(batch.begin(), batch.end(), comp);
+        size_t ct = 0;
+        typename std::vector<T>::iterator next = batch.begin();
+        BucketIterator targetBucket = buckets.begin();
+        BucketIterator sentinelBucket = 
+            std::prev(buckets.end());
+        while (next != batch.end()) {
+            /*  Same bucket search as lowerBound(), resumed from the last bucket
+                touched since the batch is sorted. Only fences of buckets already
+                passed can be stale, and rebucket() rebuilds them */
+            size_t bucketDist = std::distance(buckets.begin(), targetBucket);
+            targetBucket = std::next(buckets.begin(), std::distance(fences.begin(), 
+                searchRange<false>(std::next(fences.begin(), bucketDist), fences.end(), 
+                                   *next)));
+            ElementIterator stop = targetBucket->end();
+            if (targetBucket == sentinelBucket) {
+                --stop;
+            }
+            ElementIterator targ = 
+                searchRange<false>(targetBucket->begin(), stop, *next);
+            /*  Walk the bucket and the batch together. Matched elements are 
+                dropped and the survivors are moved down over them */
+            ElementIterator kept = targ;
+            while (targ != stop && next != batch.end()) {
+                if (comp(*next, *targ)) {
+                    ++next;
+                }
+                else if (comp(*targ, *next)) {
+                    if (kept != targ) {
+                        *kept = std::move(*targ);
+                    }
+                    ++kept;
+                    ++targ;
+                }
+                else {
+                    ++targ;
+                    ++next;
+                }
+            }
+            kept = (kept != targ) ? std::move(targ, stop, kept) : stop;
+            ct += std::distance(kept, stop);
+            targetBucket->erase(kept, stop);
+            if (targetBucket == sentinelBucket) {
+                break;
+            }
+            ++targetBucket;
+        }
         sz -= ct;
+        if (autoDensity) {
+            retune();
+        }
+        rebucket();
+        rebalanceCursor = NoCursor;
         return ct;
     }
 
+    /*
+        clear() runs in O(sqrt(n)) time and erases every element. The first
+        bucket and the bucket list keep their storage for the next inserts, 
+        and the other buckets hand theirs back, so that a reset never costs
+        more than one free per bucket (and no destructor calls if T is 
+        trivially destructible). This invalidates all iterators.
+    */
+    void clear() {
+        buckets.resize(1);
+        buckets.front().clear();
+        appendSentinel();
+        sz = 0;
+        rebalanceCursor = NoCursor;
+        if (autoDensity) {
+            retune();
+        }
+        init();
+    }
+
+    /*
+        split() runs in O(sqrt(n)) time and moves every element not below key
+        into the returned container, keeping the ones below it. Whole buckets
+        are handed over as they are, so only the bucket holding the cut has
+        elements moved. The new container takes the density settings of this
+        one. This invalidates all iterators.
+    */
+    SortedBucketVV split(const T& key) {
+        SortedBucketVV out(comp);
+        out.capacity = capacity;
+        out.bucketDensity = bucketDensity;
+        out.autoDensity = autoDensity;
+        Iterator cut = lowerBound(key);
+        size_t pos = position(cut);
+        size_t bucketDist = std::distance(buckets.begin(), cut.targetBucket);
+        out.buckets.clear();
+        if (cut.targ != cut.targetBucket->begin()) {
+            out.buckets.emplace_back(std::vector<T, Alloc>());
+            out.buckets.back().reserve(2*bucketDensity + 4);
+            out.buckets.back().insert(out.buckets.back().end(),
+                                      std::make_move_iterator(cut.targ),
+                                      std::make_move_iterator(cut.targetBucket->end()));
+            cut.targetBucket->erase(cut.targ, cut.targetBucket->end());
+            ++bucketDist;
+        }
+        /* the sentinel goes along with the last bucket */
+        out.buckets.insert(out.buckets.end(),
+                           std::make_move_iterator(std::next(buckets.begin(), bucketDist)),
+                           std::make_move_iterator(buckets.end()));
+        buckets.erase(std::next(buckets.begin(), bucketDist), buckets.end());
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        out.sz = sz - pos;
+        sz = pos;
+        settle();
+        out.settle();
+        return SortedBucketVV(std::move(out));
+    }
+
+    /*
+        join() runs in O(sqrt(n + m)) time and moves all of other onto the end
+        of this container, leaving other empty. Every element of other must
+        be at least back(), otherwise nothing is moved and false is returned.
+        The buckets of other are handed over as they are, so no element is
+        moved unless the bucket at the seam is undersized, or other has
+        another density. This invalidates all iterators of both containers.
+    */
+    bool join(SortedBucketVV& other) {
+        if (&other == this || other.sz == 0) {
+            return true;
+        }
+        if (sz > 0 && comp(other.front(), back())) {
+            return false;
+        }
+        buckets.back().pop_back();
+        if (buckets.back().empty()) {
+            buckets.pop_back();
+        }
+        buckets.insert(buckets.end(), std::make_move_iterator(other.buckets.begin()),
+                       std::make_move_iterator(other.buckets.end()));
+        sz += other.sz;
+        other.buckets.clear();
+        other.sz = 0;
+        other.settle();
+        settle();
+        return true;
+    }
+
+    /*
+        merge() runs in O(n + m) time and moves all of other into this
+        container, leaving other empty. Both are merged into one sorted run
+        which is then cut into full buckets like the SortedInput constructor.
+        This invalidates all iterators of both containers.
+    */
+    void merge(SortedBucketVV& other) {
+        if (&other == this || other.sz == 0) {
+            return;
+        }
+        std::vector<T> merged;
+        merged.reserve(sz + other.sz);
+        Iterator mine = begin(), theirs = other.begin();
+        Iterator mineEnd = end(), theirsEnd = other.end();
+        while (mine != mineEnd || theirs != theirsEnd) {
+            /* equal elements keep ours first */
+            bool ours = theirs == theirsEnd || (mine != mineEnd && !comp(*theirs, *mine));
+            merged.emplace_back(std::move(ours ? *mine++ : *theirs++));
+        }
+        if (autoDensity) {
+            /* tune for the merged size first so the buckets are cut only once */
+            sz = merged.size();
+            retune();
+        }
+        sz = 0;
+        buildSorted(std::make_move_iterator(merged.begin()),
+                    std::make_move_iterator(merged.end()));
+        rebalanceCursor = NoCursor;
+        other.clear();
+    }
+
+    /*
+        save() runs in O(n) time and writes a flat snapshot of the container
+        to path (see sortedBucketSnapshot.h), with the bucket sizes as runs
+        and each bucket written out whole. Returns whether it succeeded.
+    */
+    bool save(const char* path) const requires std::is_trivially_copyable_v<T> {
+        SnapshotFile file(path, "wb");
+        /* the sentinel is left out of the last bucket, and so are emptied buckets */
+        auto runOf = [this](size_t b) {
+            return buckets[b].size() - (b + 1 == buckets.size());
+        };
+        size_t runs = 0;
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            runs += (runOf(b) > 0);
+        }
+        SnapshotHeader header(sizeof(T), SnapshotFlat, sz, runs, bucketDensity);
+        file.write(&header, sizeof header);
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            uint64_t run = runOf(b);
+            if (run > 0) {
+                file.write(&run, sizeof run);
+            }
+        }
+        file.pad(header.elemOffset());
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            file.write(buckets[b].data(), runOf(b) * sizeof(T));
+        }
+        return file.close();
+    }
+
+    /*
+        load() runs in O(n) time and replaces the contents with the flat
+        snapshot at path, reading each bucket straight into place. If the
+        snapshot has bucket sizes they are kept along with its density, and
+        otherwise the elements are cut into buckets of the current density.
+        Returns whether it succeeded, leaving the container empty if not.
+        This invalidates all iterators.
+    */
+    bool load(const char* path) requires std::is_trivially_copyable_v<T> {
+        buckets.clear();
+        sz = 0;
+        SnapshotFile file(path, "rb");
+        SnapshotHeader header;
+        file.read(&header, sizeof header);
+        bool good = file && header.valid<T>() && header.fits<T>(file.length()) &&
+                    header.layout == SnapshotFlat;
+        std::vector<uint64_t> runs(good ? header.runs : 0);
+        file.read(runs.data(), runs.size() * sizeof(uint64_t));
+        size_t total = 0;
+        for (uint64_t run : runs) {
+            /* every bucket holds at least one element, and no more than are left */
+            good = good && run > 0 && run <= header.count - total;
+            total += good ? run : 0;
+        }
+        good = good && file && (runs.empty() || total == header.count);
+        if (good && !runs.empty()) {
+            bucketDensity = std::max<size_t>(1, header.density);
+        }
+        file.skip(header.elemOffset());
+        for (size_t b = 0, placed = 0; good && placed < header.count; ++b) {
+            size_t run = runs.empty() ? std::min<size_t>(bucketDensity, header.count - placed)
+                                      : runs[b];
+            buckets.emplace_back(std::vector<T, Alloc>());
+            buckets.back().reserve(std::max<size_t>(2*bucketDensity + 4, run + 1));
+            buckets.back().resize(run);
+            file.read(buckets.back().data(), run * sizeof(T));
+            good = bool(file);
+            placed += run;
+        }
+        if (good) {
+            sz = header.count;
+        }
+        else {
+            buckets.clear();
+        }
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        init();
+        rebalanceCursor = NoCursor;
+        if (autoDensity) {
+            retune();
+        }
+        return good;
+    }
+
+    /*
+        stats() runs in O(sqrt(n)) time and returns the counters kept since
+        construction or resetStats() (see SortedBucketStats), along with the
+        bytes held by the buckets and the bucket size index, and a histogram
+        of the bucket sizes.
+    */
+    SortedBucketStats stats() const {
+        SortedBucketStats out;
+#ifdef SORTED_BUCKET_STATS
+        out = counters;
+#endif
+        out.bytes = buckets.capacity() * sizeof(std::vector<T, Alloc>) +
+                    bucketIndex.capacity() * sizeof(size_t) + fences.capacity() * sizeof(T);
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            out.bytes += buckets[b].capacity() * sizeof(T);
+            /* the sentinel is left out of the last bucket */
+            out.countBucket(buckets[b].size() - (b + 1 == buckets.size()));
+        }
+        return out;
+    }
+
+    /* resetStats() zeroes the counters, a no-op without SORTED_BUCKET_STATS */
+    void resetStats() noexcept {
+#ifdef SORTED_BUCKET_STATS
+        counters = SortedBucketStats();
+#endif
+    }
+
 #ifndef NDEBUG
     /*
         forceDensity() forcibly changes the bucket density since in normal usage,
@@ -512,6 +1313,7 @@ public:
         to force balancing for small number of elements.
     */
     void forceDensity(size_t density) {
+        setAutoDensity(false);
         bucketDensity = density;
         if (sz > 0) {
             /* For vectors, rebalancing may invalidate iterator, so use idx */
@@ -523,7 +1325,7 @@ public:
                     point to the next bucket if the old one was undersized and 
                     got merged (since vector iterators are equivalent to indexes).
                     If so, we would stay in the same iterator */
-                typename std::vector<std::vector<T>>::iterator b = 
+                BucketIterator b = 
                     std::next(buckets.begin(), bucketDist);
                 assert(!b->empty());
                 if (!balance(b)) {
@@ -562,15 +1364,392 @@ public:
 private:
     inline void init() {
         if (buckets.empty()) {
-            buckets.emplace_back(std::vector<T>());
+            buckets.emplace_back(Bucket());
             buckets.front().reserve(2*bucketDensity + 4);
-            buckets.front().emplace_back(T{
-            # ifndef NDEBUG
-                SENTINEL_FLAG // if no flag, we use T{} constructor.
-            #endif
+            appendSentinel();
+        }
+        endSentinel = std::prev(buckets.back().end());
+        rebuildIndex();
+    }
+
+    /*
+        settle() runs in O(sqrt(n)) time, plus the size of any buckets out of
+        bounds, and tidies up after split() or join() moved whole buckets in
+        or out. A container left without buckets gets a fresh sentinel bucket,
+        and otherwise rebucket() restores the bounds around the seam.
+    */
+    void settle() {
+        if (autoDensity) {
+            retune();
+        }
+        if (buckets.empty()) {
+            init();
+        }
+        else {
+            rebucket();
+        }
+        rebalanceCursor = NoCursor;
+    }
+
+    /* appendSentinel() places the sentinel as the last item of the last bucket */
+    inline void appendSentinel() {
+        buckets.back().emplace_back(sentinelValue<T>());
+    }
+
+    /*
+        buildSorted() runs in O(n) time and fills the buckets from sorted input,
+        bucketDensity elements at a time. Only the last bucket (which also holds
+        the sentinel) may end up undersized, which balance() permits anyway.
+    */
+    template<class InputIterator>
+    void buildSorted(InputIterator beginIt, InputIterator endIt) {
+        assert(sz == 0);
+        buckets.clear();
+        for (InputIterator it = beginIt; it != endIt; ++it) {
+            if (buckets.empty() || buckets.back().size() == bucketDensity) {
+                buckets.emplace_back(std::vector<T, Alloc>());
+                buckets.back().reserve(2*bucketDensity + 4);
+            }
+            buckets.back().emplace_back(*it);
+            ++sz;
+        }
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        init();
+    }
+
+    /*
+        sortParallel() stable sorts data in one chunk per thread, then merges
+        neighbouring chunks in rounds until one is left.
+    */
+    void sortParallel(const Parallel& par, std::vector<T>& data) const {
+        size_t shards = parallelShards(par, data.size());
+        std::vector<size_t> cuts(shards + 1);
+        for (size_t shard = 0; shard <= shards; ++shard) {
+            cuts[shard] = data.size() * shard / shards;
+        }
+        typename std::vector<T>::iterator first = data.begin();
+        runShards(shards, [&](size_t shard) {
+            std::stable_sort(first + cuts[shard], first + cuts[shard + 1], comp);
+        });
+        for (size_t width = 1; width < shards; width *= 2) {
+            runShards((shards + 2*width - 1) / (2*width), [&](size_t pair) {
+                size_t lo = 2*width*pair;
+                size_t mid = std::min(lo + width, shards);
+                size_t hi = std::min(lo + 2*width, shards);
+                std::inplace_merge(first + cuts[lo], first + cuts[mid], first + cuts[hi], comp);
             });
         }
+    }
+
+    /*
+        buildParallel() is buildSorted() for the n sorted elements from 
+        beginIt, with the buckets split into one run per thread.
+    */
+    template<class RandomIt>
+    void buildParallel(const Parallel& par, RandomIt beginIt, size_t n) {
+        assert(sz == 0);
+        size_t count = (n + bucketDensity - 1) / bucketDensity;
+        buckets.clear();
+        buckets.resize(count);
+        size_t shards = std::min(parallelShards(par, n), count);
+        runShards(shards, [&](size_t shard) {
+            for (size_t b = count * shard / shards; b < count * (shard + 1) / shards; ++b) {
+                size_t lo = b * bucketDensity;
+                buckets[b].reserve(2*bucketDensity + 4);
+                buckets[b].insert(buckets[b].end(), beginIt + lo, 
+                                  beginIt + std::min(n, lo + bucketDensity));
+            }
+        });
+        sz = n;
+        if (!buckets.empty()) {
+            appendSentinel();
+        }
+        init();
+    }
+
+    /*
+        scanShards() splits the sorted indexes [first, last) evenly into shards
+        parts, and on a thread per part calls visit(shard, run) for each run of
+        the part within one bucket, in order. It only reads the buckets and the
+        index, so the threads share them safely.
+    */
+    template <typename Visit>
+    void scanShards(size_t shards, size_t first, size_t last, Visit&& visit) {
+        runShards(shards, [&](size_t shard) {
+            size_t lo = first + (last - first) * shard / shards;
+            size_t left = first + (last - first) * (shard + 1) / shards - lo;
+            size_t offset = lo;
+            /* lo < sz, so this stops before the sentinel */
+            size_t b = indexFind(offset);
+            while (left > 0) {
+                const std::vector<T, Alloc>& bucket = buckets[b++];
+                size_t take = std::min(left, bucket.size() - offset);
+                visit(shard, std::span<const T>(bucket.data() + offset, take));
+                left -= take;
+                offset = 0;
+            }
+        });
+    }
+
+    /*
+        The bucket size index is a Fenwick tree (1-indexed) over the sizes of
+        the buckets, so that the number of elements before any bucket can be
+        found without walking the buckets. Single element inserts and erases
+        update it in O(log(sqrt(n))), and any change to the bucket layout in
+        balance() rebuilds it in O(sqrt(n)).
+        The fences are a copy of the max of every bucket but the sentinel 
+        bucket, laid out contiguously so that picking a bucket only touches one
+        small array instead of one heap allocation per probe. They are rebuilt
+        together with the size index, and erase() patches a single fence when 
+        it removes the max of a bucket. insert() never changes a fence, since 
+        upperBound() only places elements below the max of their bucket.
+    */
+    void rebuildIndex() {
+        fences.clear();
+        for (size_t i = 0; i + 1 < buckets.size(); ++i) {
+            fences.emplace_back(buckets[i].back());
+        }
+        bucketIndex.assign(buckets.size() + 1, 0);
+        for (size_t i = 1; i <= buckets.size(); ++i) {
+            bucketIndex[i] += buckets[i - 1].size();
+            size_t par = i + (i & (0 - i));
+            if (par <= buckets.size()) {
+                bucketIndex[par] += bucketIndex[i];
+            }
+        }
+    }
+
+    /* indexAdd() adds delta to the size recorded for bucket bucketDist */
+    inline void indexAdd(size_t bucketDist, int delta) noexcept {
+        for (size_t i = bucketDist + 1; i < bucketIndex.size(); i += i & (0 - i)) {
+            bucketIndex[i] += delta;
+        }
+    }
+
+    /* indexPrefix() returns the number of elements before bucket bucketDist */
+    inline size_t indexPrefix(size_t bucketDist) const noexcept {
+        size_t sum = 0;
+        for (size_t i = bucketDist; i > 0; i -= i & (0 - i)) {
+            sum += bucketIndex[i];
+        }
+        return sum;
+    }
+
+    /*  indexFind() returns the bucket holding sorted index idx, and reduces idx
+        to the offset inside that bucket. Requires idx < total bucket sizes. */
+    inline size_t indexFind(size_t& idx) const noexcept {
+        size_t pos = 0;
+        for (size_t step = std::bit_floor(bucketIndex.size() - 1); step > 0; step >>= 1) {
+            if (pos + step < bucketIndex.size() && bucketIndex[pos + step] <= idx) {
+                pos += step;
+                idx -= bucketIndex[pos];
+            }
+        }
+        return pos;
+    }
+
+    /*
+        lowerBoundMany() runs lowerBoundWithDistance() for every key, 
+        BatchLookupLanes at a time, and calls visit(i, it, dist) with the result
+        for keys[i]. The fences are small enough to stay cached, so the misses 
+        are in the buckets, and the probe points of the first few search steps
+        are prefetched for every key before any bucket is searched.
+    */
+    template <typename Visit>
+    void lowerBoundMany(std::span<const T> keys, Visit&& visit) noexcept {
+        size_t bucketDists[BatchLookupLanes];
+        for (size_t first = 0; first < keys.size(); first += BatchLookupLanes) {
+            size_t lanes = std::min(BatchLookupLanes, keys.size() - first);
+            for (size_t l = 0; l < lanes; ++l) {
+                size_t bucketDist = 0;
+                if (buckets.size() > 1) {
+                    bucketDist = std::distance(fences.begin(), 
+                        searchRange<false>(fences.begin(), fences.end(), keys[first + l]));
+                }
+                bucketDists[l] = bucketDist;
+                const T* data = buckets[bucketDist].data();
+                size_t quarter = buckets[bucketDist].size() / 4;
+                prefetchRead(data + quarter);
+                prefetchRead(data + 2 * quarter);
+                prefetchRead(data + 3 * quarter);
+            }
+            for (size_t l = 0; l < lanes; ++l) {
+                BucketIterator targetBucket = 
+                    std::next(buckets.begin(), bucketDists[l]);
+                ElementIterator end = targetBucket->end();
+                if (std::next(targetBucket) == buckets.end()) {
+                    --end;
+                }
+                ElementIterator targ = 
+                    searchRange<false>(targetBucket->begin(), end, keys[first + l]);
+                size_t dist = indexPrefix(bucketDists[l]) + 
+                              std::distance(targetBucket->begin(), targ);
+                if (targ == targetBucket->end()) { 
+                    ++targetBucket;
+                    targ = targetBucket->begin();
+                }
+                visit(first + l, Iterator(targetBucket, targ), dist);
+            }
+        }
+    }
+
+    /*
+        emplaceNear() inserts n right before hint if it belongs there, and at
+        upperBound(n) otherwise. As adapt() may move elements between buckets,
+        the hint is only trusted when adapt() has nothing to do.
+    */
+    template <typename U>
+    Iterator emplaceNear(Iterator hint, U&& n) {
+        bool adapting = sz >= growAt || sz < shrinkAt || rebalanceCursor != NoCursor;
+        if (adapting || !fitsBefore(hint, n)) {
+            adapt();
+            auto [targetBucket, targ] = upperBound(n);
+            return emplaceAt(targetBucket, targ, std::forward<U>(n));
+        }
+        return emplaceAt(hint.targetBucket, hint.targ, std::forward<U>(n));
+    }
+
+    /*  fitsBefore() checks that n is not below the element before hint, nor 
+        above hint, treating end() as above everything */
+    inline bool fitsBefore(const Iterator& hint, const T& n) noexcept {
+        bool atEnd = hint.targetBucket == std::prev(buckets.end()) && hint.targ == endSentinel;
+        if (!atEnd && comp(*hint, n)) {
+            return false;
+        }
+        if (hint.targetBucket == buckets.begin() && hint.targ == buckets.front().begin()) {
+            return true;
+        }
+        return !comp(n, *std::prev(hint));
+    }
+
+    /*
+        emplaceAt() inserts n in front of targ, which must keep the order, and
+        balances the bucket. It returns an Iterator to the new element.
+    */
+    template <typename U>
+    Iterator emplaceAt(BucketIterator targetBucket,
+                       ElementIterator targ, U&& n) {
+        /*  Only for insertion: the rebalance may invalidate all buckets::iterator
+            and bucket::iterator if allocation occurs due to buckets vector 
+            resizing. We store dists then regenerate iterators after balancing */
+        size_t bucketDist = std::distance(buckets.begin(), targetBucket);
+        size_t targDist = std::distance(targetBucket->begin(), targ);
+        targetBucket->emplace(targ, std::forward<U>(n));
+        SORTED_BUCKET_COUNT(shifted, targetBucket->size() - targDist - 1);
+        endSentinel = std::prev(buckets.back().end());
+        indexAdd(bucketDist, 1);
+
+        size_t origSize = targetBucket->size();
+        bool shiftRight = balance(targetBucket,
+                                  std::next(targetBucket->begin(), targDist),
+                                  true);
+        
+        /*  If shifted right without a split, targetBucket was merged into the
+            bucket after it, which now sits at bucketDist */
+        bool split = shiftRight && origSize > 2*bucketDensity;
+        targetBucket = std::next(buckets.begin(), bucketDist + split);
+        targDist -= split ? bucketDensity : 0;
+        targ = std::next(targetBucket->begin(), targDist);
+        ++sz;
+        return Iterator(targetBucket, targ);
+    }
+
+    /*
+        eraseAt() erases the element at targ, which must not be the sentinel,
+        and balances its bucket.
+    */
+    void eraseAt(BucketIterator targetBucket,
+                 ElementIterator targ) {
+        size_t bucketDist = std::distance(buckets.begin(), targetBucket);
+        /* The sentinel is never erased, so this is never the sentinel bucket */
+        bool erasedMax = std::next(targ) == targetBucket->end();
+        SORTED_BUCKET_COUNT(shifted, std::distance(targ, targetBucket->end()) - 1);
+        targetBucket->erase(targ);
+        indexAdd(bucketDist, -1);
+        if (erasedMax && !targetBucket->empty()) {
+            fences[bucketDist] = targetBucket->back();
+        }
+        balance(targetBucket);
+        --sz;
+    }
+
+    /* position() returns the index of an Iterator, size() for end() */
+    inline size_t position(const Iterator& it) noexcept {
+        return indexPrefix(std::distance(buckets.begin(), it.targetBucket)) + 
+               std::distance(it.targetBucket->begin(), it.targ);
+    }
+
+    /*
+        searchRange() runs in O(log(sqrt(n))) time and returns the first element 
+        in [first, last) (a bucket or the fences) not below n, or the first 
+        element above n if Upper. See searchSorted() for the branchless path 
+        taken by arithmetic keys.
+    */
+    template <bool Upper, typename It, typename K>
+    It searchRange(It first, It last, const K& n) const noexcept {
+        const T* base = std::to_address(first);
+        return std::next(first, 
+            searchSorted<Upper>(base, std::to_address(last), n, comp) - base);
+    }
+
+    /*
+        rebucket() runs in O(sqrt(n) + m) time, where m is the total size of the
+        buckets outside of the density bounds, and restores the bounds in a 
+        single pass after a batch operation. Empty buckets are dropped, 
+        undersized buckets are merged into their left neighbour, and oversized 
+        buckets are cut into buckets of bucketDensity. Buckets which are already 
+        fine are only moved, which keeps their storage.
+    */
+    void rebucket() {
+        std::vector<std::vector<T, Alloc>> rebuilt;
+        rebuilt.reserve(buckets.size() + 1);
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            std::vector<T, Alloc>& bucket = buckets[b];
+            // last bucket is permitted to be undersized, and never empty
+            bool undersized = bucket.size() < bucketDensity / 2 && 
+                              b + 1 != buckets.size();
+            if (bucket.empty()) {
+                continue;
+            }
+            if (!rebuilt.empty() && 
+                (undersized || rebuilt.back().size() < bucketDensity / 2)) {
+                SORTED_BUCKET_COUNT(merges, 1);
+                SORTED_BUCKET_COUNT(moved, bucket.size());
+                rebuilt.back().insert(rebuilt.back().end(), 
+                                      std::make_move_iterator(bucket.begin()), 
+                                      std::make_move_iterator(bucket.end()));
+            }
+            else {
+                rebuilt.emplace_back(std::move(bucket));
+            }
+            /*  Keep the first bucketDensity elements in place and move the rest
+                out in pieces, the last piece taking the remainder */
+            size_t top = rebuilt.size() - 1;
+            size_t pieces = rebuilt[top].size() / bucketDensity;
+            if (rebuilt[top].size() <= bucketDensity * 2) {
+                continue;
+            }
+            SORTED_BUCKET_COUNT(splits, pieces - 1);
+            SORTED_BUCKET_COUNT(moved, rebuilt[top].size() - bucketDensity);
+            for (size_t p = 1; p < pieces; ++p) {
+                ElementIterator from = 
+                    std::next(rebuilt[top].begin(), p * bucketDensity);
+                ElementIterator to = (p + 1 == pieces) 
+                    ? rebuilt[top].end() : std::next(from, bucketDensity);
+                std::vector<T, Alloc> piece;
+                piece.reserve(2*bucketDensity + 4);
+                piece.insert(piece.end(), std::make_move_iterator(from), 
+                             std::make_move_iterator(to));
+                rebuilt.emplace_back(std::move(piece));
+            }
+            rebuilt[top].erase(std::next(rebuilt[top].begin(), bucketDensity), 
+                               rebuilt[top].end());
+        }
+        buckets.swap(rebuilt);
         endSentinel = std::prev(buckets.back().end());
+        rebuildIndex();
     }
 
     /* 
@@ -580,18 +1759,21 @@ private:
         This first removes any empty buckets to its right.
         Then it checks if targetBucket is too large or too small. 
         If so, we redistribute the contents among other buckets to maintain 
-        approximately sqrt(n) operations for this container.
+        approximately sqrt(n) operations for this container. Elements are
+        moved between buckets rather than copied.
     */
-    bool balance(typename std::vector<std::vector<T>>::iterator targetBucket,
-                 typename std::vector<T>::iterator targ = typename std::vector<T>::iterator(),
+    bool balance(BucketIterator targetBucket,
+                 ElementIterator targ = ElementIterator(),
                  bool targSupplied = false) {
         if (targetBucket == buckets.end()) {
             return false;
         }
         bool shiftRight = false;
-        typename std::vector<std::vector<T>>::iterator right = std::next(targetBucket);
+        bool restructured = false;
+        BucketIterator right = std::next(targetBucket);
         while (right != buckets.end() && right->empty()) {
             right = buckets.erase(right); 
+            restructured = true;
         }
         // right points to next available bucket
         if (targetBucket->size() > bucketDensity * 2) {
@@ -599,51 +1781,130 @@ private:
                 oversized targetBucket there */
             shiftRight = targSupplied && 
                          (std::distance(targetBucket->begin(), targ) >= bucketDensity);
-            typename std::vector<std::vector<T>>::iterator next = 
+            restructured = true;
+            BucketIterator next = 
                 buckets.emplace(std::next(targetBucket), std::vector<T, Alloc>());
             next->reserve(2*bucketDensity + 4);
             /* targetBucket may be invalidated if a vector reallocation occurred 
                 on buckets, but the return iterator next is guaranteed to be 
                 post-reallocation valid, so regenerate targetBucket from it. */
             targetBucket = std::prev(next);
-            next->insert(next->begin(), std::next(targetBucket->begin(), bucketDensity), 
-                         targetBucket->end());
+            SORTED_BUCKET_COUNT(splits, 1);
+            SORTED_BUCKET_COUNT(moved, targetBucket->size() - bucketDensity);
+            next->insert(next->begin(), 
+                         std::make_move_iterator(std::next(targetBucket->begin(), bucketDensity)), 
+                         std::make_move_iterator(targetBucket->end()));
             targetBucket->erase(std::next(targetBucket->begin(), bucketDensity),
                                 targetBucket->end());
         }
         else if (targetBucket->size() < bucketDensity / 2) {
             // last bucket is permitted to be undersized
             if (std::next(targetBucket) == buckets.end()) {
+                endSentinel = std::prev(buckets.back().end());
+                if (restructured) {
+                    rebuildIndex();
+                }
                 return false;
             }
-            typename std::vector<std::vector<T>>::iterator next = std::next(targetBucket);
+            restructured = true;
+            BucketIterator next = std::next(targetBucket);
             /* If dumping to the right would cause overflow, append some of right
                 into targetBucket */
             if (targetBucket->size() + next->size() > bucketDensity * 2) {
                 targetBucket->reserve(2*bucketDensity + 4);
                 int desired = (next->size() - targetBucket->size()) / 2;
-                targetBucket->insert(targetBucket->end(), next->begin(), 
-                                     std::next(next->begin(), desired));
+                SORTED_BUCKET_COUNT(moved, desired);
+                targetBucket->insert(targetBucket->end(), 
+                                     std::make_move_iterator(next->begin()), 
+                                     std::make_move_iterator(std::next(next->begin(), desired)));
                 next->erase(next->begin(), std::next(next->begin(), desired));
             }
             // Otherwise prepend all to the right
             else {
                 shiftRight = true;
+                SORTED_BUCKET_COUNT(merges, 1);
+                SORTED_BUCKET_COUNT(moved, targetBucket->size());
                 next->reserve(2*bucketDensity + 4);
-                next->insert(next->begin(), targetBucket->begin(), targetBucket->end());
+                next->insert(next->begin(), std::make_move_iterator(targetBucket->begin()), 
+                             std::make_move_iterator(targetBucket->end()));
                 buckets.erase(targetBucket);
             }
         }
         endSentinel = std::prev(buckets.back().end());
+        if (restructured) {
+            rebuildIndex();
+        }
         return shiftRight;
     }
 
+    /*
+        adapt() runs at the start of every insert and erase. In auto density 
+        mode it tunes the density once size() crosses a threshold, then 
+        balances the bucket under the rebalance cursor until every bucket has 
+        been visited. Otherwise it only compares size() against thresholds 
+        which can never be crossed.
+    */
+    inline void adapt() {
+        if (sz >= growAt || sz < shrinkAt) {
+            retune();
+        }
+        if (rebalanceCursor != NoCursor) {
+            stepCursor();
+        }
+    }
+
+    /*
+        retune() sets the density for the current size, restarting the 
+        rebalance cursor if it changed, and sets the sizes at which the density
+        would double or halve. When the density is already at one of the 
+        bounds of autoDensityFor(), that side never triggers.
+    */
+    void retune() {
+        size_t density = autoDensityFor<T>(sz);
+        if (density != bucketDensity) {
+            bucketDensity = density;
+            rebalanceCursor = 0;
+        }
+        size_t grow = 4 * density * density;
+        size_t shrink = density * density / 4;
+        growAt = (autoDensityFor<T>(grow) > density) ? grow : NoThreshold;
+        shrinkAt = (autoDensityFor<T>(shrink) < density) ? shrink : 0;
+    }
+
+    /* stepCursor() balances the bucket under the rebalance cursor */
+    void stepCursor() {
+        if (rebalanceCursor >= buckets.size()) {
+            rebalanceCursor = NoCursor;
+            return;
+        }
+        BucketIterator b = 
+            std::next(buckets.begin(), rebalanceCursor);
+        /*  Same walk as forceDensity(): stay on a bucket that absorbed the 
+            one before it, since it may be out of bounds itself */
+        if (!balance(b)) {
+            ++rebalanceCursor;
+        }
+    }
+
+    static constexpr size_t NoThreshold = size_t(-1);
+    static constexpr size_t NoCursor = size_t(-1);
+
     // Private members
     size_t                              sz              {0};
     size_t                              capacity        {0};
     size_t                              bucketDensity   {DefaultSmallDensity};
+    bool                                autoDensity     {false};
+    size_t                              growAt          {NoThreshold};  // auto density thresholds on sz
+    size_t                              shrinkAt        {0};
+    size_t                              rebalanceCursor {NoCursor};     // next bucket to re-split
     std::vector<std::vector<T, Alloc>>  buckets;
-    typename std::vector<T>::iterator   endSentinel;
+    std::vector<size_t>                 bucketIndex;    // Fenwick tree of bucket sizes
+    std::vector<T>                      fences;         // max of each non-sentinel bucket
+    ElementIterator   endSentinel;
+    [[no_unique_address]] StatsComp<Comp> comp;
+#ifdef SORTED_BUCKET_STATS
+    SortedBucketStats                   counters;
+#endif
 };
 
 #endif // UTIL_SORTED_BUCKET_VV_H
\ No newline at end of file
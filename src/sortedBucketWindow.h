@@ -0,0 +1,160 @@
+/**
+ * @file sortedBucketWindow.h
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Sliding window answering order statistics over its last k values
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Keeps the last k pushed values in arrival order in a ring buffer, and the
+ * same values sorted in one of the Sorted Bucket containers. Once the window
+ * is full, every push evicts the oldest value. The median, percentiles and
+ * ranks are then read off the sorted container in O(log(n)) time for RBT, or
+ * O(sqrt(n)) for VV.
+ *
+ * Eviction goes through the container's replace() where it has one (RBT and
+ * VV), which reuses the slot or node of the evicted value for the new one
+ * instead of an erase() and an insert() with their own searches. RBT then
+ * never allocates after the window fills up, and VV does not touch its index
+ * or rebalance when both values share a bucket. Other containers fall back to
+ * erase() and insert().
+ *
+ * Usage:
+ *      SortedWindow<int> window(1000);                 // VV by default
+ *      SortedWindow<int, SortedBucketRBT<int>> rbtWindow(1000);
+ *      window.push(5);
+ *      int median = window.median();
+ *
+ * Lookups on the containers are not const, so neither are the queries here.
+ *
+ */
+
+#ifndef UTIL_SORTED_BUCKET_WINDOW_H
+#define UTIL_SORTED_BUCKET_WINDOW_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "sortedBucketVV.h"
+
+template <typename T, typename Engine = SortedBucketVV<T>>
+class SortedWindow {
+public:
+    using value_type = T;
+
+    /*  Window of the last capacity values, at least 1. Any further arguments
+        construct the container, such as a comparator, or a container to
+        move from (which must be empty) */
+    template <typename... Args>
+    explicit SortedWindow(size_t capacity, Args&&... args)
+        : cap(std::max<size_t>(capacity, 1))
+        , sorted(std::forward<Args>(args)...) {
+        ring.reserve(cap);
+    }
+
+    /*
+        push() adds n as the newest value and returns whether the oldest one
+        was evicted to make room for it. Once the window is full it costs one
+        replace() on the container, otherwise an insert().
+    */
+    bool push(T n) {
+        if (ring.size() < cap) {
+            sorted.insert(n);
+            ring.push_back(std::move(n));
+            return false;
+        }
+        T& slot = ring[head];
+        if constexpr (requires { sorted.replace(slot, n); }) {
+            sorted.replace(slot, n);
+        }
+        else {
+            sorted.erase(slot);
+            sorted.insert(n);
+        }
+        slot = std::move(n);
+        if (++head == cap) {
+            head = 0;
+        }
+        return true;
+    }
+
+    /*  Element at index idx (from 0) in sorted order. Calling this with idx
+        not below size() is UB */
+    const T& nth(size_t idx) noexcept {
+        return *sorted.nth(idx);
+    }
+
+    /*  Lower median of the window, the element at index (size() - 1) / 2.
+        Calling this on an empty window is UB */
+    const T& median() noexcept {
+        return nth((size() - 1) / 2);
+    }
+
+    /*  The element at index floor(p * (size() - 1)), so 0 for the minimum
+        and 1 for the maximum. p is clamped into [0, 1]. Calling this on an
+        empty window is UB */
+    const T& percentile(double p) noexcept {
+        double at = std::clamp(p, 0.0, 1.0) * static_cast<double>(size() - 1);
+        return nth(std::min(static_cast<size_t>(at), size() - 1));
+    }
+
+    /*  Number of values in the window below n, or with inclusive set, not
+        above n. n does not have to be present */
+    size_t rank(const T& n, bool inclusive = false) noexcept {
+        return sorted.rank(n, inclusive);
+    }
+
+    /* Number of values in the window in [lo, hi) */
+    size_t countRange(const T& lo, const T& hi) noexcept {
+        return sorted.countRange(lo, hi);
+    }
+
+    /*  Oldest and newest values, the next to be evicted and the last one
+        pushed. Calling these on an empty window is UB */
+    const T& oldest() const noexcept {
+        return ring.size() < cap ? ring.front() : ring[head];
+    }
+
+    const T& newest() const noexcept {
+        return ring.size() < cap ? ring.back() : ring[(head + cap - 1) % cap];
+    }
+
+    /* Empties the window, keeping its capacity */
+    void clear() {
+        ring.clear();
+        head = 0;
+        sorted.clear();
+    }
+
+    /*  The sorted container, for queries not forwarded here. Changing it
+        directly puts it out of step with the window */
+    Engine& engine() noexcept {
+        return sorted;
+    }
+
+    inline size_t size() const noexcept {
+        return ring.size();
+    }
+
+    inline size_t capacity() const noexcept {
+        return cap;
+    }
+
+    inline bool empty() const noexcept {
+        return ring.empty();
+    }
+
+    inline bool full() const noexcept {
+        return ring.size() == cap;
+    }
+
+private:
+    size_t          cap;
+    size_t          head    {0};    // slot of the oldest value once full
+    std::vector<T>  ring;           // values in arrival order, wrapping at head
+    Engine          sorted;
+};
+
+#endif // UTIL_SORTED_BUCKET_WINDOW_H
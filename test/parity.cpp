@@ -12,12 +12,28 @@
  */
 
 
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <random>
+#include <string>
+#include <string_view>
+#include <thread>
 #include "sortedBucketRBT.h"
 #include "sortedBucketLL.h"
 #include "sortedBucketVV.h"
+#include "sortedBucketBT.h"
+#include "sortedBucket.h"
+#include "sortedBucketRuns.h"
+#include "sortedBucketWindow.h"
+#include "sortedBucketPool.h"
+#include "sortedBucketConcurrent.h"
+#include "sortedBucketCOW.h"
+#include "sortedBucketRegion.h"
 
 /* Number of operations for test. Recommended 10^4 in Debug or 10^5 in Release,
     otherwise it uses too much memory and page faults take a lot of time.
@@ -26,7 +42,7 @@
 constexpr size_t ops = 190000;
 
 /* Mersenne Twister random number gen */
-static std::mt19937_64 random{uint64_t(rand())};
+static std::mt19937_64 rng{uint64_t(rand())};
 
 
 using std::cout;
@@ -38,17 +54,19 @@ int main() {
     SortedBucketRBT<int> rbt;
     SortedBucketVV<int> vv;
     SortedBucketLL<int> ll;
+    SortedBucketBT<int> bt;
     vector<int> in, out;
     in.reserve(ops);
     out.reserve(ops);
 
     /* Populate sortedBuckets with random numbers */
     for (size_t i = 0; i < ops; ++i) {
-        int rand = random();
+        int rand = rng();
         in.emplace_back(rand);
         rbt.insert(rand);
         vv.insert(rand);
         ll.insert(rand);
+        bt.insert(rand);
     }
     cout << "Random numbers inserted " << endl;
 
@@ -58,7 +76,10 @@ int main() {
     cout << "Entering test for RBT" << endl;
     int last = 0;
     for (auto it = rbt.begin(); it != rbt.end(); ++it) {
-        out.emplace_back(*it);
+        /* duplicates share a node, so expand them back out */
+        for (size_t c = 0; c < it.copies(); ++c) {
+            out.emplace_back(*it);
+        }
     }
     for (int i = 0; i < in.size(); ++i) {
         if (in[i] != out[i]) {
@@ -72,6 +93,11 @@ int main() {
                 << " but claimed " << rbt.findWithDistance(in[i]).second << endl;
             }
         }
+        /* Check rank select, every index maps back to its sorted value */
+        if (in[i] != *rbt.nth(i)) {
+            cout << "Mismatched RBT at index " << i << ", actual nth " << in[i]
+            << " but claimed " << *rbt.nth(i) << endl;
+        }
         last = in[i];
     }
     cout << "Done test for RBT insertion" << endl;
@@ -95,6 +121,11 @@ int main() {
                 << " but claimed " << vv.findWithDistance(in[i]).second << endl;
             }
         }
+        /* Check rank select, every index maps back to its sorted value */
+        if (in[i] != *vv.nth(i)) {
+            cout << "Mismatched VV at index " << i << ", actual nth " << in[i]
+            << " but claimed " << *vv.nth(i) << endl;
+        }
         last = in[i];
     }
     cout << "Done test for VV insertion" << endl;
@@ -118,10 +149,1111 @@ int main() {
                 << " but claimed " << ll.findWithDistance(in[i]).second << endl;
             }
         }
+        /* Check rank select, every index maps back to its sorted value */
+        if (in[i] != *ll.nth(i)) {
+            cout << "Mismatched LL at index " << i << ", actual nth " << in[i]
+            << " but claimed " << *ll.nth(i) << endl;
+        }
         last = in[i];
     }
     cout << "Done test for LL insertion" << endl;
 
+    out.clear();
+    last = 0;
+    /* Test BT */
+    cout << "Entering test for BT" << endl;
+    for (auto it = bt.begin(); it != bt.end(); ++it) {
+        out.emplace_back(*it);
+    }
+    for (int i = 0; i < in.size(); ++i) {
+        if (in[i] != out[i]) {
+            cout << "Mismatched BT at index " << i << ", actual val " << in[i] 
+            << " but claimed " << out[i] << endl;
+        }
+        if (in[i] != last) {
+            /* Check distance, first of every group of identical ints has valid distance */
+            if (i != bt.findWithDistance(in[i]).second) {
+                cout << "Mismatched BT at index " << i << ", actual dist " << i
+                << " but claimed " << bt.findWithDistance(in[i]).second << endl;
+            }
+        }
+        /* Check rank select, every index maps back to its sorted value */
+        if (in[i] != *bt.nth(i)) {
+            cout << "Mismatched BT at index " << i << ", actual nth " << in[i]
+            << " but claimed " << *bt.nth(i) << endl;
+        }
+        last = in[i];
+    }
+    cout << "Done test for BT insertion" << endl;
+
+    out.clear();
+    /* Test RBT backed by the pool allocator, with erasure to churn the free list */
+    cout << "Entering test for RBT with pool" << endl;
+    {
+        SortedBucketRBT<int, std::less<int>, SortedBucketPool<int>> pool(in.begin(), in.end());
+        for (size_t i = 0; i < in.size(); i += 2) {
+            pool.erase(in[i]);
+        }
+        for (size_t i = 0; i < in.size(); i += 2) {
+            pool.insert(in[i]);
+        }
+        for (auto it = pool.begin(); it != pool.end(); ++it) {
+            for (size_t c = 0; c < it.copies(); ++c) {
+                out.emplace_back(*it);
+            }
+        }
+        if (out != in) {
+            cout << "Mismatched RBT with pool after erasing and reinserting" << endl;
+        }
+    }
+    cout << "Done test for RBT with pool" << endl;
+
+    /* Test RBT counts past 2^31 total copies */
+    cout << "Entering test for RBT with many copies" << endl;
+    {
+        constexpr size_t many = size_t(3) << 30;
+        SortedBucketRBT<int> big;
+        big.insert(1, many);
+        big.insert(2);
+        if (big.size() != many + 1 || big.distance(2) != std::ptrdiff_t(many) ||
+            *big.nth(many) != 2 || big.begin().copies() != many) {
+            cout << "Mismatched RBT with many copies, claimed distance " 
+            << big.distance(2) << endl;
+        }
+    }
+    cout << "Done test for RBT with many copies" << endl;
+
+    /* Test linear construction from sorted input, then churn the result */
+    cout << "Entering test for construction from sorted" << endl;
+    {
+        SortedBucketRBT<int> sortedRbt(SortedInput, in.begin(), in.end());
+        SortedBucketVV<int> sortedVv(SortedInput, in.begin(), in.end());
+        SortedBucketLL<int> sortedLl(SortedInput, in.begin(), in.end());
+        SortedBucketBT<int> sortedBt(SortedInput, in.begin(), in.end());
+        for (size_t i = 0; i < in.size(); i += 3) {
+            sortedRbt.erase(in[i]);
+            sortedVv.erase(in[i]);
+            sortedLl.erase(in[i]);
+            sortedBt.erase(in[i]);
+        }
+        for (size_t i = 0; i < in.size(); i += 3) {
+            sortedRbt.insert(in[i]);
+            sortedVv.insert(in[i]);
+            sortedLl.insert(in[i]);
+            sortedBt.insert(in[i]);
+        }
+        std::vector<int> outRbt, outVv, outLl, outBt;
+        for (auto it = sortedRbt.begin(); it != sortedRbt.end(); ++it) {
+            for (size_t c = 0; c < it.copies(); ++c) {
+                outRbt.emplace_back(*it);
+            }
+        }
+        for (auto it = sortedVv.begin(); it != sortedVv.end(); ++it) {
+            outVv.emplace_back(*it);
+        }
+        for (auto it = sortedLl.begin(); it != sortedLl.end(); ++it) {
+            outLl.emplace_back(*it);
+        }
+        for (auto it = sortedBt.begin(); it != sortedBt.end(); ++it) {
+            outBt.emplace_back(*it);
+        }
+        if (outRbt != in || outVv != in || outLl != in || outBt != in) {
+            cout << "Mismatched construction from sorted after erasing and reinserting" << endl;
+        }
+        for (size_t i = 0; i < in.size(); i += 97) {
+            if (*sortedRbt.nth(i) != in[i] || *sortedVv.nth(i) != in[i] ||
+                *sortedLl.nth(i) != in[i] || *sortedBt.nth(i) != in[i]) {
+                cout << "Mismatched construction from sorted at index " << i << endl;
+            }
+        }
+    }
+    cout << "Done test for construction from sorted" << endl;
+
+    /* Test batched insertion and erasure against the unsorted input */
+    cout << "Entering test for batches" << endl;
+    {
+        constexpr size_t batchSize = 10000;
+        vector<int> shuffled(in.begin(), in.end());
+        std::shuffle(shuffled.begin(), shuffled.end(), rng);
+        SortedBucketRBT<int> batchRbt;
+        SortedBucketVV<int> batchVv;
+        SortedBucketLL<int> batchLl;
+        SortedBucketBT<int> batchBt;
+        for (size_t i = 0; i < shuffled.size(); i += batchSize) {
+            auto first = shuffled.begin() + i;
+            auto last = shuffled.begin() + std::min(i + batchSize, shuffled.size());
+            batchRbt.insertBatch(first, last);
+            batchVv.insertBatch(first, last);
+            batchLl.insertBatch(first, last);
+            batchBt.insertBatch(first, last);
+        }
+        /* Erase every odd index in a single batch */
+        vector<int> odd, even;
+        for (size_t i = 0; i < in.size(); ++i) {
+            (i % 2 ? odd : even).emplace_back(in[i]);
+        }
+        size_t erased = batchRbt.eraseBatch(odd.begin(), odd.end());
+        if (erased != odd.size() || erased != batchVv.eraseBatch(odd.begin(), odd.end()) ||
+            erased != batchLl.eraseBatch(odd.begin(), odd.end()) ||
+            erased != batchBt.eraseBatch(odd.begin(), odd.end())) {
+            cout << "Mismatched batches, erased " << erased << " of " << odd.size() << endl;
+        }
+        vector<int> outRbt, outVv, outLl, outBt;
+        for (auto it = batchRbt.begin(); it != batchRbt.end(); ++it) {
+            for (size_t c = 0; c < it.copies(); ++c) {
+                outRbt.emplace_back(*it);
+            }
+        }
+        for (auto it = batchVv.begin(); it != batchVv.end(); ++it) {
+            outVv.emplace_back(*it);
+        }
+        for (auto it = batchLl.begin(); it != batchLl.end(); ++it) {
+            outLl.emplace_back(*it);
+        }
+        for (auto it = batchBt.begin(); it != batchBt.end(); ++it) {
+            outBt.emplace_back(*it);
+        }
+        if (outRbt != even || outVv != even || outLl != even || outBt != even) {
+            cout << "Mismatched batches after erasing odd indices" << endl;
+        }
+    }
+    cout << "Done test for batches" << endl;
+
+    /* Test VV in-bucket search on both the branchless and the generic path */
+    cout << "Entering test for VV bucket search" << endl;
+    {
+        SortedBucketVV<double> doubles;
+        SortedBucketVV<int, std::greater<int>> descending;
+        for (size_t i = 0; i < in.size(); ++i) {
+            doubles.insert(in[i] * 0.5);
+            descending.insert(in[i]);
+        }
+        last = 0;
+        for (size_t i = 0; i < in.size(); ++i) {
+            if (in[i] != last || i == 0) {
+                if (doubles.distance(in[i] * 0.5) != static_cast<int>(i)) {
+                    cout << "Mismatched VV of doubles at index " << i << ", claimed dist "
+                    << doubles.distance(in[i] * 0.5) << endl;
+                }
+                /* descending order puts the last occurrence of in[i] first */
+                size_t rev = in.end() - std::upper_bound(in.begin(), in.end(), in[i]);
+                if (descending.distance(in[i]) != static_cast<int>(rev)) {
+                    cout << "Mismatched VV descending at index " << i << ", claimed dist "
+                    << descending.distance(in[i]) << endl;
+                }
+            }
+            last = in[i];
+        }
+    }
+    cout << "Done test for VV bucket search" << endl;
+
+    /* Test ranks, range counts and VV spans against std::lower_bound on in */
+    cout << "Entering test for range queries" << endl;
+    {
+        for (size_t i = 0; i < 2000; ++i) {
+            int lo = rng(), hi = rng();
+            if (i % 2) {
+                /* Bounds taken from the data, so duplicates sit on the edges */
+                lo = in[rng() % in.size()];
+                hi = in[rng() % in.size()];
+            }
+            size_t expected = (lo < hi) ? std::lower_bound(in.begin(), in.end(), hi) - 
+                std::lower_bound(in.begin(), in.end(), lo) : 0;
+            if (rbt.countRange(lo, hi) != expected || vv.countRange(lo, hi) != expected ||
+                ll.countRange(lo, hi) != expected || bt.countRange(lo, hi) != expected) {
+                cout << "Mismatched countRange on [" << lo << ", " << hi << "), expected "
+                << expected << endl;
+            }
+            size_t below = std::lower_bound(in.begin(), in.end(), lo) - in.begin();
+            size_t notAbove = std::upper_bound(in.begin(), in.end(), lo) - in.begin();
+            if (rbt.rank(lo) != below || vv.rank(lo) != below || ll.rank(lo) != below ||
+                rbt.rank(lo, true) != notAbove || vv.rank(lo, true) != notAbove ||
+                ll.rank(lo, true) != notAbove || vv.lowerBoundWithDistance(lo).second != below ||
+                bt.rank(lo) != below || bt.rank(lo, true) != notAbove) {
+                cout << "Mismatched rank of " << lo << ", expected " << below << endl;
+            }
+            size_t spanned = 0;
+            auto from = std::lower_bound(in.begin(), in.end(), lo);
+            for (std::span<int> run : vv.spans(lo, hi)) {
+                if (!std::equal(run.begin(), run.end(), from + spanned)) {
+                    cout << "Mismatched VV span contents on [" << lo << ", " << hi << ")" << endl;
+                }
+                spanned += run.size();
+            }
+            if (spanned != expected) {
+                cout << "Mismatched VV spans on [" << lo << ", " << hi << "), spanned "
+                << spanned << endl;
+            }
+        }
+    }
+    cout << "Done test for range queries" << endl;
+
+    /*  Test batched lookups against the single ones, with keys present or not.
+        Small containers search each key on its own (see BatchLookupMinBytes),
+        so run them at both sizes, and a BT large enough to interleave */
+    cout << "Entering test for batched lookups" << endl;
+    {
+        auto batched = [&](auto& rbt, auto& vv, auto& ll, auto& bt, const vector<int>& from) {
+            vector<int> keys;
+            for (size_t i = 0; i < 1000; ++i) {
+                keys.emplace_back((i % 2) ? from[rng() % from.size()] : int(rng()));
+            }
+            /* a length which is not a multiple of the lanes */
+            keys.resize(keys.size() - 3);
+            vector<std::ptrdiff_t> rbtDists(keys.size()), btDists(keys.size());
+            vector<int> vvDists(keys.size()), llDists(keys.size());
+            vector<SortedBucketRBT<int>::Iterator> rbtFound(keys.size());
+            vector<SortedBucketVV<int>::Iterator> vvFound(keys.size());
+            vector<SortedBucketBT<int>::Iterator> btFound(keys.size());
+            rbt.distanceMany(keys, rbtDists);
+            vv.distanceMany(keys, vvDists);
+            ll.distanceMany(keys, llDists);
+            bt.distanceMany(keys, btDists);
+            rbt.findMany(keys, rbtFound);
+            vv.findMany(keys, vvFound);
+            bt.findMany(keys, btFound);
+            for (size_t i = 0; i < keys.size(); ++i) {
+                std::ptrdiff_t expected = rbt.distance(keys[i]);
+                if (rbtDists[i] != expected || vvDists[i] != expected || llDists[i] != expected ||
+                    btDists[i] != expected || rbtFound[i] != rbt.find(keys[i]) ||
+                    vvFound[i] != vv.find(keys[i]) || btFound[i] != bt.find(keys[i])) {
+                    cout << "Mismatched batched lookup of " << keys[i] << " over "
+                    << from.size() << ", expected dist " << expected << endl;
+                }
+            }
+        };
+        batched(rbt, vv, ll, bt, in);
+
+        vector<int> few;
+        SortedBucketRBT<int> fewRbt;
+        SortedBucketVV<int> fewVv;
+        SortedBucketLL<int> fewLl;
+        SortedBucketBT<int> fewBt;
+        for (size_t i = 0; i < in.size(); i += 64) {
+            few.emplace_back(in[i]);
+            fewRbt.insert(in[i]);
+            fewVv.insert(in[i]);
+            fewLl.insert(in[i]);
+            fewBt.insert(in[i]);
+        }
+        batched(fewRbt, fewVv, fewLl, fewBt, few);
+
+        /* only BT is large enough to interleave at ops elements */
+        vector<int> many;
+        for (int i = 0; i < int(4 * ops); ++i) {
+            many.emplace_back(2 * i);
+        }
+        SortedBucketBT<int> manyBt(SortedInput, many.begin(), many.end());
+        vector<int> keys;
+        for (size_t i = 0; i < 1000; ++i) {
+            keys.emplace_back(int(rng() % (8 * ops + 8)));
+        }
+        vector<std::ptrdiff_t> dists(keys.size());
+        vector<SortedBucketBT<int>::Iterator> found(keys.size());
+        manyBt.distanceMany(keys, dists);
+        manyBt.findMany(keys, found);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (dists[i] != manyBt.distance(keys[i]) || found[i] != manyBt.find(keys[i])) {
+                cout << "Mismatched batched BT lookup of " << keys[i] << endl;
+            }
+        }
+    }
+    cout << "Done test for batched lookups" << endl;
+
+    /* Test emplace, and RBT node handles moved between keys */
+    cout << "Entering test for emplace and extract" << endl;
+    {
+        using Named = std::pair<int, std::string>;
+        SortedBucketRBT<Named> namedRbt;
+        SortedBucketVV<Named> namedVv;
+        SortedBucketBT<Named> namedBt;
+        for (size_t i = 0; i < in.size(); i += 23) {
+            namedRbt.emplace(in[i], "rbt");
+            namedVv.emplace(in[i], "vv");
+            namedBt.emplace_hint(namedBt.end(), in[i], "bt");
+        }
+        if (namedRbt.size() != namedVv.size() || namedBt.size() != namedVv.size() ||
+            namedRbt.begin()->second != "rbt" || namedVv.begin()->first != in[0] ||
+            !std::is_sorted(namedBt.begin(), namedBt.end())) {
+            cout << "Mismatched emplace" << endl;
+        }
+        SortedBucketRBT<int> moved(rbt);
+        size_t before = moved.size();
+        for (size_t i = 0; i < in.size(); i += 997) {
+            SortedBucketRBT<int>::NodeHandle handle = moved.extract(in[i]);
+            if (handle.empty() || handle.value() != in[i] || moved.find(in[i]) != 
+                SortedBucketRBT<int>::Iterator(nullptr)) {
+                cout << "Mismatched extract of " << in[i] << endl;
+                continue;
+            }
+            /* the node comes back under the negated key, copies and all */
+            size_t copies = handle.copies();
+            handle.value() = -in[i];
+            if (*moved.insert(std::move(handle)) != -in[i] || 
+                moved.rank(-in[i], true) - moved.rank(-in[i]) < copies) {
+                cout << "Mismatched node handle insert of " << -in[i] << endl;
+            }
+        }
+        if (moved.size() != before) {
+            cout << "Mismatched size after node handles, " << moved.size() << endl;
+        }
+    }
+    cout << "Done test for emplace and extract" << endl;
+
+    /* Test appends of sorted input, and inserts hinted right and wrong */
+    cout << "Entering test for hinted inserts" << endl;
+    {
+        SortedBucketRBT<int> hintRbt;
+        SortedBucketVV<int> hintVv;
+        SortedBucketLL<int> hintLl;
+        SortedBucketBT<int> hintBt;
+        for (size_t i = 0; i < in.size(); i += 2) {
+            hintRbt.insert(in[i]);
+            hintVv.insert(in[i]);
+            hintLl.insert(in[i]);
+            hintBt.insert(in[i]);
+        }
+        for (size_t i = 1; i < in.size(); i += 2) {
+            /* every other hint is the right one */
+            int near = (i % 4 == 1) ? in[i] : in[rng() % in.size()];
+            hintRbt.insert(hintRbt.lowerBound(near), in[i]);
+            hintVv.insert(hintVv.lowerBound(near), in[i]);
+            hintLl.insert(hintLl.upperBound(near), in[i]);
+            hintBt.insert(hintBt.lowerBound(near), in[i]);
+        }
+        if (hintRbt.size() != in.size() || hintRbt.back() != in.back() ||
+            !std::equal(in.begin(), in.end(), hintVv.begin(), hintVv.end()) ||
+            !std::equal(in.begin(), in.end(), hintLl.begin(), hintLl.end()) ||
+            !std::equal(in.begin(), in.end(), hintBt.begin(), hintBt.end())) {
+            cout << "Mismatched hinted inserts" << endl;
+        }
+        for (size_t i = 0; i < in.size(); i += 101) {
+            if (hintRbt.distance(in[i]) != rbt.distance(in[i])) {
+                cout << "Mismatched RBT distance after hinted inserts at index " << i << endl;
+            }
+        }
+    }
+    cout << "Done test for hinted inserts" << endl;
+
+    /* Test shard moves: split at a key, join the halves back, and merge */
+    cout << "Entering test for split, join and merge" << endl;
+    {
+        int key = in[in.size() / 3];
+        size_t below = std::lower_bound(in.begin(), in.end(), key) - in.begin();
+        SortedBucketRBT<int> lowRbt(rbt);
+        SortedBucketVV<int> lowVv(vv);
+        SortedBucketLL<int> lowLl(ll);
+        SortedBucketBT<int> lowBt(bt);
+        SortedBucketRBT<int> highRbt = lowRbt.split(key);
+        SortedBucketVV<int> highVv = lowVv.split(key);
+        SortedBucketLL<int> highLl = lowLl.split(key);
+        SortedBucketBT<int> highBt = lowBt.split(key);
+        if (lowRbt.size() != below || highRbt.front() != key || lowRbt.back() != in[below - 1] ||
+            !std::equal(in.begin(), in.begin() + below, lowVv.begin(), lowVv.end()) ||
+            !std::equal(in.begin() + below, in.end(), highVv.begin(), highVv.end()) ||
+            !std::equal(in.begin(), in.begin() + below, lowLl.begin(), lowLl.end()) ||
+            !std::equal(in.begin() + below, in.end(), highLl.begin(), highLl.end()) ||
+            !std::equal(in.begin(), in.begin() + below, lowBt.begin(), lowBt.end()) ||
+            !std::equal(in.begin() + below, in.end(), highBt.begin(), highBt.end())) {
+            cout << "Mismatched split at " << key << endl;
+        }
+        /* the halves overlap the wrong way round */
+        if (highRbt.join(lowRbt) || highVv.join(lowVv) || highLl.join(lowLl) ||
+            highBt.join(lowBt)) {
+            cout << "Mismatched join of overlapping halves" << endl;
+        }
+        if (!lowRbt.join(highRbt) || !lowVv.join(highVv) || !lowLl.join(highLl) ||
+            !lowBt.join(highBt) || highRbt.size() + highVv.size() + highLl.size() +
+            highBt.size() != 0 || lowRbt.size() != in.size() ||
+            !std::equal(in.begin(), in.end(), lowVv.begin(), lowVv.end()) ||
+            !std::equal(in.begin(), in.end(), lowLl.begin(), lowLl.end()) ||
+            !std::equal(in.begin(), in.end(), lowBt.begin(), lowBt.end())) {
+            cout << "Mismatched join after split" << endl;
+        }
+        for (size_t i = 0; i < in.size(); i += 101) {
+            if (lowRbt.distance(in[i]) != rbt.distance(in[i])) {
+                cout << "Mismatched RBT distance after join at index " << i << endl;
+            }
+        }
+        SortedBucketRBT<int> evenRbt, oddRbt;
+        SortedBucketVV<int> evenVv, oddVv;
+        SortedBucketBT<int> evenBt, oddBt;
+        for (size_t i = 0; i < in.size(); ++i) {
+            (i % 2 ? oddRbt : evenRbt).insert(in[i]);
+            (i % 2 ? oddVv : evenVv).insert(in[i]);
+            (i % 2 ? oddBt : evenBt).insert(in[i]);
+        }
+        evenRbt.merge(oddRbt);
+        evenVv.merge(oddVv);
+        evenBt.merge(oddBt);
+        if (oddRbt.size() + oddVv.size() + oddBt.size() != 0 ||
+            evenRbt.size() != in.size() || evenRbt.distance(in.back()) != rbt.distance(in.back()) ||
+            !std::equal(in.begin(), in.end(), evenVv.begin(), evenVv.end()) ||
+            !std::equal(in.begin(), in.end(), evenBt.begin(), evenBt.end())) {
+            cout << "Mismatched merge" << endl;
+        }
+    }
+    cout << "Done test for split, join and merge" << endl;
+
+    /* Test clear leaves every container empty and ready for reuse */
+    cout << "Entering test for clear" << endl;
+    {
+        SortedBucketRBT<int, std::less<int>, SortedBucketPool<int>> poolRbt;
+        SortedBucketVV<int> clearVv(vv);
+        SortedBucketLL<int> clearLl(ll);
+        SortedBucketBT<int> clearBt(bt);
+        SortedBucketRBT<int> clearRbt(rbt);
+        for (size_t i = 0; i < in.size(); i += 7) {
+            poolRbt.insert(in[i]);
+        }
+        poolRbt.clear();
+        clearRbt.clear();
+        clearVv.clear();
+        clearLl.clear();
+        clearBt.clear();
+        if (poolRbt.size() + clearRbt.size() + clearVv.size() + clearLl.size() +
+            clearBt.size() != 0 || clearRbt.begin() != clearRbt.end() ||
+            clearVv.begin() != clearVv.end() || clearLl.begin() != clearLl.end() ||
+            clearBt.begin() != clearBt.end()) {
+            cout << "Mismatched clear" << endl;
+        }
+        for (size_t i = 0; i < in.size(); i += 3) {
+            poolRbt.insert(in[i]);
+            clearRbt.insert(in[i]);
+            clearVv.insert(in[i]);
+            clearLl.insert(in[i]);
+            clearBt.insert(in[i]);
+        }
+        size_t kept = (in.size() + 2) / 3;
+        if (poolRbt.size() != kept || clearRbt.size() != kept || clearVv.size() != kept ||
+            clearLl.size() != kept || clearBt.size() != kept ||
+            poolRbt.back() != clearVv.back() || clearRbt.front() != in[0] ||
+            *clearBt.nth(kept / 2) != *clearLl.nth(kept / 2)) {
+            cout << "Mismatched inserts after clear" << endl;
+        }
+    }
+    cout << "Done test for clear" << endl;
+
+    /* Test the run-length container keeps counting copies, against RBT */
+    cout << "Entering test for runs" << endl;
+    {
+        SortedBucketRuns<int> runs;
+        SortedBucketRBT<int> dupRbt;
+        for (size_t i = 0; i < in.size(); ++i) {
+            int dup = in[i] % 4099;
+            runs.insert(dup, 1 + i % 3);
+            dupRbt.insert(dup, 1 + i % 3);
+        }
+        for (size_t i = 0; i < in.size(); i += 5) {
+            int dup = in[i] % 4099;
+            if (i % 4 == 0 && runs.eraseAll(dup) != dupRbt.eraseAll(dup)) {
+                cout << "Mismatched runs eraseAll of " << dup << endl;
+            }
+            else if (runs.erase(dup) != dupRbt.erase(dup)) {
+                cout << "Mismatched runs erase of " << dup << endl;
+            }
+        }
+        auto rbtIt = dupRbt.begin();
+        for (auto it = runs.begin(); it != runs.end(); ++it, ++rbtIt) {
+            if (rbtIt == dupRbt.end() || *it != *rbtIt || it.copies() != rbtIt.copies()) {
+                cout << "Mismatched runs contents at " << *it << endl;
+                break;
+            }
+        }
+        if (runs.size() != dupRbt.size() || rbtIt != dupRbt.end()) {
+            cout << "Mismatched runs size " << runs.size() << " for " << dupRbt.size() << endl;
+        }
+        for (int key = -4100; key < 4100; key += 37) {
+            size_t idx = (key + 4100) * runs.size() / 8200;
+            if (runs.distance(key) != dupRbt.distance(key) || runs.rank(key) != dupRbt.rank(key) ||
+                runs.count(key) != dupRbt.countRange(key, key + 1) || *runs.nth(idx) != *dupRbt.nth(idx)) {
+                cout << "Mismatched runs lookup of " << key << endl;
+            }
+        }
+        /* eraseAll() of the back of VV has to stop at the sentinel, whatever it holds */
+        constexpr int top = std::numeric_limits<int>::max();
+        SortedBucketVV<int> tailVv;
+        for (int v : {1, top, top}) {
+            tailVv.insert(v);
+            runs.insert(v);
+        }
+        if (tailVv.eraseAll(top) != 2 || tailVv.size() != 1 || tailVv.back() != 1 ||
+            runs.eraseAll(top) != 2 || runs.count(top) != 0) {
+            cout << "Mismatched eraseAll of the back" << endl;
+        }
+    }
+    cout << "Done test for runs" << endl;
+
+    /* Test stats() accounts for every bucket, and counts balancing when enabled */
+    cout << "Entering test for stats" << endl;
+    {
+        SortedBucketRBT<int> statRbt;
+        SortedBucketVV<int> statVv;
+        SortedBucketLL<int> statLl;
+        SortedBucketBT<int> statBt;
+        for (int v : in) {
+            statRbt.insert(v);
+            statVv.insert(v);
+            statLl.insert(v);
+            statBt.insert(v);
+        }
+        /* in has no huge buckets, so the histogram ends well before its last slot */
+        auto check = [&](const SortedBucketStats& stats, bool bucketed, const char* name) {
+            size_t counted = 0;
+            for (size_t ct : stats.bucketSizes) {
+                counted += ct;
+            }
+            if (stats.bytes < in.size() * sizeof(int) || (counted > 0) != bucketed ||
+                stats.bucketSizes.back() != 0) {
+                cout << "Mismatched " << name << " stats, " << stats.bytes << " bytes over " <<
+                    counted << " buckets" << endl;
+            }
+#ifdef SORTED_BUCKET_STATS
+            if (stats.rotations + stats.splits == 0) {
+                cout << "Mismatched " << name << " stats, nothing balanced" << endl;
+            }
+#endif
+        };
+        check(statRbt.stats(), false, "rbt");
+        check(statVv.stats(), true, "vv");
+        check(statLl.stats(), true, "ll");
+        check(statBt.stats(), true, "bt");
+        statVv.resetStats();
+        if (statVv.stats().splits != 0 || statVv.stats().bytes == 0) {
+            cout << "Mismatched vv resetStats" << endl;
+        }
+    }
+    cout << "Done test for stats" << endl;
+
+    /* Test sliding windows against a sorted copy of the last values */
+    cout << "Entering test for sliding window" << endl;
+    {
+        constexpr size_t span = 300;
+        SortedBucketVV<int> smallVv;
+        smallVv.forceDensity(8);
+        SortedWindow<int> windowVv(span, std::move(smallVv));
+        SortedWindow<int, SortedBucketRBT<int>> windowRbt(span);
+        SortedWindow<int, SortedBucketBT<int>> windowBt(span);
+        /* in is sorted, so stride through it, with a few small values for duplicates */
+        auto valueAt = [&](size_t j) {
+            return (j % 7 == 0) ? int(j % 40) : in[j * 7919 % in.size()];
+        };
+        for (size_t i = 0; i < 5000; ++i) {
+            int v = valueAt(i);
+            bool evicted = windowVv.push(v);
+            windowRbt.push(v);
+            windowBt.push(v);
+            if (evicted != (i >= span) || windowVv.newest() != v) {
+                cout << "Mismatched window eviction at " << i << endl;
+            }
+            if (i % 97 != 0) {
+                continue;
+            }
+            size_t first = (i >= span) ? i + 1 - span : 0;
+            vector<int> last;
+            for (size_t j = first; j <= i; ++j) {
+                last.push_back(valueAt(j));
+            }
+            std::sort(last.begin(), last.end());
+            for (size_t j = 0; j < last.size(); ++j) {
+                if (windowVv.nth(j) != last[j] || windowRbt.nth(j) != last[j] || 
+                    windowBt.nth(j) != last[j]) {
+                    cout << "Mismatched window contents at " << i << endl;
+                    break;
+                }
+            }
+            if (windowVv.median() != last[(last.size() - 1) / 2] || 
+                windowRbt.percentile(1.0) != last.back() || 
+                windowVv.rank(v) != windowRbt.rank(v)) {
+                cout << "Mismatched window queries at " << i << endl;
+            }
+        }
+        /* replace() of a missing value changes nothing */
+        SortedBucketRBT<int> noneRbt;
+        SortedBucketVV<int> noneVv;
+        if (noneRbt.replace(1, 5) != noneRbt.end() || noneVv.replace(1, 5) != noneVv.end() ||
+            noneRbt.size() + noneVv.size() != 0) {
+            cout << "Mismatched replace of a missing value" << endl;
+        }
+    }
+    cout << "Done test for sliding window" << endl;
+
+    /* Test the parallel build and scans match the serial ones */
+    cout << "Entering test for parallel VV" << endl;
+    {
+        /* in is sorted, so build from a stride through it */
+        vector<int> shuffled;
+        for (size_t i = 0; i < in.size(); ++i) {
+            shuffled.push_back(in[i * 7919 % in.size()]);
+        }
+        SortedBucketVV<int> parVv(Parallel{4}, shuffled.begin(), shuffled.end());
+        SortedBucketVV<int> parSortedVv(Parallel{4}, SortedInput, in.begin(), in.end(), 400);
+        size_t i = 0;
+        for (auto it = parVv.begin(), at = parSortedVv.begin(); it != parVv.end(); ++it, ++at, ++i) {
+            if (*it != in[i] || *at != in[i]) {
+                cout << "Mismatched parallel build at index " << i << endl;
+                break;
+            }
+        }
+        if (parVv.size() != in.size() || parSortedVv.size() != in.size()) {
+            cout << "Mismatched parallel build size " << parVv.size() << endl;
+        }
+        long long sum = 0;
+        for (size_t j = 10; j < in.size(); ++j) {
+            sum += in[j];
+        }
+        std::atomic<size_t> visited {0};
+        parVv.forEach(Parallel{4}, 10, in.size() + 5, [&](int) { ++visited; });
+        if (parVv.transformReduce(Parallel{4}, 10, in.size(), 0LL, std::plus<>(),
+                                  [](int v) { return (long long)v; }) != sum || 
+            visited != in.size() - 10) {
+            cout << "Mismatched parallel scan" << endl;
+        }
+    }
+    cout << "Done test for parallel VV" << endl;
+
+    /* Test the facade gives every engine the same answers, misses included */
+    cout << "Entering test for facade" << endl;
+    {
+        static_assert(std::is_same_v<AutoEngine<int>, SortedBucketVV<int>>);
+        static_assert(std::is_same_v<AutoEngine<std::string>, SortedBucketBT<std::string>>);
+        SortedBucket<int> autoBucket(in.begin(), in.end());
+        SortedBucket<int, std::less<int>, SortedBucketRBT<int>> rbtBucket(in.begin(), in.end());
+        SortedBucket<int, std::less<int>, SortedBucketLL<int>> llBucket(in.begin(), in.end());
+        for (size_t i = 0; i < in.size(); i += 101) {
+            /* in[i] + 1 is usually missing */
+            for (int key : {in[i], in[i] + 1}) {
+                auto expected = std::lower_bound(in.begin(), in.end(), key);
+                bool present = expected != in.end() && *expected == key;
+                std::ptrdiff_t dist = present ? expected - in.begin() : -1;
+                if (rbtBucket.contains(key) != present || (llBucket.find(key) == llBucket.end()) == present ||
+                    (rbtBucket.find(key) == rbtBucket.end()) == present || autoBucket.distance(key) != dist ||
+                    rbtBucket.distance(key) != dist || llBucket.count(key) != rbtBucket.count(key)) {
+                    cout << "Mismatched facade lookup of " << key << endl;
+                }
+            }
+        }
+        rbtBucket.insert(in[0], 3);
+        autoBucket.insert(in[0], 3);
+        if (rbtBucket.eraseAll(in[0]) != autoBucket.eraseAll(in[0]) || 
+            rbtBucket.size() != autoBucket.size()) {
+            cout << "Mismatched facade insert of copies" << endl;
+        }
+
+        /* every engine walks every copy, both ways, whether or not it counts them */
+        const vector<int> copies {1, 1, 1, 2, 2, 3};
+        auto walks = [&](auto&& facade) {
+            vector<int> forward(facade.begin(), facade.end());
+            vector<int> backward;
+            for (auto it = facade.end(); it != facade.begin();) {
+                backward.emplace_back(*--it);
+            }
+            std::reverse(backward.begin(), backward.end());
+            bool indexed = true;
+            for (size_t i = 0; i < copies.size(); ++i) {
+                auto it = facade.nth(i);
+                indexed = indexed && *it == copies[i] && 
+                          std::distance(it, facade.end()) == std::ptrdiff_t(copies.size() - i);
+            }
+            bool matched = facade.size() == copies.size() && forward == copies &&
+                           backward == copies && indexed &&
+                           std::distance(facade.find(2), facade.end()) == 3;
+            /* a new copy goes last among its equals */
+            auto inserted = facade.insert(2);
+            return matched && std::next(inserted) == facade.find(3);
+        };
+        if (!walks(SortedBucket<int, std::less<int>, SortedBucketRBT<int>>(copies.begin(), copies.end())) ||
+            !walks(SortedBucket<int, std::less<int>, SortedBucketRuns<int>>(copies.begin(), copies.end())) ||
+            !walks(SortedBucket<int, std::less<int>, SortedBucketVV<int>>(copies.begin(), copies.end())) ||
+            !walks(SortedBucket<int, std::less<int>, SortedBucketLL<int>>(copies.begin(), copies.end())) ||
+            !walks(SortedBucket<int, std::less<int>, SortedBucketBT<int>>(copies.begin(), copies.end())) ||
+            !walks(SortedBucket<int, std::less<int>, SortedBucketCOW<int>>(copies.begin(), copies.end()))) {
+            cout << "Mismatched facade walk over copies" << endl;
+        }
+    }
+    cout << "Done test for facade" << endl;
+
+    /* Test auto density follows the size both ways without losing elements */
+    cout << "Entering test for auto density" << endl;
+    {
+        /* Large elements so that the density starts low and has room to grow */
+        using Wide = std::array<int, 64>;
+        constexpr size_t wideOps = 20000;
+        SortedBucketVV<Wide> wideVv;
+        SortedBucketLL<Wide> wideLl;
+        wideVv.setAutoDensity(true);
+        wideLl.setAutoDensity(true);
+        size_t startDensity = wideVv.getDensity();
+        for (size_t i = 0; i < wideOps; ++i) {
+            wideVv.insert(Wide{in[i]});
+            wideLl.insert(Wide{in[i]});
+        }
+        size_t grownDensity = wideVv.getDensity();
+        for (size_t i = wideOps / 10; i < wideOps; ++i) {
+            wideVv.erase(Wide{in[i]});
+            wideLl.erase(Wide{in[i]});
+        }
+        if (grownDensity <= startDensity || wideVv.getDensity() >= grownDensity ||
+            wideLl.getDensity() != wideVv.getDensity()) {
+            cout << "Mismatched auto density, went from " << startDensity << " to " 
+            << grownDensity << " to " << wideVv.getDensity() << endl;
+        }
+        vector<int> kept(in.begin(), in.begin() + wideOps / 10);
+        vector<int> outVv, outLl;
+        for (auto it = wideVv.begin(); it != wideVv.end(); ++it) {
+            outVv.emplace_back((*it)[0]);
+        }
+        for (auto it = wideLl.begin(); it != wideLl.end(); ++it) {
+            outLl.emplace_back((*it)[0]);
+        }
+        std::sort(kept.begin(), kept.end());
+        if (outVv != kept || outLl != kept) {
+            cout << "Mismatched auto density contents" << endl;
+        }
+    }
+    cout << "Done test for auto density" << endl;
+
+    /* Test lookups by std::string_view, and a comparator carrying state */
+    cout << "Entering test for comparators" << endl;
+    {
+        SortedBucketRBT<std::string, std::less<>> strRbt;
+        SortedBucketVV<std::string, std::less<>> strVv;
+        SortedBucketLL<std::string, std::less<>> strLl;
+        SortedBucketBT<std::string, std::less<>> strBt;
+        vector<std::string> strs;
+        for (size_t i = 0; i < in.size(); i += 19) {
+            strs.emplace_back(std::to_string(in[i]));
+        }
+        for (const std::string& str : strs) {
+            strRbt.insert(str);
+            strVv.insert(str);
+            strLl.insert(str);
+            strBt.insert(str);
+        }
+        std::sort(strs.begin(), strs.end());
+        for (size_t i = 0; i < strs.size(); i += 7) {
+            std::string_view key = strs[i];
+            size_t below = std::lower_bound(strs.begin(), strs.end(), key) - strs.begin();
+            if (strRbt.distance(key) != std::ptrdiff_t(below) || 
+                strVv.distance(key) != int(below) || strLl.distance(key) != int(below) ||
+                strBt.distance(key) != std::ptrdiff_t(below) || *strBt.upperBound(key) <= key) {
+                cout << "Mismatched string_view lookup of " << key << endl;
+            }
+        }
+        for (size_t i = 0; i < strs.size(); i += 7) {
+            std::string_view key = strs[i];
+            if (strRbt.erase(key) != 1 || strVv.erase(key) != 1 || strLl.erase(key) != 1 ||
+                strBt.erase(key) != 1) {
+                cout << "Mismatched string_view erase of " << key << endl;
+            }
+        }
+        /* One comparator type which sorts either way, depending on its state */
+        struct Ordered {
+            bool descending {false};
+            bool operator ()(int a, int b) const { return descending ? b < a : a < b; }
+        };
+        SortedBucketVV<int, Ordered> downVv(Ordered{true});
+        SortedBucketBT<int, Ordered> downBt(Ordered{true});
+        for (size_t i = 0; i < in.size(); i += 13) {
+            downVv.insert(in[i]);
+            downBt.insert(in[i]);
+        }
+        if (!std::is_sorted(downVv.begin(), downVv.end(), std::greater<int>()) ||
+            !std::equal(downVv.begin(), downVv.end(), downBt.begin(), downBt.end())) {
+            cout << "Mismatched stateful comparator order" << endl;
+        }
+    }
+    cout << "Done test for comparators" << endl;
+
+    /* Test snapshots round trip, across containers and through the mapped view */
+    cout << "Entering test for snapshots" << endl;
+    {
+        const char* vvPath = "parity_vv.snap";
+        const char* rbtPath = "parity_rbt.snap";
+        if (!vv.save(vvPath) || !rbt.save(rbtPath)) {
+            cout << "Mismatched snapshots, could not save" << endl;
+        }
+        SortedBucketRBT<int> loadedRbt;
+        SortedBucketVV<int> loadedVv;
+        SortedBucketLL<int> loadedLl;
+        SortedBucketBT<int> loadedBt;
+        SortedBucketMapped<int> mapped(vvPath);
+        SortedBucketMapped<int> mappedRbt(rbtPath);
+        if (!loadedRbt.load(rbtPath) || !loadedVv.load(vvPath) || !loadedLl.load(vvPath) ||
+            !loadedBt.load(vvPath) || loadedVv.load(rbtPath) || !mapped.attached() ||
+            !mappedRbt.attached() || mappedRbt.size() != in.size()) {
+            cout << "Mismatched snapshots, could not load" << endl;
+        }
+        vector<int> outRbt, outVv, outLl, outBt;
+        for (auto it = loadedRbt.begin(); it != loadedRbt.end(); ++it) {
+            for (size_t c = 0; c < it.copies(); ++c) {
+                outRbt.emplace_back(*it);
+            }
+        }
+        /* the failed load of the RBT snapshot left loadedVv empty */
+        loadedVv.load(vvPath);
+        for (auto it = loadedVv.begin(); it != loadedVv.end(); ++it) {
+            outVv.emplace_back(*it);
+        }
+        for (auto it = loadedLl.begin(); it != loadedLl.end(); ++it) {
+            outLl.emplace_back(*it);
+        }
+        for (auto it = loadedBt.begin(); it != loadedBt.end(); ++it) {
+            outBt.emplace_back(*it);
+        }
+        vector<int> outMapped(mapped.elements().begin(), mapped.elements().end());
+        if (outRbt != in || outVv != in || outLl != in || outBt != in || outMapped != in) {
+            cout << "Mismatched snapshots after loading" << endl;
+        }
+        for (size_t i = 0; i < in.size(); i += 97) {
+            if (mapped.rank(in[i]) != rbt.rank(in[i]) || mappedRbt.nth(i) != in[i] ||
+                mappedRbt.distance(in[i]) != rbt.distance(in[i])) {
+                cout << "Mismatched mapped snapshot at index " << i << endl;
+            }
+        }
+        std::remove(vvPath);
+        std::remove(rbtPath);
+
+        /* draining the tail empties the last buckets, which must still round trip */
+        const char* tailPath = "parity_tail.snap";
+        for (size_t density : {size_t(0), size_t(5)}) {
+            SortedBucketVV<int> tailVv;
+            SortedBucketLL<int> tailLl;
+            if (density > 0) {
+                tailVv.forceDensity(density);
+                tailLl.forceDensity(density);
+            }
+            for (int i = 0; i < 100000; ++i) {
+                tailVv.insert(i);
+                tailLl.insert(i);
+            }
+            for (int i = 99999; i >= 100000 - 600; --i) {
+                tailVv.erase(i);
+                tailLl.erase(i);
+            }
+            SortedBucketVV<int> loadedTailVv;
+            SortedBucketLL<int> loadedTailLl;
+            if (!tailVv.save(tailPath) || !loadedTailVv.load(tailPath) ||
+                !tailLl.save(tailPath) || !loadedTailLl.load(tailPath) ||
+                loadedTailVv.size() != tailVv.size() || loadedTailLl.size() != tailLl.size() ||
+                !std::equal(tailVv.begin(), tailVv.end(), loadedTailVv.begin(), loadedTailVv.end()) ||
+                !std::equal(tailLl.begin(), tailLl.end(), loadedTailLl.begin(), loadedTailLl.end())) {
+                cout << "Mismatched snapshots after draining the tail, density " << density << endl;
+            }
+        }
+        std::remove(tailPath);
+
+        /*  a header whose count or runs wraps around once multiplied out must
+            not pass for a short file */
+        const char* badPath = "parity_bad.snap";
+        SortedBucketVV<int> small;
+        for (int i = 0; i < 100; ++i) {
+            small.insert(i);
+        }
+        for (int field = 0; field < 2; ++field) {
+            SnapshotHeader header(sizeof(int), SnapshotFlat, 100, 0, 0);
+            if (field == 0) {
+                header.count = uint64_t(1) << 62;   // count * sizeof(int) wraps to 0
+            }
+            else {
+                header.runs = uint64_t(1) << 61;    // runs * sizeof(uint64_t) wraps to 0
+            }
+            small.save(badPath);
+            std::FILE* bad = std::fopen(badPath, "r+b");
+            std::fwrite(&header, sizeof header, 1, bad);
+            std::fclose(bad);
+            SortedBucketVV<int> badVv;
+            SortedBucketLL<int> badLl;
+            SortedBucketBT<int> badBt;
+            SortedBucketRBT<int> badRbt;
+            SortedBucketRuns<int> badRuns;
+            SortedBucketMapped<int> badMapped(badPath);
+            if (badVv.load(badPath) || badLl.load(badPath) || badBt.load(badPath) ||
+                badRbt.load(badPath) || badRuns.load(badPath) || badMapped.attached() ||
+                badVv.size() || badLl.size() || badBt.size() || badRbt.size() ||
+                badRuns.size() || badMapped.size()) {
+                cout << "Mismatched snapshots, loaded a header past the end of the file" << endl;
+            }
+        }
+        std::remove(badPath);
+    }
+    cout << "Done test for snapshots" << endl;
+
+    /* Test readers of the concurrent wrapper always see a whole write */
+    cout << "Entering test for concurrent readers" << endl;
+    {
+        SortedBucketConcurrent<SortedBucketVV<int>> shared;
+        std::atomic<bool> writing {true};
+        std::atomic<size_t> torn {0};
+        vector<std::thread> readers;
+        for (int t = 0; t < 2; ++t) {
+            readers.emplace_back([&]() {
+                while (writing) {
+                    /* 0..s-1 were inserted in order, so the last one sits at s-1 */
+                    shared.read([&](SortedBucketVV<int>& c) {
+                        int s = c.size();
+                        if (s > 0 && (*c.nth(s - 1) != s - 1 || c.distance(s - 1) != s - 1)) {
+                            ++torn;
+                        }
+                    });
+                    std::this_thread::yield();
+                }
+            });
+        }
+        for (int i = 0; i < 2000; ++i) {
+            shared.insert(i);
+        }
+        writing = false;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        if (torn != 0 || shared.size() != 2000 || shared.distance(1999) != 1999) {
+            cout << "Mismatched concurrent readers, " << torn << " torn reads" << endl;
+        }
+    }
+    cout << "Done test for concurrent readers" << endl;
+
+    /* Test copy-on-write snapshots stay frozen while the container changes */
+    cout << "Entering test for copy-on-write snapshots" << endl;
+    {
+        SortedBucketCOW<int> cow;
+        cow.forceDensity(8);
+        vector<int> expect;
+        vector<std::pair<SortedBucketCOW<int>::Snapshot, vector<int>>> frozen;
+        for (size_t i = 0; i < 20000; ++i) {
+            int v = in[i * 7919 % in.size()] % 1000;
+            if (i % 3 == 2) {
+                auto at = std::lower_bound(expect.begin(), expect.end(), v);
+                bool present = at != expect.end() && *at == v;
+                if (cow.erase(v) != int(present)) {
+                    cout << "Mismatched cow erase at " << i << endl;
+                }
+                if (present) {
+                    expect.erase(at);
+                }
+            }
+            else {
+                cow.insert(v);
+                expect.insert(std::upper_bound(expect.begin(), expect.end(), v), v);
+            }
+            if (i % 1999 == 0) {
+                frozen.emplace_back(cow.snapshot(), expect);
+            }
+        }
+        if (!std::equal(cow.begin(), cow.end(), expect.begin(), expect.end())) {
+            cout << "Mismatched cow contents" << endl;
+        }
+        for (size_t j = 0; j < expect.size(); j += 37) {
+            if (*cow.nth(j) != expect[j] || cow.rank(expect[j]) !=
+                size_t(std::lower_bound(expect.begin(), expect.end(), expect[j]) - expect.begin())) {
+                cout << "Mismatched cow queries at index " << j << endl;
+            }
+        }
+        /* a reader thread scans the latest snapshot while writes go on */
+        std::atomic<size_t> torn {0};
+        std::thread reader([&torn, view = frozen.back()]() {
+            for (int round = 0; round < 20; ++round) {
+                if (!std::equal(view.first.begin(), view.first.end(), 
+                                view.second.begin(), view.second.end())) {
+                    ++torn;
+                }
+            }
+        });
+        for (int v = 0; v < 1000; ++v) {
+            cow.insert(v);
+            cow.erase(v % 7);
+        }
+        reader.join();
+        cow.clear();
+        for (auto& [view, contents] : frozen) {
+            if (view.size() != contents.size() || 
+                !std::equal(view.begin(), view.end(), contents.begin(), contents.end()) ||
+                (!contents.empty() && *view.nth(contents.size() / 2) != contents[contents.size() / 2])) {
+                ++torn;
+            }
+        }
+        if (torn != 0 || cow.size() != 0) {
+            cout << "Mismatched cow snapshots, " << torn << " changed" << endl;
+        }
+    }
+    cout << "Done test for copy-on-write snapshots" << endl;
+
+    /* Test containers on region storage match the ones on std::allocator */
+    cout << "Entering test for region storage" << endl;
+    {
+        using Region = SortedBucketRegion<int>;
+        Region::reserve(in.size() / DefaultSmallDensity * (2*DefaultSmallDensity + 4));
+        SortedBucketVV<int, std::less<int>, Region> regionVv;
+        SortedBucketRBT<int, std::less<int>, Region> regionRbt;
+        SortedBucketBT<int, std::less<int>, SortedBucketRegion<int, false, 0>> regionBt;
+        for (size_t i = 0; i < in.size(); ++i) {
+            int v = in[i * 7919 % in.size()];
+            regionVv.insert(v);
+            regionRbt.insert(v);
+            regionBt.insert(v);
+        }
+        for (size_t i = 0; i < in.size(); i += 3) {
+            if (regionVv.erase(in[i]) != 1 || regionRbt.erase(in[i]) != 1 || 
+                regionBt.erase(in[i]) != 1) {
+                cout << "Mismatched region erase at index " << i << endl;
+                break;
+            }
+        }
+        vector<int> kept;
+        for (size_t i = 0; i < in.size(); ++i) {
+            if (i % 3 != 0) {
+                kept.push_back(in[i]);
+            }
+        }
+        for (size_t i = 0; i < kept.size(); i += 41) {
+            if (*regionVv.nth(i) != kept[i] || *regionRbt.nth(i) != kept[i] || 
+                *regionBt.nth(i) != kept[i]) {
+                cout << "Mismatched region nth at index " << i << endl;
+                break;
+            }
+        }
+        if (!std::equal(regionVv.begin(), regionVv.end(), kept.begin(), kept.end()) ||
+            regionRbt.size() != kept.size() || Region::mapped() == 0) {
+            cout << "Mismatched region contents" << endl;
+        }
+
+        /* copies and moves must own their buckets, and leave the source behind */
+        using RegionVV = SortedBucketVV<int, std::less<int>, Region>;
+        auto copied = std::make_unique<RegionVV>(regionVv);
+        RegionVV moved(std::move(regionVv));
+        if (regionVv.size() != 0 || regionVv.begin() != regionVv.end() ||
+            moved.size() != kept.size() || copied->size() != kept.size()) {
+            cout << "Mismatched region copy or move sizes" << endl;
+        }
+        regionVv.insert(kept[0]);
+        if (regionVv.size() != 1 || *regionVv.begin() != kept[0]) {
+            cout << "Mismatched region moved-from container" << endl;
+        }
+        RegionVV copy(*copied);
+        copied.reset();
+        if (!std::equal(copy.begin(), copy.end(), kept.begin(), kept.end()) ||
+            !std::equal(moved.begin(), moved.end(), kept.begin(), kept.end())) {
+            cout << "Mismatched region copy or move contents" << endl;
+        }
+        int cutKey = kept[kept.size() / 2];
+        RegionVV upper = copy.split(cutKey);
+        auto cutAt = std::lower_bound(kept.begin(), kept.end(), cutKey);
+        if (!std::equal(copy.begin(), copy.end(), kept.begin(), cutAt) ||
+            !std::equal(upper.begin(), upper.end(), cutAt, kept.end()) ||
+            copy.size() + upper.size() != kept.size()) {
+            cout << "Mismatched region split" << endl;
+        }
+        SortedBucketLL<int, std::less<int>, Region> regionLl(kept.begin(), kept.end());
+        auto copiedLl = std::make_unique<SortedBucketLL<int, std::less<int>, Region>>(regionLl);
+        SortedBucketLL<int, std::less<int>, Region> movedLl(std::move(regionLl));
+        bool copyMatched = std::equal(copiedLl->begin(), copiedLl->end(), kept.begin(), kept.end());
+        copiedLl.reset();
+        if (!copyMatched || regionLl.size() != 0 ||
+            !std::equal(movedLl.begin(), movedLl.end(), kept.begin(), kept.end())) {
+            cout << "Mismatched region LL copy or move" << endl;
+        }
+    }
+    cout << "Done test for region storage" << endl;
 
     cout << "Done all tests" << endl;
     return 0;
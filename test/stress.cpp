@@ -0,0 +1,1028 @@
+/**
+ * @file stress.cpp
+ *
+ * @author Gavin Dan (xfdan10@gmail.com)
+ * @brief Large scale parity and latency harness for every sortedBucket engine
+ * @version 1.2
+ * @date 2026-10-14
+ *
+ *
+ * Runs a long stream of mixed operations (up to 10^8 and beyond) against each
+ * engine through the SortedBucket facade, and checks every single result
+ * against a reference: a Fenwick tree counting copies of each key id, which
+ * answers rank, nth and counts in O(log(U)) for a universe of U ids, so the
+ * check does not slow down as the container grows. Key ids map to keys in
+ * order, as uint64_t or as zero padded std::string.
+ *
+ * Operations: insert, erase (mostly of a present key, sometimes of any key),
+ * find, distance, rank, nth, countRange, and now and then insertBatch,
+ * eraseBatch, findMany and distanceMany of 64 keys, or eraseAll of a present
+ * key. A quarter of the inserts go through the engine's hinted insert where
+ * it has one, with the right hint (end() for an append) or else a wrong one.
+ * Every inserted key is also pushed into a SortedWindow of the last --window
+ * keys, whose median and ranks are checked against a sorted copy. The live
+ * size first grows to --size, then writes keep it there. At every --check ops
+ * and at the end, the whole container is walked against the reference.
+ *
+ * Every --special ops, one of the whole-container features takes its turn,
+ * on the engines which have it:
+ *      splitJoin       split() at a random key, then join() the halves back
+ *      merge           merge() in a container of 64 random keys
+ *      saveLoad        erase the largest 4096 elements, so the last buckets
+ *                      empty out, then save() and load() back in place (u64)
+ *      snapshot        snapshot(), then scan it on a second thread while
+ *                      the writes go on, against its size and checksum at
+ *                      the time it was taken (COW)
+ *      parallel        build copies on --threads threads from sorted and
+ *                      shuffled keys, and reduce a random index range (VV)
+ *
+ * Every operation is timed on its own with steady_clock (the clock's own cost
+ * is measured first and taken off), into a log-linear histogram per kind,
+ * giving p50/p99/p99.9 within about 6%. Peak RSS is the VmHWM of the process,
+ * reset through /proc/self/clear_refs before each engine, so every engine
+ * reports its own peak (or null where the kernel cannot reset it).
+ *
+ * Usage:
+ *      stress [--ops N] [--size N] [--universe N] [--reads P] [--keys uniform|zipf|sorted]
+ *             [--type u64|string] [--engine all|rbt|vv|ll|bt|runs|cow|rbt-region|vv-region]
+ *             [--check N] [--special N] [--window N] [--threads N] [--seed N] [--json path]
+ *
+ * Prints a summary, and the machine-readable report as JSON to --json (or to
+ * stdout if none is given). Any mismatch is printed like in parity.cpp, and
+ * makes the exit status nonzero. Build it optimized and without ASan for
+ * runs beyond a few million ops. ThreadSanitizer does not model the acquire
+ * fence COW writes pair with a finished scan's release, so it flags those.
+ * The region engines share one arena, which keeps its chunks, so a region
+ * engine's peak counts what the one before it left resident.
+ */
+
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif // ifdef __GLIBC__
+#include "sortedBucket.h"
+#include "sortedBucketCOW.h"
+#include "sortedBucketRegion.h"
+#include "sortedBucketWindow.h"
+
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/* Options */
+struct Options {
+    size_t      ops         {10000000};
+    size_t      size        {1 << 20};
+    size_t      universe    {1 << 22};
+    size_t      reads       {50};       // percent of single ops that are reads
+    size_t      check       {1 << 24};  // ops between full walks
+    size_t      special     {1 << 16};  // ops between whole-container features
+    size_t      window      {4096};     // sliding window length, 0 for none
+    size_t      threads     {4};        // threads for the parallel build and scans
+    uint64_t    seed        {20231103};
+    string      keys        {"uniform"};
+    string      type        {"u64"};
+    string      engine      {"all"};
+    string      json;
+};
+
+/* Batch size for insertBatch, eraseBatch and findMany */
+constexpr size_t stressBatch = 64;
+
+/* One batch op per this many single ops */
+constexpr size_t stressBatchEvery = 4096;
+
+/* Largest elements erased before each save() */
+constexpr size_t stressDrain = 4096;
+
+
+/* Operation kinds, each with its own latency histogram */
+enum Op : size_t {
+    OpInsert,
+    OpErase,
+    OpFind,
+    OpDistance,
+    OpRank,
+    OpNth,
+    OpCountRange,
+    OpInsertBatch,
+    OpEraseBatch,
+    OpFindMany,
+    OpEraseAll,
+    OpHintInsert,
+    OpDistanceMany,
+    OpWindowPush,
+    OpWindowQuery,
+    OpSplitJoin,
+    OpMerge,
+    OpSaveLoad,
+    OpSnapshot,
+    OpSnapshotScan,
+    OpParallelBuild,
+    OpParallelScan,
+    OpKinds,
+};
+
+static const char* opNames[OpKinds] = {
+    "insert", "erase", "find", "distance", "rank", "nth", "countRange",
+    "insertBatch", "eraseBatch", "findMany", "eraseAll", "hintInsert", "distanceMany",
+    "windowPush", "windowQuery", "splitJoin", "merge", "saveLoad", "snapshot",
+    "snapshotScan", "parallelBuild", "parallelScan",
+};
+
+
+/*
+    Log-linear latency histogram in nanoseconds: below 16 ns one slot per ns,
+    above that 16 slots per power of two, so a percentile is off by at most
+    1/16 of its value.
+*/
+struct Latency {
+    std::array<uint64_t, 64 * 16>   slots   {};
+    uint64_t                        count   {0};
+    uint64_t                        max     {0};
+    long double                     total   {0};
+
+    static inline size_t slotOf(uint64_t ns) noexcept {
+        if (ns < 16) {
+            return ns;
+        }
+        size_t e = std::bit_width(ns) - 1;
+        return (e - 3) * 16 + ((ns >> (e - 4)) & 15);
+    }
+
+    /* Highest value landing in slot */
+    static inline uint64_t slotTop(size_t slot) noexcept {
+        if (slot < 16) {
+            return slot;
+        }
+        size_t e = slot / 16 + 3;
+        return ((uint64_t(16 + slot % 16) + 1) << (e - 4)) - 1;
+    }
+
+    inline void add(uint64_t ns) noexcept {
+        ++slots[slotOf(ns)];
+        ++count;
+        max = std::max(max, ns);
+        total += ns;
+    }
+
+    uint64_t percentile(double p) const noexcept {
+        uint64_t want = std::max<uint64_t>(1, uint64_t(p * count + 0.5));
+        uint64_t seen = 0;
+        for (size_t slot = 0; slot < slots.size(); ++slot) {
+            seen += slots[slot];
+            if (seen >= want) {
+                return std::min(slotTop(slot), max);
+            }
+        }
+        return max;
+    }
+};
+
+
+/* Keys in the same order as their ids */
+template <typename T>
+static T makeKey(size_t id) {
+    if constexpr (std::is_same_v<T, string>) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "key-%020llu", static_cast<unsigned long long>(id));
+        return string(buf);
+    }
+    else {
+        return T(id) * 1000003u + 17;
+    }
+}
+
+/* The id of a key made by makeKey() */
+template <typename T>
+static size_t keyId(const T& key) {
+    if constexpr (std::is_same_v<T, string>) {
+        return std::stoull(key.substr(4));
+    }
+    else {
+        return size_t((key - 17) / 1000003u);
+    }
+}
+
+
+/*
+    Reference multiset over key ids [0, U): copies per id, and a Fenwick tree
+    over them for rank and nth.
+*/
+class Reference {
+public:
+    explicit Reference(size_t universe)
+        : copies(universe, 0)
+        , tree(universe + 1, 0) {}
+
+    inline size_t size() const noexcept {
+        return sz;
+    }
+
+    inline uint32_t count(size_t id) const noexcept {
+        return copies[id];
+    }
+
+    /* Sum of the ids of all elements, copies included, wrapping around */
+    inline uint64_t idSum() const noexcept {
+        return sum;
+    }
+
+    void insert(size_t id) noexcept {
+        ++copies[id];
+        ++sz;
+        sum += id;
+        add(id, 1);
+    }
+
+    bool erase(size_t id) noexcept {
+        if (copies[id] == 0) {
+            return false;
+        }
+        --copies[id];
+        --sz;
+        sum -= id;
+        add(id, -1);
+        return true;
+    }
+
+    size_t eraseAll(size_t id) noexcept {
+        size_t had = copies[id];
+        sz -= had;
+        sum -= had * id;
+        add(id, -int64_t(had));
+        copies[id] = 0;
+        return had;
+    }
+
+    /* Every element as a key, in sorted order */
+    template <typename T>
+    vector<T> keys() const {
+        vector<T> out;
+        out.reserve(sz);
+        for (size_t id = 0; id < copies.size(); ++id) {
+            for (uint32_t c = 0; c < copies[id]; ++c) {
+                out.emplace_back(makeKey<T>(id));
+            }
+        }
+        return out;
+    }
+
+    /* Number of elements with an id below id */
+    size_t rank(size_t id) const noexcept {
+        size_t sum = 0;
+        for (size_t i = id; i > 0; i -= i & (0 - i)) {
+            sum += tree[i];
+        }
+        return sum;
+    }
+
+    /* Id of the element at sorted index idx, which must be below size() */
+    size_t nth(size_t idx) const noexcept {
+        size_t pos = 0;
+        for (size_t step = std::bit_floor(tree.size() - 1); step > 0; step >>= 1) {
+            if (pos + step < tree.size() && tree[pos + step] <= idx) {
+                pos += step;
+                idx -= tree[pos];
+            }
+        }
+        return pos;
+    }
+
+private:
+    void add(size_t id, int64_t delta) noexcept {
+        for (size_t i = id + 1; i < tree.size(); i += i & (0 - i)) {
+            tree[i] += delta;
+        }
+    }
+
+    vector<uint32_t>    copies;
+    vector<uint32_t>    tree;
+    size_t              sz      {0};
+    uint64_t            sum     {0};
+};
+
+
+/* Draws key ids from the chosen distribution */
+class KeySource {
+public:
+    KeySource(const Options& opt)
+        : universe(opt.universe)
+        , rng(opt.seed) {
+        if (opt.keys == "zipf") {
+            /* rank r is drawn with weight 1/(r+1), then scattered over the ids */
+            cdf.resize(universe);
+            double total = 0;
+            for (size_t r = 0; r < universe; ++r) {
+                total += 1.0 / (r + 1);
+                cdf[r] = total;
+            }
+        }
+        sorted = opt.keys == "sorted";
+    }
+
+    size_t next() {
+        if (!cdf.empty()) {
+            std::uniform_real_distribution<double> unit(0, cdf.back());
+            size_t rank = std::lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin();
+            return (rank * 0x9E3779B97F4A7C15ull >> 7) % universe;
+        }
+        if (sorted) {
+            /* rising ids, wrapping around */
+            return sweep++ % universe;
+        }
+        return rng() % universe;
+    }
+
+    inline uint64_t raw() {
+        return rng();
+    }
+
+private:
+    size_t              universe;
+    std::mt19937_64     rng;
+    vector<double>      cdf;
+    bool                sorted  {false};
+    size_t              sweep   {0};
+};
+
+
+/*  Resets the peak RSS of the process to its current RSS, returning whether
+    the kernel allowed it (Linux 4.0 and up). The heap is trimmed first, so
+    that what the last engine freed does not count towards the next one */
+static bool resetPeakRss() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif // ifdef __GLIBC__
+    FILE* refs = std::fopen("/proc/self/clear_refs", "w");
+    if (!refs) {
+        return false;
+    }
+    bool reset = std::fputs("5", refs) >= 0;
+    return std::fclose(refs) == 0 && reset;
+}
+
+/* Process memory, in KiB */
+static size_t peakRssKiB() {
+    size_t peak = 0;
+    if (FILE* status = std::fopen("/proc/self/status", "r")) {
+        char line[256];
+        while (std::fgets(line, sizeof(line), status)) {
+            if (std::sscanf(line, "VmHWM: %zu", &peak) == 1) {
+                break;
+            }
+        }
+        std::fclose(status);
+    }
+    return peak;
+}
+
+static size_t rssKiB() {
+    size_t pages = 0, resident = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%zu %zu", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(statm);
+    }
+    return resident * size_t(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+/* Cost of a pair of steady_clock::now() calls, to take off every sample */
+static uint64_t clockOverhead() {
+    uint64_t best = ~uint64_t(0);
+    for (int i = 0; i < 10000; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min<uint64_t>(best, (stop - start).count());
+    }
+    return best;
+}
+
+
+/* Results of one engine */
+struct Result {
+    string                      engine;
+    size_t                      mismatches  {0};
+    double                      seconds     {0};
+    size_t                      finalSize   {0};
+    size_t                      bytes       {0};
+    size_t                      rss         {0};
+    long                        peakRss     {-1};   // -1 if it could not be reset
+    std::array<Latency, OpKinds> latency;
+};
+
+/* Whether the engine has distanceMany(), into either distance type */
+template <typename Engine, typename T>
+constexpr bool hasDistanceMany = requires(Engine& engine, std::span<const T> keys,
+                                          std::span<std::ptrdiff_t> wide, std::span<int> narrow) {
+    requires requires { engine.distanceMany(keys, wide); } ||
+             requires { engine.distanceMany(keys, narrow); };
+};
+
+/* distanceMany() through the engine, whichever distance type it fills */
+template <typename Engine, typename T>
+static void distanceMany(Engine& engine, std::span<const T> keys, std::span<std::ptrdiff_t> out) {
+    if constexpr (requires { engine.distanceMany(keys, out); }) {
+        engine.distanceMany(keys, out);
+    }
+    else {
+        std::array<int, stressBatch> narrow;
+        engine.distanceMany(keys, std::span<int>(narrow.data(), keys.size()));
+        std::copy(narrow.begin(), narrow.begin() + keys.size(), out.begin());
+    }
+}
+
+/*
+    run() drives one engine through opt.ops operations, checking each result
+    against the reference.
+*/
+template <typename T, typename Engine>
+static Result run(const string& name, const Options& opt, uint64_t overhead) {
+    using Bucket = SortedBucket<T, std::less<T>, Engine>;
+    using Iterator = typename Bucket::Iterator;
+    using EngineIterator = typename Engine::Iterator;
+    Result result;
+    result.engine = name;
+    bool peakReset = resetPeakRss();
+    Bucket* bucket = new Bucket();
+    Engine& engine = bucket->engine();
+    Reference ref(opt.universe);
+    KeySource source(opt);
+    vector<T> batch(stressBatch);
+    vector<size_t> batchIds(stressBatch);
+    vector<Iterator> found(stressBatch);
+    vector<std::ptrdiff_t> distances(stressBatch);
+
+    /* the window, and its reference: ids in arrival order and sorted */
+    std::unique_ptr<SortedWindow<T, Engine>> window;
+    if (opt.window > 0) {
+        window = std::make_unique<SortedWindow<T, Engine>>(opt.window);
+    }
+    vector<size_t> windowRing, windowSorted;
+    size_t windowHead = 0;
+
+    /* the scan of the last snapshot, on its own thread */
+    struct Scan {
+        std::thread thread;
+        bool        matched {true};
+        uint64_t    ns      {0};
+    } scan;
+
+    const string snapshotPath = (std::filesystem::temp_directory_path() /
+                                 ("stress-" + std::to_string(getpid()) + ".snap")).string();
+
+    auto mismatch = [&](const char* what, size_t i) {
+        if (++result.mismatches <= 20) {
+            cout << "Mismatched " << name << " " << what << " at op " << i << endl;
+        }
+    };
+
+    /* Walks the whole container against the reference */
+    auto walk = [&](size_t i) {
+        if (bucket->size() != ref.size()) {
+            mismatch("size", i);
+            return;
+        }
+        size_t id = 0, left = 0;
+        /* the facade visits every copy, on RBT and Runs too */
+        for (auto it = bucket->begin(); it != bucket->end(); ++it) {
+            while (left == 0) {
+                left = ref.count(id++);
+            }
+            if (*it != makeKey<T>(id - 1)) {
+                mismatch("walk", i);
+                return;
+            }
+            --left;
+        }
+    };
+
+    auto time = [&](Op op, auto&& f) {
+        auto start = std::chrono::steady_clock::now();
+        auto out = f();
+        auto stop = std::chrono::steady_clock::now();
+        uint64_t ns = (stop - start).count();
+        result.latency[op].add(ns > overhead ? ns - overhead : 0);
+        return out;
+    };
+
+    /* Pushes an inserted key into the window, and checks its median and ranks */
+    auto pushWindow = [&](size_t id, const T& key, size_t i) {
+        if (!window) {
+            return;
+        }
+        time(OpWindowPush, [&]() { return window->push(key); });
+        if (windowRing.size() < opt.window) {
+            windowRing.emplace_back(id);
+        }
+        else {
+            size_t& oldest = windowRing[windowHead];
+            windowSorted.erase(std::lower_bound(windowSorted.begin(), windowSorted.end(), oldest));
+            oldest = id;
+            windowHead = (windowHead + 1) % opt.window;
+        }
+        windowSorted.insert(std::upper_bound(windowSorted.begin(), windowSorted.end(), id), id);
+        T median = time(OpWindowQuery, [&]() { return window->median(); });
+        size_t below = std::lower_bound(windowSorted.begin(), windowSorted.end(), id) -
+                       windowSorted.begin();
+        if (window->size() != windowSorted.size() ||
+            median != makeKey<T>(windowSorted[(windowSorted.size() - 1) / 2]) ||
+            window->rank(key) != below) {
+            mismatch("window", i);
+        }
+    };
+
+    /* Waits for the scan of the last snapshot, if there is one */
+    auto finishScan = [&](size_t i) {
+        if (!scan.thread.joinable()) {
+            return;
+        }
+        scan.thread.join();
+        result.latency[OpSnapshotScan].add(scan.ns);
+        if (!scan.matched) {
+            mismatch("snapshot", i);
+        }
+    };
+
+    /* One of the whole-container features, taking turns */
+    auto special = [&](size_t turn, size_t i) {
+        size_t id = source.next();
+        T key = makeKey<T>(id);
+        if (turn == 0) {
+            if constexpr (requires { engine.join(engine); Engine(engine.split(key)); }) {
+                size_t below = 0, above = 0;
+                bool joined = time(OpSplitJoin, [&]() {
+                    Engine upper = engine.split(key);
+                    below = engine.size();
+                    above = upper.size();
+                    return engine.join(upper);
+                });
+                if (!joined || below != ref.rank(id) || below + above != ref.size() ||
+                    engine.size() != ref.size()) {
+                    mismatch("splitJoin", i);
+                }
+            }
+        }
+        else if (turn == 1) {
+            if constexpr (requires { engine.merge(engine); }) {
+                Engine other;
+                for (size_t j = 0; j < stressBatch; ++j) {
+                    batchIds[j] = source.next();
+                    other.insert(makeKey<T>(batchIds[j]));
+                }
+                time(OpMerge, [&]() { engine.merge(other); return 0; });
+                for (size_t added : batchIds) {
+                    ref.insert(added);
+                }
+                if (other.size() != 0 || engine.size() != ref.size()) {
+                    mismatch("merge", i);
+                }
+            }
+        }
+        else if (turn == 2) {
+            if constexpr (requires(const char* path) { engine.save(path); engine.load(path); }) {
+                /* erasing the largest elements leaves the last buckets empty or close to it */
+                for (size_t drain = std::min(ref.size(), stressDrain); drain > 0; --drain) {
+                    size_t top = ref.nth(ref.size() - 1);
+                    if (bucket->erase(makeKey<T>(top)) != 1 || !ref.erase(top)) {
+                        mismatch("erase", i);
+                        break;
+                    }
+                }
+                bool saved = false, loaded = false;
+                time(OpSaveLoad, [&]() {
+                    saved = engine.save(snapshotPath.c_str());
+                    loaded = saved && engine.load(snapshotPath.c_str());
+                    return 0;
+                });
+                std::remove(snapshotPath.c_str());
+                if (!saved || !loaded) {
+                    mismatch("saveLoad", i);
+                }
+                walk(i);
+            }
+        }
+        else if (turn == 3) {
+            if constexpr (requires { engine.snapshot(); }) {
+                finishScan(i);
+                auto frozen = time(OpSnapshot, [&]() { return engine.snapshot(); });
+                size_t expectSize = ref.size();
+                uint64_t expectSum = ref.idSum();
+                scan.thread = std::thread([&scan, frozen, expectSize, expectSum]() {
+                    auto start = std::chrono::steady_clock::now();
+                    size_t seen = 0;
+                    uint64_t sum = 0;
+                    bool ordered = true;
+                    const T* last = nullptr;
+                    for (const T& n : frozen) {
+                        ordered = ordered && (!last || !(n < *last));
+                        last = &n;
+                        sum += keyId<T>(n);
+                        ++seen;
+                    }
+                    scan.ns = (std::chrono::steady_clock::now() - start).count();
+                    scan.matched = ordered && seen == expectSize && frozen.size() == expectSize &&
+                                   sum == expectSum;
+                });
+            }
+        }
+        else {
+            if constexpr (requires(vector<T>& keys) {
+                              Engine(Parallel{}, SortedInput, keys.begin(), keys.end());
+                              engine.transformReduce(Parallel{}, 0, 0, uint64_t(0), std::plus<>(),
+                                                     keyId<T>);
+                          }) {
+                const Parallel par {opt.threads};
+                vector<T> keys = ref.template keys<T>();
+                vector<T> shuffled = keys;
+                std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(source.raw()));
+                std::optional<Engine> built, sorted;
+                time(OpParallelBuild, [&]() {
+                    built.emplace(par, SortedInput, keys.begin(), keys.end());
+                    return 0;
+                });
+                time(OpParallelBuild, [&]() {
+                    sorted.emplace(par, shuffled.begin(), shuffled.end());
+                    return 0;
+                });
+                if (!std::equal(built->begin(), built->end(), keys.begin(), keys.end()) ||
+                    !std::equal(sorted->begin(), sorted->end(), keys.begin(), keys.end())) {
+                    mismatch("parallelBuild", i);
+                }
+                size_t lo = keys.empty() ? 0 : source.raw() % keys.size();
+                size_t hi = lo + source.raw() % (keys.size() - lo + 1);
+                uint64_t sum = time(OpParallelScan, [&]() {
+                    return engine.transformReduce(par, lo, hi, uint64_t(0), std::plus<>(),
+                                                  [](const T& n) { return uint64_t(keyId<T>(n)); });
+                });
+                uint64_t expect = 0;
+                for (size_t k = lo; k < hi; ++k) {
+                    expect += keyId<T>(keys[k]);
+                }
+                if (sum != expect) {
+                    mismatch("parallelScan", i);
+                }
+            }
+        }
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < opt.ops; ++i) {
+        if (i % opt.check == opt.check - 1) {
+            walk(i);
+        }
+        if (i % opt.special == opt.special - 1) {
+            special((i / opt.special) % 5, i);
+            continue;
+        }
+        bool growing = ref.size() < opt.size;
+        if (i % stressBatchEvery == stressBatchEvery - 1) {
+            /* batch ops, taking turns */
+            size_t turn = (i / stressBatchEvery) % 5;
+            for (size_t j = 0; j < stressBatch; ++j) {
+                /* eraseBatch mostly hits, and distanceMany hits half the time */
+                bool hit = (turn == 1 || (turn == 4 && j % 2 == 0)) && ref.size() > 0;
+                batchIds[j] = hit ? ref.nth(source.raw() % ref.size()) : source.next();
+                batch[j] = makeKey<T>(batchIds[j]);
+            }
+            if (turn == 0) {
+                time(OpInsertBatch, [&]() { bucket->insertBatch(batch.begin(), batch.end()); return 0; });
+                for (size_t id : batchIds) {
+                    ref.insert(id);
+                }
+            }
+            else if (turn == 1) {
+                size_t erased = time(OpEraseBatch,
+                                     [&]() { return bucket->eraseBatch(batch.begin(), batch.end()); });
+                size_t expect = 0;
+                for (size_t id : batchIds) {
+                    expect += ref.erase(id);
+                }
+                if (erased != expect) {
+                    mismatch("eraseBatch", i);
+                }
+            }
+            else if (turn == 3) {
+                size_t id = batchIds[0];
+                if (ref.size() > 0) {
+                    id = ref.nth(source.raw() % ref.size());
+                }
+                T key = makeKey<T>(id);
+                size_t erased = time(OpEraseAll, [&]() { return bucket->eraseAll(key); });
+                if (erased != ref.eraseAll(id)) {
+                    mismatch("eraseAll", i);
+                }
+            }
+            else if (turn == 4) {
+                if constexpr (hasDistanceMany<Engine, T>) {
+                    time(OpDistanceMany, [&]() {
+                        distanceMany(engine, std::span<const T>(batch), std::span(distances));
+                        return 0;
+                    });
+                    for (size_t j = 0; j < stressBatch; ++j) {
+                        size_t id = batchIds[j];
+                        if (distances[j] != (ref.count(id) > 0 ? std::ptrdiff_t(ref.rank(id)) : -1)) {
+                            mismatch("distanceMany", i);
+                            break;
+                        }
+                    }
+                }
+            }
+            else {
+                time(OpFindMany, [&]() {
+                    bucket->findMany(std::span<const T>(batch), std::span<Iterator>(found));
+                    return 0;
+                });
+                for (size_t j = 0; j < stressBatch; ++j) {
+                    bool present = ref.count(batchIds[j]) > 0;
+                    if ((found[j] != bucket->end()) != present ||
+                        (present && *found[j] != batch[j])) {
+                        mismatch("findMany", i);
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+        size_t roll = source.raw() % 100;
+        if (roll >= opt.reads || ref.size() == 0) {
+            /* writes: grow to the target size, then hold it there */
+            if (growing) {
+                size_t id = source.next();
+                T key = makeKey<T>(id);
+                bool matched = true;
+                if constexpr (requires(EngineIterator hint) { { engine.insert(hint, key) } ->
+                                                              std::same_as<EngineIterator>; }) {
+                    if (roll % 4 == 0) {
+                        /* mostly the right hint, which is end() for an append, else begin() */
+                        EngineIterator hint = (roll % 16 != 0) ? engine.upperBound(key)
+                                                               : engine.begin();
+                        EngineIterator it = time(OpHintInsert,
+                                                 [&]() { return engine.insert(hint, key); });
+                        matched = it != engine.end() && *it == key;
+                    }
+                    else {
+                        Iterator it = time(OpInsert, [&]() { return bucket->insert(key); });
+                        matched = it != bucket->end() && *it == key;
+                    }
+                }
+                else {
+                    Iterator it = time(OpInsert, [&]() { return bucket->insert(key); });
+                    matched = it != bucket->end() && *it == key;
+                }
+                ref.insert(id);
+                if (!matched) {
+                    mismatch("insert", i);
+                }
+                pushWindow(id, key, i);
+            }
+            else {
+                /* mostly hits on present keys, with some misses */
+                size_t id = (roll % 8 != 0) ? ref.nth(source.raw() % ref.size()) : source.next();
+                T key = makeKey<T>(id);
+                size_t erased = time(OpErase, [&]() { return bucket->erase(key); });
+                if (erased != size_t(ref.erase(id))) {
+                    mismatch("erase", i);
+                }
+            }
+            continue;
+        }
+        size_t id = source.next();
+        T key = makeKey<T>(id);
+        switch (roll % 5) {
+        case 0: {
+            Iterator it = time(OpFind, [&]() { return bucket->find(key); });
+            bool present = ref.count(id) > 0;
+            if ((it != bucket->end()) != present || (present && *it != key)) {
+                mismatch("find", i);
+            }
+            break;
+        }
+        case 1: {
+            std::ptrdiff_t dist = time(OpDistance, [&]() { return bucket->distance(key); });
+            if (dist != (ref.count(id) > 0 ? std::ptrdiff_t(ref.rank(id)) : -1)) {
+                mismatch("distance", i);
+            }
+            break;
+        }
+        case 2: {
+            size_t rank = time(OpRank, [&]() { return bucket->rank(key, roll & 1); });
+            if (rank != ref.rank(id + (roll & 1))) {
+                mismatch("rank", i);
+            }
+            break;
+        }
+        case 3: {
+            /* one in a hundred is past the end */
+            size_t idx = source.raw() % (ref.size() + ref.size() / 100 + 1);
+            Iterator it = time(OpNth, [&]() { return bucket->nth(idx); });
+            if (idx >= ref.size() ? it != bucket->end()
+                                  : (it == bucket->end() || *it != makeKey<T>(ref.nth(idx)))) {
+                mismatch("nth", i);
+            }
+            break;
+        }
+        default: {
+            size_t hiId = std::min(opt.universe, id + 1 + source.raw() % 1024);
+            T hi = makeKey<T>(hiId);
+            size_t count = time(OpCountRange, [&]() { return bucket->countRange(key, hi); });
+            if (count != ref.rank(hiId) - ref.rank(id)) {
+                mismatch("countRange", i);
+            }
+            break;
+        }
+        }
+    }
+    finishScan(opt.ops);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    walk(opt.ops);
+    result.finalSize = bucket->size();
+    result.bytes = bucket->stats().bytes;
+    result.rss = rssKiB();
+    if (peakReset) {
+        result.peakRss = long(peakRssKiB());
+    }
+    delete bucket;
+    return result;
+}
+
+/* Every engine for T, filtered by --engine */
+template <typename T>
+static vector<Result> runAll(const Options& opt, uint64_t overhead) {
+    vector<Result> results;
+    auto pick = [&](const char* name) {
+        return opt.engine == "all" || opt.engine == name;
+    };
+    if (pick("rbt")) {
+        results.emplace_back(run<T, SortedBucketRBT<T>>("rbt", opt, overhead));
+    }
+    if (pick("vv")) {
+        results.emplace_back(run<T, SortedBucketVV<T>>("vv", opt, overhead));
+    }
+    if (pick("ll")) {
+        results.emplace_back(run<T, SortedBucketLL<T>>("ll", opt, overhead));
+    }
+    if (pick("bt")) {
+        results.emplace_back(run<T, SortedBucketBT<T>>("bt", opt, overhead));
+    }
+    if (pick("runs")) {
+        results.emplace_back(run<T, SortedBucketRuns<T>>("runs", opt, overhead));
+    }
+    if (pick("cow")) {
+        results.emplace_back(run<T, SortedBucketCOW<T>>("cow", opt, overhead));
+    }
+    /* the same engines on huge page backed regions */
+    if (pick("rbt-region")) {
+        results.emplace_back(run<T, SortedBucketRBT<T, std::less<T>, SortedBucketRegion<T>>>(
+            "rbt-region", opt, overhead));
+    }
+    if (pick("vv-region")) {
+        results.emplace_back(run<T, SortedBucketVV<T, std::less<T>, SortedBucketRegion<T>>>(
+            "vv-region", opt, overhead));
+    }
+    return results;
+}
+
+
+static string report(const Options& opt, uint64_t overhead, const vector<Result>& results) {
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"ops\": " << opt.ops << ", \"size\": " << opt.size << ", \"universe\": "
+        << opt.universe << ", \"reads\": " << opt.reads << ",\n";
+    out << "  \"keys\": \"" << opt.keys << "\", \"type\": \"" << opt.type << "\", \"seed\": "
+        << opt.seed << ", \"clockOverheadNs\": " << overhead << ",\n";
+    out << "  \"engines\": [\n";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const Result& res = results[r];
+        out << "    {\"engine\": \"" << res.engine << "\", \"mismatches\": " << res.mismatches
+            << ", \"seconds\": " << res.seconds << ", \"opsPerSec\": "
+            << (res.seconds > 0 ? opt.ops / res.seconds : 0) << ",\n";
+        out << "     \"finalSize\": " << res.finalSize << ", \"bytes\": " << res.bytes
+            << ", \"rssKiB\": " << res.rss << ", \"peakRssKiB\": "
+            << (res.peakRss < 0 ? string("null") : std::to_string(res.peakRss)) << ",\n";
+        out << "     \"latencyNs\": {";
+        bool first = true;
+        for (size_t op = 0; op < OpKinds; ++op) {
+            const Latency& lat = res.latency[op];
+            if (lat.count == 0) {
+                continue;
+            }
+            out << (first ? "\n" : ",\n") << "       \"" << opNames[op] << "\": {\"count\": "
+                << lat.count << ", \"mean\": " << double(lat.total / lat.count)
+                << ", \"p50\": " << lat.percentile(0.5) << ", \"p99\": " << lat.percentile(0.99)
+                << ", \"p999\": " << lat.percentile(0.999) << ", \"max\": " << lat.max << "}";
+            first = false;
+        }
+        out << "}}" << (r + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+/* Parses the options, returning false on anything it does not know */
+static bool parse(int argc, char** argv, Options& opt) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string value = argv[i + 1];
+        if (flag == "--ops") {
+            opt.ops = std::stoull(value);
+        }
+        else if (flag == "--size") {
+            opt.size = std::stoull(value);
+        }
+        else if (flag == "--universe") {
+            opt.universe = std::max<size_t>(1, std::stoull(value));
+        }
+        else if (flag == "--reads") {
+            opt.reads = std::min<size_t>(100, std::stoull(value));
+        }
+        else if (flag == "--check") {
+            opt.check = std::max<size_t>(1, std::stoull(value));
+        }
+        else if (flag == "--special") {
+            opt.special = std::max<size_t>(1, std::stoull(value));
+        }
+        else if (flag == "--window") {
+            opt.window = std::stoull(value);
+        }
+        else if (flag == "--threads") {
+            opt.threads = std::stoull(value);
+        }
+        else if (flag == "--seed") {
+            opt.seed = std::stoull(value);
+        }
+        else if (flag == "--keys") {
+            opt.keys = value;
+        }
+        else if (flag == "--type") {
+            opt.type = value;
+        }
+        else if (flag == "--engine") {
+            opt.engine = value;
+        }
+        else if (flag == "--json") {
+            opt.json = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return argc % 2 == 1 && (opt.keys == "uniform" || opt.keys == "zipf" || opt.keys == "sorted") &&
+        (opt.type == "u64" || opt.type == "string");
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse(argc, argv, opt)) {
+        cout << "Usage: stress [--ops N] [--size N] [--universe N] [--reads P] " <<
+            "[--keys uniform|zipf|sorted] [--type u64|string] " <<
+            "[--engine all|rbt|vv|ll|bt|runs|cow|rbt-region|vv-region] [--check N] " <<
+            "[--special N] [--window N] [--threads N] [--seed N] [--json path]" << endl;
+        return 2;
+    }
+    const uint64_t overhead = clockOverhead();
+    std::ostream& log = opt.json.empty() ? std::cerr : cout;
+    log << "Starting stress with " << opt.ops << " ops, size " << opt.size << ", " <<
+        opt.keys << " " << opt.type << " keys" << endl;
+    vector<Result> results = (opt.type == "string") ? runAll<string>(opt, overhead)
+                                                    : runAll<uint64_t>(opt, overhead);
+    size_t mismatches = 0;
+    for (const Result& res : results) {
+        mismatches += res.mismatches;
+        log << "  " << res.engine << ": " << res.seconds << " s, " << res.mismatches <<
+            " mismatches, insert p99 " << res.latency[OpInsert].percentile(0.99) <<
+            " ns, find p99 " << res.latency[OpFind].percentile(0.99) << " ns, peak RSS " <<
+            (res.peakRss < 0 ? string("n/a") : std::to_string(res.peakRss) + " KiB") << endl;
+    }
+    string json = report(opt, overhead, results);
+    if (opt.json.empty()) {
+        cout << json;
+    }
+    else {
+        std::ofstream(opt.json) << json;
+    }
+    log << "Done stress" << endl;
+    return mismatches == 0 ? 0 : 1;
+}